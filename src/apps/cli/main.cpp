@@ -1,8 +1,12 @@
+#include <cmath>
 #include <iostream>
+#include <thread>
 
 #include "../../optixdvr/optixdvr.hpp"
 #include "../../optixdvr/optixdvr_instance.hpp"
 #include "../../optixdvr/utils/argparse.hpp"
+#include "../../optixdvr/utils/imagefiles.hpp"
+#include "../../optixdvr/utils/savePPM.h"
 
 void SetUpAndParseArgs(int argc, char *argv[])
 {
@@ -11,6 +15,10 @@ void SetUpAndParseArgs(int argc, char *argv[])
 	Arguments::AddFloatArgument("LightPosX", "-lx", "--lightx", 5);
 	Arguments::AddFloatArgument("LightPosY", "-ly", "--lighty", 0);
 	Arguments::AddFloatArgument("LightPosZ", "-lz", "--lightz", 0);
+	Arguments::AddStringArgument("Gradients", "-gr", "--gradients", "onthefly");
+	Arguments::SetArgumentInfo("Gradients", "Where shading takes gradients from. Usage: [-gr | --gradients] <onthefly|precomputed>");
+	Arguments::AddFlagArgument("ShadingBenchmark", "-sb", "--shading-benchmark");
+	Arguments::SetArgumentInfo("ShadingBenchmark", "Render the orbit unshaded and shaded with either gradient source and write their memory and frame times to shading.csv.");
 
 	// Transfer Function
 	Arguments::AddStringArgument("TransferFunction", "-tf", "--transferFunction", "");
@@ -21,10 +29,44 @@ void SetUpAndParseArgs(int argc, char *argv[])
 	Arguments::AddStringArgument("VolumePath", "-v", "--volume", "");
 	Arguments::SetArgumentRequired("VolumePath", true);
 	Arguments::SetArgumentInfo("VolumePath", "Path to volume MHD.");
+    Arguments::AddIntegerArgument("ReadChunkSize", "-rcs", "--read-chunk-size", 16);
+    Arguments::SetArgumentInfo("ReadChunkSize", "Chunk size in MB for parallel volume reads.");
+    Arguments::AddIntegerArgument("ReadThreads", "-rt", "--read-threads", 0);
+    Arguments::SetArgumentInfo("ReadThreads", "Threads used to read volume files, 0 uses all hardware threads.");
+    Arguments::AddFlagArgument("DirectIO", "-odirect", "--direct-io");
 	Arguments::AddIntegerArgument("BrickSizeX", "-bsx", "--brick-size-x", 16);
 	Arguments::AddIntegerArgument("BrickSizeY", "-bsy", "--brick-size-y", 16);
 	Arguments::AddIntegerArgument("BrickSizeZ", "-bsz", "--brick-size-z", 16);
     Arguments::AddFlagArgument("Cluster", "-cluster", "--cluster");
+    Arguments::AddFlagArgument("DistanceField", "-df", "--distance-field");
+    Arguments::SetArgumentInfo("DistanceField", "Keep a distance field over the leaves so CPU grid rays leap empty space.");
+    Arguments::AddStringArgument("Quantisation", "-q", "--quantisation", "none");
+    Arguments::SetArgumentInfo("Quantisation", "Pool format for float volumes. Usage: [-q | --quantisation] <none|8|16|half>");
+    Arguments::AddStringArgument("QuantisationReport", "-qr", "--quantisation-report", "");
+    Arguments::AddIntegerArgument("LODLevels", "-lod", "--lod-levels", 1);
+    Arguments::SetArgumentInfo("LODLevels", "Number of brick pyramid levels, 1 disables LOD.");
+    Arguments::AddStringArgument("LODFilter", "-lodf", "--lod-filter", "max");
+    Arguments::SetArgumentInfo("LODFilter", "Pyramid downsampling filter. Usage: [-lodf | --lod-filter] <box|max>");
+    Arguments::AddFloatArgument("LODPixelsPerVoxel", "-lodp", "--lod-pixels-per-voxel", 1.0f);
+    Arguments::AddIntegerArgument("PrefetchFrames", "-pf", "--prefetch-frames", 2);
+    Arguments::SetArgumentInfo("PrefetchFrames", "Frames of a time series loaded ahead of the one shown.");
+    Arguments::AddStringArgument("BrickCache", "-bc", "--brick-cache", "");
+    Arguments::SetArgumentInfo("BrickCache", "Cache file for the bricked volume, written on the first load and mapped after.");
+    Arguments::AddFlagArgument("OutOfCore", "-ooc", "--out-of-core");
+    Arguments::SetArgumentInfo("OutOfCore", "Read bricks from disk as they're needed instead of loading the whole volume.");
+    Arguments::AddIntegerArgument("HostCacheMB", "-hc", "--host-cache", 1024);
+    Arguments::SetArgumentInfo("HostCacheMB", "Host memory in MB for out-of-core bricks, 0 for no limit.");
+    Arguments::AddFlagArgument("CPU", "-cpu", "--cpu");
+    Arguments::SetArgumentInfo("CPU", "Render with the CPU reference ray marcher instead of OptiX.");
+    Arguments::AddIntegerArgument("CPUTileSize", "-cts", "--cpu-tile-size", 32);
+    Arguments::AddIntegerArgument("CPUThreads", "-cth", "--cpu-threads", 0);
+    Arguments::SetArgumentInfo("CPUThreads", "Threads rendering CPU tiles, 0 for one per core.");
+    Arguments::AddFlagArgument("CPUScalar", "-csc", "--cpu-scalar");
+    Arguments::SetArgumentInfo("CPUScalar", "March CPU rays one at a time rather than in SIMD packets.");
+    Arguments::AddStringArgument("CPUESS", "-cess", "--cpu-ess", "bvh");
+    Arguments::SetArgumentInfo("CPUESS", "How CPU rays skip empty space. Usage: [-cess | --cpu-ess] <bvh|grid|boxes>");
+    Arguments::AddFlagArgument("Playback", "-play", "--playback");
+    Arguments::SetArgumentInfo("Playback", "Render every frame of a time series once and write playback.csv.");
 
 	// Render Info
 	Arguments::AddIntegerArgument("RenderSizeX", "-rx", "", 1024);
@@ -44,6 +86,47 @@ void SetUpAndParseArgs(int argc, char *argv[])
     Arguments::AddFloatArgument("CameraAperture", "-ap", "", 0);
     Arguments::AddFloatArgument("CameraFovY", "-fov", "", 30);
     Arguments::AddIntegerArgument("Samples", "-s", "", 1);
+    Arguments::AddStringArgument("Quality", "-qp", "--quality", "final");
+    Arguments::SetArgumentInfo("Quality", "Sampling quality preset. Usage: [-qp | --quality] <draft|interactive|final>");
+    Arguments::AddFloatArgument("SamplesPerVoxel", "-spv", "--samples-per-voxel", 0);
+    Arguments::SetArgumentInfo("SamplesPerVoxel", "Ray march steps per voxel, 0 keeps the preset's.");
+    Arguments::AddFloatArgument("ERTThreshold", "-erth", "--ert-threshold", 0);
+    Arguments::SetArgumentInfo("ERTThreshold", "Opacity at which rays terminate, 0 keeps the preset's.");
+    Arguments::AddFloatArgument("OpacityReference", "-opr", "--opacity-reference", 150.0f);
+    Arguments::SetArgumentInfo("OpacityReference", "Steps across the volume the transfer function's opacities are given for.");
+    Arguments::AddFlagArgument("AdaptiveStep", "-adst", "--adaptive-step");
+    Arguments::SetArgumentInfo("AdaptiveStep", "Stretch ray steps through leaves the transfer function keeps transparent.");
+    Arguments::AddIntegerArgument("MaxStepScale", "-mss", "--max-step-scale", 8);
+    Arguments::AddFloatArgument("StepTolerance", "-stt", "--step-tolerance", 0);
+    Arguments::SetArgumentInfo("StepTolerance", "Opacity a stretched step may reach in a leaf that isn't transparent, 0 only stretches through transparent leaves.");
+    Arguments::AddFlagArgument("QualityBenchmark", "-qb", "--quality-benchmark");
+    Arguments::SetArgumentInfo("QualityBenchmark", "Render the orbit at every quality preset and write their frame times and error against final to quality.csv.");
+    Arguments::AddIntegerArgument("AccumulateFrames", "-acc", "--accumulate", 0);
+    Arguments::SetArgumentInfo("AccumulateFrames", "Progressive frames accumulated into every captured image, 0 renders one frame.");
+    Arguments::AddFlagArgument("AdaptiveSampling", "-as", "--adaptive-sampling");
+    Arguments::SetArgumentInfo("AdaptiveSampling", "Launch extra passes of -s samples over the noisy tiles only.");
+    Arguments::AddFloatArgument("AdaptiveThreshold", "-ast", "--adaptive-threshold", 0.004f);
+    Arguments::AddIntegerArgument("AdaptiveMaxPasses", "-asp", "--adaptive-max-passes", 16);
+    Arguments::AddFloatArgument("AdaptiveTimeBudget", "-asb", "--adaptive-budget", 0);
+    Arguments::SetArgumentInfo("AdaptiveTimeBudget", "Milliseconds of adaptive passes per frame, 0 for no limit.");
+    Arguments::AddFlagArgument("Reproject", "-rp", "--reproject");
+    Arguments::SetArgumentInfo("Reproject", "Reuse the previous view's pixels along the orbit, marching only disoccluded and unreliable ones.");
+    Arguments::AddStringArgument("ImageFormat", "-if", "--image-format", "png");
+    Arguments::SetArgumentInfo("ImageFormat", "Format of captured images. Usage: [-if | --image-format] <png|ppm|qoi>");
+    Arguments::AddIntegerArgument("PNGCompression", "-pngc", "--png-compression", -1);
+    Arguments::SetArgumentInfo("PNGCompression", "zlib level of captured PNGs, 0 (fastest) to 9 (smallest), -1 for libpng's default.");
+    Arguments::AddIntegerArgument("EncodeThreads", "-et", "--encode-threads", 2);
+    Arguments::SetArgumentInfo("EncodeThreads", "Threads encoding captured images while the next ones render, 0 uses all hardware threads.");
+    Arguments::AddIntegerArgument("EncodeQueue", "-eq", "--encode-queue", 4);
+    Arguments::SetArgumentInfo("EncodeQueue", "Captured images waiting to be encoded before rendering waits for them.");
+    Arguments::AddStringArgument("SharedMemory", "-shm", "--shared-memory", "");
+    Arguments::SetArgumentInfo("SharedMemory", "Publish every rendered frame to a shared memory ring of this name for other processes to read.");
+    Arguments::AddStringArgument("Pipe", "-pipe", "--pipe", "");
+    Arguments::SetArgumentInfo("Pipe", "Stream every rendered frame as raw RGBA to the stdin of this command, {width} and {height} are replaced by the frame size.");
+    Arguments::AddFlagArgument("PipeKeepFrames", "-pipekeep", "--pipe-keep-frames");
+    Arguments::SetArgumentInfo("PipeKeepFrames", "Wait for the piped command to take every frame instead of dropping the ones it can't keep up with.");
+    Arguments::AddFlagArgument("ImageBenchmark", "-ib", "--image-benchmark");
+    Arguments::SetArgumentInfo("ImageBenchmark", "Write a rendered frame with the old and the new image writers and their sizes and times to images.csv.");
 
     // Experimental Arguments
     Arguments::AddIntegerArgument("Runs", "-runs", "", 50);
@@ -55,11 +138,202 @@ void SetUpAndParseArgs(int argc, char *argv[])
 		throw std::runtime_error("Arguments didn't pass validation!");
 }
 
+/* Root mean square difference of the RGB channels of two RGBA8 frames */
+double FrameRMSE(const unsigned char* a, const unsigned char* b, size_t pixels)
+{
+    double sum = 0.0;
+    for(size_t i = 0; i < pixels * 4; ++i)
+    {
+        if(i % 4 == 3)
+            continue;
+        double d = (double)a[i] - (double)b[i];
+        sum += d * d;
+    }
+    return sqrt(sum / (double)(pixels * 3));
+}
+
+/* Renders every view of the orbit at each preset, the final one first as
+   the reference, and writes the mean frame time and error per preset */
+void QualityBenchmark(OptixDVR* optixdvr, int views, float distance)
+{
+    const SamplingQuality quality = optixdvr->m_quality;
+    const int presets = SamplingQuality::Final + 1;
+    const size_t pixels = (size_t)optixdvr->m_renderwidth * (size_t)optixdvr->m_renderheight;
+    std::vector<unsigned char> reference(pixels * 4);
+    std::vector<double> totaltime(presets, 0.0);
+    std::vector<double> totalrmse(presets, 0.0);
+    std::vector<double> maxrmse(presets, 0.0);
+
+    float dt = 2.0f * M_PI / (float)views;
+    for(int i = 0; i < views; i++)
+    {
+        std::cout << "Quality view [" << i << "/" << views << "]        \r";
+        float x = sinf(dt * (float)i);
+        float y = cosf(dt * (float)i);
+        optixdvr->m_camera.origin(vec3f(x * distance, 0.01f, y * distance));
+        optixdvr->m_camera.lookdir(normalize(vec3f(-x, -0.0001f, -y)));
+
+        for(int p = presets - 1; p >= 0; --p)
+        {
+            optixdvr->m_quality = quality;
+            optixdvr->m_quality.apply((SamplingQuality::Preset)p);
+            optixdvr->render();
+            totaltime[p] += optixdvr->m_lastrenderduration;
+            if(p == SamplingQuality::Final)
+            {
+                memcpy(&reference[0], optixdvr->readFrame(), pixels * 4);
+                continue;
+            }
+            double rmse = FrameRMSE(&reference[0], optixdvr->readFrame(), pixels);
+            totalrmse[p] += rmse;
+            maxrmse[p] = std::max(maxrmse[p], rmse);
+        }
+    }
+    optixdvr->m_quality = quality;
+
+    std::ofstream csvfile("quality.csv");
+    csvfile << "preset,samples_per_voxel,ert_threshold,avg_frame_time,avg_rmse,max_rmse,psnr";
+    std::cout << "\033[K";
+    for(int p = 0; p < presets; ++p)
+    {
+        SamplingQuality preset = quality;
+        preset.apply((SamplingQuality::Preset)p);
+        double time = totaltime[p] / (double)views;
+        double rmse = totalrmse[p] / (double)views;
+        /* Of the mean error, infinite for the reference */
+        double psnr = 20.0 * log10(255.0 / rmse);
+        csvfile << "\n" << SamplingQuality::name((SamplingQuality::Preset)p);
+        csvfile << "," << preset.mSamplesPerVoxel << "," << preset.mERTThreshold;
+        csvfile << "," << time << "," << rmse << "," << maxrmse[p] << "," << psnr;
+        std::cout << SamplingQuality::name((SamplingQuality::Preset)p) << ": "
+            << time << " ms, RMSE " << rmse << " (max " << maxrmse[p] << "), PSNR "
+            << psnr << " dB" << std::endl;
+    }
+}
+
+/* Renders the orbit unshaded, then shaded with gradients on the fly and
+   precomputed, and writes what each costs in memory and frame time */
+void ShadingBenchmark(OptixDVR* optixdvr, int views, float distance)
+{
+    const bool useshading = optixdvr->m_useshading;
+    const Shading shading = optixdvr->m_shading;
+    const VolumeBrickPool* pool = optixdvr->mPool;
+    const size_t poolbytes = pool->mNextUploadSlot * pool->mBytesPerVoxel
+        * pool->mActualDataSize.x * pool->mActualDataSize.y * pool->mActualDataSize.z;
+
+    std::ofstream csvfile("shading.csv");
+    csvfile << "gradients,gradient_bytes,pool_bytes,pack_time,avg_frame_time";
+    std::cout << "\033[K";
+    for(int mode = -1; mode <= Shading::GradientsPrecomputed; ++mode)
+    {
+        optixdvr->m_useshading = mode >= 0;
+        optixdvr->m_shading.mGradients = mode >= 0 ? (Shading::Gradients)mode : shading.mGradients;
+        optixdvr->mStats.set("gradienttime", 0.0);
+
+        double totaltime = 0.0;
+        float dt = 2.0f * M_PI / (float)views;
+        for(int i = 0; i < views; i++)
+        {
+            float x = sinf(dt * (float)i);
+            float y = cosf(dt * (float)i);
+            optixdvr->m_camera.origin(vec3f(x * distance, 0.01f, y * distance));
+            optixdvr->m_camera.lookdir(normalize(vec3f(-x, -0.0001f, -y)));
+            optixdvr->render();
+            totaltime += optixdvr->m_lastrenderduration;
+        }
+
+        /* Normals are packed before the first view only */
+        const char* name = mode >= 0 ? Shading::name((Shading::Gradients)mode) : "none";
+        double time = totaltime / (double)views;
+        double gradientbytes = optixdvr->mStats.get("gradientmemory");
+        double packtime = optixdvr->mStats.get("gradienttime");
+        csvfile << "\n" << name << "," << gradientbytes << "," << poolbytes;
+        csvfile << "," << packtime << "," << time;
+        std::cout << name << ": " << time << " ms, gradients " << gradientbytes
+            << " bytes (pool " << poolbytes << "), packed in " << packtime << " ms" << std::endl;
+    }
+    optixdvr->m_useshading = useshading;
+    optixdvr->m_shading = shading;
+}
+
+/* Size of a file in bytes, 0 if it can't be read */
+size_t FileBytes(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    return file ? (size_t)file.tellg() : 0;
+}
+
+void ImageBenchmark(OptixDVR* optixdvr, float distance)
+{
+    const int repeats = 5;
+    const int width = optixdvr->m_renderwidth;
+    const int height = optixdvr->m_renderheight;
+    const int compression = optixdvr->m_imagewriter.mCompression;
+    optixdvr->m_camera.origin(vec3f(0.0f, 0.01f, distance));
+    optixdvr->m_camera.lookdir(normalize(vec3f(0.0f, -0.0001f, -1.0f)));
+    optixdvr->render();
+    const unsigned char* pixels = optixdvr->readFrame();
+
+    struct Writer
+    {
+        std::string mName;
+        std::string mPath;
+        unsigned int mThreads;
+        int mCompression;
+    };
+    std::vector<Writer> writers;
+    writers.push_back({"saveppm", "output/benchmark_saveppm.ppm", 1, -1});
+    writers.push_back({"writeppm", "output/benchmark_writeppm.ppm", 1, -1});
+    writers.push_back({"savepng", "output/benchmark_savepng.png", 1, compression});
+    const unsigned int cores = std::max(std::thread::hardware_concurrency(), 1u);
+    for(unsigned int threads = 1; ; threads = std::min(threads * 2, cores))
+    {
+        writers.push_back({"writepng", "output/benchmark_writepng.png", threads, compression});
+        if(threads == cores)
+            break;
+    }
+    writers.push_back({"writepng", "output/benchmark_writepng_fast.png", cores, 1});
+    writers.push_back({"saveqoi", "output/benchmark_saveqoi.qoi", 1, -1});
+
+    std::ofstream csvfile("images.csv");
+    csvfile << "writer,threads,compression,width,height,bytes,avg_time";
+    std::cout << "\033[K";
+    for(size_t w = 0; w < writers.size(); ++w)
+    {
+        const Writer& writer = writers[w];
+        utils::Timer timer;
+        timer.start();
+        for(int r = 0; r < repeats; ++r)
+        {
+            if(writer.mName == "saveppm")
+                savePPM(writer.mPath, width, height, pixels);
+            else if(writer.mName == "writeppm")
+                writePPM(writer.mPath, width, height, pixels);
+            else if(writer.mName == "savepng")
+                savePNG(writer.mPath, width, height, pixels, writer.mCompression);
+            else if(writer.mName == "writepng")
+                writePNG(writer.mPath, width, height, pixels, writer.mCompression, writer.mThreads);
+            else
+                saveQOI(writer.mPath, width, height, pixels);
+        }
+        timer.stop();
+
+        double time = timer.getTime() / (double)repeats;
+        size_t bytes = FileBytes(writer.mPath);
+        csvfile << "\n" << writer.mName << "," << writer.mThreads << "," << writer.mCompression;
+        csvfile << "," << width << "," << height << "," << bytes << "," << time;
+        std::cout << writer.mName << " (" << writer.mThreads << " threads, level " << writer.mCompression
+            << "): " << time << " ms, " << bytes << " bytes" << std::endl;
+    }
+}
+
 int main(int argc, char *argv[])
 {
 	SetUpAndParseArgs(argc, argv);
 
-    OptixDVR* optixdvr = OptixInstance::get();
+    OptixDVR* optixdvr = OptixInstance::get(
+        Arguments::IsSet("CPU") ? OptixDVR::BackendCPU : OptixDVR::BackendOptix
+    );
 
     // Camera Parameters
     optixdvr->m_camera.origin(vec3f(
@@ -82,6 +356,13 @@ int main(int argc, char *argv[])
     // optixdvr->m_subdivisions.y = Arguments::GetAsInt("SubDivisionsY");
     // optixdvr->m_subdivisions.z = Arguments::GetAsInt("SubDivisionsZ");
     optixdvr->m_useshading = Arguments::IsSet("Lighting");
+    optixdvr->m_lightposition = vec3f(
+        Arguments::GetAsFloat("LightPosX"),
+        Arguments::GetAsFloat("LightPosY"),
+        Arguments::GetAsFloat("LightPosZ")
+    );
+    if(!Shading::parse(Arguments::GetAsString("Gradients"), optixdvr->m_shading.mGradients))
+        throw std::runtime_error("Unknown gradient source " + Arguments::GetAsString("Gradients"));
     optixdvr->m_highlightert = Arguments::IsSet("HighlightERT");
     optixdvr->m_showdepthcomplexity = Arguments::IsSet("ShowDepthComplexity");
     optixdvr->m_dontsample = Arguments::IsSet("StubSampling");
@@ -97,8 +378,71 @@ int main(int argc, char *argv[])
     optixdvr->m_renderwidth = Arguments::GetAsInt("RenderSizeX");
     optixdvr->m_renderheight = Arguments::GetAsInt("RenderSizeY");
     optixdvr->m_samples = Arguments::GetAsInt("Samples");
+    SamplingQuality::Preset preset;
+    if(!SamplingQuality::parse(Arguments::GetAsString("Quality"), preset))
+        throw std::runtime_error("Unknown quality preset " + Arguments::GetAsString("Quality"));
+    optixdvr->m_quality.apply(preset);
+    if(Arguments::GetAsFloat("SamplesPerVoxel") > 0.0f)
+        optixdvr->m_quality.mSamplesPerVoxel = Arguments::GetAsFloat("SamplesPerVoxel");
+    if(Arguments::GetAsFloat("ERTThreshold") > 0.0f)
+        optixdvr->m_quality.mERTThreshold = Arguments::GetAsFloat("ERTThreshold");
+    optixdvr->m_quality.mOpacityReference = Arguments::GetAsFloat("OpacityReference");
+    optixdvr->m_adaptivestep = Arguments::IsSet("AdaptiveStep");
+    optixdvr->m_opacitybounds.mMaxStepScale = Arguments::GetAsInt("MaxStepScale");
+    optixdvr->m_opacitybounds.mTolerance = Arguments::GetAsFloat("StepTolerance");
+    optixdvr->m_adaptivesampling = Arguments::IsSet("AdaptiveSampling");
+    optixdvr->m_sampler.mThreshold = Arguments::GetAsFloat("AdaptiveThreshold");
+    optixdvr->m_sampler.mMaxPasses = Arguments::GetAsInt("AdaptiveMaxPasses");
+    optixdvr->m_sampler.mTimeBudget = Arguments::GetAsFloat("AdaptiveTimeBudget");
+    optixdvr->m_reproject = Arguments::IsSet("Reproject");
 
     optixdvr->m_subdivision->mCluster = Arguments::IsSet("Cluster");
+    optixdvr->m_subdivision->mDistanceField = Arguments::IsSet("DistanceField");
+
+    optixdvr->m_reader.mChunkSize = (size_t)Arguments::GetAsInt("ReadChunkSize") * 1024UL * 1024UL;
+    optixdvr->m_reader.mThreads = Arguments::GetAsInt("ReadThreads");
+    optixdvr->m_reader.mDirectIO = Arguments::IsSet("DirectIO");
+
+    std::string quantisation = Arguments::GetAsString("Quantisation");
+    if(quantisation == "8")
+        optixdvr->mPool->mQuantisation = VolumeBrickPool::Quantise8Bit;
+    else if(quantisation == "16")
+        optixdvr->mPool->mQuantisation = VolumeBrickPool::Quantise16Bit;
+    else if(quantisation == "half")
+        optixdvr->mPool->mQuantisation = VolumeBrickPool::QuantiseHalf;
+
+    optixdvr->mPool->mPyramidLevels = Arguments::GetAsInt("LODLevels");
+    optixdvr->mPool->mPyramidFilter = Arguments::GetAsString("LODFilter") == "box"
+        ? VolumeBrickPool::FilterBox
+        : VolumeBrickPool::FilterMax;
+    optixdvr->m_uselod = Arguments::GetAsInt("LODLevels") > 1;
+    optixdvr->m_lodselector.mPixelsPerVoxel = Arguments::GetAsFloat("LODPixelsPerVoxel");
+
+    optixdvr->m_prefetchframes = Arguments::GetAsInt("PrefetchFrames");
+    optixdvr->m_brickcachepath = Arguments::GetAsString("BrickCache");
+    optixdvr->m_outofcore = Arguments::IsSet("OutOfCore");
+    optixdvr->m_hostcachemb = Arguments::GetAsInt("HostCacheMB");
+    if(optixdvr->m_cpurenderer)
+    {
+        optixdvr->m_cpurenderer->mScheduler.mTileSize = Arguments::GetAsInt("CPUTileSize");
+        optixdvr->m_cpurenderer->mScheduler.mThreads = Arguments::GetAsInt("CPUThreads");
+        optixdvr->m_cpurenderer->mUsePackets = !Arguments::IsSet("CPUScalar");
+        if(Arguments::GetAsString("CPUESS") == "boxes")
+            optixdvr->m_cpurenderer->mEmptySpaceSkipping = CPURenderer::ESSBoxes;
+        else if(Arguments::GetAsString("CPUESS") == "grid")
+            optixdvr->m_cpurenderer->mEmptySpaceSkipping = CPURenderer::ESSGrid;
+    }
+
+    if(!ImageWriter::parse(Arguments::GetAsString("ImageFormat"), optixdvr->m_imagewriter.mFormat))
+    {
+        std::cerr << "==OptixDVR== Unknown image format " << Arguments::GetAsString("ImageFormat") << ", saving PNGs" << std::endl;
+    }
+    optixdvr->m_imagewriter.mCompression = Arguments::GetAsInt("PNGCompression");
+    optixdvr->m_imagewriter.mThreads = Arguments::GetAsInt("EncodeThreads");
+    optixdvr->m_imagewriter.mQueueLength = Arguments::GetAsInt("EncodeQueue");
+    optixdvr->m_framering.mName = Arguments::GetAsString("SharedMemory");
+    optixdvr->m_framepipe.mCommand = Arguments::GetAsString("Pipe");
+    optixdvr->m_framepipe.mDropFrames = !Arguments::IsSet("PipeKeepFrames");
 
     optixdvr->resizeFrameBuffer(optixdvr->m_renderwidth, optixdvr->m_renderheight);
     optixdvr->m_subdivision->set_brick_size(bricksize);
@@ -106,10 +450,50 @@ int main(int argc, char *argv[])
     optixdvr->loadtransferfunction(Arguments::GetAsString("TransferFunction").c_str());
     optixdvr->updateScene();
 
+    if(Arguments::IsSet("QuantisationReport"))
+    {
+        std::ofstream reportfile(Arguments::GetAsString("QuantisationReport"));
+        optixdvr->mPool->reportQuantisation(reportfile);
+    }
+
     int views = Arguments::GetAsInt("Views");
     float dt = 2.0f * M_PI / (float)views;
     float distance = 2.0f;
     vec3f cameraLookAt(0.0f);
+
+    if(Arguments::IsSet("Playback"))
+    {
+        optixdvr->m_camera.origin(vec3f(0.0f, 0.01f, distance));
+        optixdvr->m_camera.lookdir(normalize(vec3f(0.0f, -0.0001f, -1.0f)));
+
+        std::ofstream playbackfile("playback.csv");
+        playbackfile << "frame,wait_time,swap_time,render_time";
+        int frames = optixdvr->numFrames();
+        for(int f = 0; f < frames; ++f)
+        {
+            std::cout << "Frame [" << f << "/" << frames << "]        \r";
+            optixdvr->setFrame(f);
+            optixdvr->render();
+            playbackfile << "\n" << f;
+            playbackfile << "," << optixdvr->mStats.get("framewaittime");
+            playbackfile << "," << optixdvr->mStats.get("frameswaptime");
+            playbackfile << "," << optixdvr->m_lastrenderduration;
+        }
+        std::cout << "\033[KPlayed back " << frames << " frames" << std::endl;
+        optixdvr->setFrame(0);
+    }
+    if(Arguments::IsSet("QualityBenchmark"))
+    {
+        QualityBenchmark(optixdvr, views, distance);
+    }
+    if(Arguments::IsSet("ShadingBenchmark"))
+    {
+        ShadingBenchmark(optixdvr, views, distance);
+    }
+    if(Arguments::IsSet("ImageBenchmark"))
+    {
+        ImageBenchmark(optixdvr, distance);
+    }
     // Warming loop
     std::cout << "Warming frames..." << std::endl;
     for(int i = 0; i < views; i++)
@@ -147,7 +531,11 @@ int main(int argc, char *argv[])
         }
     }
 
-    // Capture loop
+    // Capture loop, refining each view progressively if asked to
+    const int accumulateframes = Arguments::GetAsInt("AccumulateFrames");
+    optixdvr->m_accumulate = accumulateframes > 0;
+    utils::Timer capturetimer;
+    capturetimer.start();
     for(int i = 0; i < views; i++)
     {
         float x = sinf(dt * (float)i);
@@ -158,13 +546,21 @@ int main(int argc, char *argv[])
         optixdvr->m_camera.origin(p);
         optixdvr->m_camera.lookdir(d);
         optixdvr->render();
+        for(int f = 1; f < accumulateframes; ++f)
+        {
+            optixdvr->render();
+        }
 
         std::stringstream ss;
-        ss << "output/" << i << ".png";
+        ss << "output/" << i << "." << ImageWriter::extension(optixdvr->m_imagewriter.mFormat);
         std::cout << "\033[KSaving image to " << ss.str() << "              \r";
-        optixdvr->saveToPNG(ss.str().c_str());
+        optixdvr->saveImage(ss.str().c_str());
     }
-    std::cout << "\033[KCaptured frames... " << std::endl;
+    optixdvr->m_imagewriter.flush();
+    capturetimer.stop();
+    std::cout << "\033[KCaptured frames in " << capturetimer.getTime() << "ms, "
+        << optixdvr->m_imagewriter.mStats.get("encodetime") << "ms encoding each and "
+        << optixdvr->m_imagewriter.mStats.get("encodewaittime") << "ms waiting for the encoder" << std::endl;
 
     std::ofstream csvfile("times.csv");
     csvfile << "avg_frame_time";
@@ -180,4 +576,8 @@ int main(int argc, char *argv[])
             csvfile << "," << times[r][v];
         }
     }
-}
\ No newline at end of file
+
+    /* Let an encoder at the other end of the pipe finish its file */
+    optixdvr->m_framepipe.close();
+    optixdvr->m_framering.close();
+}
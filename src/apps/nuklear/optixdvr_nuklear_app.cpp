@@ -37,6 +37,7 @@ void SetUpAndParseArgs(int argc, char *argv[])
 	Arguments::AddFloatArgument("LightPosX", "-lx", "--lightx", 5);
 	Arguments::AddFloatArgument("LightPosY", "-ly", "--lighty", 0);
 	Arguments::AddFloatArgument("LightPosZ", "-lz", "--lightz", 0);
+	Arguments::AddStringArgument("Gradients", "-gr", "--gradients", "onthefly");
 
 	// Transfer Function
 	Arguments::AddStringArgument("TransferFunction", "-tf", "--transferFunction", "");
@@ -55,6 +56,12 @@ void SetUpAndParseArgs(int argc, char *argv[])
     Arguments::AddFlagArgument("HighlightERT", "-ert", "--highlight-ert");
     Arguments::AddFlagArgument("ShowDepthComplexity", "-dc", "--depth-complexity");
 	Arguments::AddStringArgument("OutFile", "-o", "--output", "out.ppm");
+	Arguments::AddFloatArgument("TargetFrameTime", "-tft", "--target-frame-time", 0);
+	Arguments::SetArgumentInfo("TargetFrameTime", "Frame time in ms to hold while the camera moves by lowering the render resolution, 0 always renders at full resolution.");
+	Arguments::AddStringArgument("SharedMemory", "-shm", "--shared-memory", "");
+	Arguments::SetArgumentInfo("SharedMemory", "Publish every rendered frame to a shared memory ring of this name for other processes to read.");
+	Arguments::AddStringArgument("Pipe", "-pipe", "--pipe", "");
+	Arguments::SetArgumentInfo("Pipe", "Stream every rendered frame as raw RGBA to the stdin of this command, {width} and {height} are replaced by the frame size.");
 
 	/* Parse and validate the arguments */
 	Arguments::Parse(argc, argv);
@@ -110,8 +117,16 @@ int main(int argc, char **argv)
     rendererInstance->m_volumefilepath = Arguments::GetAsString("VolumePath");
     rendererInstance->m_transferfuncpath = Arguments::GetAsString("TransferFunction");
     rendererInstance->m_useshading = Arguments::IsSet("Lighting");
+    rendererInstance->m_lightposition = vec3f(
+        Arguments::GetAsFloat("LightPosX"),
+        Arguments::GetAsFloat("LightPosY"),
+        Arguments::GetAsFloat("LightPosZ")
+    );
+    Shading::parse(Arguments::GetAsString("Gradients"), rendererInstance->m_shading.mGradients);
     rendererInstance->m_highlightert = Arguments::IsSet("HighlightERT");
     rendererInstance->m_showdepthcomplexity = Arguments::IsSet("ShowDepthComplexity");
+    rendererInstance->m_framering.mName = Arguments::GetAsString("SharedMemory");
+    rendererInstance->m_framepipe.mCommand = Arguments::GetAsString("Pipe");
 
     if(Arguments::IsSet("VolumePath"))
         rendererInstance->loadvolume(Arguments::GetAsString("VolumePath").c_str());
@@ -120,6 +135,7 @@ int main(int argc, char **argv)
         rendererInstance->loadtransferfunction(Arguments::GetAsString("TransferFunction").c_str());
 
     RenderPanel renderPanel;
+    renderPanel.mTargetFrameTime = Arguments::GetAsFloat("TargetFrameTime");
     while (!glfwWindowShouldClose(win))
     {
         /* Input */
@@ -139,6 +155,8 @@ int main(int argc, char **argv)
         nk_glfw3_render(NK_ANTI_ALIASING_ON);
         glfwSwapBuffers(win);
     }
+    rendererInstance->m_framepipe.close();
+    rendererInstance->m_framering.close();
     nk_glfw3_shutdown();
     glfwTerminate();
     return 0;
@@ -136,6 +136,20 @@ int Overview::gui(struct nk_context *ctx, int windowWidth, int windowHeight)
                 renderer->m_showPageTableAccesses = (option == PT);
             }
 
+            nk_layout_row_static(ctx, 30, 80, 3);
+            static int quality = SamplingQuality::Final;
+            int previousQuality = quality;
+            for(int p = SamplingQuality::Draft; p <= SamplingQuality::Final; ++p)
+            {
+                const char* name = SamplingQuality::name((SamplingQuality::Preset)p);
+                quality = nk_option_label(ctx, name, quality == p) ? p : quality;
+            }
+            if(quality != previousQuality)
+            {
+                renderer->m_quality.apply((SamplingQuality::Preset)quality);
+                updateRenderer = true;
+            }
+
 
             nk_layout_row_static(ctx, 30, 200, 1);
             int dontSample = renderer->m_dontsample;
@@ -146,6 +160,55 @@ int Overview::gui(struct nk_context *ctx, int windowWidth, int windowHeight)
                 updateRenderer = true;
             }
 
+            int accumulate = renderer->m_accumulate;
+            nk_checkbox_label(ctx, "Progressive", &accumulate);
+            if((accumulate == 1) != renderer->m_accumulate)
+            {
+                renderer->m_accumulate = (accumulate == 1);
+                renderer->resetAccumulation();
+                updateRenderer = true;
+            }
+
+            int adaptive = renderer->m_adaptivesampling;
+            nk_checkbox_label(ctx, "Adaptive Sampling", &adaptive);
+            if((adaptive == 1) != renderer->m_adaptivesampling)
+            {
+                renderer->m_adaptivesampling = (adaptive == 1);
+                updateRenderer = true;
+            }
+
+            int reproject = renderer->m_reproject;
+            nk_checkbox_label(ctx, "Reprojection", &reproject);
+            if((reproject == 1) != renderer->m_reproject)
+            {
+                renderer->m_reproject = (reproject == 1);
+                updateRenderer = true;
+            }
+
+            int adaptiveStep = renderer->m_adaptivestep;
+            nk_checkbox_label(ctx, "Adaptive Step", &adaptiveStep);
+            if((adaptiveStep == 1) != renderer->m_adaptivestep)
+            {
+                renderer->m_adaptivestep = (adaptiveStep == 1);
+                updateRenderer = true;
+            }
+
+            int shading = renderer->m_useshading;
+            nk_checkbox_label(ctx, "Shading", &shading);
+            if((shading == 1) != renderer->m_useshading)
+            {
+                renderer->m_useshading = (shading == 1);
+                updateRenderer = true;
+            }
+
+            int precomputed = renderer->m_shading.mGradients == Shading::GradientsPrecomputed;
+            nk_checkbox_label(ctx, "Precomputed Gradients", &precomputed);
+            if((precomputed == 1) != (renderer->m_shading.mGradients == Shading::GradientsPrecomputed))
+            {
+                renderer->m_shading.mGradients = precomputed ? Shading::GradientsPrecomputed : Shading::GradientsOnTheFly;
+                updateRenderer = true;
+            }
+
             nk_tree_pop(ctx);
         }
 
@@ -200,6 +263,24 @@ int Overview::gui(struct nk_context *ctx, int windowWidth, int windowHeight)
                     nk_label(ctx, std::to_string(renderer->m_lastbvhbuildtime).c_str(), NK_TEXT_LEFT);
                 }
 
+                if(renderer->m_accumulate)
+                {
+                    nk_layout_row_begin(ctx, NK_STATIC, rowheight, 2);
+                    nk_layout_row_push(ctx, namewidth);
+                    nk_label(ctx, "Accumulated Frames: ", NK_TEXT_LEFT);
+                    nk_layout_row_push(ctx, datawidth);
+                    nk_label(ctx, std::to_string(renderer->m_accumulatedframes).c_str(), NK_TEXT_LEFT);
+                }
+
+                if(renderer->m_reproject)
+                {
+                    nk_layout_row_begin(ctx, NK_STATIC, rowheight, 2);
+                    nk_layout_row_push(ctx, namewidth);
+                    nk_label(ctx, "Reprojection Reuse: ", NK_TEXT_LEFT);
+                    nk_layout_row_push(ctx, datawidth);
+                    nk_label(ctx, std::to_string(renderer->mStats.get("reprojectionreuse")).c_str(), NK_TEXT_LEFT);
+                }
+
             }
 
             nk_tree_pop(ctx);
@@ -2,6 +2,9 @@
 #include "../../optixdvr/programs/vec.h"
 #include "../../optixdvr/optixdvr_instance.hpp"
 
+#include <algorithm>
+#include <cmath>
+
 RenderPanel::RenderPanel()
 {
     mImageWidth = 512;
@@ -21,7 +24,6 @@ RenderPanel::RenderPanel()
     renderer->m_camera.lookat(mCameraLookAt);
 
     // Volume Parameters
-    renderer->m_useshading = 0;
     renderer->m_highlightert = 0;
     renderer->m_showdepthcomplexity = 0;
 
@@ -35,7 +37,7 @@ RenderPanel::RenderPanel()
     mBackgroundImage = nk_image_id(mBackgroundTextureID);
 }
 
-void RenderPanel::render()
+void RenderPanel::render(bool moving)
 {
     vec3f v(0, 0, 1);
     v = rotationX(mCameraRotationY * 0.0174533f) * v;
@@ -43,11 +45,34 @@ void RenderPanel::render()
     v = normalize(v) * mCameraRadius;
     mCameraPosition = v + mCameraLookAt;
 
+    /* Scale in 1/32 steps so small corrections don't reallocate the
+       frame buffers every frame */
+    const bool adaptive = mTargetFrameTime > 0.0f;
+    float scale = (adaptive && moving) ? roundf(mResolutionScale * 32.0f) / 32.0f : 1.0f;
+    int width = std::max((int)(mImageWidth * scale), 1);
+    int height = std::max((int)(mImageHeight * scale), 1);
+
     OptixDVR* renderer = OptixInstance::get();
-    renderer->resizeFrameBuffer(mImageWidth, mImageHeight);
+    renderer->resizeFrameBuffer(width, height);
     renderer->m_camera.origin(mCameraPosition);
     renderer->m_camera.lookat(mCameraLookAt);
     renderer->render();
+
+    mReducedFrame = scale < 1.0f;
+    if(adaptive)
+    {
+        updateResolutionScale(scale, renderer->m_lastrenderduration);
+    }
+}
+
+void RenderPanel::updateResolutionScale(float scale, float frameTime)
+{
+    /* Frame time goes with the pixel count, the square of the scale. Go
+       half way to the scale that would have hit the target, a full step
+       oscillates on noisy frame times */
+    float ideal = scale * sqrtf(mTargetFrameTime / std::max(frameTime, 0.01f));
+    float next = 0.5f * (mResolutionScale + ideal);
+    mResolutionScale = std::min(std::max(next, mMinResolutionScale), 1.0f);
 }
 
 void RenderPanel::updateTexture()
@@ -60,7 +85,8 @@ void RenderPanel::updateTexture()
         {
             if(m_textureid != -1)
                 nk_glfw3_destroy_texture(m_textureid);
-            m_textureid = nk_glfw3_create_texture(renderer->m_renderdata, mImageWidth, mImageHeight);
+            m_textureid = nk_glfw3_create_texture(renderer->readFrame(),
+                renderer->m_renderwidth, renderer->m_renderheight);
         }
     }
     else
@@ -78,6 +104,8 @@ void RenderPanel::updateTexture()
 
 int RenderPanel::gui(struct nk_context *ctx, int windowWidth, int windowHeight)
 {
+    OptixDVR* renderer = OptixInstance::get();
+
     /* window flags */
     if (nk_begin(ctx, "Render Window", nk_rect(400, 0, windowWidth - 400, windowHeight),
         NK_WINDOW_TITLE | NK_WINDOW_NO_SCROLLBAR
@@ -91,12 +119,12 @@ int RenderPanel::gui(struct nk_context *ctx, int windowWidth, int windowHeight)
         {
             mCameraRotationX -= (float)ctx->input.mouse.delta.x;
             mCameraRotationY += (float)ctx->input.mouse.delta.y;
-            render();
+            render(true);
         }
         else if(nk_widget_has_mouse_click_down(ctx, NK_BUTTON_RIGHT, nk_true))
         {
             mCameraRadius += (float)ctx->input.mouse.delta.y * 0.1f;
-            render();
+            render(true);
         }
         else if(nk_widget_has_mouse_click_down(ctx, NK_BUTTON_MIDDLE, nk_true))
         {
@@ -109,7 +137,7 @@ int RenderPanel::gui(struct nk_context *ctx, int windowWidth, int windowHeight)
 
             mCameraLookAt = mCameraLookAt + right * rightchange + up * upchange;
 
-            render();
+            render(true);
         }
         else if(widgetBounds.w != mImageWidth || widgetBounds.h != mImageHeight)
         {
@@ -117,6 +145,17 @@ int RenderPanel::gui(struct nk_context *ctx, int windowWidth, int windowHeight)
             mImageHeight = widgetBounds.h;
             render();
         }
+        else if(mReducedFrame)
+        {
+            /* Motion stopped, replace the reduced frame at full size */
+            render();
+        }
+        else if(renderer->m_accumulate && renderer->m_frameavailable
+            && renderer->m_accumulatedframes < mMaxAccumulatedFrames)
+        {
+            /* Nothing moved, refine the progressive frame */
+            render();
+        }
         struct nk_color white = {255,255,255,255};
         updateTexture();
         nk_draw_image(canvas, widgetBounds, &mBackgroundImage, white);
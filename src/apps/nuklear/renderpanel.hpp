@@ -18,8 +18,9 @@ protected:
     int mBackgroundTextureID;
     struct nk_image mBackgroundImage;
 
-    void render();
+    void render(bool moving = false);
     void updateTexture();
+    void updateResolutionScale(float scale, float frameTime);
 
     float mCameraRotationY;
     float mCameraRotationX;
@@ -27,7 +28,20 @@ protected:
     vec3f mCameraPosition;
     vec3f mCameraLookAt;
 
+    /* Progressive frames stop refining after this many */
+    int mMaxAccumulatedFrames = 256;
+
+    /* Launch size relative to the widget during camera motion, and whether
+       the frame on screen was rendered below full size */
+    float mResolutionScale = 1.0f;
+    float mMinResolutionScale = 0.25f;
+    bool mReducedFrame = false;
+
 public:
+    /* Frame time in ms to hold while the camera moves by scaling down the
+       launch size, the texture is stretched over the widget. 0 disables */
+    float mTargetFrameTime = 0.0f;
+
     RenderPanel();
     void setImage(char* data, int w, int h);
     int gui(struct nk_context *ctx, int windowWidth, int windowHeight);
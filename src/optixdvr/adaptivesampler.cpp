@@ -0,0 +1,99 @@
+#include "adaptivesampler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+    inline float luminance(const vec4f& c)
+    {
+        return c.x * 0.2126f + c.y * 0.7152f + c.z * 0.0722f;
+    }
+}
+
+void AdaptiveSampler::begin(int width, int height)
+{
+    mWidth = width;
+    mHeight = height;
+    mTilesX = (width + mTileSize - 1) / mTileSize;
+    mTilesY = (height + mTileSize - 1) / mTileSize;
+    mLaunches = 0;
+
+    const size_t tiles = (size_t)mTilesX * mTilesY;
+    mPasses.assign(tiles, 0);
+    mLaunch.assign(tiles, 1);
+    mError.assign(tiles, std::numeric_limits<float>::infinity());
+}
+
+bool AdaptiveSampler::next(const vec4f* sums, const float* moments, float elapsed)
+{
+    mLaunches++;
+    for(size_t t = 0; t < mLaunch.size(); ++t)
+    {
+        if(mLaunch[t] == 0)
+        {
+            continue;
+        }
+        mPasses[t] = mLaunch[t];
+        if(mPasses[t] > 1)
+        {
+            mError[t] = tileError((int)t, sums, moments);
+        }
+    }
+
+    /* Every tile has had the same passes up to mMinPasses, so stopping on
+       the budget leaves none of them behind the others */
+    const bool budget = mTimeBudget > 0.0f && elapsed >= mTimeBudget;
+    size_t launched = 0;
+    for(size_t t = 0; t < mLaunch.size(); ++t)
+    {
+        const int passes = mPasses[t];
+        const bool more = !budget && passes < mMaxPasses
+            && (passes < mMinPasses || mError[t] > mThreshold);
+        mLaunch[t] = more ? passes + 1 : 0;
+        launched += more ? 1 : 0;
+    }
+
+    report();
+    return launched > 0;
+}
+
+float AdaptiveSampler::tileError(int tile, const vec4f* sums, const float* moments) const
+{
+    const int x0 = (tile % mTilesX) * mTileSize;
+    const int y0 = (tile / mTilesX) * mTileSize;
+    const int x1 = std::min(x0 + mTileSize, mWidth);
+    const int y1 = std::min(y0 + mTileSize, mHeight);
+    const float n = (float)mPasses[tile];
+
+    /* Unbiased variance of a pass's luminance, over n for that of the mean */
+    float error = 0.0f;
+    for(int y = y0; y < y1; ++y)
+    {
+        for(int x = x0; x < x1; ++x)
+        {
+            const size_t i = (size_t)y * mWidth + x;
+            const float mean = luminance(sums[i]) / n;
+            const float variance = std::max(moments[i] / n - mean * mean, 0.0f) * n / (n - 1.0f);
+            error += sqrtf(variance / n);
+        }
+    }
+    return error / (float)((x1 - x0) * (y1 - y0));
+}
+
+void AdaptiveSampler::report()
+{
+    size_t passes = 0;
+    size_t converged = 0;
+    for(size_t t = 0; t < mPasses.size(); ++t)
+    {
+        passes += mPasses[t];
+        converged += mError[t] <= mThreshold ? 1 : 0;
+    }
+
+    const double tiles = mPasses.empty() ? 1.0 : (double)mPasses.size();
+    mStats.set("adaptivelaunches", mLaunches);
+    mStats.set("adaptivepasses", (double)passes / tiles);
+    mStats.set("adaptiveconverged", (double)converged / tiles);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+
+#include "programs/vec.h"
+#include "utils/stats.hpp"
+
+/**
+ * Host side of adaptive sampling, shared by the OptiX and CPU backends.
+ * The image is split into square tiles. Every tile first gets mMinPasses
+ * launches of numSamples each, and then only the tiles whose estimated
+ * noise is above mThreshold are launched again. This repeats until every
+ * tile is below the threshold, at mMaxPasses, or out of mTimeBudget.
+ *
+ * A launch renders the tiles with a non-zero launchPasses(), which is the
+ * pass count the tile will have once the launch is done. The backends
+ * seed pass n with frame index n - 1. They add each pass's colour into a
+ * float4 sum and its squared luminance into a float moment, and show
+ * sum / passes.
+ */
+class AdaptiveSampler
+{
+public:
+    Stats mStats;
+
+    /* Pixels per tile side, a multiple of the SIMD width keeps the CPU's
+       packets whole */
+    int mTileSize = 16;
+    int mMinPasses = 2;
+    int mMaxPasses = 16;
+    /* Mean standard error of a tile's pixel luminance to stop at */
+    float mThreshold = 0.004f;
+    /* Milliseconds per frame, 0 for no limit */
+    float mTimeBudget = 0.0f;
+
+    int mTilesX = 0;
+    int mTilesY = 0;
+
+    /* Sets up every tile for the first launch */
+    void begin(int width, int height);
+
+    /* Reads the sums after a launch and picks the tiles for the next one.
+       False when there's nothing left to launch */
+    bool next(const vec4f* sums, const float* moments, float elapsed);
+
+    /* Per tile, x fastest */
+    const std::vector<int>& launchPasses() const { return mLaunch; }
+
+    /* Passes after this launch of the tile holding the pixel, 0 if the
+       launch skips it */
+    int launchPasses(int x, int y) const
+    {
+        return mLaunch[(size_t)(y / mTileSize) * mTilesX + (x / mTileSize)];
+    }
+
+private:
+    int mWidth = 0;
+    int mHeight = 0;
+    int mLaunches = 0;
+    std::vector<int> mPasses;
+    std::vector<int> mLaunch;
+    std::vector<float> mError;
+
+    float tileError(int tile, const vec4f* sums, const float* moments) const;
+    void report();
+};
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <optixu/optixpp.h>
+
 #include "programs/vec.h"
 #include <iostream>
 
@@ -53,18 +55,32 @@ struct Camera
         }
 	}
 
-	void set(optix::Context& context)
+	/* Focus plane corner and spans, and the camera frame, as raygen uses them */
+	void basis(
+		vec3f& lower_left_corner,
+		vec3f& horizontal,
+		vec3f& vertical,
+		vec3f& u,
+		vec3f& v,
+		vec3f& w
+	) const
 	{
-        float lens_radius = mAperture / 2.0f;
 		float theta = mFOVY * ((float)M_PI) / 180.0f;
 		float half_height = tan(theta / 2.0f);
 		float half_width = mAspect * half_height;
-        vec3f w = -mLookDirection;
-		vec3f u = unit_vector(cross(mUp, w));
-		vec3f v = cross(w, u);
-		vec3f lower_left_corner = mOrigin - half_width * mFocusDistance * u - half_height * mFocusDistance * v - mFocusDistance * w;
-		vec3f horizontal = 2.0f * half_width * mFocusDistance * u;
-		vec3f vertical = 2.0f * half_height * mFocusDistance * v;
+        w = -mLookDirection;
+		u = unit_vector(cross(mUp, w));
+		v = cross(w, u);
+		lower_left_corner = mOrigin - half_width * mFocusDistance * u - half_height * mFocusDistance * v - mFocusDistance * w;
+		horizontal = 2.0f * half_width * mFocusDistance * u;
+		vertical = 2.0f * half_height * mFocusDistance * v;
+	}
+
+	void set(optix::Context& context)
+	{
+        float lens_radius = mAperture / 2.0f;
+		vec3f lower_left_corner, horizontal, vertical, u, v, w;
+		basis(lower_left_corner, horizontal, vertical, u, v, w);
 
 		context["camera_lower_left_corner"]->set3fv(&lower_left_corner.x);
 		context["camera_horizontal"]->set3fv(&horizontal.x);
@@ -0,0 +1,378 @@
+#include "bvh.hpp"
+#include "../utils/utils.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+    const int BVHBins = 16;
+    /* Deeper nodes become leaves, keeping traversal stacks small */
+    const unsigned int BVHMaxDepth = 48;
+    const int BVHStackSize = 96;
+
+    struct Bin
+    {
+        vec3f mMin = vec3f(std::numeric_limits<float>::infinity());
+        vec3f mMax = vec3f(-std::numeric_limits<float>::infinity());
+        size_t mCount = 0;
+
+        /* std::min/max rather than fminf/fmaxf, which may be library calls */
+        void grow(const vec3f& lo, const vec3f& hi)
+        {
+            mMin = vec3f(std::min(mMin.x, lo.x), std::min(mMin.y, lo.y), std::min(mMin.z, lo.z));
+            mMax = vec3f(std::max(mMax.x, hi.x), std::max(mMax.y, hi.y), std::max(mMax.z, hi.z));
+        }
+    };
+
+    inline float component(const vec3f& v, int axis)
+    {
+        return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+    }
+
+    inline float area(const vec3f& lo, const vec3f& hi)
+    {
+        if(hi.x < lo.x || hi.y < lo.y || hi.z < lo.z)
+        {
+            return 0.0f;
+        }
+        const vec3f d = hi - lo;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    inline vec3f centroid(const BVH::Box& box)
+    {
+        return (box.mMin + box.mMax) * 0.5f;
+    }
+}
+
+void BVH::build(const std::vector<vec4f>& boxMin, const std::vector<vec4f>& boxMax)
+{
+    utils::Timer timer;
+    timer.start();
+
+    size_t count = std::min(boxMin.size(), boxMax.size());
+    mBoxes.resize(count);
+    for(size_t i = 0; i < count; ++i)
+    {
+        mBoxes[i].mMin = vec3f(boxMin[i].x, boxMin[i].y, boxMin[i].z);
+        mBoxes[i].mIndex = (unsigned int)i;
+        mBoxes[i].mMax = vec3f(boxMax[i].x, boxMax[i].y, boxMax[i].z);
+    }
+
+    mNodes.clear();
+    mDepth = 0;
+    if(count)
+    {
+        /* A binary tree over n boxes never needs more than 2n - 1 nodes */
+        mNodes.reserve(2 * count);
+        mNodes.push_back(BVHNode());
+        subdivide(0, 0, (unsigned int)count, 1);
+    }
+
+    timer.stop();
+
+    size_t leaves = 0;
+    for(size_t i = 0; i < mNodes.size(); ++i)
+    {
+        leaves += mNodes[i].mCount ? 1 : 0;
+    }
+    mStats.set("cpubvhbuildtime", timer.getTime());
+    mStats.set("cpubvhnodes", mNodes.size());
+    mStats.set("cpubvhleaves", leaves);
+    mStats.set("cpubvhdepth", mDepth);
+    mStats.set("cpubvhsahcost", mNodes.size() ? cost(0, area(mNodes[0].mMin, mNodes[0].mMax)) : 0.0f);
+}
+
+void BVH::subdivide(unsigned int node, unsigned int first, unsigned int count, unsigned int depth)
+{
+    mDepth = std::max(mDepth, depth);
+    const int end = (int)(first + count);
+
+    /* Bounds of the boxes and of their centroids */
+    Bin bounds;
+    Bin centroids;
+    #pragma omp parallel if(count >= mParallelThreshold)
+    {
+        Bin localBounds;
+        Bin localCentroids;
+        #pragma omp for nowait
+        for(int i = (int)first; i < end; ++i)
+        {
+            localBounds.grow(mBoxes[i].mMin, mBoxes[i].mMax);
+            vec3f c = centroid(mBoxes[i]);
+            localCentroids.grow(c, c);
+        }
+        #pragma omp critical
+        {
+            bounds.grow(localBounds.mMin, localBounds.mMax);
+            centroids.grow(localCentroids.mMin, localCentroids.mMax);
+        }
+    }
+    mNodes[node].mMin = bounds.mMin;
+    mNodes[node].mMax = bounds.mMax;
+
+    if(count == 1 || (depth >= BVHMaxDepth && count <= 0xffff))
+    {
+        mNodes[node].mFirst = first;
+        mNodes[node].mCount = (unsigned short)count;
+        mNodes[node].mAxis = 0;
+        return;
+    }
+
+    /* Bin the centroids along every axis */
+    const vec3f extent = centroids.mMax - centroids.mMin;
+    float scale[3];
+    for(int axis = 0; axis < 3; ++axis)
+    {
+        float e = component(extent, axis);
+        scale[axis] = e > 0.0f ? (float)BVHBins / e : 0.0f;
+    }
+    auto binOf = [&](const vec3f& c, int axis)
+    {
+        float offset = component(c, axis) - component(centroids.mMin, axis);
+        return std::min((int)(offset * scale[axis]), BVHBins - 1);
+    };
+
+    Bin bins[3][BVHBins];
+    #pragma omp parallel if(count >= mParallelThreshold)
+    {
+        Bin localBins[3][BVHBins];
+        #pragma omp for nowait
+        for(int i = (int)first; i < end; ++i)
+        {
+            const Box& box = mBoxes[i];
+            const vec3f c = centroid(box);
+            for(int axis = 0; axis < 3; ++axis)
+            {
+                Bin& bin = localBins[axis][binOf(c, axis)];
+                bin.grow(box.mMin, box.mMax);
+                bin.mCount++;
+            }
+        }
+        #pragma omp critical
+        {
+            for(int axis = 0; axis < 3; ++axis)
+            {
+                for(int b = 0; b < BVHBins; ++b)
+                {
+                    bins[axis][b].grow(localBins[axis][b].mMin, localBins[axis][b].mMax);
+                    bins[axis][b].mCount += localBins[axis][b].mCount;
+                }
+            }
+        }
+    }
+
+    /* Sweep the bins from both sides for the cheapest split, left of bin s */
+    int bestAxis = -1;
+    int bestSplit = 0;
+    float bestCost = std::numeric_limits<float>::infinity();
+    for(int axis = 0; axis < 3; ++axis)
+    {
+        if(scale[axis] == 0.0f)
+        {
+            continue;
+        }
+
+        float rightCost[BVHBins];
+        Bin right;
+        for(int b = BVHBins - 1; b > 0; --b)
+        {
+            right.grow(bins[axis][b].mMin, bins[axis][b].mMax);
+            right.mCount += bins[axis][b].mCount;
+            rightCost[b] = area(right.mMin, right.mMax) * (float)right.mCount;
+        }
+
+        Bin left;
+        for(int s = 1; s < BVHBins; ++s)
+        {
+            left.grow(bins[axis][s - 1].mMin, bins[axis][s - 1].mMax);
+            left.mCount += bins[axis][s - 1].mCount;
+            if(left.mCount == 0 || left.mCount == count)
+            {
+                continue;
+            }
+            float c = area(left.mMin, left.mMax) * (float)left.mCount + rightCost[s];
+            if(c < bestCost)
+            {
+                bestCost = c;
+                bestAxis = axis;
+                bestSplit = s;
+            }
+        }
+    }
+
+    /* Small nodes stay leaves unless splitting them pays off */
+    const float parentArea = area(bounds.mMin, bounds.mMax);
+    if(count <= mMaxLeafSize)
+    {
+        float splitCost = parentArea > 0.0f ? mTraversalCost + bestCost / parentArea : (float)count;
+        if(bestAxis < 0 || splitCost >= (float)count)
+        {
+            mNodes[node].mFirst = first;
+            mNodes[node].mCount = (unsigned short)count;
+            mNodes[node].mAxis = 0;
+            return;
+        }
+    }
+
+    unsigned int mid;
+    if(bestAxis >= 0)
+    {
+        Box* begin = &mBoxes[first];
+        Box* split = std::partition(begin, begin + count,
+            [&](const Box& box) { return binOf(centroid(box), bestAxis) < bestSplit; });
+        mid = first + (unsigned int)(split - begin);
+    }
+    else
+    {
+        /* Every centroid coincides, halve the list */
+        bestAxis = 0;
+        mid = first + count / 2;
+    }
+
+    unsigned int left = (unsigned int)mNodes.size();
+    mNodes.push_back(BVHNode());
+    mNodes.push_back(BVHNode());
+    mNodes[node].mFirst = left;
+    mNodes[node].mCount = 0;
+    mNodes[node].mAxis = (unsigned short)bestAxis;
+
+    subdivide(left, first, mid - first, depth + 1);
+    subdivide(left + 1, mid, first + count - mid, depth + 1);
+}
+
+float BVH::cost(unsigned int node, float rootArea) const
+{
+    const BVHNode& n = mNodes[node];
+    float relativeArea = rootArea > 0.0f ? area(n.mMin, n.mMax) / rootArea : 1.0f;
+    if(n.mCount)
+    {
+        return relativeArea * (float)n.mCount;
+    }
+    return relativeArea * mTraversalCost + cost(n.mFirst, rootArea) + cost(n.mFirst + 1, rootArea);
+}
+
+bool BVH::intersect(const vec3f& origin, const vec3f& rayDirectionInverse, float tmin,
+    float& entry, float& exit, size_t& tests) const
+{
+    if(mNodes.empty())
+    {
+        return false;
+    }
+
+    bool hit = false;
+    float closest = std::numeric_limits<float>::infinity();
+    unsigned int closestIndex = std::numeric_limits<unsigned int>::max();
+
+    unsigned int stack[BVHStackSize];
+    int top = 0;
+    stack[top++] = 0;
+    while(top)
+    {
+        const BVHNode& node = mNodes[stack[--top]];
+        float nodeEntry, nodeExit;
+        tests++;
+        if(!intersectBox(node.mMin, node.mMax, origin, rayDirectionInverse, tmin, nodeEntry, nodeExit)
+            || nodeEntry > closest)
+        {
+            continue;
+        }
+
+        if(node.mCount)
+        {
+            for(unsigned int i = node.mFirst; i < node.mFirst + node.mCount; ++i)
+            {
+                const Box& box = mBoxes[i];
+                float boxEntry, boxExit;
+                tests++;
+                if(intersectBox(box.mMin, box.mMax, origin, rayDirectionInverse, tmin, boxEntry, boxExit)
+                    && (boxEntry < closest || (boxEntry == closest && box.mIndex < closestIndex)))
+                {
+                    closest = boxEntry;
+                    closestIndex = box.mIndex;
+                    entry = boxEntry;
+                    exit = boxExit;
+                    hit = true;
+                }
+            }
+        }
+        else
+        {
+            /* Near child on top */
+            unsigned int flip = component(rayDirectionInverse, node.mAxis) < 0.0f ? 1 : 0;
+            stack[top++] = node.mFirst + 1 - flip;
+            stack[top++] = node.mFirst + flip;
+        }
+    }
+    return hit;
+}
+
+#if OPTIXDVR_SIMD_LANES
+simd::vmask BVH::intersect(const simd::vfloat3& origin, const simd::vfloat3& rayDirectionInverse,
+    simd::vfloat tmin, simd::vmask lanes, simd::vfloat& entry, simd::vfloat& exit, size_t& tests) const
+{
+    using namespace simd;
+
+    vmask hit = vmask::first(0);
+    if(mNodes.empty() || !lanes.any())
+    {
+        return hit;
+    }
+
+    /* Children are visited in the order the first active lane wants */
+    float inverse[3][Lanes];
+    rayDirectionInverse.x.store(inverse[0]);
+    rayDirectionInverse.y.store(inverse[1]);
+    rayDirectionInverse.z.store(inverse[2]);
+    int lead = 0;
+    while(!lanes.lane(lead))
+    {
+        lead++;
+    }
+
+    vfloat closest(std::numeric_limits<float>::infinity());
+    vint closestIndex(std::numeric_limits<int>::max());
+
+    unsigned int stack[BVHStackSize];
+    int top = 0;
+    stack[top++] = 0;
+    while(top)
+    {
+        const BVHNode& node = mNodes[stack[--top]];
+        vfloat nodeEntry, nodeExit;
+        tests += lanes.count();
+        vmask active = lanes & intersectBox(node.mMin, node.mMax, origin, rayDirectionInverse, tmin, nodeEntry, nodeExit);
+        active = andnot(nodeEntry > closest, active);
+        if(!active.any())
+        {
+            continue;
+        }
+
+        if(node.mCount)
+        {
+            for(unsigned int i = node.mFirst; i < node.mFirst + node.mCount; ++i)
+            {
+                const Box& box = mBoxes[i];
+                vfloat boxEntry, boxExit;
+                tests += active.count();
+                const vint index((int)box.mIndex);
+                vmask closer = active & intersectBox(box.mMin, box.mMax, origin, rayDirectionInverse, tmin, boxEntry, boxExit);
+                closer = closer & ((boxEntry < closest) | ((boxEntry == closest) & (index < closestIndex)));
+                closest = select(closer, boxEntry, closest);
+                closestIndex = select(closer, index, closestIndex);
+                entry = select(closer, boxEntry, entry);
+                exit = select(closer, boxExit, exit);
+                hit = hit | closer;
+            }
+        }
+        else
+        {
+            unsigned int flip = inverse[node.mAxis][lead] < 0.0f ? 1 : 0;
+            stack[top++] = node.mFirst + 1 - flip;
+            stack[top++] = node.mFirst + flip;
+        }
+    }
+    return hit;
+}
+#endif
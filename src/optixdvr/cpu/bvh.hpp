@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+#include "../programs/vec.h"
+#include "../utils/stats.hpp"
+#include "simd.hpp"
+
+/* Ray/box slab test as in aabb.cu, the entry clamped to tmin */
+inline bool intersectBox(const vec3f& boxMin, const vec3f& boxMax, const vec3f& origin,
+    const vec3f& rayDirectionInverse, float tmin, float& entry, float& exit)
+{
+    const vec3f vminv = (boxMin - origin) * rayDirectionInverse;
+    const vec3f vmaxv = (boxMax - origin) * rayDirectionInverse;
+    const vec3f tnear = min(vminv, vmaxv);
+    const vec3f tfar = max(vminv, vmaxv);
+    entry = fmaxf(tmin, fmaxf(fmaxf(tnear.x, tnear.y), tnear.z));
+    exit = fminf(fminf(tfar.x, tfar.y), tfar.z);
+    return exit > entry;
+}
+
+#if OPTIXDVR_SIMD_LANES
+inline simd::vmask intersectBox(const vec3f& boxMin, const vec3f& boxMax, const simd::vfloat3& origin,
+    const simd::vfloat3& rayDirectionInverse, simd::vfloat tmin, simd::vfloat& entry, simd::vfloat& exit)
+{
+    using namespace simd;
+    const vfloat3 vminv = (vfloat3(boxMin.x, boxMin.y, boxMin.z) - origin) * rayDirectionInverse;
+    const vfloat3 vmaxv = (vfloat3(boxMax.x, boxMax.y, boxMax.z) - origin) * rayDirectionInverse;
+    entry = fmax(tmin, fmax(fmax(fmin(vminv.x, vmaxv.x), fmin(vminv.y, vmaxv.y)), fmin(vminv.z, vmaxv.z)));
+    exit = fmin(fmin(fmax(vminv.x, vmaxv.x), fmax(vminv.y, vmaxv.y)), fmax(vminv.z, vmaxv.z));
+    return exit > entry;
+}
+#endif
+
+struct BVHNode
+{
+    vec3f mMin;
+    /* First box of a leaf, left child of an inner node (right is next) */
+    unsigned int mFirst;
+    vec3f mMax;
+    /* Boxes in a leaf, 0 for inner nodes */
+    unsigned short mCount;
+    /* Inner nodes' split axis, left holds the lower centroids */
+    unsigned short mAxis;
+};
+
+/**
+ * Bounding volume hierarchy over the ESS boxes for the CPU renderer,
+ * standing in for the Trbvh OptiX builds over the same boxes. Built
+ * top-down with binned SAH, the binning of large nodes spread over
+ * threads. Closest hits are resolved as the brute-force box loop does,
+ * equally close boxes going to the lowest index, so both render the
+ * same frames.
+ */
+class BVH
+{
+public:
+    struct Box
+    {
+        vec3f mMin;
+        unsigned int mIndex;
+        vec3f mMax;
+    };
+
+    Stats mStats;
+    /* Leaves are split further as long as SAH thinks it pays off, and
+       always above mMaxLeafSize boxes */
+    unsigned int mMaxLeafSize = 4;
+    /* Cost of visiting a node relative to testing a box */
+    float mTraversalCost = 1.0f;
+    /* Nodes with more boxes are binned in parallel */
+    size_t mParallelThreshold = 16384;
+
+    std::vector<BVHNode> mNodes;
+    std::vector<Box> mBoxes;
+
+    void build(const std::vector<vec4f>& boxMin, const std::vector<vec4f>& boxMax);
+
+    /* Closest box with an exit past tmin, the first of equally close boxes
+       wins. tests counts the nodes and boxes tested */
+    bool intersect(const vec3f& origin, const vec3f& rayDirectionInverse, float tmin,
+        float& entry, float& exit, size_t& tests) const;
+
+#if OPTIXDVR_SIMD_LANES
+    /* Packet traversal, a node is entered when any lane hits it. Lanes
+       outside the returned mask keep their entry and exit */
+    simd::vmask intersect(const simd::vfloat3& origin, const simd::vfloat3& rayDirectionInverse,
+        simd::vfloat tmin, simd::vmask lanes, simd::vfloat& entry, simd::vfloat& exit, size_t& tests) const;
+#endif
+
+private:
+    unsigned int mDepth = 0;
+    void subdivide(unsigned int node, unsigned int first, unsigned int count, unsigned int depth);
+    float cost(unsigned int node, float rootArea) const;
+};
@@ -0,0 +1,686 @@
+#include "cpurenderer.hpp"
+#include "../programs/sampling.h"
+#include "../programs/shading.h"
+#include "../programs/stepping.h"
+#include "../utils/half.h"
+#include "../utils/utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+/* The texture unit keeps filter weights as 8-bit fractions */
+static inline float filterWeight(float f)
+{
+    return rintf(f * 256.0f) / 256.0f;
+}
+
+static inline float lerp(float a, float b, float t)
+{
+    return (1.0f - t) * a + t * b;
+}
+
+static inline vec4f lerp(const vec4f& a, const vec4f& b, float t)
+{
+    return a * (1.0f - t) + b * t;
+}
+
+static inline vec3f heat(float ratio)
+{
+    /* Convert scalar to RGB heat (blue minimum, red maximum) */
+    float b = fmaxf(0.0f, (1.0f - ratio));
+    float r = fmaxf(0.0f, (ratio - 1.0f));
+    float g = 1.0f - b - r;
+    return vec3f(r, g, b);
+}
+
+void CPURenderer::resize(int w, int h)
+{
+    mWidth = w;
+    mHeight = h;
+    mFrame.assign((size_t)w * (size_t)h * 4, 0);
+    mAccumulation.assign((size_t)w * (size_t)h, vec4f(0.0f));
+    mMoments.assign((size_t)w * (size_t)h, 0.0f);
+    mSurfaceDistances.assign((size_t)w * (size_t)h, -1.0f);
+}
+
+void CPURenderer::updatePool(HostVolumeBrickPool* pool)
+{
+    mPool = pool;
+    mVolumeDimensions = pool->levelDimensions();
+
+    VolumeBrick& exampleBrick = pool->brick(0, 0, 0);
+    vec3f brickDimensions(
+        exampleBrick.mDataDimensions.x,
+        exampleBrick.mDataDimensions.y,
+        exampleBrick.mDataDimensions.z
+    );
+    mBrickSizeVolumeSpace = brickDimensions / mVolumeDimensions;
+}
+
+void CPURenderer::updateBoxes()
+{
+    mBVH.build(mAABBMinData, mAABBMaxData);
+    std::vector<std::string> keys = mBVH.mStats.list();
+    for(size_t i = 0; i < keys.size(); ++i)
+    {
+        mStats.set(keys[i], mBVH.mStats.get(keys[i]));
+    }
+    keys = mLeafGrid.mStats.list();
+    for(size_t i = 0; i < keys.size(); ++i)
+    {
+        mStats.set(keys[i], mLeafGrid.mStats.get(keys[i]));
+    }
+}
+
+CPURenderer::Ray CPURenderer::generateRay(float s, float t, DRand48& rnd) const
+{
+    const vec3f rd = mCameraLensRadius * random_in_unit_disk(rnd);
+    const vec3f lens_offset = mCameraU * rd.x + mCameraV * rd.y;
+    Ray ray;
+    ray.origin = mCameraOrigin + lens_offset;
+    ray.direction = normalize(
+        mCameraLowerLeft
+        + s * mCameraHorizontal
+        + t * mCameraVertical
+        - ray.origin
+    );
+    ray.tmin = 1e-6f;
+    return ray;
+}
+
+bool CPURenderer::trace(const Ray& ray, RayData& prd, RayStats& stats) const
+{
+    if(mEmptySpaceSkipping == ESSBVH)
+    {
+        return mBVH.intersect(ray.origin, prd.rayDirectionInverse, ray.tmin,
+            prd.entryDistance, prd.exitDistance, stats.mTests);
+    }
+    else if(mEmptySpaceSkipping == ESSGrid)
+    {
+        return mLeafGrid.intersect(ray.origin, prd.rayDirectionInverse, ray.tmin,
+            prd.entryDistance, prd.exitDistance, stats.mTests);
+    }
+
+    /* Every box is tested, the first of equally close boxes wins */
+    bool hit = false;
+    float closest = std::numeric_limits<float>::infinity();
+    for(size_t i = 0; i < mAABBMinData.size(); ++i)
+    {
+        const vec3f aabbMin(mAABBMinData[i].x, mAABBMinData[i].y, mAABBMinData[i].z);
+        const vec3f aabbMax(mAABBMaxData[i].x, mAABBMaxData[i].y, mAABBMaxData[i].z);
+        float tmin, tmax;
+        if(intersectBox(aabbMin, aabbMax, ray.origin, prd.rayDirectionInverse, ray.tmin, tmin, tmax)
+            && tmin < closest)
+        {
+            closest = tmin;
+            prd.entryDistance = tmin;
+            prd.exitDistance = tmax;
+            hit = true;
+        }
+    }
+    stats.mTests += mAABBMinData.size();
+    return hit;
+}
+
+float CPURenderer::voxel(int x, int y, int z) const
+{
+    /* Clamp to edge */
+    x = std::min(std::max(x, 0), (int)mPool->mDataDimensions.x - 1);
+    y = std::min(std::max(y, 0), (int)mPool->mDataDimensions.y - 1);
+    z = std::min(std::max(z, 0), (int)mPool->mDataDimensions.z - 1);
+    size_t index = (size_t)x
+        + (size_t)y * mPool->mDataDimensions.x
+        + (size_t)z * mPool->mDataDimensions.x * mPool->mDataDimensions.y;
+
+    const char* data = mPool->mPoolData;
+    switch(mPool->mFormat)
+    {
+    case RT_FORMAT_UNSIGNED_BYTE:
+        return (float)((const unsigned char*)data)[index] / 255.0f;
+    case RT_FORMAT_UNSIGNED_SHORT:
+        return (float)((const unsigned short*)data)[index] / 65535.0f;
+    case RT_FORMAT_UNSIGNED_INT:
+        return (float)((const unsigned int*)data)[index] / 4294967295.0f;
+    case RT_FORMAT_HALF:
+        return halfToFloat(((const unsigned short*)data)[index]);
+    default:
+        return ((const float*)data)[index];
+    }
+}
+
+float CPURenderer::sampleVolume(const vec3f& address) const
+{
+    /* Unnormalised coordinates address texel centres at +0.5 */
+    const float x = address.x - 0.5f;
+    const float y = address.y - 0.5f;
+    const float z = address.z - 0.5f;
+    const float fx = floorf(x);
+    const float fy = floorf(y);
+    const float fz = floorf(z);
+    const int ix = (int)fx;
+    const int iy = (int)fy;
+    const int iz = (int)fz;
+    const float ax = filterWeight(x - fx);
+    const float ay = filterWeight(y - fy);
+    const float az = filterWeight(z - fz);
+
+    float c00 = lerp(voxel(ix, iy, iz), voxel(ix + 1, iy, iz), ax);
+    float c10 = lerp(voxel(ix, iy + 1, iz), voxel(ix + 1, iy + 1, iz), ax);
+    float c01 = lerp(voxel(ix, iy, iz + 1), voxel(ix + 1, iy, iz + 1), ax);
+    float c11 = lerp(voxel(ix, iy + 1, iz + 1), voxel(ix + 1, iy + 1, iz + 1), ax);
+    return lerp(lerp(c00, c10, ay), lerp(c01, c11, ay), az);
+}
+
+vec4f CPURenderer::sampleTransferFunction(float value) const
+{
+    /* Normalised coordinates over the LUT, clamped to its edges */
+    const int size = mTransferFunction->mSize;
+    const float x = value * (float)size - 0.5f;
+    const float fx = floorf(x);
+    const float ax = filterWeight(x - fx);
+    int i0 = (int)fx;
+    int i1 = i0 + 1;
+    i0 = std::min(std::max(i0, 0), size - 1);
+    i1 = std::min(std::max(i1, 0), size - 1);
+    return lerp(mTransferFunction->mLUT[i0], mTransferFunction->mLUT[i1], ax);
+}
+
+vec3f CPURenderer::tapGradient(const vec3f& address, const vec3f& lo, const vec3f& hi) const
+{
+    const float xm = fmaxf(address.x - 1.0f, lo.x);
+    const float xp = fminf(address.x + 1.0f, hi.x);
+    const float ym = fmaxf(address.y - 1.0f, lo.y);
+    const float yp = fminf(address.y + 1.0f, hi.y);
+    const float zm = fmaxf(address.z - 1.0f, lo.z);
+    const float zp = fminf(address.z + 1.0f, hi.z);
+    return vec3f(
+        gradient_difference(sampleVolume(vec3f(xm, address.y, address.z)),
+            sampleVolume(vec3f(xp, address.y, address.z)), xp - xm),
+        gradient_difference(sampleVolume(vec3f(address.x, ym, address.z)),
+            sampleVolume(vec3f(address.x, yp, address.z)), yp - ym),
+        gradient_difference(sampleVolume(vec3f(address.x, address.y, zm)),
+            sampleVolume(vec3f(address.x, address.y, zp)), zp - zm)
+    );
+}
+
+vec4f CPURenderer::gradientVoxel(int x, int y, int z) const
+{
+    /* Clamp to edge, normalised integer reads */
+    const vec3size_t& dims = mGradients->mDimensions;
+    x = std::min(std::max(x, 0), (int)dims.x - 1);
+    y = std::min(std::max(y, 0), (int)dims.y - 1);
+    z = std::min(std::max(z, 0), (int)dims.z - 1);
+    const unsigned char* packed = &mGradients->mData[4 * ((size_t)x + (size_t)y * dims.x + (size_t)z * dims.x * dims.y)];
+    return vec4f(packed[0], packed[1], packed[2], packed[3]) * vec4f(1.0f / 255.0f);
+}
+
+vec3f CPURenderer::sampleGradient(const vec3f& address) const
+{
+    /* Filtered as sampleVolume() */
+    const float x = address.x - 0.5f;
+    const float y = address.y - 0.5f;
+    const float z = address.z - 0.5f;
+    const float fx = floorf(x);
+    const float fy = floorf(y);
+    const float fz = floorf(z);
+    const int ix = (int)fx;
+    const int iy = (int)fy;
+    const int iz = (int)fz;
+    const float ax = filterWeight(x - fx);
+    const float ay = filterWeight(y - fy);
+    const float az = filterWeight(z - fz);
+
+    vec4f c00 = lerp(gradientVoxel(ix, iy, iz), gradientVoxel(ix + 1, iy, iz), ax);
+    vec4f c10 = lerp(gradientVoxel(ix, iy + 1, iz), gradientVoxel(ix + 1, iy + 1, iz), ax);
+    vec4f c01 = lerp(gradientVoxel(ix, iy, iz + 1), gradientVoxel(ix + 1, iy, iz + 1), ax);
+    vec4f c11 = lerp(gradientVoxel(ix, iy + 1, iz + 1), gradientVoxel(ix + 1, iy + 1, iz + 1), ax);
+    return unpack_gradient(lerp(lerp(c00, c10, ay), lerp(c01, c11, ay), az));
+}
+
+void CPURenderer::accumulate(const Ray& ray, RayData& prd) const
+{
+    float entryDistance = prd.entryDistance;
+    float exitDistance = prd.exitDistance;
+
+    /* Round up and down to the nearest entry/exit samples */
+    int startSample = (int)ceilf(entryDistance / prd.worldSpaceStepSize);
+    int endSample = (int)floorf(exitDistance / prd.worldSpaceStepSize);
+    exitDistance = (float)endSample * prd.worldSpaceStepSize;
+    prd.exitDistance = exitDistance + prd.worldSpaceStepSize;
+    const int steps = endSample - startSample;
+
+    /* Entry point in normalised volume space */
+    const vec3f worldSpaceEntry = ray.direction * entryDistance + ray.origin;
+    const vec3f brickEntryPoint = (worldSpaceEntry - mVolumeMin) / mVolumeSize;
+
+    const vec3size_t& numBricks = mPool->mNumBricks;
+    const vec3f poolDataRegionSize(
+        mPool->mActualDataSize.x,
+        mPool->mActualDataSize.y,
+        mPool->mActualDataSize.z
+    );
+    const vec3f poolSampleRegionSize(
+        mPool->mBrickSize.x,
+        mPool->mBrickSize.y,
+        mPool->mBrickSize.z
+    );
+
+    /* Ray-stepping loop */
+    vec3f p = brickEntryPoint;
+    vec4f a = prd.accumulation;
+    float surfaceDistance = prd.surfaceDistance;
+    const vec3f step = prd.volumeSpaceStep;
+    const float opacityCorrection = prd.opacityCorrection;
+    vec3f pageTableIndex;
+    vec3f prevPageTableIndex(-1.0f);
+    vec3f poolOffset(0.0f);
+    vec3f brickBegin(0.0f);
+    PageTableScaleEntry brickScale;
+    brickScale.scale = 1.0f;
+    brickScale.offset = 0.0f;
+    const vec3f brickSizeInv = vec3f(1.0f) / mBrickSizeVolumeSpace;
+    int ptaccesses = 0;
+    int samples = 0;
+    vec3f leafMin(0.0f);
+    vec3f leafMax(-1.0f);
+    float leafBound = 1.0f;
+    int leafScale = 1;
+    int advance = 1;
+    const vec3f toEye = -ray.direction;
+    const vec3f voxelsPerUnit = mVolumeDimensions / mVolumeSize;
+    const vec4f shadingTerms = mShading.terms();
+    for(int i = 0; i < steps && a.w < mERTThreshold; i += advance)
+    {
+        /* Skip ahead through the rest of a transparent leaf, or stretch
+           the step through a nearly transparent one */
+        if(mOpacityBounds)
+        {
+            if(!(p.x >= leafMin.x && p.y >= leafMin.y && p.z >= leafMin.z
+                && p.x < leafMax.x && p.y < leafMax.y && p.z < leafMax.z))
+            {
+                leafBound = mOpacityBounds->bound(p, leafMin, leafMax);
+                leafScale = step_scale(leafBound, opacityCorrection,
+                    mOpacityBounds->mTolerance, mOpacityBounds->mMaxStepScale);
+            }
+            advance = 1;
+            if(leafScale > 1)
+            {
+                advance = std::min(std::min(leafScale, steps_to_leave(p, step, leafMin, leafMax)), steps - i);
+            }
+            if(leafBound <= 0.0f)
+            {
+                p += step * (float)advance;
+                continue;
+            }
+        }
+
+        pageTableIndex.x = floorf(p.x * brickSizeInv.x);
+        pageTableIndex.y = floorf(p.y * brickSizeInv.y);
+        pageTableIndex.z = floorf(p.z * brickSizeInv.z);
+
+        /* If we've moved to a new brick, need to fetch page table info */
+        if(pageTableIndex != prevPageTableIndex)
+        {
+            size_t bx = (size_t)std::min(std::max((int)pageTableIndex.x, 0), (int)numBricks.x - 1);
+            size_t by = (size_t)std::min(std::max((int)pageTableIndex.y, 0), (int)numBricks.y - 1);
+            size_t bz = (size_t)std::min(std::max((int)pageTableIndex.z, 0), (int)numBricks.z - 1);
+            size_t entryIndex = bx + by * numBricks.x + bz * numBricks.x * numBricks.y;
+            const PageTableEntry& pageTableEntry = mPool->mPageTableData[entryIndex];
+            if(pageTableEntry.flags == PageTableEntryNotPaged)
+            {
+                p += step * (float)advance;
+                continue;
+            }
+            brickBegin = pageTableIndex * mBrickSizeVolumeSpace;
+
+            poolOffset.x = (float)pageTableEntry.x * poolDataRegionSize.x + 0.5f;
+            poolOffset.y = (float)pageTableEntry.y * poolDataRegionSize.y + 0.5f;
+            poolOffset.z = (float)pageTableEntry.z * poolDataRegionSize.z + 0.5f;
+            brickScale = mPool->mPageTableScaleData[entryIndex];
+            prevPageTableIndex = pageTableIndex;
+            ptaccesses++;
+        }
+
+        /* Convert p from normalized volume space to pool data space */
+        vec3f voxelAddress;
+        voxelAddress.x = poolOffset.x + ((p.x - brickBegin.x) * brickSizeInv.x) * poolSampleRegionSize.x;
+        voxelAddress.y = poolOffset.y + ((p.y - brickBegin.y) * brickSizeInv.y) * poolSampleRegionSize.y;
+        voxelAddress.z = poolOffset.z + ((p.z - brickBegin.z) * brickSizeInv.z) * poolSampleRegionSize.z;
+
+        float value = sampleVolume(voxelAddress);
+        value = value * brickScale.scale + brickScale.offset;
+
+        vec4f colour = sampleTransferFunction(value);
+        samples++;
+
+        /* Light what the transfer function shows */
+        if(mUseShading && colour.w > 0.0f)
+        {
+            vec3f gradient;
+            if(mGradients)
+            {
+                gradient = sampleGradient(voxelAddress);
+            }
+            else
+            {
+                const vec3f slotMax = poolOffset + poolDataRegionSize - vec3f(1.0f);
+                gradient = tapGradient(voxelAddress, poolOffset, slotMax) * brickScale.scale;
+            }
+            const vec3f worldSpacePoint = mVolumeMin + p * mVolumeSize;
+            const vec3f lit = shade_sample(vec3f(colour.x, colour.y, colour.z), gradient, voxelsPerUnit,
+                normalize(mLightPosition - worldSpacePoint), toEye, shadingTerms, mShading.mMinGradient);
+            colour.x = lit.x;
+            colour.y = lit.y;
+            colour.z = lit.z;
+        }
+
+        /* Apply opacity correction and accumulate colour */
+        colour.w = 1.0f - powf(1.0f - colour.w, opacityCorrection * (float)advance);
+        float opacity = 1.0f - a.w;
+        colour.w *= opacity;
+        a.x = colour.x * colour.w + a.x;
+        a.y = colour.y * colour.w + a.y;
+        a.z = colour.z * colour.w + a.z;
+        a.w = colour.w + a.w;
+
+        if(a.w >= 0.5f && surfaceDistance < 0.0f)
+        {
+            surfaceDistance = entryDistance + (float)i * prd.worldSpaceStepSize;
+        }
+
+        p += step * (float)advance;
+    }
+    prd.pageTableAccesses += ptaccesses;
+    prd.samples += samples;
+    prd.accumulation = a;
+    prd.surfaceDistance = surfaceDistance;
+}
+
+vec4f CPURenderer::color(Ray& ray, RayStats& stats, float& surfaceDistance) const
+{
+    stats.mRays++;
+
+    RayData prd;
+
+    vec4f accumulatedColour(vec3f(0.0f), 0.0f);
+    prd.accumulation = accumulatedColour;
+    prd.surfaceDistance = -1.0f;
+    surfaceDistance = -1.0f;
+
+    /* Entry and exit points of the whole volume */
+    const vec3f boxsize = mVolumeSize;
+    const vec3f boxmin = mVolumeMin;
+    const vec3f boxmax = mVolumeMin + mVolumeSize;
+    const vec3f rayDirectionInverse = vec3f(1.0f) / ray.direction;
+    const vec3f vminv = (boxmin - ray.origin) * rayDirectionInverse;
+    const vec3f vmaxv = (boxmax - ray.origin) * rayDirectionInverse;
+    const vec3f vmin = min(vminv, vmaxv);
+    const vec3f vmax = max(vminv, vmaxv);
+    float volumeEntryDistance = fmaxf(ray.tmin + 1e-9f, fmaxf(fmaxf(vmin.x, vmin.y), vmin.z));
+    float volumeExitDistance = fminf(fminf(vmax.x, vmax.y), vmax.z);
+    if(!(volumeExitDistance > volumeEntryDistance))
+    {
+        return accumulatedColour;
+    }
+
+    float worldSpaceDepth = volumeExitDistance - volumeEntryDistance;
+
+    vec3f volumeEntryPoint = ray.origin + ray.direction * volumeEntryDistance;
+    vec3f volumeExitPoint = ray.origin + ray.direction * volumeExitDistance;
+    volumeEntryPoint = (volumeEntryPoint + boxmax) / boxsize;
+    volumeExitPoint = (volumeExitPoint + boxmax) / boxsize;
+
+    vec3f volumeDirection = volumeExitPoint - volumeEntryPoint;
+    vec3f dataSpaceVector = volumeDirection * mVolumeDimensions;
+    float steps = (mSamplesPerVoxel * dataSpaceVector.length());
+    vec3f volumeSpaceStep = normalize(volumeDirection) / (mSamplesPerVoxel * mVolumeDimensions);
+    float volumeSpaceStepSize = volumeSpaceStep.length();
+    float worldSpaceStepSize = worldSpaceDepth / steps;
+
+    prd.rayDirectionInverse = rayDirectionInverse;
+    prd.worldSpaceStepSize = worldSpaceStepSize;
+    prd.opacityCorrection = volumeSpaceStepSize * mOpacityReference;
+    prd.volumeSpaceStep = volumeSpaceStep;
+    prd.pageTableAccesses = 0;
+    prd.samples = 0;
+    prd.rayTerminated = false;
+
+    int depth = 0;
+    for(; depth < mMaxBounces; ++depth)
+    {
+        if(trace(ray, prd, stats))
+        {
+            if(!mDontSample)
+            {
+                accumulate(ray, prd);
+            }
+        }
+        else
+        {
+            /* The miss program blends in a black background */
+            prd.rayTerminated = true;
+        }
+
+        if(prd.accumulation.w >= mERTThreshold || prd.rayTerminated)
+            break;
+
+        ray.tmin = prd.exitDistance;
+    }
+
+    stats.mDepth += depth;
+    stats.mPageTableAccesses += prd.pageTableAccesses;
+    stats.mSamples += prd.samples;
+    surfaceDistance = prd.surfaceDistance;
+    return shade(prd.accumulation, depth, prd.pageTableAccesses);
+}
+
+vec4f CPURenderer::shade(const vec4f& accumulation, int depth, unsigned int pageTableAccesses) const
+{
+    if(mShowDepthComplexity)
+    {
+        float ratio = 2.0f * (float)depth / (float)mMaxBounces;
+        return vec4f(heat(ratio), 1.0f);
+    }
+    else if(mShowPageTableAccesses)
+    {
+        float ratio = 2.0f * (float)pageTableAccesses / (float)mMaxBounces;
+        return vec4f(heat(ratio), 1.0f);
+    }
+    else if(mHighlightERT)
+    {
+        if(accumulation.w >= mERTThreshold)
+        {
+            /* Highlight the ERT with red */
+            return vec4f(1, 0, 0, 1);
+        }
+        else
+        {
+            /* Convert anything that isn't an ERT to grayscale */
+            vec4f c = accumulation;
+            float luminance = c.x * 0.2126f + c.y * 0.7152f + c.z * 0.0722f;
+            return vec4f(vec3f(luminance), 1.0f);
+        }
+    }
+
+    return accumulation;
+}
+
+void CPURenderer::render(const Camera& camera)
+{
+    utils::Timer timer;
+    timer.start();
+
+    vec3f w;
+    camera.basis(mCameraLowerLeft, mCameraHorizontal, mCameraVertical, mCameraU, mCameraV, w);
+    mCameraOrigin = camera.mOrigin;
+    mCameraLensRadius = camera.mAperture / 2.0f;
+
+    if(mFrame.size() != (size_t)mWidth * (size_t)mHeight * 4
+        || mAccumulation.size() != (size_t)mWidth * (size_t)mHeight
+        || mMoments.size() != (size_t)mWidth * (size_t)mHeight
+        || mSurfaceDistances.size() != (size_t)mWidth * (size_t)mHeight)
+    {
+        resize(mWidth, mHeight);
+    }
+
+    if(mPool == nullptr || mTransferFunction == nullptr || mTransferFunction->mLUT == nullptr)
+    {
+        std::fill(mFrame.begin(), mFrame.end(), 0);
+        return;
+    }
+
+    mFrameStats = RayStats();
+    mScheduler.run(mWidth, mHeight, [this](const Tile& tile) { renderTile(tile); });
+
+    std::vector<std::string> keys = mScheduler.mStats.list();
+    for(size_t i = 0; i < keys.size(); ++i)
+    {
+        mStats.set(keys[i], mScheduler.mStats.get(keys[i]));
+    }
+
+    /* Per primary ray, rays missing the volume count as 0 */
+    double rays = mFrameStats.mRays ? (double)mFrameStats.mRays : 1.0;
+    mStats.set("cpudepthcomplexity", (double)mFrameStats.mDepth / rays);
+    mStats.set("cpupagetableaccesses", (double)mFrameStats.mPageTableAccesses / rays);
+    mStats.set("cpuesstests", (double)mFrameStats.mTests / rays);
+    mStats.set("cpusamples", (double)mFrameStats.mSamples / rays);
+
+#if OPTIXDVR_SIMD_LANES
+    mStats.set("cpupacketlanes", mUsePackets && packetsSupported() ? simd::Lanes : 1);
+#else
+    mStats.set("cpupacketlanes", 1);
+#endif
+
+    timer.stop();
+    mStats.set("cpurendertime", timer.getTime());
+}
+
+void CPURenderer::renderTile(const Tile& tile)
+{
+    RayStats stats;
+#if OPTIXDVR_SIMD_LANES
+    if(mUsePackets && packetsSupported())
+    {
+        for(int y = tile.y; y < tile.y + tile.height; ++y)
+        {
+            for(int x = tile.x; x < tile.x + tile.width;)
+            {
+                int count = std::min(simd::Lanes, tile.x + tile.width - x);
+                if(mSampler)
+                {
+                    /* Packets don't straddle the sampler's tiles */
+                    const int tileEnd = (x / mSampler->mTileSize + 1) * mSampler->mTileSize;
+                    count = std::min(count, tileEnd - x);
+                }
+                if(mReprojection)
+                {
+                    /* Packets only take the run of marched pixels from x */
+                    int run = 0;
+                    while(run < count && !mReprojection->reused((size_t)y * mWidth + x + run))
+                    {
+                        run++;
+                    }
+                    if(run == 0)
+                    {
+                        reprojected(y * mWidth + x);
+                        x++;
+                        continue;
+                    }
+                    count = run;
+                }
+                if(pixelPass(x, y) >= 0)
+                {
+                    renderPacket(x, y, count, stats);
+                }
+                x += count;
+            }
+        }
+    }
+    else
+#endif
+    {
+        for(int y = tile.y; y < tile.y + tile.height; ++y)
+        {
+            for(int x = tile.x; x < tile.x + tile.width; ++x)
+            {
+                const int pass = pixelPass(x, y);
+                if(pass < 0)
+                {
+                    continue;
+                }
+                int pixel_index = y * mWidth + x;
+                if(reprojected(pixel_index))
+                {
+                    continue;
+                }
+                vec4f col(0.0f);
+                DRand48 rnd;
+                rnd.init(pixel_seed(pixel_index, pass));
+                for(int s = 0; s < mSamples; s++)
+                {
+                    float u = float(x) / float(mWidth);
+                    float v = float(y) / float(mHeight);
+                    Ray ray = generateRay(u, v, rnd);
+                    float surfaceDistance;
+                    col += color(ray, stats, surfaceDistance);
+                    if(s == 0)
+                    {
+                        mSurfaceDistances[pixel_index] = surfaceDistance;
+                    }
+                }
+                storePixel(pixel_index, pass, col / float(mSamples));
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mFrameStatsMutex);
+    mFrameStats.mRays += stats.mRays;
+    mFrameStats.mDepth += stats.mDepth;
+    mFrameStats.mPageTableAccesses += stats.mPageTableAccesses;
+    mFrameStats.mTests += stats.mTests;
+    mFrameStats.mSamples += stats.mSamples;
+}
+
+int CPURenderer::pixelPass(int x, int y) const
+{
+    if(mSampler)
+    {
+        return mSampler->launchPasses(x, y) - 1;
+    }
+    return mAccumulate ? mFrameIndex : 0;
+}
+
+bool CPURenderer::reprojected(int pixelIndex)
+{
+    if(!mReprojection || !mReprojection->reused(pixelIndex))
+    {
+        return false;
+    }
+    memcpy(&mFrame[(size_t)pixelIndex * 4], &mReprojection->mFrame[(size_t)pixelIndex * 4], 4);
+    return true;
+}
+
+void CPURenderer::storePixel(int pixelIndex, int pass, vec4f col)
+{
+    if(mSampler)
+    {
+        const float luminance = col.x * 0.2126f + col.y * 0.7152f + col.z * 0.0722f;
+        float& moment = mMoments[pixelIndex];
+        moment = pass > 0 ? moment + luminance * luminance : luminance * luminance;
+    }
+
+    if(mAccumulate || mSampler)
+    {
+        vec4f& sum = mAccumulation[pixelIndex];
+        sum = pass > 0 ? sum + col : col;
+        col = sum / float(pass + 1);
+    }
+
+    col = saturate(col);
+    unsigned char* c = &mFrame[(size_t)pixelIndex * 4];
+    c[0] = (unsigned char)(col.x * 255.0f);
+    c[1] = (unsigned char)(col.y * 255.0f);
+    c[2] = (unsigned char)(col.z * 255.0f);
+    c[3] = 255;
+}
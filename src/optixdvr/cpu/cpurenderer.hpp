@@ -0,0 +1,243 @@
+#pragma once
+
+#include <vector>
+
+#include "../programs/vec.h"
+#include "../programs/DRand48.h"
+#include "../adaptivesampler.hpp"
+#include "../camera.hpp"
+#include "../reprojection.hpp"
+#include "../shading.hpp"
+#include "../volume/gradientpool.hpp"
+#include "../volume/hostbrickpool.hpp"
+#include "../volume/opacitybounds.hpp"
+#include "../volume/transferfunction.hpp"
+#include "../utils/stats.hpp"
+#include "tilescheduler.hpp"
+#include "bvh.hpp"
+#include "leafgrid.hpp"
+#include "simd.hpp"
+
+/**
+ * Multithreaded CPU reference for the OptiX pipeline. Traces the same ESS
+ * boxes, page table, brick pool and transfer function LUT, and follows
+ * raygen.cu, aabb.cu and volume.cu step for step, so frames can be
+ * compared against the GPU's or rendered where there's no GPU at all.
+ * Texture reads emulate the texture unit: clamp to edge, normalised
+ * integer reads and linear filtering with 8-bit fractional weights.
+ */
+class CPURenderer
+{
+public:
+    struct Ray
+    {
+        vec3f origin;
+        vec3f direction;
+        float tmin;
+    };
+
+    /* The OptiX programs' PerRayData, flattened */
+    struct RayData
+    {
+        vec3f rayDirectionInverse;
+        float worldSpaceStepSize;
+        vec3f volumeSpaceStep;
+        float opacityCorrection;
+        float entryDistance;
+        float exitDistance;
+        vec4f accumulation;
+        /* Where the ray turned half opaque, -1 until it does */
+        float surfaceDistance;
+        unsigned int pageTableAccesses;
+        unsigned int samples;
+        bool rayTerminated;
+    };
+
+    /* Per-ray counters, summed over a tile */
+    struct RayStats
+    {
+        size_t mRays = 0;
+        size_t mDepth = 0;
+        size_t mPageTableAccesses = 0;
+        /* ESS nodes and boxes tested */
+        size_t mTests = 0;
+        /* Volume samples taken */
+        size_t mSamples = 0;
+    };
+
+    /* How rays find the next ESS box */
+    enum EmptySpaceSkipping
+    {
+        /* Every box is tested, the reference */
+        ESSBoxes,
+        /* Binned SAH BVH over the boxes, like the OptiX path's Trbvh */
+        ESSBVH,
+        /* 3D-DDA over the leaf grid, skipping inactive leaves */
+        ESSGrid
+    };
+
+    Stats mStats;
+
+    /* Launch parameters, the context variables of the OptiX path */
+    int mSamples = 1;
+    int mMaxBounces = 1;
+    float mERTThreshold = 0.99f;
+    float mSamplesPerVoxel = 2.0f;
+    float mOpacityReference = 150.0f;
+    bool mHighlightERT = false;
+    bool mShowDepthComplexity = false;
+    bool mShowPageTableAccesses = false;
+    bool mDontSample = false;
+
+    /* March neighbouring pixels together in SIMD packets when the build
+       has them and the pool format can be gathered, see packetsSupported() */
+    bool mUsePackets = true;
+
+    EmptySpaceSkipping mEmptySpaceSkipping = ESSBVH;
+
+    /* ESS boxes, as handed to the OptiX geometry */
+    std::vector<vec4f> mAABBMinData;
+    std::vector<vec4f> mAABBMaxData;
+    BVH mBVH;
+    /* Leaf activity behind the boxes, set up by the caller */
+    LeafGrid mLeafGrid;
+
+    vec3f mVolumeMin;
+    vec3f mVolumeSize;
+    vec3f mVolumeDimensions;
+    vec3f mBrickSizeVolumeSpace;
+
+    /* Tiles are rendered by a work-stealing pool, as ERT and empty space
+       make their cost very uneven */
+    TileScheduler mScheduler;
+
+    HostVolumeBrickPool* mPool = nullptr;
+    const TransferFunction* mTransferFunction = nullptr;
+
+    int mWidth = 0;
+    int mHeight = 0;
+    /* RGBA8, rows bottom to top like the OptiX frame buffer */
+    std::vector<unsigned char> mFrame;
+
+    /* Progressive refinement as in raygen: frame mFrameIndex adds into the
+       running sum and shows the average, each frame seeded apart */
+    bool mAccumulate = false;
+    int mFrameIndex = 0;
+    std::vector<vec4f> mAccumulation;
+
+    /* Adaptive sampling launch: only the sampler's launched tiles are
+       rendered, as their pass, taking over from mAccumulate while set */
+    const AdaptiveSampler* mSampler = nullptr;
+    /* Squared luminance of every pass, summed, for the sampler */
+    std::vector<float> mMoments;
+
+    /* Pixels the reprojection reused are copied from it instead of being
+       marched, see Reprojection */
+    const Reprojection* mReprojection = nullptr;
+    /* Surface distance of every marched pixel's first sample, -1 if the
+       ray never turned half opaque */
+    std::vector<float> mSurfaceDistances;
+
+    /* Rays stretch their steps through leaves the transfer function keeps
+       (nearly) transparent while set, see OpacityBounds. Rays are then
+       marched one at a time, packets step every lane alike */
+    const OpacityBounds* mOpacityBounds = nullptr;
+
+    /* Gradient shading, see Shading. Normals are read from mGradients
+       when set and taken on the fly otherwise. Rays are then marched one
+       at a time */
+    bool mUseShading = false;
+    Shading mShading;
+    vec3f mLightPosition = vec3f(5.0f, 0.0f, 0.0f);
+    const GradientPool* mGradients = nullptr;
+
+    void resize(int w, int h);
+
+    /* Picks up the pool's current level, after uploads or a level change */
+    void updatePool(HostVolumeBrickPool* pool);
+
+    /* Rebuilds the BVH after the boxes change, and picks up the BVH's and
+       leaf grid's stats */
+    void updateBoxes();
+
+    void render(const Camera& camera);
+
+    /* Radiance of a single primary ray, as raygen's color(), which needs
+       no random numbers past generateRay() */
+    vec4f color(Ray& ray, RayStats& stats, float& surfaceDistance) const;
+
+    bool packetsSupported() const;
+
+private:
+    vec3f mCameraLowerLeft;
+    vec3f mCameraHorizontal;
+    vec3f mCameraVertical;
+    vec3f mCameraOrigin;
+    vec3f mCameraU;
+    vec3f mCameraV;
+    float mCameraLensRadius;
+
+    Ray generateRay(float s, float t, DRand48& rnd) const;
+    void renderTile(const Tile& tile);
+
+    /* Tiles add their counters when done */
+    std::mutex mFrameStatsMutex;
+    RayStats mFrameStats;
+    /* Pass the pixel renders in this launch for seeding and accumulation,
+       -1 if the sampler skips it */
+    int pixelPass(int x, int y) const;
+    /* Copies the pixel over if the reprojection reused it */
+    bool reprojected(int pixelIndex);
+    void storePixel(int pixelIndex, int pass, vec4f col);
+
+    /* Debug views and ERT highlighting applied to a finished ray */
+    vec4f shade(const vec4f& accumulation, int depth, unsigned int pageTableAccesses) const;
+
+    /* Closest ESS box past ray.tmin, false on a miss */
+    bool trace(const Ray& ray, RayData& prd, RayStats& stats) const;
+    void accumulate(const Ray& ray, RayData& prd) const;
+
+    /* Pool voxel as read by a normalised-float texture */
+    float voxel(int x, int y, int z) const;
+    float sampleVolume(const vec3f& address) const;
+    vec4f sampleTransferFunction(float value) const;
+
+    /* Gradient at a pool address, from 6 taps clamped to the brick's
+       slot [lo, hi], or from the precomputed normals */
+    vec3f tapGradient(const vec3f& address, const vec3f& lo, const vec3f& hi) const;
+    vec4f gradientVoxel(int x, int y, int z) const;
+    vec3f sampleGradient(const vec3f& address) const;
+
+#if OPTIXDVR_SIMD_LANES
+    /* Packet versions of the above, cpurenderer_simd.cpp. Lanes outside
+       the mask are left as they were */
+    struct PacketData
+    {
+        simd::vfloat3 rayDirectionInverse;
+        simd::vfloat worldSpaceStepSize;
+        simd::vfloat3 volumeSpaceStep;
+        simd::vfloat opacityCorrection;
+        simd::vfloat entryDistance;
+        simd::vfloat exitDistance;
+        simd::vfloat accumulation[4];
+        simd::vfloat surfaceDistance;
+        simd::vint pageTableAccesses;
+        simd::vint samples;
+    };
+
+    /* Renders count (at most simd::Lanes) pixels of a row from x on, all
+       in the same sampler tile */
+    void renderPacket(int x, int y, int count, RayStats& stats);
+    /* Leaves every lane's colour, depth and page table accesses in prd,
+       returns the lanes that entered the volume */
+    simd::vmask colorPacket(const simd::vfloat3& origin, const simd::vfloat3& direction, float tmin,
+        simd::vmask lanes, PacketData& prd, simd::vint& depth, RayStats& stats) const;
+    simd::vmask tracePacket(const simd::vfloat3& origin, simd::vfloat tmin,
+        simd::vmask lanes, PacketData& prd, RayStats& stats) const;
+    void accumulatePacket(const simd::vfloat3& origin, const simd::vfloat3& direction,
+        simd::vmask lanes, PacketData& prd) const;
+    simd::vfloat voxelPacket(simd::vint index, simd::vmask lanes) const;
+    simd::vfloat sampleVolumePacket(const simd::vfloat3& address, simd::vmask lanes) const;
+    void sampleTransferFunctionPacket(simd::vfloat value, simd::vmask lanes, simd::vfloat colour[4]) const;
+#endif
+};
@@ -0,0 +1,504 @@
+#include "cpurenderer.hpp"
+#include "../programs/sampling.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if !OPTIXDVR_SIMD_LANES
+
+bool CPURenderer::packetsSupported() const
+{
+    return false;
+}
+
+#else
+
+using namespace simd;
+
+static inline vfloat filterWeight(vfloat f)
+{
+    return rint(f * vfloat(256.0f)) / vfloat(256.0f);
+}
+
+static inline vfloat lerp(vfloat a, vfloat b, vfloat t)
+{
+    return (vfloat(1.0f) - t) * a + t * b;
+}
+
+static inline vint clamp(vint i, int maximum)
+{
+    return min(max(i, vint(0)), vint(maximum));
+}
+
+static inline vfloat3 broadcast(const vec3f& v)
+{
+    return vfloat3(v.x, v.y, v.z);
+}
+
+bool CPURenderer::packetsSupported() const
+{
+    /* Lanes of a packet all take the same step, and aren't shaded */
+    if(mPool == nullptr || mOpacityBounds != nullptr || mUseShading)
+    {
+        return false;
+    }
+
+    /* Voxels are addressed with 32-bit gather indices */
+    const vec3size_t& dims = mPool->mDataDimensions;
+    if(dims.x * dims.y * dims.z >= ((size_t)1 << 31))
+    {
+        return false;
+    }
+
+    switch(mPool->mFormat)
+    {
+    case RT_FORMAT_UNSIGNED_BYTE:
+    case RT_FORMAT_UNSIGNED_SHORT:
+    case RT_FORMAT_FLOAT:
+        return true;
+#if OPTIXDVR_SIMD_LANES == 16 || defined(__F16C__)
+    case RT_FORMAT_HALF:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+void CPURenderer::renderPacket(int x, int y, int count, RayStats& stats)
+{
+    const vmask lanes = vmask::first(count);
+    const int firstPixel = y * mWidth + x;
+    const int pass = pixelPass(x, y);
+
+    DRand48 rnd[Lanes];
+    for(int l = 0; l < count; ++l)
+    {
+        rnd[l].init(pixel_seed(firstPixel + l, pass));
+    }
+
+    vec4f col[Lanes];
+    for(int l = 0; l < Lanes; ++l)
+    {
+        col[l] = vec4f(0.0f);
+    }
+
+    const float v = float(y) / float(mHeight);
+    for(int s = 0; s < mSamples; s++)
+    {
+        /* Lanes past the end of the row repeat the first ray, masked off */
+        float origin[3][Lanes];
+        float direction[3][Lanes];
+        float tmin = 0.0f;
+        for(int l = 0; l < Lanes; ++l)
+        {
+            Ray ray;
+            if(l < count)
+            {
+                float u = float(x + l) / float(mWidth);
+                ray = generateRay(u, v, rnd[l]);
+            }
+            else
+            {
+                ray.origin = vec3f(origin[0][0], origin[1][0], origin[2][0]);
+                ray.direction = vec3f(direction[0][0], direction[1][0], direction[2][0]);
+            }
+            origin[0][l] = ray.origin.x;
+            origin[1][l] = ray.origin.y;
+            origin[2][l] = ray.origin.z;
+            direction[0][l] = ray.direction.x;
+            direction[1][l] = ray.direction.y;
+            direction[2][l] = ray.direction.z;
+            if(l == 0)
+            {
+                tmin = ray.tmin;
+            }
+        }
+
+        PacketData prd;
+        vint depth;
+        vmask entered = colorPacket(
+            vfloat3(vfloat::load(origin[0]), vfloat::load(origin[1]), vfloat::load(origin[2])),
+            vfloat3(vfloat::load(direction[0]), vfloat::load(direction[1]), vfloat::load(direction[2])),
+            tmin, lanes, prd, depth, stats
+        );
+
+        float accumulation[4][Lanes];
+        int depths[Lanes];
+        int pageTableAccesses[Lanes];
+        for(int c = 0; c < 4; ++c)
+        {
+            prd.accumulation[c].store(accumulation[c]);
+        }
+        depth.store(depths);
+        prd.pageTableAccesses.store(pageTableAccesses);
+        int samples[Lanes];
+        prd.samples.store(samples);
+        if(s == 0)
+        {
+            float surfaceDistances[Lanes];
+            prd.surfaceDistance.store(surfaceDistances);
+            std::copy(surfaceDistances, surfaceDistances + count, &mSurfaceDistances[firstPixel]);
+        }
+
+        stats.mRays += count;
+        for(int l = 0; l < count; ++l)
+        {
+            vec4f c(accumulation[0][l], accumulation[1][l], accumulation[2][l], accumulation[3][l]);
+            /* Rays that miss the volume skip the debug views, as in color() */
+            if(entered.lane(l))
+            {
+                c = shade(c, depths[l], (unsigned int)pageTableAccesses[l]);
+                stats.mDepth += depths[l];
+                stats.mPageTableAccesses += pageTableAccesses[l];
+                stats.mSamples += samples[l];
+            }
+            col[l] += c;
+        }
+    }
+
+    for(int l = 0; l < count; ++l)
+    {
+        storePixel(firstPixel + l, pass, col[l] / float(mSamples));
+    }
+}
+
+vmask CPURenderer::colorPacket(const vfloat3& origin, const vfloat3& direction, float tmin,
+    vmask lanes, PacketData& prd, vint& depth, RayStats& stats) const
+{
+    for(int c = 0; c < 4; ++c)
+    {
+        prd.accumulation[c] = vfloat(0.0f);
+    }
+    prd.surfaceDistance = vfloat(-1.0f);
+    prd.pageTableAccesses = vint(0);
+    prd.samples = vint(0);
+    depth = vint(0);
+
+    /* Entry and exit points of the whole volume */
+    const vfloat3 boxsize = broadcast(mVolumeSize);
+    const vfloat3 boxmin = broadcast(mVolumeMin);
+    const vfloat3 boxmax = broadcast(mVolumeMin + mVolumeSize);
+    const vfloat3 rayDirectionInverse = vfloat3(1.0f, 1.0f, 1.0f) / direction;
+    const vfloat3 vminv = (boxmin - origin) * rayDirectionInverse;
+    const vfloat3 vmaxv = (boxmax - origin) * rayDirectionInverse;
+    const vfloat3 vmin(fmin(vminv.x, vmaxv.x), fmin(vminv.y, vmaxv.y), fmin(vminv.z, vmaxv.z));
+    const vfloat3 vmax(fmax(vminv.x, vmaxv.x), fmax(vminv.y, vmaxv.y), fmax(vminv.z, vmaxv.z));
+    const vfloat volumeEntryDistance = fmax(vfloat(tmin + 1e-9f), fmax(fmax(vmin.x, vmin.y), vmin.z));
+    const vfloat volumeExitDistance = fmin(fmin(vmax.x, vmax.y), vmax.z);
+    const vmask entered = lanes & (volumeExitDistance > volumeEntryDistance);
+    if(!entered.any())
+    {
+        return entered;
+    }
+
+    const vfloat worldSpaceDepth = volumeExitDistance - volumeEntryDistance;
+
+    vfloat3 volumeEntryPoint = origin + direction * volumeEntryDistance;
+    vfloat3 volumeExitPoint = origin + direction * volumeExitDistance;
+    volumeEntryPoint = (volumeEntryPoint + boxmax) / boxsize;
+    volumeExitPoint = (volumeExitPoint + boxmax) / boxsize;
+
+    /* Same operation order as vec3f's length() and normalize() */
+    const vfloat3 volumeDirection = volumeExitPoint - volumeEntryPoint;
+    const vfloat3 dataSpaceVector = volumeDirection * broadcast(mVolumeDimensions);
+    const vfloat steps = vfloat(mSamplesPerVoxel) * sqrt(
+        dataSpaceVector.x * dataSpaceVector.x
+        + dataSpaceVector.y * dataSpaceVector.y
+        + dataSpaceVector.z * dataSpaceVector.z
+    );
+    const vfloat directionLength = sqrt(
+        volumeDirection.x * volumeDirection.x
+        + volumeDirection.y * volumeDirection.y
+        + volumeDirection.z * volumeDirection.z
+    );
+    const vfloat3 volumeSpaceStep =
+        (volumeDirection * (vfloat(1.0f) / directionLength)) / broadcast(mSamplesPerVoxel * mVolumeDimensions);
+    const vfloat volumeSpaceStepSize = sqrt(
+        volumeSpaceStep.x * volumeSpaceStep.x
+        + volumeSpaceStep.y * volumeSpaceStep.y
+        + volumeSpaceStep.z * volumeSpaceStep.z
+    );
+
+    prd.rayDirectionInverse = rayDirectionInverse;
+    prd.worldSpaceStepSize = worldSpaceDepth / steps;
+    prd.opacityCorrection = volumeSpaceStepSize * vfloat(mOpacityReference);
+    prd.volumeSpaceStep = volumeSpaceStep;
+    prd.entryDistance = vfloat(0.0f);
+    prd.exitDistance = vfloat(0.0f);
+
+    /* Lanes drop out as they miss or terminate early */
+    vfloat rayTMin(tmin);
+    vmask active = entered;
+    for(int bounce = 0; bounce < mMaxBounces && active.any(); ++bounce)
+    {
+        vmask hit = tracePacket(origin, rayTMin, active, prd, stats);
+        if(!mDontSample)
+        {
+            accumulatePacket(origin, direction, hit, prd);
+        }
+
+        vmask done = andnot(hit, active) | (prd.accumulation[3] >= vfloat(mERTThreshold));
+        active = andnot(done, active);
+        rayTMin = select(active, prd.exitDistance, rayTMin);
+        depth = select(active, depth + vint(1), depth);
+    }
+
+    return entered;
+}
+
+vmask CPURenderer::tracePacket(const vfloat3& origin, vfloat tmin, vmask lanes, PacketData& prd, RayStats& stats) const
+{
+    if(mEmptySpaceSkipping == ESSBVH)
+    {
+        return mBVH.intersect(origin, prd.rayDirectionInverse, tmin, lanes,
+            prd.entryDistance, prd.exitDistance, stats.mTests);
+    }
+    else if(mEmptySpaceSkipping == ESSGrid)
+    {
+        return mLeafGrid.intersect(origin, prd.rayDirectionInverse, tmin, lanes,
+            prd.entryDistance, prd.exitDistance, stats.mTests);
+    }
+
+    /* Every box is tested, the first of equally close boxes wins */
+    vmask hit = vmask::first(0);
+    vfloat closest(std::numeric_limits<float>::infinity());
+    for(size_t i = 0; i < mAABBMinData.size(); ++i)
+    {
+        const vec3f aabbMin(mAABBMinData[i].x, mAABBMinData[i].y, mAABBMinData[i].z);
+        const vec3f aabbMax(mAABBMaxData[i].x, mAABBMaxData[i].y, mAABBMaxData[i].z);
+        vfloat boxEntry, boxExit;
+        vmask closer = lanes & intersectBox(aabbMin, aabbMax, origin, prd.rayDirectionInverse, tmin, boxEntry, boxExit);
+        closer = closer & (boxEntry < closest);
+        closest = select(closer, boxEntry, closest);
+        prd.entryDistance = select(closer, boxEntry, prd.entryDistance);
+        prd.exitDistance = select(closer, boxExit, prd.exitDistance);
+        hit = hit | closer;
+    }
+    stats.mTests += mAABBMinData.size() * lanes.count();
+    return hit;
+}
+
+vfloat CPURenderer::voxelPacket(vint index, vmask lanes) const
+{
+    /* Narrow voxels are gathered 32 bits at a time, the pool is padded
+       so the last one can be read too */
+    const char* data = mPool->mPoolData;
+    switch(mPool->mFormat)
+    {
+    case RT_FORMAT_UNSIGNED_BYTE:
+        return toFloat(gather<1>(data, index, lanes) & vint(0xff)) / vfloat(255.0f);
+    case RT_FORMAT_UNSIGNED_SHORT:
+        return toFloat(gather<2>(data, index, lanes) & vint(0xffff)) / vfloat(65535.0f);
+#if OPTIXDVR_SIMD_LANES == 16 || defined(__F16C__)
+    case RT_FORMAT_HALF:
+        return halfToFloat(gather<2>(data, index, lanes) & vint(0xffff));
+#endif
+    default:
+        return gather((const float*)data, index, lanes);
+    }
+}
+
+vfloat CPURenderer::sampleVolumePacket(const vfloat3& address, vmask lanes) const
+{
+    /* Unnormalised coordinates address texel centres at +0.5 */
+    const vfloat x = address.x - vfloat(0.5f);
+    const vfloat y = address.y - vfloat(0.5f);
+    const vfloat z = address.z - vfloat(0.5f);
+    const vfloat fx = floor(x);
+    const vfloat fy = floor(y);
+    const vfloat fz = floor(z);
+    const vfloat ax = filterWeight(x - fx);
+    const vfloat ay = filterWeight(y - fy);
+    const vfloat az = filterWeight(z - fz);
+
+    /* Clamp to edge */
+    const vec3size_t& dims = mPool->mDataDimensions;
+    const vint ix = toInt(fx);
+    const vint iy = toInt(fy);
+    const vint iz = toInt(fz);
+    const vint x0 = clamp(ix, (int)dims.x - 1);
+    const vint x1 = clamp(ix + vint(1), (int)dims.x - 1);
+    const vint y0 = clamp(iy, (int)dims.y - 1) * vint((int)dims.x);
+    const vint y1 = clamp(iy + vint(1), (int)dims.y - 1) * vint((int)dims.x);
+    const vint z0 = clamp(iz, (int)dims.z - 1) * vint((int)(dims.x * dims.y));
+    const vint z1 = clamp(iz + vint(1), (int)dims.z - 1) * vint((int)(dims.x * dims.y));
+
+    vfloat c00 = lerp(voxelPacket(x0 + y0 + z0, lanes), voxelPacket(x1 + y0 + z0, lanes), ax);
+    vfloat c10 = lerp(voxelPacket(x0 + y1 + z0, lanes), voxelPacket(x1 + y1 + z0, lanes), ax);
+    vfloat c01 = lerp(voxelPacket(x0 + y0 + z1, lanes), voxelPacket(x1 + y0 + z1, lanes), ax);
+    vfloat c11 = lerp(voxelPacket(x0 + y1 + z1, lanes), voxelPacket(x1 + y1 + z1, lanes), ax);
+    return lerp(lerp(c00, c10, ay), lerp(c01, c11, ay), az);
+}
+
+void CPURenderer::sampleTransferFunctionPacket(vfloat value, vmask lanes, vfloat colour[4]) const
+{
+    /* Normalised coordinates over the LUT, clamped to its edges */
+    const int size = mTransferFunction->mSize;
+    const vfloat x = value * vfloat((float)size) - vfloat(0.5f);
+    const vfloat fx = floor(x);
+    const vfloat ax = filterWeight(x - fx);
+    const vint i0 = clamp(toInt(fx), size - 1);
+    const vint i1 = clamp(toInt(fx) + vint(1), size - 1);
+
+    /* The LUT is read as a flat array of RGBA floats */
+    const float* lut = (const float*)mTransferFunction->mLUT;
+    const vint base0 = i0 * vint(4);
+    const vint base1 = i1 * vint(4);
+    const vfloat weight0 = vfloat(1.0f) - ax;
+    for(int c = 0; c < 4; ++c)
+    {
+        colour[c] = gather(lut, base0 + vint(c), lanes) * weight0 + gather(lut, base1 + vint(c), lanes) * ax;
+    }
+}
+
+void CPURenderer::accumulatePacket(const vfloat3& origin, const vfloat3& direction,
+    vmask lanes, PacketData& prd) const
+{
+    if(!lanes.any())
+    {
+        return;
+    }
+
+    const vfloat entryDistance = prd.entryDistance;
+    const vfloat worldSpaceStepSize = prd.worldSpaceStepSize;
+
+    /* Round up and down to the nearest entry/exit samples */
+    const vint startSample = toInt(ceil(entryDistance / worldSpaceStepSize));
+    const vint endSample = toInt(floor(prd.exitDistance / worldSpaceStepSize));
+    const vfloat exitDistance = toFloat(endSample) * worldSpaceStepSize;
+    prd.exitDistance = select(lanes, exitDistance + worldSpaceStepSize, prd.exitDistance);
+    const vint steps = endSample - startSample;
+
+    /* Entry point in normalised volume space */
+    const vfloat3 worldSpaceEntry = direction * entryDistance + origin;
+    const vfloat3 brickEntryPoint = (worldSpaceEntry - broadcast(mVolumeMin)) / broadcast(mVolumeSize);
+
+    const vec3size_t& numBricks = mPool->mNumBricks;
+    const vfloat3 poolDataRegionSize(
+        (float)mPool->mActualDataSize.x,
+        (float)mPool->mActualDataSize.y,
+        (float)mPool->mActualDataSize.z
+    );
+    const vfloat3 poolSampleRegionSize(
+        (float)mPool->mBrickSize.x,
+        (float)mPool->mBrickSize.y,
+        (float)mPool->mBrickSize.z
+    );
+
+    /* Page table entries are gathered as two 32-bit halves, x|y and z|flags */
+    const void* pageTable = mPool->mPageTableData.data();
+    const float* scaleTable = (const float*)mPool->mPageTableScaleData.data();
+
+    /* Ray-stepping loop */
+    vfloat3 p = brickEntryPoint;
+    vfloat a[4] = { prd.accumulation[0], prd.accumulation[1], prd.accumulation[2], prd.accumulation[3] };
+    vfloat surfaceDistance = prd.surfaceDistance;
+    const vfloat3 step = prd.volumeSpaceStep;
+    const vfloat opacityCorrection = prd.opacityCorrection;
+    vfloat3 prevPageTableIndex(-1.0f, -1.0f, -1.0f);
+    vfloat3 poolOffset(0.0f, 0.0f, 0.0f);
+    vfloat3 brickBegin(0.0f, 0.0f, 0.0f);
+    vfloat brickScale(1.0f);
+    vfloat brickOffset(0.0f);
+    const vfloat3 brickSize = broadcast(mBrickSizeVolumeSpace);
+    const vfloat3 brickSizeInv = broadcast(vec3f(1.0f) / mBrickSizeVolumeSpace);
+    vint ptaccesses(0);
+    vint samples(0);
+    for(int i = 0; ; ++i)
+    {
+        const vmask active = lanes & (vint(i) < steps) & (a[3] < vfloat(mERTThreshold));
+        if(!active.any())
+        {
+            break;
+        }
+
+        const vfloat3 pageTableIndex(
+            floor(p.x * brickSizeInv.x),
+            floor(p.y * brickSizeInv.y),
+            floor(p.z * brickSizeInv.z)
+        );
+
+        /* Lanes that moved to a new brick fetch its page table entry */
+        vmask sample = active;
+        const vmask changed = active & (
+            (pageTableIndex.x != prevPageTableIndex.x)
+            | (pageTableIndex.y != prevPageTableIndex.y)
+            | (pageTableIndex.z != prevPageTableIndex.z)
+        );
+        if(changed.any())
+        {
+            const vint bx = clamp(toInt(pageTableIndex.x), (int)numBricks.x - 1);
+            const vint by = clamp(toInt(pageTableIndex.y), (int)numBricks.y - 1);
+            const vint bz = clamp(toInt(pageTableIndex.z), (int)numBricks.z - 1);
+            const vint entryIndex = bx + by * vint((int)numBricks.x) + bz * vint((int)(numBricks.x * numBricks.y));
+            const vint half = entryIndex + entryIndex;
+            const vint xy = gather<4>(pageTable, half, changed);
+            const vint zflags = gather<4>(pageTable, half + vint(1), changed);
+            const vmask paged = changed & (shiftRight(zflags, 16) != vint(PageTableEntryNotPaged));
+
+            /* Unpaged bricks are stepped over without sampling */
+            sample = andnot(andnot(paged, changed), active);
+
+            brickBegin = select(paged, pageTableIndex * brickSize, brickBegin);
+            poolOffset.x = select(paged, toFloat(xy & vint(0xffff)) * poolDataRegionSize.x + vfloat(0.5f), poolOffset.x);
+            poolOffset.y = select(paged, toFloat(shiftRight(xy, 16)) * poolDataRegionSize.y + vfloat(0.5f), poolOffset.y);
+            poolOffset.z = select(paged, toFloat(zflags & vint(0xffff)) * poolDataRegionSize.z + vfloat(0.5f), poolOffset.z);
+            brickScale = select(paged, gather(scaleTable, half, paged), brickScale);
+            brickOffset = select(paged, gather(scaleTable, half + vint(1), paged), brickOffset);
+            prevPageTableIndex = select(paged, pageTableIndex, prevPageTableIndex);
+            ptaccesses = select(paged, ptaccesses + vint(1), ptaccesses);
+        }
+
+        if(sample.any())
+        {
+            /* Convert p from normalized volume space to pool data space */
+            const vfloat3 voxelAddress = poolOffset + ((p - brickBegin) * brickSizeInv) * poolSampleRegionSize;
+
+            vfloat value = sampleVolumePacket(voxelAddress, sample);
+            value = value * brickScale + brickOffset;
+
+            vfloat colour[4];
+            sampleTransferFunctionPacket(value, sample, colour);
+            samples = select(sample, samples + vint(1), samples);
+
+            /* Opacity correction per lane, there's no vector powf to hand.
+               Transparent samples stay transparent and are skipped */
+            float alpha[Lanes];
+            float correction[Lanes];
+            colour[3].store(alpha);
+            opacityCorrection.store(correction);
+            for(int l = 0; l < Lanes; ++l)
+            {
+                if(alpha[l] != 0.0f && sample.lane(l))
+                {
+                    alpha[l] = 1.0f - powf(1.0f - alpha[l], correction[l]);
+                }
+            }
+            colour[3] = vfloat::load(alpha);
+
+            /* Accumulate colour */
+            const vfloat opacity = vfloat(1.0f) - a[3];
+            colour[3] = colour[3] * opacity;
+            a[0] = select(sample, colour[0] * colour[3] + a[0], a[0]);
+            a[1] = select(sample, colour[1] * colour[3] + a[1], a[1]);
+            a[2] = select(sample, colour[2] * colour[3] + a[2], a[2]);
+            a[3] = select(sample, colour[3] + a[3], a[3]);
+
+            const vmask surface = sample & (a[3] >= vfloat(0.5f)) & (surfaceDistance < vfloat(0.0f));
+            surfaceDistance = select(surface, entryDistance + vfloat((float)i) * worldSpaceStepSize, surfaceDistance);
+        }
+
+        p = p + step;
+    }
+    prd.pageTableAccesses = prd.pageTableAccesses + ptaccesses;
+    prd.samples = prd.samples + samples;
+    prd.surfaceDistance = surfaceDistance;
+    for(int c = 0; c < 4; ++c)
+    {
+        prd.accumulation[c] = a[c];
+    }
+}
+
+#endif
@@ -0,0 +1,253 @@
+#include "leafgrid.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+    inline float component(const vec3f& v, int axis)
+    {
+        return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+    }
+}
+
+void LeafGrid::build(const std::vector<AccelerationLeaf>& leaves, const std::vector<unsigned char>& distances,
+    const vec3f& numLeaves, const vec3f& volumeMin, const vec3f& volumeSize, const vec3f& padding)
+{
+    mNumLeaves[0] = (int)numLeaves.x;
+    mNumLeaves[1] = (int)numLeaves.y;
+    mNumLeaves[2] = (int)numLeaves.z;
+    mMin = volumeMin;
+    mMax = volumeMin + volumeSize;
+    mLeafSize = volumeSize / numLeaves;
+    mPadding = padding;
+
+    size_t active = 0;
+    mActive.resize(leaves.size());
+    for(size_t i = 0; i < leaves.size(); ++i)
+    {
+        mActive[i] = leaves[i].mActive ? 1 : 0;
+        active += mActive[i];
+    }
+
+    if(distances.size() == leaves.size())
+    {
+        mDistances = distances;
+    }
+    else
+    {
+        mDistances.clear();
+    }
+
+    mStats.set("cpugridleaves", mActive.size());
+    mStats.set("cpugridactiveleaves", active);
+}
+
+bool LeafGrid::intersect(const vec3f& origin, const vec3f& rayDirectionInverse, float tmin,
+    float& entry, float& exit, size_t& tests) const
+{
+    float gridEntry, gridExit;
+    if(mActive.empty() || !intersectBox(mMin, mMax, origin, rayDirectionInverse, tmin, gridEntry, gridExit))
+    {
+        return false;
+    }
+
+    /* Direction of travel and the distance between boundaries per axis */
+    int step[3];
+    float delta[3];
+    for(int axis = 0; axis < 3; ++axis)
+    {
+        const float inv = component(rayDirectionInverse, axis);
+        if(std::isinf(inv))
+        {
+            /* Parallel to this axis' boundaries */
+            step[axis] = 0;
+            delta[axis] = 0.0f;
+        }
+        else
+        {
+            step[axis] = inv > 0.0f ? 1 : -1;
+            delta[axis] = fabsf(component(mLeafSize, axis) * inv);
+        }
+    }
+
+    /* Distances to each axis' next leaf boundary from cell */
+    int cell[3];
+    float next[3];
+    auto boundaries = [&]()
+    {
+        for(int axis = 0; axis < 3; ++axis)
+        {
+            const float lo = component(mMin, axis);
+            const float size = component(mLeafSize, axis);
+            const int boundary = step[axis] > 0 ? cell[axis] + 1 : cell[axis];
+            next[axis] = step[axis] == 0
+                ? std::numeric_limits<float>::infinity()
+                : (lo + (float)boundary * size - component(origin, axis)) * component(rayDirectionInverse, axis);
+        }
+    };
+
+    /* Leaf holding the entry point */
+    for(int axis = 0; axis < 3; ++axis)
+    {
+        const float p = component(origin, axis) + gridEntry / component(rayDirectionInverse, axis);
+        const int c = (int)floorf((p - component(mMin, axis)) / component(mLeafSize, axis));
+        cell[axis] = std::min(std::max(c, 0), mNumLeaves[axis] - 1);
+    }
+    boundaries();
+
+    bool inRun = false;
+    float t = gridEntry;
+    float runExit = gridEntry;
+    int last[3] = { 0, 0, 0 };
+    for(;;)
+    {
+        tests++;
+        size_t index = (size_t)cell[0]
+            + (size_t)cell[1] * mNumLeaves[0]
+            + (size_t)cell[2] * mNumLeaves[0] * mNumLeaves[1];
+
+        const int distance = mDistances.empty() ? 0 : mDistances[index];
+        if(distance > 1 && !inRun)
+        {
+            /* Every leaf within distance - 1 is empty, leave their cube
+               through its far side */
+            int lo[3], hi[3];
+            for(int axis = 0; axis < 3; ++axis)
+            {
+                lo[axis] = std::max(cell[axis] - (distance - 1), 0);
+                hi[axis] = std::min(cell[axis] + (distance - 1), mNumLeaves[axis] - 1);
+            }
+            int axis = -1;
+            float leap = std::numeric_limits<float>::infinity();
+            for(int a = 0; a < 3; ++a)
+            {
+                if(step[a] == 0)
+                {
+                    continue;
+                }
+                const int boundary = step[a] > 0 ? hi[a] + 1 : lo[a];
+                const float d = (component(mMin, a) + (float)boundary * component(mLeafSize, a)
+                    - component(origin, a)) * component(rayDirectionInverse, a);
+                if(d < leap)
+                {
+                    leap = d;
+                    axis = a;
+                }
+            }
+            if(axis < 0 || leap >= gridExit)
+            {
+                break;
+            }
+
+            /* The exit point lies on the cube's side in the other axes */
+            t = std::max(leap, t);
+            for(int a = 0; a < 3; ++a)
+            {
+                if(a == axis)
+                {
+                    cell[a] = step[a] > 0 ? hi[a] + 1 : lo[a] - 1;
+                }
+                else
+                {
+                    const float p = component(origin, a) + t / component(rayDirectionInverse, a);
+                    const int c = (int)floorf((p - component(mMin, a)) / component(mLeafSize, a));
+                    cell[a] = std::min(std::max(c, lo[a]), hi[a]);
+                }
+            }
+            if(cell[axis] < 0 || cell[axis] >= mNumLeaves[axis])
+            {
+                break;
+            }
+            boundaries();
+            continue;
+        }
+
+        const int axis = next[0] < next[1]
+            ? (next[0] < next[2] ? 0 : 2)
+            : (next[1] < next[2] ? 1 : 2);
+        const float leafExit = std::min(next[axis], gridExit);
+
+        if(mActive[index])
+        {
+            if(!inRun)
+            {
+                inRun = true;
+                entry = t;
+            }
+            runExit = leafExit;
+            last[0] = cell[0];
+            last[1] = cell[1];
+            last[2] = cell[2];
+        }
+        else if(inRun)
+        {
+            break;
+        }
+
+        if(leafExit >= gridExit)
+        {
+            break;
+        }
+        t = leafExit;
+        cell[axis] += step[axis];
+        if(cell[axis] < 0 || cell[axis] >= mNumLeaves[axis])
+        {
+            break;
+        }
+        next[axis] += delta[axis];
+    }
+
+    if(!inRun)
+    {
+        return false;
+    }
+
+    /* Leave through the last leaf's ESS box, padding included, so the run
+       covers the same samples the boxes would */
+    const vec3f boxMin = mMin + mLeafSize * vec3f((float)last[0], (float)last[1], (float)last[2]);
+    const vec3f boxMax = boxMin + mLeafSize + mPadding;
+    float boxEntry, boxExit;
+    intersectBox(boxMin, boxMax, origin, rayDirectionInverse, tmin, boxEntry, boxExit);
+    exit = std::max(runExit, boxExit);
+    return exit > entry;
+}
+
+#if OPTIXDVR_SIMD_LANES
+simd::vmask LeafGrid::intersect(const simd::vfloat3& origin, const simd::vfloat3& rayDirectionInverse,
+    simd::vfloat tmin, simd::vmask lanes, simd::vfloat& entry, simd::vfloat& exit, size_t& tests) const
+{
+    using namespace simd;
+    float ox[Lanes], oy[Lanes], oz[Lanes];
+    float ix[Lanes], iy[Lanes], iz[Lanes];
+    float t[Lanes], en[Lanes], ex[Lanes];
+    origin.x.store(ox);
+    origin.y.store(oy);
+    origin.z.store(oz);
+    rayDirectionInverse.x.store(ix);
+    rayDirectionInverse.y.store(iy);
+    rayDirectionInverse.z.store(iz);
+    tmin.store(t);
+    entry.store(en);
+    exit.store(ex);
+
+    float hit[Lanes];
+    for(int i = 0; i < Lanes; ++i)
+    {
+        float laneEntry, laneExit;
+        hit[i] = 0.0f;
+        if(lanes.lane(i) && intersect(vec3f(ox[i], oy[i], oz[i]), vec3f(ix[i], iy[i], iz[i]), t[i],
+            laneEntry, laneExit, tests))
+        {
+            en[i] = laneEntry;
+            ex[i] = laneExit;
+            hit[i] = 1.0f;
+        }
+    }
+
+    entry = vfloat::load(en);
+    exit = vfloat::load(ex);
+    return lanes & (vfloat::load(hit) != vfloat(0.0f));
+}
+#endif
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+
+#include "../programs/vec.h"
+#include "../volume/brickedvolume.hpp"
+#include "../utils/stats.hpp"
+#include "bvh.hpp"
+#include "simd.hpp"
+
+/**
+ * BrickedVolume's leaf grid for the CPU renderer, walked with a 3D-DDA
+ * (Amanatides & Woo) instead of intersecting the ESS boxes. A ray steps
+ * through every leaf it crosses, skipping inactive ones, and a run of
+ * active leaves is handed back as a single segment. Cost is linear in
+ * the leaves crossed rather than logarithmic in the boxes, but there is
+ * nothing to build. Given BrickedVolume's distance field, a ray in an
+ * empty leaf leaps the cube of leaves known to be empty around it.
+ */
+class LeafGrid
+{
+public:
+    Stats mStats;
+
+    /* One flag per leaf, x fastest as in BrickedVolume::mLeaves */
+    std::vector<unsigned char> mActive;
+    /* Chebyshev distances to the nearest active leaf, empty to step
+       leaf by leaf */
+    std::vector<unsigned char> mDistances;
+    int mNumLeaves[3] = { 0, 0, 0 };
+    vec3f mMin;
+    vec3f mMax;
+    vec3f mLeafSize;
+    /* Added to a leaf's far corner, as on the ESS boxes */
+    vec3f mPadding;
+
+    void build(const std::vector<AccelerationLeaf>& leaves, const std::vector<unsigned char>& distances,
+        const vec3f& numLeaves, const vec3f& volumeMin, const vec3f& volumeSize, const vec3f& padding);
+
+    /* First run of active leaves past tmin. tests counts the leaves visited
+       and leaps taken */
+    bool intersect(const vec3f& origin, const vec3f& rayDirectionInverse, float tmin,
+        float& entry, float& exit, size_t& tests) const;
+
+#if OPTIXDVR_SIMD_LANES
+    /* Lanes walk the grid one after another, their paths diverge after a
+       few leaves. Lanes outside the returned mask keep their entry and exit */
+    simd::vmask intersect(const simd::vfloat3& origin, const simd::vfloat3& rayDirectionInverse,
+        simd::vfloat tmin, simd::vmask lanes, simd::vfloat& entry, simd::vfloat& exit, size_t& tests) const;
+#endif
+};
@@ -0,0 +1,223 @@
+#pragma once
+
+/**
+ * Just enough of a SIMD float/int/mask abstraction for the CPU renderer's
+ * ray packets: 16 lanes with AVX-512, 8 with AVX2. Without either,
+ * OPTIXDVR_SIMD_LANES is 0 and the renderer marches rays one at a time.
+ */
+#if defined(OPTIXDVR_SIMD) && defined(__AVX512F__)
+#define OPTIXDVR_SIMD_LANES 16
+#elif defined(OPTIXDVR_SIMD) && defined(__AVX2__)
+#define OPTIXDVR_SIMD_LANES 8
+#else
+#define OPTIXDVR_SIMD_LANES 0
+#endif
+
+#if OPTIXDVR_SIMD_LANES
+
+#include <immintrin.h>
+
+namespace simd
+{
+    const int Lanes = OPTIXDVR_SIMD_LANES;
+
+#if OPTIXDVR_SIMD_LANES == 16
+
+    struct vmask
+    {
+        __mmask16 m;
+        vmask() {}
+        vmask(__mmask16 m) : m(m) {}
+        static vmask first(int n) { return vmask((__mmask16)((n >= 16) ? 0xffff : ((1u << n) - 1u))); }
+        bool any() const { return m != 0; }
+        bool lane(int i) const { return (m >> i) & 1; }
+        int count() const { return __builtin_popcount(m); }
+    };
+    inline vmask operator&(vmask a, vmask b) { return vmask(a.m & b.m); }
+    inline vmask operator|(vmask a, vmask b) { return vmask(a.m | b.m); }
+    inline vmask andnot(vmask a, vmask b) { return vmask((__mmask16)(~a.m & b.m)); }
+
+    struct vfloat
+    {
+        __m512 v;
+        vfloat() {}
+        vfloat(__m512 v) : v(v) {}
+        vfloat(float f) : v(_mm512_set1_ps(f)) {}
+        static vfloat load(const float* p) { return _mm512_loadu_ps(p); }
+        void store(float* p) const { _mm512_storeu_ps(p, v); }
+    };
+
+    struct vint
+    {
+        __m512i v;
+        vint() {}
+        vint(__m512i v) : v(v) {}
+        vint(int i) : v(_mm512_set1_epi32(i)) {}
+        void store(int* p) const { _mm512_storeu_si512((void*)p, v); }
+    };
+
+    inline vfloat operator+(vfloat a, vfloat b) { return _mm512_add_ps(a.v, b.v); }
+    inline vfloat operator-(vfloat a, vfloat b) { return _mm512_sub_ps(a.v, b.v); }
+    inline vfloat operator*(vfloat a, vfloat b) { return _mm512_mul_ps(a.v, b.v); }
+    inline vfloat operator/(vfloat a, vfloat b) { return _mm512_div_ps(a.v, b.v); }
+    inline vfloat min(vfloat a, vfloat b) { return _mm512_min_ps(a.v, b.v); }
+    inline vfloat max(vfloat a, vfloat b) { return _mm512_max_ps(a.v, b.v); }
+    inline vfloat sqrt(vfloat a) { return _mm512_sqrt_ps(a.v); }
+    inline vfloat floor(vfloat a) { return _mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+    inline vfloat ceil(vfloat a) { return _mm512_roundscale_ps(a.v, _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC); }
+    inline vfloat rint(vfloat a) { return _mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    inline vmask operator<(vfloat a, vfloat b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ); }
+    inline vmask operator>(vfloat a, vfloat b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ); }
+    inline vmask operator>=(vfloat a, vfloat b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ); }
+    inline vmask operator==(vfloat a, vfloat b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_EQ_OQ); }
+    inline vmask operator!=(vfloat a, vfloat b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_NEQ_UQ); }
+    inline vfloat select(vmask m, vfloat a, vfloat b) { return _mm512_mask_blend_ps(m.m, b.v, a.v); }
+
+    inline vint operator+(vint a, vint b) { return _mm512_add_epi32(a.v, b.v); }
+    inline vint operator-(vint a, vint b) { return _mm512_sub_epi32(a.v, b.v); }
+    inline vint operator*(vint a, vint b) { return _mm512_mullo_epi32(a.v, b.v); }
+    inline vint operator&(vint a, vint b) { return _mm512_and_si512(a.v, b.v); }
+    inline vint shiftRight(vint a, int n) { return _mm512_srli_epi32(a.v, n); }
+    inline vint min(vint a, vint b) { return _mm512_min_epi32(a.v, b.v); }
+    inline vint max(vint a, vint b) { return _mm512_max_epi32(a.v, b.v); }
+    inline vmask operator<(vint a, vint b) { return _mm512_cmplt_epi32_mask(a.v, b.v); }
+    inline vmask operator!=(vint a, vint b) { return _mm512_cmpneq_epi32_mask(a.v, b.v); }
+    inline vint select(vmask m, vint a, vint b) { return _mm512_mask_blend_epi32(m.m, b.v, a.v); }
+    inline vint toInt(vfloat a) { return _mm512_cvttps_epi32(a.v); }
+    inline vfloat toFloat(vint a) { return _mm512_cvtepi32_ps(a.v); }
+    inline vfloat halfToFloat(vint a) { return _mm512_cvtph_ps(_mm512_cvtepi32_epi16(a.v)); }
+
+    /* Masked-off lanes read nothing and come back as zero */
+    inline vfloat gather(const float* base, vint index, vmask m)
+    {
+        return _mm512_mask_i32gather_ps(_mm512_setzero_ps(), m.m, index.v, base, 4);
+    }
+    template<int Scale>
+    inline vint gather(const void* base, vint index, vmask m)
+    {
+        return _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), m.m, index.v, base, Scale);
+    }
+
+#else
+
+    struct vmask
+    {
+        __m256 m;
+        vmask() {}
+        vmask(__m256 m) : m(m) {}
+        static vmask first(int n)
+        {
+            __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+            return vmask(_mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(n), lanes)));
+        }
+        bool any() const { return _mm256_movemask_ps(m) != 0; }
+        bool lane(int i) const { return (_mm256_movemask_ps(m) >> i) & 1; }
+        int count() const { return __builtin_popcount(_mm256_movemask_ps(m)); }
+    };
+    inline vmask operator&(vmask a, vmask b) { return vmask(_mm256_and_ps(a.m, b.m)); }
+    inline vmask operator|(vmask a, vmask b) { return vmask(_mm256_or_ps(a.m, b.m)); }
+    inline vmask andnot(vmask a, vmask b) { return vmask(_mm256_andnot_ps(a.m, b.m)); }
+
+    struct vfloat
+    {
+        __m256 v;
+        vfloat() {}
+        vfloat(__m256 v) : v(v) {}
+        vfloat(float f) : v(_mm256_set1_ps(f)) {}
+        static vfloat load(const float* p) { return _mm256_loadu_ps(p); }
+        void store(float* p) const { _mm256_storeu_ps(p, v); }
+    };
+
+    struct vint
+    {
+        __m256i v;
+        vint() {}
+        vint(__m256i v) : v(v) {}
+        vint(int i) : v(_mm256_set1_epi32(i)) {}
+        void store(int* p) const { _mm256_storeu_si256((__m256i*)p, v); }
+    };
+
+    inline vfloat operator+(vfloat a, vfloat b) { return _mm256_add_ps(a.v, b.v); }
+    inline vfloat operator-(vfloat a, vfloat b) { return _mm256_sub_ps(a.v, b.v); }
+    inline vfloat operator*(vfloat a, vfloat b) { return _mm256_mul_ps(a.v, b.v); }
+    inline vfloat operator/(vfloat a, vfloat b) { return _mm256_div_ps(a.v, b.v); }
+    inline vfloat min(vfloat a, vfloat b) { return _mm256_min_ps(a.v, b.v); }
+    inline vfloat max(vfloat a, vfloat b) { return _mm256_max_ps(a.v, b.v); }
+    inline vfloat sqrt(vfloat a) { return _mm256_sqrt_ps(a.v); }
+    inline vfloat floor(vfloat a) { return _mm256_round_ps(a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+    inline vfloat ceil(vfloat a) { return _mm256_round_ps(a.v, _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC); }
+    inline vfloat rint(vfloat a) { return _mm256_round_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    inline vmask operator<(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+    inline vmask operator>(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+    inline vmask operator>=(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+    inline vmask operator==(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ); }
+    inline vmask operator!=(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_NEQ_UQ); }
+    inline vfloat select(vmask m, vfloat a, vfloat b) { return _mm256_blendv_ps(b.v, a.v, m.m); }
+
+    inline vint operator+(vint a, vint b) { return _mm256_add_epi32(a.v, b.v); }
+    inline vint operator-(vint a, vint b) { return _mm256_sub_epi32(a.v, b.v); }
+    inline vint operator*(vint a, vint b) { return _mm256_mullo_epi32(a.v, b.v); }
+    inline vint operator&(vint a, vint b) { return _mm256_and_si256(a.v, b.v); }
+    inline vint shiftRight(vint a, int n) { return _mm256_srli_epi32(a.v, n); }
+    inline vint min(vint a, vint b) { return _mm256_min_epi32(a.v, b.v); }
+    inline vint max(vint a, vint b) { return _mm256_max_epi32(a.v, b.v); }
+    inline vmask operator<(vint a, vint b) { return _mm256_castsi256_ps(_mm256_cmpgt_epi32(b.v, a.v)); }
+    inline vmask operator!=(vint a, vint b)
+    {
+        __m256i equal = _mm256_cmpeq_epi32(a.v, b.v);
+        return _mm256_castsi256_ps(_mm256_xor_si256(equal, _mm256_set1_epi32(-1)));
+    }
+    inline vint select(vmask m, vint a, vint b)
+    {
+        return _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(b.v), _mm256_castsi256_ps(a.v), m.m));
+    }
+    inline vint toInt(vfloat a) { return _mm256_cvttps_epi32(a.v); }
+    inline vfloat toFloat(vint a) { return _mm256_cvtepi32_ps(a.v); }
+#ifdef __F16C__
+    inline vfloat halfToFloat(vint a)
+    {
+        /* Pack the low 16 bits of each lane, then widen as halfs */
+        __m256i packed = _mm256_packus_epi32(a.v, a.v);
+        packed = _mm256_permute4x64_epi64(packed, 0x08);
+        return _mm256_cvtph_ps(_mm256_castsi256_si128(packed));
+    }
+#endif
+
+    /* Masked-off lanes read nothing and come back as zero */
+    inline vfloat gather(const float* base, vint index, vmask m)
+    {
+        return _mm256_mask_i32gather_ps(_mm256_setzero_ps(), base, index.v, m.m, 4);
+    }
+    template<int Scale>
+    inline vint gather(const void* base, vint index, vmask m)
+    {
+        return _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*)base, index.v, _mm256_castps_si256(m.m), Scale);
+    }
+
+#endif
+
+    /* fminf/fmaxf semantics, a NaN operand gives the other one, so packets
+       agree with scalar code when a slab test computes 0 * inf */
+    inline vfloat fmin(vfloat a, vfloat b) { return select(b != b, a, min(a, b)); }
+    inline vfloat fmax(vfloat a, vfloat b) { return select(b != b, a, max(a, b)); }
+
+    /* Three lanes of vectors, one component per register */
+    struct vfloat3
+    {
+        vfloat x, y, z;
+        vfloat3() {}
+        vfloat3(vfloat x, vfloat y, vfloat z) : x(x), y(y), z(z) {}
+        vfloat3(float x, float y, float z) : x(x), y(y), z(z) {}
+    };
+    inline vfloat3 operator+(const vfloat3& a, const vfloat3& b) { return vfloat3(a.x + b.x, a.y + b.y, a.z + b.z); }
+    inline vfloat3 operator-(const vfloat3& a, const vfloat3& b) { return vfloat3(a.x - b.x, a.y - b.y, a.z - b.z); }
+    inline vfloat3 operator*(const vfloat3& a, const vfloat3& b) { return vfloat3(a.x * b.x, a.y * b.y, a.z * b.z); }
+    inline vfloat3 operator/(const vfloat3& a, const vfloat3& b) { return vfloat3(a.x / b.x, a.y / b.y, a.z / b.z); }
+    inline vfloat3 operator*(const vfloat3& a, vfloat b) { return vfloat3(a.x * b, a.y * b, a.z * b); }
+    inline vfloat3 select(vmask m, const vfloat3& a, const vfloat3& b)
+    {
+        return vfloat3(select(m, a.x, b.x), select(m, a.y, b.y), select(m, a.z, b.z));
+    }
+}
+
+#endif
@@ -0,0 +1,217 @@
+#include "tilescheduler.hpp"
+#include "../utils/utils.h"
+
+#include <algorithm>
+
+TileScheduler::~TileScheduler()
+{
+    resize(0);
+}
+
+void TileScheduler::resize(unsigned int threads)
+{
+    /* The caller is thread 0, so only the others are spawned */
+    size_t workers = threads > 1 ? threads - 1 : 0;
+    if(workers == mWorkers.size() && mQueues.size() == std::max(threads, 1u))
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+    mWork.notify_all();
+    for(size_t i = 0; i < mWorkers.size(); ++i)
+    {
+        mWorkers[i].join();
+    }
+    mWorkers.clear();
+    mStop = false;
+
+    mQueues.clear();
+    for(unsigned int i = 0; i < std::max(threads, 1u); ++i)
+    {
+        mQueues.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+    for(size_t i = 0; i < workers; ++i)
+    {
+        mWorkers.push_back(std::thread(&TileScheduler::worker, this, (unsigned int)i + 1, mGeneration));
+    }
+}
+
+void TileScheduler::worker(unsigned int id, size_t generation)
+{
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWork.wait(lock, [&]{ return mStop || mGeneration != generation; });
+            if(mStop)
+            {
+                return;
+            }
+            generation = mGeneration;
+        }
+
+        process(id);
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mRunning--;
+        }
+        mDone.notify_all();
+    }
+}
+
+bool TileScheduler::next(unsigned int id, size_t& tile)
+{
+    /* Own tiles are taken in order, keeping neighbouring tiles on one thread */
+    {
+        Queue& own = *mQueues[id];
+        std::lock_guard<std::mutex> lock(own.mMutex);
+        if(own.mTiles.size())
+        {
+            tile = own.mTiles.front();
+            own.mTiles.pop_front();
+            return true;
+        }
+    }
+
+    /* Steal from the far end of the next thread that still has tiles */
+    size_t queues = mQueues.size();
+    for(size_t i = 1; i < queues; ++i)
+    {
+        Queue& victim = *mQueues[(id + i) % queues];
+        std::lock_guard<std::mutex> lock(victim.mMutex);
+        if(victim.mTiles.size())
+        {
+            tile = victim.mTiles.back();
+            victim.mTiles.pop_back();
+            mSteals++;
+            return true;
+        }
+    }
+
+    /* Tiles are never added mid-run, so empty queues mean we're done */
+    return false;
+}
+
+void TileScheduler::process(unsigned int id)
+{
+    utils::Timer timer;
+    float busy = 0.0f;
+    size_t tile;
+    while(next(id, tile))
+    {
+        timer.start();
+        (*mRender)(mTiles[tile]);
+        float time = timer.stop();
+        mTileTimes[tile] = time;
+        mTileThreads[tile] = (int)id;
+        busy += time;
+    }
+    mThreadBusy[id] = busy;
+}
+
+void TileScheduler::run(int width, int height, const std::function<void(const Tile&)>& render)
+{
+    utils::Timer timer;
+    timer.start();
+
+    unsigned int threads = mThreads ? mThreads : std::thread::hardware_concurrency();
+    if(threads == 0)
+    {
+        threads = 1;
+    }
+    resize(threads);
+
+    /* Tiles in scanline order */
+    int tileSize = std::max(mTileSize, 1);
+    mTiles.clear();
+    for(int y = 0; y < height; y += tileSize)
+    {
+        for(int x = 0; x < width; x += tileSize)
+        {
+            Tile tile;
+            tile.x = x;
+            tile.y = y;
+            tile.width = std::min(tileSize, width - x);
+            tile.height = std::min(tileSize, height - y);
+            tile.index = mTiles.size();
+            mTiles.push_back(tile);
+        }
+    }
+    mTileTimes.assign(mTiles.size(), 0.0f);
+    mTileThreads.assign(mTiles.size(), -1);
+    mThreadBusy.assign(mQueues.size(), 0.0f);
+    mSteals = 0;
+
+    /* Each thread starts on a contiguous band of the image */
+    size_t queues = mQueues.size();
+    for(size_t q = 0; q < queues; ++q)
+    {
+        size_t begin = mTiles.size() * q / queues;
+        size_t end = mTiles.size() * (q + 1) / queues;
+        mQueues[q]->mTiles.clear();
+        for(size_t t = begin; t < end; ++t)
+        {
+            mQueues[q]->mTiles.push_back(t);
+        }
+    }
+
+    mRender = &render;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mRunning = mWorkers.size();
+        mGeneration++;
+    }
+    mWork.notify_all();
+
+    process(0);
+
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mDone.wait(lock, [&]{ return mRunning == 0; });
+    }
+    mRender = nullptr;
+
+    timer.stop();
+    mStats.set("cpuscheduletime", timer.getTime());
+    report();
+}
+
+void TileScheduler::report()
+{
+    float minTime = 0.0f;
+    float maxTime = 0.0f;
+    double sumTime = 0.0;
+    if(mTileTimes.size())
+    {
+        minTime = *std::min_element(mTileTimes.begin(), mTileTimes.end());
+        maxTime = *std::max_element(mTileTimes.begin(), mTileTimes.end());
+        for(size_t i = 0; i < mTileTimes.size(); ++i)
+        {
+            sumTime += mTileTimes[i];
+        }
+    }
+
+    /* Busiest thread over the average, 1 is perfectly balanced */
+    double maxBusy = 0.0;
+    double sumBusy = 0.0;
+    for(size_t i = 0; i < mThreadBusy.size(); ++i)
+    {
+        maxBusy = std::max(maxBusy, (double)mThreadBusy[i]);
+        sumBusy += mThreadBusy[i];
+    }
+    double meanBusy = mThreadBusy.size() ? sumBusy / (double)mThreadBusy.size() : 0.0;
+
+    mStats.set("cputhreads", mQueues.size());
+    mStats.set("cputiles", mTiles.size());
+    mStats.set("cputilesize", mTileSize);
+    mStats.set("cputiletimemin", minTime);
+    mStats.set("cputiletimemax", maxTime);
+    mStats.set("cputiletimemean", mTileTimes.size() ? sumTime / (double)mTileTimes.size() : 0.0);
+    mStats.set("cputilesteals", mSteals);
+    mStats.set("cputhreadimbalance", meanBusy > 0.0 ? maxBusy / meanBusy : 1.0);
+}
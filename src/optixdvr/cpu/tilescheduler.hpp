@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../utils/stats.hpp"
+
+/* A rectangle of the image rendered as one unit of work */
+struct Tile
+{
+    int x;
+    int y;
+    int width;
+    int height;
+    size_t index;
+};
+
+/**
+ * Splits an image into tiles and renders them on a persistent pool of
+ * threads. Every thread starts with a contiguous run of tiles and, once
+ * it runs dry, steals from the far end of the other threads' runs, so
+ * threads that drew mostly empty or early-terminating tiles pick up the
+ * work of those that didn't. The calling thread works too.
+ */
+class TileScheduler
+{
+public:
+    Stats mStats;
+    int mTileSize = 32;
+    /* Threads including the caller, 0 for one per core */
+    unsigned int mThreads = 0;
+
+    /* Milliseconds each tile of the last run took and the thread that rendered it */
+    std::vector<float> mTileTimes;
+    std::vector<int> mTileThreads;
+
+    ~TileScheduler();
+
+    void run(int width, int height, const std::function<void(const Tile&)>& render);
+
+private:
+    struct Queue
+    {
+        std::mutex mMutex;
+        std::deque<size_t> mTiles;
+    };
+
+    std::vector<Tile> mTiles;
+    std::vector<std::unique_ptr<Queue>> mQueues;
+    std::vector<float> mThreadBusy;
+    std::atomic<size_t> mSteals;
+    const std::function<void(const Tile&)>* mRender = nullptr;
+
+    std::vector<std::thread> mWorkers;
+    std::mutex mMutex;
+    std::condition_variable mWork;
+    std::condition_variable mDone;
+    size_t mGeneration = 0;
+    size_t mRunning = 0;
+    bool mStop = false;
+
+    void resize(unsigned int threads);
+    /* Waits for runs after the given generation */
+    void worker(unsigned int id, size_t generation);
+    void process(unsigned int id);
+    bool next(unsigned int id, size_t& tile);
+    void report();
+};
@@ -17,7 +17,7 @@
 #include "optixdvr.hpp"
 #include "optixdvr_instance.hpp"
 
-#include "utils/savePPM.h"
+#include "utils/imagefiles.hpp"
 
 #include "volume/mhdreader.hpp"
 #define _USE_MATH_DEFINES 1
@@ -34,8 +34,9 @@ extern "C" const char embedded_volume_program[];
 extern "C" const char embedded_volume_shading_program[];
 extern "C" const char embedded_raygen_program[];
 extern "C" const char embedded_miss_program[];
+extern "C" const char embedded_reprojection_program[];
 
-OptixDVR::OptixDVR()
+OptixDVR::OptixDVR(Backend backend)
 {
 	OptixInstance::set(this);
 
@@ -45,6 +46,17 @@ OptixDVR::OptixDVR()
 	m_renderdata = nullptr;
 	m_framebuffer = nullptr;
 	mPreviousBrickSize = vec3size_t(0);
+	m_backend = backend;
+
+	// The CPU backend never creates a context, so it runs without a GPU
+	if(m_backend == BackendCPU)
+	{
+		m_subdivision = new BrickedVolume();
+		mPool = new HostVolumeBrickPool();
+		m_cpurenderer = new CPURenderer();
+		resizeFrameBuffer(512, 512);
+		return;
+	}
 
 	// Create OptiX context with RTX on or off
 	int rtxEnabled = 1;
@@ -109,7 +121,33 @@ OptixDVR::OptixDVR()
 	m_subdivision = new BrickedVolume();
 	mPool = new OptixVolumeBrickPool();
 
-
+	m_context["accumulate"]->setInt(0);
+	m_context["frameIndex"]->setInt(0);
+	m_context["adaptive"]->setInt(0);
+	m_context["adaptiveTileSize"]->setInt(m_sampler.mTileSize);
+	m_tilepassesbuffer = m_context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_INT, 1, 1);
+	m_context["tilePasses"]->set(m_tilepassesbuffer);
+	m_context["reproject"]->setInt(0);
+	m_context["reprojectStore"]->setInt(0);
+	m_context["reprojectionMaxDepthStep"]->setFloat(m_reprojection.mMaxDepthStep);
+	m_context["reprojectionMaxAge"]->setInt(m_reprojection.mMaxAge);
+	m_context["reprojectionFrame"]->setUint(0);
+	m_context["adaptiveStep"]->setInt(0);
+	m_context["leafSizeVolumeSpace"]->setFloat(1.0f, 1.0f, 1.0f);
+	m_opacityboundsbuffer = m_context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_FLOAT, 1, 1, 1);
+	m_context["opacityBounds"]->set(m_opacityboundsbuffer);
+
+	m_gradientbuffer = m_context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_UNSIGNED_BYTE4, 1, 1, 1);
+	m_gradienttexture = m_context->createTextureSampler();
+	m_gradienttexture->setWrapMode(0, RT_WRAP_CLAMP_TO_EDGE);
+	m_gradienttexture->setWrapMode(1, RT_WRAP_CLAMP_TO_EDGE);
+	m_gradienttexture->setWrapMode(2, RT_WRAP_CLAMP_TO_EDGE);
+	m_gradienttexture->setFilteringModes(RT_FILTER_LINEAR, RT_FILTER_LINEAR, RT_FILTER_LINEAR);
+	m_gradienttexture->setIndexingMode(RT_TEXTURE_INDEX_ARRAY_INDEX);
+	m_gradienttexture->setReadMode(RT_TEXTURE_READ_NORMALIZED_FLOAT);
+	m_gradienttexture->setBuffer(0, 0, m_gradientbuffer);
+	m_context["gradientTexture"]->set(m_gradienttexture);
+	m_context["precomputedGradients"]->setInt(0);
 
 	resizeFrameBuffer(512, 512);
 };
@@ -132,9 +170,6 @@ void OptixDVR::shadedVolumeMaterial(
 ){
 	gi->setMaterial(0, m_volumeshadingdvrmaterial);
 	gi["lightPosition"]->setFloat(lpos.x, lpos.y, lpos.z);
-
-	const vec3f gradientStep = 1.0f / m_volume->dataDimensions;
-	gi["gradientStep"]->setFloat(gradientStep.x, gradientStep.y, gradientStep.z);
 }
 
 optix::GeometryInstance OptixDVR::createAABB(
@@ -164,24 +199,191 @@ optix::GeometryInstance OptixDVR::createAABB(
 
 void OptixDVR::loadvolume(const char* volumepath)
 {
+	/* The time series owns its frames, including the one shown */
+	if(m_timeseries)
+	{
+		delete m_timeseries;
+		m_timeseries = nullptr;
+		m_volume = nullptr;
+	}
+	m_frame = 0;
+
 	m_volumefilepath = std::string(volumepath);
 	VolumeFile volumefile = MHDHeaderReader::Load(m_volumefilepath.c_str());
+	volumefile.reader = m_reader;
 	utils::Timer timer;
-	timer.start();
-	m_volume = volumefile.loadFrame(0);
-	timer.stop();
-	mStats.set("volumeloadtime", timer.getTime());
 
+	/* Bricks of the previous volume don't refer back to its source */
+	m_subdivision->mSource = nullptr;
+	mPool->mSource = nullptr;
+	delete m_bricksource;
+	m_bricksource = nullptr;
+
+	if(m_outofcore && volumefile.numFrames() == 1 && loadvolumeoutofcore(volumefile))
+	{
+		delete m_brickcache;
+		m_brickcache = nullptr;
+		setup();
+		return;
+	}
+
+	/* Time series swap bricks every frame, so only single volumes are cached */
+	BrickCache* brickcache = nullptr;
+	if(!m_brickcachepath.empty() && volumefile.numFrames() == 1)
+	{
+		brickcache = new BrickCache();
+		m_volume = brickcache->load(m_brickcachepath, volumefile, m_subdivision, mPool);
+		mStats.set("brickcachehit", m_volume ? 1 : 0);
+		if(m_volume)
+		{
+			mStats.set("volumeloadtime", brickcache->mStats.get("brickcacheloadtime"));
+			m_subdivision->mStats.set("subdivisiontime", 0.0f);
+		}
+	}
+
+	if(m_volume == nullptr)
+	{
+		timer.start();
+		m_volume = volumefile.loadFrame(0);
+		timer.stop();
+		mStats.set("volumeloadtime", timer.getTime());
+		mStats.set("volumereadtime", volumefile.reader.mLastReadTime);
+		mStats.set("volumereadbandwidth", volumefile.reader.mLastBandwidth);
+		if(m_volume == nullptr)
+		{
+			std::cerr << "Couldn't load volume " << m_volumefilepath << std::endl;
+			delete brickcache;
+			return;
+		}
+
+
+		// Do an initial subdivision on the volume
+		timer.start();
+		m_subdivision->set_volume(m_volume);
+		timer.stop();
+		m_subdivision->mStats.set("subdivisiontime", timer.getTime());
+
+		mPool->volume(m_volume);
+
+		if(brickcache && brickcache->write(m_brickcachepath, volumefile, m_volume, m_subdivision, mPool))
+		{
+			mStats.set("brickcachewritetime", brickcache->mStats.get("brickcachewritetime"));
+		}
+	}
+
+	/* The pool has let go of the bricks mapped from the previous cache */
+	delete m_brickcache;
+	m_brickcache = brickcache;
+
+	if(volumefile.numFrames() > 1)
+	{
+		m_timeseries = new VolumeTimeSeries(
+			volumefile,
+			m_subdivision,
+			mPool,
+			m_prefetchframes
+		);
+		mStats.set("numframes", volumefile.numFrames());
+	}
+
+	setup();
+}
 
-	// Do an initial subdivision on the volume
+bool OptixDVR::loadvolumeoutofcore(VolumeFile& volumefile)
+{
+	utils::Timer timer;
 	timer.start();
+
+	/* Prefer a brick cache, it has the ranges and bricks already */
+	RawBrickSource* source = nullptr;
+	bool cached = false;
+	if(!m_brickcachepath.empty())
+	{
+		source = new CachedBrickSource(volumefile, m_brickcachepath);
+		cached = source->open();
+		if(!cached)
+		{
+			delete source;
+			source = nullptr;
+		}
+	}
+	if(source == nullptr)
+	{
+		source = new RawBrickSource(volumefile);
+		if(!source->open())
+		{
+			std::cerr << "Couldn't load " << m_volumefilepath << " out-of-core, loading it whole" << std::endl;
+			delete source;
+			return false;
+		}
+	}
+
+	m_bricksource = source;
+	m_volume = source->volume();
+	m_subdivision->mSource = source;
+	mPool->mSource = source;
+	mPool->mHostCache.mBudget = m_hostcachemb * 1024UL * 1024UL;
+
+	utils::Timer subdivisiontimer;
+	subdivisiontimer.start();
 	m_subdivision->set_volume(m_volume);
-	timer.stop();
-	m_subdivision->mStats.set("subdivisiontime", timer.getTime());
+	subdivisiontimer.stop();
+	m_subdivision->mStats.set("subdivisiontime", subdivisiontimer.getTime());
 
 	mPool->volume(m_volume);
 
-	setup();
+	timer.stop();
+	mStats.set("volumeloadtime", timer.getTime());
+	mStats.set("outofcore", 1);
+	mStats.set("brickcachehit", cached ? 1 : 0);
+
+	if(!cached && !m_brickcachepath.empty())
+	{
+		BrickCache brickcache;
+		if(brickcache.write(m_brickcachepath, volumefile, m_volume, m_subdivision, mPool))
+		{
+			mStats.set("brickcachewritetime", brickcache.mStats.get("brickcachewritetime"));
+		}
+	}
+	return true;
+}
+
+int OptixDVR::numFrames() const
+{
+	if(m_timeseries)
+	{
+		return m_timeseries->numFrames();
+	}
+	return m_volume ? 1 : 0;
+}
+
+bool OptixDVR::setFrame(int frame)
+{
+	if(!m_timeseries)
+	{
+		return frame == 0;
+	}
+
+	Volume* volume = m_timeseries->show(frame);
+	if(volume == nullptr)
+	{
+		return false;
+	}
+
+	m_volume = volume;
+	m_frame = m_timeseries->currentFrame();
+	mStats.set("frame", m_frame);
+	mStats.set("framewaittime", m_timeseries->mStats.get("framewaittime"));
+	mStats.set("frameswaptime", m_timeseries->mStats.get("frameswaptime"));
+
+	/* New leaf ranges and bricks, so re-test and page them in */
+	updateScene();
+	return true;
+}
+
+bool OptixDVR::nextFrame()
+{
+	return setFrame(m_frame + 1);
 }
 
 void OptixDVR::loadtransferfunction(const char* tfpath)
@@ -189,16 +391,27 @@ void OptixDVR::loadtransferfunction(const char* tfpath)
 	m_transferfuncpath = std::string(tfpath);
 	m_transferfunction = new OptixTransferFunction();
 	TFITransferFunctionLoader::load(m_transferfuncpath, m_transferfunction);
-	m_transferfunction->toTextureSampler(m_context);
+	if(m_backend == BackendCPU)
+	{
+		m_transferfunction->updateLUT();
+		m_cpurenderer->mTransferFunction = m_transferfunction;
+	}
+	else
+	{
+		m_transferfunction->toTextureSampler(m_context);
+	}
 	setup();
 }
 
 void OptixDVR::createScene()
 {
 	// Load the transfer function
-	m_context["transferFunction"]->set(
-		m_transferfunction->toTextureSampler(m_context)
-	);
+	if(m_backend == BackendOptix)
+	{
+		m_context["transferFunction"]->set(
+			m_transferfunction->toTextureSampler(m_context)
+		);
+	}
 
 	// Test the subdivision with the TF and upload bricks
 	updateScene();
@@ -220,11 +433,34 @@ void OptixDVR::updateScene()
 		return;
 	}
 
+	/* Bricks, boxes or the TF change under the accumulated frames */
+	resetAccumulation();
+	m_reprojection.invalidate();
+
 	/* Test the subdivision bricks against the transfer funcion */
 	timer.start();
 	size_t changes = m_subdivision->testbricks(*m_transferfunction);
 	timer.stop();
 
+	/* Bound the opacity of the leaves for stretching steps */
+	m_opacitybounds.update(*m_subdivision, *m_transferfunction);
+	if(m_backend != BackendCPU && !m_opacitybounds.mBounds.empty())
+	{
+		const OpacityBounds& bounds = m_opacitybounds;
+		m_opacityboundsbuffer->setSize(bounds.mNumLeaves[0], bounds.mNumLeaves[1], bounds.mNumLeaves[2]);
+		float* boundsMap = (float*)m_opacityboundsbuffer->map();
+		memcpy(boundsMap, &bounds.mBounds[0], bounds.mBounds.size() * sizeof(float));
+		m_opacityboundsbuffer->unmap();
+		m_context["leafSizeVolumeSpace"]->setFloat(bounds.mLeafSize.x, bounds.mLeafSize.y, bounds.mLeafSize.z);
+	}
+	{
+		std::vector<std::string> keys = m_opacitybounds.mStats.list();
+		for(size_t i = 0; i < keys.size(); ++i)
+		{
+			mStats.set(keys[i], m_opacitybounds.mStats.get(keys[i]));
+		}
+	}
+
 	timer.start();
 	size_t poolChanges = mPool->testBricks(*m_transferfunction);
 	timer.stop();
@@ -232,7 +468,12 @@ void OptixDVR::updateScene()
 	/* Upload bricks if any unpaged bricks need to be uploaded */
 	{
 		timer.start();
-		if(mPool->upload() > 0)
+		if(m_backend == BackendCPU)
+		{
+			mPool->upload();
+			timer.stop();
+		}
+		else if(mPool->upload() > 0)
 		{
 			/* Dummy code to flush the uploads */
 			m_volumegeometryinstance["aabbMinBuffer"]->set(m_aabbMinBuffer);
@@ -299,6 +540,23 @@ void OptixDVR::updateScene()
 		}
 	}
 
+	/* The CPU renderer traces the boxes itself */
+	if(m_backend == BackendCPU)
+	{
+		m_cpurenderer->mAABBMinData = mAABBMinData;
+		m_cpurenderer->mAABBMaxData = mAABBMaxData;
+		m_cpurenderer->mVolumeMin = center - volumeRadius;
+		m_cpurenderer->mVolumeSize = m_volume->volumeSize;
+		m_cpurenderer->mLeafGrid.build(m_subdivision->mLeaves, m_subdivision->mDistances, subdivisions,
+			center - volumeRadius, m_volume->volumeSize, voxelsize);
+		m_cpurenderer->updateBoxes();
+		mStats.set("optixprimitivescount", mAABBMinData.size());
+		mStats.set("lastbvhbuildtime", m_cpurenderer->mBVH.mStats.get("cpubvhbuildtime"));
+		m_lastbvhbuildtime = m_cpurenderer->mBVH.mStats.get("cpubvhbuildtime");
+		updatePoolVariables();
+		return;
+	}
+
 	m_aabbMinBuffer->destroy();
 	m_aabbMaxBuffer->destroy();
 
@@ -319,10 +577,48 @@ void OptixDVR::updateScene()
 	m_volumegeometry->setPrimitiveCount(mAABBMinData.size());
 	mStats.set("optixprimitivescount", mAABBMinData.size());
 
+	updatePoolVariables();
+
+	m_context["volumeMin"]->setFloat(
+		center.x - volumeRadius.x,
+		center.y - volumeRadius.y,
+		center.z - volumeRadius.z
+	);
+
+	m_context["volumeSize"]->setFloat(
+		m_volume->volumeSize.x,
+		m_volume->volumeSize.y,
+		m_volume->volumeSize.z
+	);
+
+	m_context->validate();
+	if(changes > 0)
+	{
+		m_bvh->markDirty();
+		cudaDeviceSynchronize();
+		timer.start();
+		renderFrame(0, 0);
+		cudaDeviceSynchronize();
+		timer.stop();
+		mStats.set("lastbvhbuildtime", timer.getTime());
+		m_lastbvhbuildtime = timer.getTime();
+	}
+}
+
+void OptixDVR::updatePoolVariables()
+{
+	if(m_backend == BackendCPU)
+	{
+		m_cpurenderer->updatePool((HostVolumeBrickPool*)mPool);
+		return;
+	}
+
+	/* Dimensions of the pyramid level currently held by the pool */
+	vec3f levelDimensions = mPool->levelDimensions();
 	m_context["volumeDimensions"]->setFloat(
-		m_volume->dataDimensions.x,
-		m_volume->dataDimensions.y,
-		m_volume->dataDimensions.z
+		levelDimensions.x,
+		levelDimensions.y,
+		levelDimensions.z
 	);
 
 	VolumeBrick& exampleBrick = mPool->brick(0, 0, 0);
@@ -337,7 +633,7 @@ void OptixDVR::updateScene()
 		exampleBrick.mDataDimensions.y,
 		exampleBrick.mDataDimensions.z
 	);
-	vec3f brickSizeVolumeSpace = brickDimensions / m_volume->dataDimensions;
+	vec3f brickSizeVolumeSpace = brickDimensions / levelDimensions;
 	m_context["brickSizeVolumeSpace"]->setFloat(
 		brickSizeVolumeSpace.x,
 		brickSizeVolumeSpace.y,
@@ -349,36 +645,130 @@ void OptixDVR::updateScene()
 		mPool->mDataDimensions.y,
 		mPool->mDataDimensions.z
 	);
+}
 
-	m_context["volumeMin"]->setFloat(
-		center.x - volumeRadius.x,
-		center.y - volumeRadius.y,
-		center.z - volumeRadius.z
-	);
+void OptixDVR::updateLOD()
+{
+	if(!m_volume || !m_transferfunction)
+	{
+		return;
+	}
 
-	m_context["volumeSize"]->setFloat(
-		m_volume->volumeSize.x,
-		m_volume->volumeSize.y,
-		m_volume->volumeSize.z
-	);
+	size_t level = 0;
+	if(m_uselod && mPool->mLevels.size() > 1)
+	{
+		vec3f volumeRadius = m_volume->volumeSize * 0.5f;
+		level = m_lodselector.select(
+			m_camera,
+			m_renderheight,
+			-volumeRadius,
+			volumeRadius,
+			m_volume->dataDimensions,
+			mPool->mLevels.size()
+		);
+	}
 
-	m_context->validate();
-	if(changes > 0)
+	if(level == mPool->mCurrentLevel)
 	{
-		m_bvh->markDirty();
-		cudaDeviceSynchronize();
-		timer.start();
-		renderFrame(0, 0);
-		cudaDeviceSynchronize();
-		timer.stop();
-		mStats.set("lastbvhbuildtime", timer.getTime());
-		m_lastbvhbuildtime = timer.getTime();
+		return;
+	}
+
+	/* Page in the new level's active bricks before rendering with it */
+	resetAccumulation();
+	m_reprojection.invalidate();
+	mPool->select_level(level);
+	mPool->testBricks(*m_transferfunction);
+	mPool->upload();
+	updatePoolVariables();
+}
+
+bool OptixDVR::updateGradients()
+{
+	if(!m_useshading || m_shading.mGradients != Shading::GradientsPrecomputed)
+	{
+		/* Don't hold on to them, nor to slots the pool may have reused */
+		if(m_gradients.mData.size() && m_backend != BackendCPU)
+		{
+			m_gradientbuffer->setSize(1, 1, 1);
+		}
+		m_gradients.clear();
+		mStats.set("gradientmemory", 0);
+		return false;
+	}
+
+	if(m_gradients.update(*mPool) && m_backend != BackendCPU)
+	{
+		const vec3size_t& dims = m_gradients.mDimensions;
+		m_gradientbuffer->setSize(dims.x, dims.y, dims.z);
+		unsigned char* gradientMap = (unsigned char*)m_gradientbuffer->map();
+		memcpy(gradientMap, &m_gradients.mData[0], m_gradients.mData.size());
+		m_gradientbuffer->unmap();
+	}
+
+	std::vector<std::string> keys = m_gradients.mStats.list();
+	for(size_t i = 0; i < keys.size(); ++i)
+	{
+		mStats.set(keys[i], m_gradients.mStats.get(keys[i]));
 	}
+	return m_gradients.valid();
 }
 
 void OptixDVR::renderFrame(int Nx, int Ny)
 {
-	m_context->launch(0, Nx, Ny);
+	m_context->launch(EntryRender, Nx, Ny);
+}
+
+void OptixDVR::renderAdaptive()
+{
+	utils::Timer timer;
+	timer.start();
+	m_sampler.begin(m_renderwidth, m_renderheight);
+
+	if(m_backend == BackendCPU)
+	{
+		m_cpurenderer->mSampler = &m_sampler;
+		do
+		{
+			m_cpurenderer->render(m_camera);
+		}
+		while(m_sampler.next(&m_cpurenderer->mAccumulation[0], &m_cpurenderer->mMoments[0], timer.stop()));
+		m_cpurenderer->mSampler = nullptr;
+	}
+	else
+	{
+		RTsize tilesx = 0, tilesy = 0;
+		m_tilepassesbuffer->getSize(tilesx, tilesy);
+		if(tilesx != (RTsize)m_sampler.mTilesX || tilesy != (RTsize)m_sampler.mTilesY)
+		{
+			m_tilepassesbuffer->setSize(m_sampler.mTilesX, m_sampler.mTilesY);
+		}
+		m_context["adaptive"]->setInt(1);
+		m_context["adaptiveTileSize"]->setInt(m_sampler.mTileSize);
+
+		bool more = true;
+		while(more)
+		{
+			const std::vector<int>& passes = m_sampler.launchPasses();
+			int* tiles = (int*)m_tilepassesbuffer->map();
+			memcpy(tiles, &passes[0], passes.size() * sizeof(int));
+			m_tilepassesbuffer->unmap();
+
+			renderFrame(m_renderwidth, m_renderheight);
+
+			const vec4f* sums = (const vec4f*)m_accumulationbuffer->map();
+			const float* moments = (const float*)m_momentbuffer->map();
+			more = m_sampler.next(sums, moments, timer.stop());
+			m_momentbuffer->unmap();
+			m_accumulationbuffer->unmap();
+		}
+		m_context["adaptive"]->setInt(0);
+	}
+
+	std::vector<std::string> keys = m_sampler.mStats.list();
+	for(size_t i = 0; i < keys.size(); ++i)
+	{
+		mStats.set(keys[i], m_sampler.mStats.get(keys[i]));
+	}
 }
 
 optix::Buffer OptixDVR::createFrameBuffer(int Nx, int Ny)
@@ -394,8 +784,16 @@ void OptixDVR::setRayGenProgram()
 	optix::Program program = m_context->createProgramFromPTXString(
 		embedded_raygen_program, "renderPixel"
 	);
-	m_context->setEntryPointCount(1);
-	m_context->setRayGenerationProgram(0, program);
+	m_context->setEntryPointCount(EntryPointCount);
+	m_context->setRayGenerationProgram(EntryRender, program);
+
+	/* Temporal reprojection on the device, see render() */
+	m_context->setRayGenerationProgram(EntryReprojectionSplat, m_context->createProgramFromPTXString(
+		embedded_reprojection_program, "reprojection_splat"
+	));
+	m_context->setRayGenerationProgram(EntryReprojectionStore, m_context->createProgramFromPTXString(
+		embedded_reprojection_program, "reprojection_store"
+	));
 }
 
 void OptixDVR::setMissProgram()
@@ -425,7 +823,10 @@ int OptixDVR::setup()
 	const size_t Nx = m_renderwidth, Ny = m_renderheight;
 
 	m_camera.mAspect = float(Nx) / float(Ny);
-	m_camera.set(m_context);
+	if(m_backend == BackendOptix)
+	{
+		m_camera.set(m_context);
+	}
 
 	createScene();
 
@@ -438,59 +839,423 @@ int OptixDVR::render()
 		return -1;
 
 	m_camera.mAspect = float(m_renderwidth) / float(m_renderheight);
-	m_camera.set(m_context);
 
-	m_context["ertThreshold"]->setFloat(0.99f);
-	m_context["highlightERT"]->setInt(m_highlightert ? 1 : 0);
-	m_context["showDepthComplexity"]->setInt(m_showdepthcomplexity ? 1 : 0);
-	m_context["showPageTableAccesses"]->setInt(m_showPageTableAccesses ? 1 : 0);
-	m_context["dontSample"]->setInt(m_dontsample ? 1 : 0);
+	updateLOD();
 
 	const int numSamples = m_samples;
-	m_context["numSamples"]->setInt(numSamples);
-
 	vec3f subdivisions = m_subdivision->mNumLeaves;
 	const int maxBounces = subdivisions.x + subdivisions.y + subdivisions.z;
-	m_context["maxBounces"]->setInt(maxBounces);
+
+	if(viewChanged())
+	{
+		resetAccumulation();
+	}
+	const bool accumulate = m_accumulate && !m_adaptivesampling;
+	const int frameIndex = accumulate ? m_accumulatedframes : 0;
+
+	/* Reuse what the camera can still see of the last frame */
+	const bool reproject = m_reproject && !accumulate && !m_adaptivesampling;
+	bool warp = false;
+	if(reproject && m_backend == BackendCPU)
+	{
+		warp = m_reprojection.reproject(m_camera, m_renderwidth, m_renderheight);
+	}
+	else if(reproject)
+	{
+		warp = m_reprojection.warpable(m_camera, m_renderwidth, m_renderheight);
+	}
+	else
+	{
+		m_reprojection.invalidate();
+	}
+
+	/* The bounds hold for the full resolution voxels only */
+	const bool adaptivestep = m_adaptivestep && mPool->mCurrentLevel == 0;
+
+	/* Normals of the bricks paged since the last frame */
+	const bool precomputedgradients = updateGradients();
+
+	if(m_backend == BackendCPU)
+	{
+		m_cpurenderer->mAccumulate = accumulate;
+		m_cpurenderer->mFrameIndex = frameIndex;
+		m_cpurenderer->mReprojection = reproject ? &m_reprojection : nullptr;
+		m_cpurenderer->mOpacityBounds = adaptivestep ? &m_opacitybounds : nullptr;
+		m_cpurenderer->mUseShading = m_useshading;
+		m_cpurenderer->mShading = m_shading;
+		m_cpurenderer->mLightPosition = m_lightposition;
+		m_cpurenderer->mGradients = precomputedgradients ? &m_gradients : nullptr;
+		m_cpurenderer->mERTThreshold = m_quality.mERTThreshold;
+		m_cpurenderer->mSamplesPerVoxel = m_quality.mSamplesPerVoxel;
+		m_cpurenderer->mOpacityReference = m_quality.mOpacityReference;
+		m_cpurenderer->mHighlightERT = m_highlightert;
+		m_cpurenderer->mShowDepthComplexity = m_showdepthcomplexity;
+		m_cpurenderer->mShowPageTableAccesses = m_showPageTableAccesses;
+		m_cpurenderer->mDontSample = m_dontsample;
+		m_cpurenderer->mSamples = numSamples;
+		m_cpurenderer->mMaxBounces = maxBounces;
+	}
+	else
+	{
+		m_camera.set(m_context);
+		m_context["ertThreshold"]->setFloat(m_quality.mERTThreshold);
+		m_context["samplesPerVoxel"]->setFloat(m_quality.mSamplesPerVoxel);
+		m_context["opacityReference"]->setFloat(m_quality.mOpacityReference);
+		m_context["adaptiveStep"]->setInt(adaptivestep ? 1 : 0);
+		m_context["maxStepScale"]->setInt(m_opacitybounds.mMaxStepScale);
+		m_context["stepTolerance"]->setFloat(m_opacitybounds.mTolerance);
+
+		/* Switching materials recompiles, so only when shading is toggled */
+		if(m_useshading != m_shadedmaterial)
+		{
+			m_volumegeometryinstance->setMaterial(0, m_useshading ? m_volumeshadingdvrmaterial : m_volumedvrmaterial);
+			m_shadedmaterial = m_useshading;
+		}
+		const vec4f shadingTerms = m_shading.terms();
+		m_context["lightPosition"]->setFloat(m_lightposition.x, m_lightposition.y, m_lightposition.z);
+		m_context["shadingTerms"]->setFloat(shadingTerms.x, shadingTerms.y, shadingTerms.z, shadingTerms.w);
+		m_context["minGradient"]->setFloat(m_shading.mMinGradient);
+		m_context["precomputedGradients"]->setInt(precomputedgradients ? 1 : 0);
+		m_context["highlightERT"]->setInt(m_highlightert ? 1 : 0);
+		m_context["showDepthComplexity"]->setInt(m_showdepthcomplexity ? 1 : 0);
+		m_context["showPageTableAccesses"]->setInt(m_showPageTableAccesses ? 1 : 0);
+		m_context["dontSample"]->setInt(m_dontsample ? 1 : 0);
+		m_context["numSamples"]->setInt(numSamples);
+		m_context["maxBounces"]->setInt(maxBounces);
+		m_context["accumulate"]->setInt(accumulate ? 1 : 0);
+		m_context["frameIndex"]->setInt(frameIndex);
+		m_context["reproject"]->setInt(warp ? 1 : 0);
+		m_context["reprojectStore"]->setInt(reproject ? 1 : 0);
+		m_context["reprojectionMaxDepthStep"]->setFloat(m_reprojection.mMaxDepthStep);
+		m_context["reprojectionMaxAge"]->setInt(m_reprojection.mMaxAge);
+	}
+
+	/* The last frame stays on the device: its points are splatted into
+	   the new view before the launch, which copies the pixels they land
+	   on and marches the rest */
+	utils::Timer reprojectionTimer;
+	float reprojectionTime = 0.0f;
+	if(warp && m_backend != BackendCPU)
+	{
+		reprojectionTimer.start();
+		m_context->launch(EntryReprojectionSplat, m_renderwidth, m_renderheight);
+		reprojectionTime = reprojectionTimer.stop();
+	}
 
 	// Render Frame
 	utils::Timer timer;
 	timer.start();
-	renderFrame(m_renderwidth, m_renderheight);
+	if(m_adaptivesampling)
+	{
+		renderAdaptive();
+	}
+	else if(m_backend == BackendCPU)
+	{
+		m_cpurenderer->render(m_camera);
+	}
+	else
+	{
+		renderFrame(m_renderwidth, m_renderheight);
+	}
 	timer.stop();
 	m_lastrenderduration = timer.getTime();
 	mStats.set("rendertime", m_lastrenderduration);
 
+	if(accumulate)
+	{
+		m_accumulatedframes++;
+	}
+	mStats.set("accumulatedframes", m_accumulatedframes);
+
+	if(reproject)
+	{
+		if(m_backend == BackendCPU)
+		{
+			m_reprojection.store(m_camera, &m_cpurenderer->mFrame[0], &m_cpurenderer->mSurfaceDistances[0]);
+		}
+		else
+		{
+			/* Only the count of reused pixels comes back to the host */
+			reprojectionTimer.start();
+			if(warp)
+			{
+				const unsigned int reused = *(const unsigned int*)m_reprojectionreusedbuffer->map();
+				m_reprojectionreusedbuffer->unmap();
+				m_reprojection.mStats.set("reprojectionreuse",
+					(double)reused / ((double)m_renderwidth * (double)m_renderheight));
+			}
+			m_context["reprojectionFrame"]->setUint(m_reprojection.stored(m_camera));
+			m_context->launch(EntryReprojectionStore, m_renderwidth, m_renderheight);
+			std::swap(m_reprojectionpointbuffers[0], m_reprojectionpointbuffers[1]);
+			std::swap(m_reprojectionagebuffers[0], m_reprojectionagebuffers[1]);
+			bindReprojectionBuffers();
+			reprojectionTime += reprojectionTimer.stop();
+			m_reprojection.mStats.set("reprojectiontime", reprojectionTime);
+		}
+		std::vector<std::string> keys = m_reprojection.mStats.list();
+		for(size_t i = 0; i < keys.size(); ++i)
+		{
+			mStats.set(keys[i], m_reprojection.mStats.get(keys[i]));
+		}
+	}
+
 	m_previousframetimepoint = std::chrono::system_clock::now();
 
-	// Copy render buffer to host
-	if(m_renderdata)
-		delete[] m_renderdata;
-	const unsigned char *pixels = (const unsigned char *)m_framebuffer->map();
-	m_renderdata = new unsigned char[m_renderwidth * m_renderheight * 4];
-	memcpy(m_renderdata, pixels, m_renderwidth * m_renderheight * 4);
-	m_framebuffer->unmap();
+	/* Read back to the host only when someone asks, see readFrame() */
+	m_framereadback = false;
 	m_frameavailable = true;
+	publishFrame();
 
 	return 0;
 }
 
+const unsigned char* OptixDVR::readFrame()
+{
+	if(!m_frameavailable)
+		return nullptr;
+	if(m_framereadback)
+		return m_renderdata;
+
+	utils::Timer timer;
+	timer.start();
+
+	/* Fill the image not handed out last. Resizing within the capacity
+	   doesn't allocate, so only a render size larger than ever before does */
+	m_hostframe = 1 - m_hostframe;
+	std::vector<unsigned char>& frame = m_hostframes[m_hostframe];
+	const size_t bytes = (size_t)m_renderwidth * (size_t)m_renderheight * 4;
+	frame.resize(bytes);
+	if(m_backend == BackendCPU)
+	{
+		memcpy(&frame[0], &m_cpurenderer->mFrame[0], bytes);
+	}
+	else
+	{
+		const unsigned char *pixels = (const unsigned char *)m_framebuffer->map();
+		memcpy(&frame[0], pixels, bytes);
+		m_framebuffer->unmap();
+	}
+	m_renderdata = &frame[0];
+	m_framereadback = true;
+
+	timer.stop();
+	mStats.set("readbacktime", timer.getTime());
+	return m_renderdata;
+}
+
+void OptixDVR::publishFrame()
+{
+	if(m_framering.mName.empty() && m_framepipe.mCommand.empty())
+		return;
+
+	/* Straight from the frame, both keep their own copy */
+	const unsigned char *pixels;
+	if(m_backend == BackendCPU)
+		pixels = &m_cpurenderer->mFrame[0];
+	else
+		pixels = (const unsigned char *)m_framebuffer->map();
+	m_framering.publish(m_renderwidth, m_renderheight, pixels);
+	m_framepipe.publish(m_renderwidth, m_renderheight, pixels);
+	if(m_backend != BackendCPU)
+		m_framebuffer->unmap();
+
+	Stats* streams[2] = {&m_framering.mStats, &m_framepipe.mStats};
+	for(int s = 0; s < 2; ++s)
+	{
+		std::vector<std::string> keys = streams[s]->list();
+		for(size_t i = 0; i < keys.size(); ++i)
+		{
+			mStats.set(keys[i], streams[s]->get(keys[i]));
+		}
+	}
+}
+
 void OptixDVR::saveToPNG(const char* path)
 {
+	const int compression = m_imagewriter.mCompression;
+	if(m_backend == BackendCPU)
+	{
+		writePNG(path, m_renderwidth, m_renderheight, &m_cpurenderer->mFrame[0], compression);
+		return;
+	}
+
 	const unsigned char *pixels = (const unsigned char *)m_framebuffer->map();
-	savePNG(path, m_renderwidth, m_renderheight, pixels);
+	writePNG(path, m_renderwidth, m_renderheight, pixels, compression);
 	m_framebuffer->unmap();
 }
 
+void OptixDVR::saveImage(const char* path)
+{
+	/* Straight from the frame, the writer keeps its own copy */
+	if(m_backend == BackendCPU)
+	{
+		m_imagewriter.save(path, m_renderwidth, m_renderheight, &m_cpurenderer->mFrame[0]);
+	}
+	else
+	{
+		const unsigned char *pixels = (const unsigned char *)m_framebuffer->map();
+		m_imagewriter.save(path, m_renderwidth, m_renderheight, pixels);
+		m_framebuffer->unmap();
+	}
+
+	std::vector<std::string> keys = m_imagewriter.mStats.list();
+	for(size_t i = 0; i < keys.size(); ++i)
+	{
+		mStats.set(keys[i], m_imagewriter.mStats.get(keys[i]));
+	}
+}
+
 void OptixDVR::resizeFrameBuffer(int w, int h)
 {
+	if(m_backend == BackendCPU)
+	{
+		if(w != m_cpurenderer->mWidth || h != m_cpurenderer->mHeight)
+		{
+			m_cpurenderer->resize(w, h);
+			resetAccumulation();
+			m_frameavailable = false;
+		}
+		m_renderwidth = w;
+		m_renderheight = h;
+		m_camera.mAspect = float(m_renderwidth) / float(m_renderheight);
+		return;
+	}
+
+	/* Called every frame by the GUI, keep the buffers and the frames
+	   accumulated in them unless the size changes */
+	RTsize width = 0, height = 0;
 	if(m_framebuffer)
-		m_framebuffer->destroy();
-	m_framebuffer = createFrameBuffer(w, h);
-	m_context["fb"]->set(m_framebuffer);
+		m_framebuffer->getSize(width, height);
+	if(!m_framebuffer || width != (RTsize)w || height != (RTsize)h)
+	{
+		if(m_framebuffer)
+			m_framebuffer->destroy();
+		m_framebuffer = createFrameBuffer(w, h);
+		m_context["fb"]->set(m_framebuffer);
+		/* The frame went with the old buffer */
+		m_frameavailable = false;
+
+		if(m_accumulationbuffer)
+			m_accumulationbuffer->destroy();
+		m_accumulationbuffer = m_context->createBuffer(RT_BUFFER_INPUT_OUTPUT, RT_FORMAT_FLOAT4, w, h);
+		m_context["accumulationBuffer"]->set(m_accumulationbuffer);
+
+		if(m_momentbuffer)
+			m_momentbuffer->destroy();
+		m_momentbuffer = m_context->createBuffer(RT_BUFFER_INPUT_OUTPUT, RT_FORMAT_FLOAT, w, h);
+		m_context["momentBuffer"]->set(m_momentbuffer);
+
+		/* Reprojection state stays on the device, apart from the counter */
+		const unsigned int local = RT_BUFFER_INPUT_OUTPUT | RT_BUFFER_GPU_LOCAL;
+		if(m_surfacedistancebuffer)
+			m_surfacedistancebuffer->destroy();
+		m_surfacedistancebuffer = m_context->createBuffer(local, RT_FORMAT_FLOAT, w, h);
+		m_context["surfaceDistanceBuffer"]->set(m_surfacedistancebuffer);
+
+		if(m_reprojectioncolourbuffer)
+			m_reprojectioncolourbuffer->destroy();
+		m_reprojectioncolourbuffer = m_context->createBuffer(local, RT_FORMAT_UNSIGNED_BYTE4, w, h);
+		for(int i = 0; i < 2; ++i)
+		{
+			if(m_reprojectionpointbuffers[i])
+				m_reprojectionpointbuffers[i]->destroy();
+			m_reprojectionpointbuffers[i] = m_context->createBuffer(local, RT_FORMAT_FLOAT4, w, h);
+			if(m_reprojectionagebuffers[i])
+				m_reprojectionagebuffers[i]->destroy();
+			m_reprojectionagebuffers[i] = m_context->createBuffer(local, RT_FORMAT_UNSIGNED_BYTE, w, h);
+		}
+
+		/* Splatting takes the smallest key, so targets start all ones */
+		if(m_reprojectiontargetbuffer)
+			m_reprojectiontargetbuffer->destroy();
+		m_reprojectiontargetbuffer = m_context->createBuffer(RT_BUFFER_INPUT_OUTPUT, RT_FORMAT_USER, w, h);
+		m_reprojectiontargetbuffer->setElementSize(sizeof(unsigned long long));
+		memset(m_reprojectiontargetbuffer->map(), 0xff, (size_t)w * (size_t)h * sizeof(unsigned long long));
+		m_reprojectiontargetbuffer->unmap();
+
+		if(!m_reprojectionreusedbuffer)
+			m_reprojectionreusedbuffer = m_context->createBuffer(RT_BUFFER_INPUT_OUTPUT, RT_FORMAT_UNSIGNED_INT, 1);
+		bindReprojectionBuffers();
+		/* The stored frame went with the old buffers */
+		m_reprojection.invalidate();
+		resetAccumulation();
+	}
 	m_renderwidth = w;
 	m_renderheight = h;
 
 	m_camera.mAspect = float(m_renderwidth) / float(m_renderheight);
 	m_camera.set(m_context);
-}
\ No newline at end of file
+}
+
+void OptixDVR::bindReprojectionBuffers()
+{
+	m_context["reprojectionColours"]->set(m_reprojectioncolourbuffer);
+	m_context["reprojectionPoints"]->set(m_reprojectionpointbuffers[0]);
+	m_context["reprojectionAges"]->set(m_reprojectionagebuffers[0]);
+	m_context["reprojectionNextPoints"]->set(m_reprojectionpointbuffers[1]);
+	m_context["reprojectionNextAges"]->set(m_reprojectionagebuffers[1]);
+	m_context["reprojectionTargets"]->set(m_reprojectiontargetbuffer);
+	m_context["reprojectionReused"]->set(m_reprojectionreusedbuffer);
+}
+
+void OptixDVR::resetAccumulation()
+{
+	m_accumulatedframes = 0;
+}
+
+bool OptixDVR::viewChanged()
+{
+	const Camera& c = m_camera;
+	const Camera& p = m_accumulationcamera;
+	bool changed = c.mOrigin != p.mOrigin
+		|| c.mLookDirection != p.mLookDirection
+		|| c.mUp != p.mUp
+		|| c.mAperture != p.mAperture
+		|| c.mFOVY != p.mFOVY
+		|| c.mAspect != p.mAspect
+		|| c.mFocusDistance != p.mFocusDistance;
+	m_accumulationcamera = m_camera;
+
+	/* TF edits don't always go through updateScene, e.g. colour-only ones */
+	const vec4f* lut = m_transferfunction ? m_transferfunction->mLUT : nullptr;
+	const size_t lutsize = lut ? (size_t)m_transferfunction->mSize : 0;
+	if(lutsize != m_accumulationlut.size()
+		|| (lutsize && memcmp(lut, &m_accumulationlut[0], lutsize * sizeof(vec4f)) != 0))
+	{
+		m_accumulationlut.assign(lut, lut + lutsize);
+		m_reprojection.invalidate();
+		changed = true;
+	}
+
+	const decltype(m_accumulationsettings) settings = {{
+		(float)m_samples,
+		m_quality.mSamplesPerVoxel,
+		m_quality.mERTThreshold,
+		m_quality.mOpacityReference,
+		(float)m_adaptivestep,
+		(float)m_opacitybounds.mMaxStepScale,
+		m_opacitybounds.mTolerance,
+		(float)m_highlightert,
+		(float)m_showdepthcomplexity,
+		(float)m_showPageTableAccesses,
+		(float)m_dontsample,
+		(float)m_useshading,
+		m_lightposition.x,
+		m_lightposition.y,
+		m_lightposition.z,
+		(float)m_shading.mGradients,
+		m_shading.mAmbient,
+		m_shading.mDiffuse,
+		m_shading.mSpecular,
+		m_shading.mShininess,
+		m_shading.mMinGradient,
+		(float)m_frame
+	}};
+	if(settings != m_accumulationsettings)
+	{
+		m_accumulationsettings = settings;
+		m_reprojection.invalidate();
+		changed = true;
+	}
+	return changed;
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <ctime>
 #include <chrono>
 #include <vector>
@@ -7,18 +8,52 @@
 #include <optix.h>
 #include <optixu/optixpp.h>
 
+#include "adaptivesampler.hpp"
 #include "camera.hpp"
+#include "reprojection.hpp"
+#include "samplingquality.hpp"
+#include "shading.hpp"
+#include "utils/framestreams.hpp"
+#include "utils/imagewriter.hpp"
 #include "programs/vec.h"
 #include "volume/brickedvolume.hpp"
 #include "volume/optixtransferfunction.hpp"
 #include "volume/optixbrickpool.hpp"
+#include "volume/hostbrickpool.hpp"
+#include "volume/lodselector.hpp"
+#include "volume/opacitybounds.hpp"
+#include "volume/gradientpool.hpp"
+#include "volume/timeseries.hpp"
+#include "volume/brickcache.hpp"
+#include "volume/bricksource.hpp"
 
+#include "cpu/cpurenderer.hpp"
 #include "utils/stats.hpp"
 
 class OptixDVR
 {
 public:
+    /* Where frames are rendered, fixed when the renderer is created */
+    enum Backend
+    {
+        BackendOptix,
+        BackendCPU
+    };
+
+    /* OptiX launch entry points: renderPixel, and the reprojection
+       programs launched before and after it */
+    enum EntryPoint
+    {
+        EntryRender,
+        EntryReprojectionSplat,
+        EntryReprojectionStore,
+        EntryPointCount
+    };
+
     Stats mStats;
+    Backend m_backend = BackendOptix;
+    /* Reference renderer used by the CPU backend */
+    CPURenderer *m_cpurenderer = nullptr;
     optix::Context m_context;
     optix::Program m_volumedvrprogram;
     optix::Program m_volumeshadingdvrprogram;
@@ -27,6 +62,8 @@ public:
     optix::Geometry m_geometry_aabb;
     optix::Material m_volumedvrmaterial;
     optix::Material m_volumeshadingdvrmaterial;
+    /* Whether the volume geometry has the shaded material */
+    bool m_shadedmaterial = false;
     optix::GeometryGroup m_world;
     optix::Acceleration m_bvh;
     //std::vector<optix::GeometryInstance> m_optixbricks;
@@ -37,18 +74,38 @@ public:
     optix::GeometryInstance m_volumegeometryinstance;
     optix::Geometry m_volumegeometry;
 
+    utils::ChunkedReader m_reader;
     std::string m_volumefilepath;
     std::string m_transferfuncpath;
     Volume *m_volume = nullptr;
     BrickedVolume *m_subdivision = nullptr;
-    OptixVolumeBrickPool *mPool = nullptr;
+    VolumeBrickPool *mPool = nullptr;
     vec3size_t mPreviousBrickSize;
     OptixTransferFunction *m_transferfunction = nullptr;
 
+    /* Set when the volume file lists more than one frame */
+    VolumeTimeSeries *m_timeseries = nullptr;
+    int m_prefetchframes = 2;
+    int m_frame = 0;
+
+    /* Bricked volume cache, written on a miss and mapped on a hit */
+    std::string m_brickcachepath;
+    BrickCache *m_brickcache = nullptr;
+
+    /* Read bricks on demand instead of loading the whole volume */
+    bool m_outofcore = false;
+    size_t m_hostcachemb = 1024;
+    BrickSource *m_bricksource = nullptr;
+
+    bool m_uselod = false;
+    LODSelector m_lodselector;
+
     Camera m_camera;
     float m_lastrenderduration;
     float m_lastbvhbuildtime;
     int m_samples = 1;
+    /* Ray march step and termination, see SamplingQuality */
+    SamplingQuality m_quality;
     bool m_highlightert = false;
     bool m_showdepthcomplexity = false;
     bool m_showPageTableAccesses = false;
@@ -57,33 +114,127 @@ public:
     bool m_useshading = false;
     bool m_needsrecreate = false;
     vec3f m_lightposition = vec3f(5, 0, 0);
+    /* Lighting terms and where gradients come from while shading, see
+       Shading. Precomputed normals are packed into m_gradients */
+    Shading m_shading;
+    GradientPool m_gradients;
 
     int m_renderwidth = 1024;
     int m_renderheight = 1024;
     std::string m_outppmpath;
 
+    /* Progressive refinement: while the view stays put every render adds
+       a frame into a float accumulation buffer and shows the average, so
+       depth of field and extra samples converge while idle */
+    bool m_accumulate = false;
+    int m_accumulatedframes = 0;
+
+    /* Adaptive sampling: every render refines the noisy tiles over several
+       launches, see AdaptiveSampler. Renders aren't accumulated while on */
+    bool m_adaptivesampling = false;
+    AdaptiveSampler m_sampler;
+
+    /* Temporal reprojection: while only the camera moves, pixels are
+       reused from the previous frame and just the rest are marched, see
+       Reprojection. Off while accumulating or sampling adaptively */
+    bool m_reproject = false;
+    Reprojection m_reprojection;
+
+    /* Empty-space-aware stepping: rays stretch their steps through leaves
+       the transfer function keeps (nearly) transparent, see
+       OpacityBounds. Only at full resolution, the bounds are the leaves' */
+    bool m_adaptivestep = false;
+    OpacityBounds m_opacitybounds;
+
     optix::Buffer m_framebuffer;
+    optix::Buffer m_accumulationbuffer;
+    optix::Buffer m_momentbuffer;
+    optix::Buffer m_tilepassesbuffer;
+    optix::Buffer m_surfacedistancebuffer;
+    /* The last frame kept on the device for reprojection, points and
+       ages twice as reprojection_store writes the next ones beside them */
+    optix::Buffer m_reprojectioncolourbuffer;
+    optix::Buffer m_reprojectionpointbuffers[2];
+    optix::Buffer m_reprojectionagebuffers[2];
+    optix::Buffer m_reprojectiontargetbuffer;
+    optix::Buffer m_reprojectionreusedbuffer;
+    optix::Buffer m_opacityboundsbuffer;
+    optix::Buffer m_gradientbuffer;
+    optix::TextureSampler m_gradienttexture;
+
+    /* Host copies of the frame, only made when readFrame() asks. Two of
+       them, so the image handed out last stays intact while the next
+       frame is read back into the other. Kept across frames, they only
+       grow with the render size */
+    std::vector<unsigned char> m_hostframes[2];
+    int m_hostframe = 0;
+    bool m_framereadback = false;
+    /* The image readFrame() handed out last */
     unsigned char* m_renderdata;
+
+    /* Encodes frames queued by saveImage() in the background, see
+       ImageWriter. Its format and compression apply to saveToPNG too */
+    ImageWriter m_imagewriter;
+
+    /* Every rendered frame is published to these when they're given a
+       segment name or command, for viewers and encoders in other
+       processes, see FrameRing and FramePipe */
+    FrameRing m_framering;
+    FramePipe m_framepipe;
     std::chrono::time_point<std::chrono::system_clock> m_previousframetimepoint;
 
     bool m_ready = false;
     bool m_frameavailable = false;
 
-    OptixDVR();
+    OptixDVR(Backend backend = BackendOptix);
 
     void loadvolume(const char* volumepath);
+    /* False if the file can't be read piecewise, loadvolume then reads it whole */
+    bool loadvolumeoutofcore(VolumeFile& volumefile);
     void loadtransferfunction(const char* tfpath);
+    int numFrames() const;
+    bool setFrame(int frame);
+    bool nextFrame();
     optix::GeometryInstance createAABB(const vec3f &boxCenter, const vec3f &boxRadius);
     void createScene();
     void renderFrame(int Nx, int Ny);
+    /* Launches until m_sampler has nothing left to refine */
+    void renderAdaptive();
     optix::Buffer createFrameBuffer(int Nx, int Ny);
     void setRayGenProgram();
     void setMissProgram();
     int setup();
     void updateScene();
+    void updatePoolVariables();
+    void updateLOD();
+    /* Packs the normals of newly paged bricks while shading with
+       precomputed gradients. False if gradients are taken on the fly */
+    bool updateGradients();
     int render();
+    /* Copies the last rendered frame to a host image and returns it,
+       nullptr before the first render. A frame is read back only once,
+       the image stays valid until the second readFrame() after it */
+    const unsigned char* readFrame();
+    /* Hands the frame to m_framering and m_framepipe, see render() */
+    void publishFrame();
     void saveToPNG(const char* path);
+    /* Queues the frame to be written to path by m_imagewriter and returns
+       while it is encoded, m_imagewriter.flush() waits for the files */
+    void saveImage(const char* path);
     void resizeFrameBuffer(int w, int h);
+    /* Points reprojection_splat at the last frame's buffers and
+       reprojection_store at the others */
+    void bindReprojectionBuffers();
+    void resetAccumulation();
+
+    /* What the accumulated frames were rendered with, see viewChanged() */
+    Camera m_accumulationcamera;
+    std::vector<vec4f> m_accumulationlut;
+    /* Fixed size, so comparing them every frame doesn't allocate. One
+       per setting viewChanged() checks */
+    std::array<float, 22> m_accumulationsettings = {};
+    /* True when the camera, TF or view settings moved since the last call */
+    bool viewChanged();
 
     void volumeMaterial(
         optix::GeometryInstance &gi,
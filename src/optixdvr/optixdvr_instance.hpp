@@ -8,11 +8,12 @@ private:
     static OptixDVR* mInstance;
 
 public:
-    static OptixDVR* get()
+    /* The backend only applies to the call that creates the renderer */
+    static OptixDVR* get(OptixDVR::Backend backend = OptixDVR::BackendOptix)
     {
         if(mInstance == nullptr)
         {
-            mInstance = new OptixDVR();
+            mInstance = new OptixDVR(backend);
         }
 
         return mInstance;
@@ -4,6 +4,7 @@
 #include <optix.h>
 #include <optix_world.h>
 rtTextureSampler<ushort4, 3> pageTableTexture;
+rtTextureSampler<float2, 3> pageTableScaleTexture;
 rtDeclareVariable(float3, poolSlots, , );
 rtDeclareVariable(float3, poolDataRegionSize, , );
 rtDeclareVariable(float3, poolSampleRegionSize, , );
@@ -14,6 +15,12 @@ struct PageTableEntry
     unsigned short x, y, z, flags;
 
 };
+
+/* Decode parameters for quantised bricks: value = sample * scale + offset */
+struct PageTableScaleEntry
+{
+    float scale, offset;
+};
 #define PageTableEntryNotPaged 0
 #define PageTableEntryPaged 1
 #define PageTableEntryPaging 2
@@ -35,6 +35,8 @@ struct PerRayData {
 
   struct {
     vec4f accumulation;
+    /* where the ray turned half opaque, -1 until it does */
+    float surfaceDistance;
     unsigned int pageTableAccesses;
   } out;
 
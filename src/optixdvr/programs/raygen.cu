@@ -18,6 +18,7 @@
 #include <optix.h>
 #include <optixu/optixu_math_namespace.h>
 #include "prd.h"
+#include "reprojection.h"
 #include "sampling.h"
 
 /*! the 'builtin' launch index we need to render a frame */
@@ -30,10 +31,29 @@ rtDeclareVariable(PerRayData, prd, rtPayload, );
 
 /*! the 2D, float3-type color frame buffer we'll write into */
 rtBuffer<uchar4, 2> fb;
+/*! running sum of the frames since the view last changed */
+rtBuffer<float4, 2> accumulationBuffer;
+/*! summed squared luminance of the adaptive passes */
+rtBuffer<float, 2> momentBuffer;
+/*! per adaptive tile, the passes it has after this launch, 0 to skip it */
+rtBuffer<int, 2> tilePasses;
+/*! where each marched pixel's ray turned half opaque, for reprojection */
+rtBuffer<float, 2> surfaceDistanceBuffer;
+
+rtDeclareVariable(int, accumulate, , );
+rtDeclareVariable(int, frameIndex, , );
+rtDeclareVariable(int, adaptive, , );
+rtDeclareVariable(int, adaptiveTileSize, , );
+/*! reuse the pixels reprojection_splat found a point for */
+rtDeclareVariable(int, reproject, , );
+/*! keep surface distances for reprojection_store */
+rtDeclareVariable(int, reprojectStore, , );
 
 rtDeclareVariable(int, numSamples, , );
 rtDeclareVariable(int, maxBounces, , );
 rtDeclareVariable(float, ertThreshold, , );
+rtDeclareVariable(float, samplesPerVoxel, , );
+rtDeclareVariable(float, opacityReference, , );
 rtDeclareVariable(int, highlightERT, , );
 rtDeclareVariable(int, showDepthComplexity, , );
 rtDeclareVariable(int, showPageTableAccesses, , );
@@ -101,12 +121,14 @@ bool __device__ entryExitPoints(
     return tmax > tmin;
 }
 
-inline __device__ vec4f color(optix::Ray &ray, DRand48 &rnd)
+inline __device__ vec4f color(optix::Ray &ray, DRand48 &rnd, float &surfaceDistance)
 {
   PerRayData prd;
 
   vec4f accumulatedColour(vec3f(0.0f), 0.0f);
   prd.out.accumulation = accumulatedColour;
+  prd.out.surfaceDistance = -1.0f;
+  surfaceDistance = -1.0f;
 
   float volumeEntryDistance, volumeExitDistance;
   vec3f boxsize = volumeSize;
@@ -127,10 +149,10 @@ inline __device__ vec4f color(optix::Ray &ray, DRand48 &rnd)
   float volumeSpaceDepth = volumeDirection.length();
 
   vec3f dataSpaceVector = volumeDirection * volumeDimensions;
-  vec3f poolSpaceStep = normalize(dataSpaceVector) / (2.0f * vec3f(poolDimensions));
+  vec3f poolSpaceStep = normalize(dataSpaceVector) / (samplesPerVoxel * vec3f(poolDimensions));
 
-  float steps = (2.0f * dataSpaceVector.length());
-  vec3f volumeSpaceStep = normalize(volumeDirection) / (2.0f * volumeDimensions);
+  float steps = (samplesPerVoxel * dataSpaceVector.length());
+  vec3f volumeSpaceStep = normalize(volumeDirection) / (samplesPerVoxel * volumeDimensions);
   float volumeSpaceStepSize = volumeSpaceStep.length();
   float worldSpaceStepSize = worldSpaceDepth / steps;//volumeSpaceStepSize * (worldSpaceDepth /volumeSpaceDepth);
 
@@ -138,7 +160,7 @@ inline __device__ vec4f color(optix::Ray &ray, DRand48 &rnd)
   prd.in.worldSpaceStepSize = worldSpaceStepSize;
   prd.in.worldSpaceStepSizeInv = 1.0f / worldSpaceStepSize;
   prd.in.poolSpaceStep = poolSpaceStep;
-  prd.in.opacityCorrection = volumeSpaceStepSize * 150.0f;
+  prd.in.opacityCorrection = volumeSpaceStepSize * opacityReference;
   prd.in.volumeSpaceStep = volumeSpaceStep;
   prd.out.pageTableAccesses = 0;
 
@@ -155,6 +177,7 @@ inline __device__ vec4f color(optix::Ray &ray, DRand48 &rnd)
 
     ray.tmin = prd.hit.exitDistance;
   }
+  surfaceDistance = prd.out.surfaceDistance;
 
   if(showDepthComplexity)
   {
@@ -205,18 +228,58 @@ inline __device__ vec4f color(optix::Ray &ray, DRand48 &rnd)
   and 'pixelBuffer' variables/buffers declared above */
 RT_PROGRAM void renderPixel()
 {
+  int pass = accumulate ? frameIndex : 0;
+  if(adaptive)
+  {
+    pass = tilePasses[make_uint2(pixelID.x / adaptiveTileSize, pixelID.y / adaptiveTileSize)] - 1;
+    if(pass < 0)
+      return;
+  }
+
+  if(reproject)
+  {
+    const unsigned long long target = reprojectionTargets[pixelID];
+    if(target != ReprojectionNoTarget)
+    {
+      const unsigned int source = (unsigned int)target;
+      fb[pixelID] = reprojectionColours[make_uint2(source % launchDim.x, source / launchDim.x)];
+      atomicAdd(&reprojectionReused[0], 1u);
+      return;
+    }
+  }
+
   int pixel_index = pixelID.y * launchDim.x + pixelID.x;
   vec4f col(0.0f);
   DRand48 rnd;
-  rnd.init(pixel_index);
+  rnd.init(pixel_seed(pixel_index, pass));
   for (int s = 0; s < numSamples; s++) {
     float u = float(pixelID.x) / float(launchDim.x);
     float v = float(pixelID.y) / float(launchDim.y);
     optix::Ray ray = Camera::generateRay(u, v, rnd);
-    col += color(ray, rnd);
+    float surfaceDistance;
+    col += color(ray, rnd, surfaceDistance);
+    if(s == 0 && reprojectStore)
+      surfaceDistanceBuffer[pixelID] = surfaceDistance;
   }
   col = col / float(numSamples);
 
+  if(adaptive)
+  {
+    float luminance = col.x * 0.2126f + col.y * 0.7152f + col.z * 0.0722f;
+    float moment = luminance * luminance;
+    if(pass > 0)
+      moment += momentBuffer[pixelID];
+    momentBuffer[pixelID] = moment;
+  }
+
+  if(accumulate || adaptive)
+  {
+    if(pass > 0)
+      col += vec4f(accumulationBuffer[pixelID]);
+    accumulationBuffer[pixelID] = col.as_float4();
+    col = col / float(pass + 1);
+  }
+
   col = saturate(col);
   uchar4 c;
   c.x = col.x * 255.0f;
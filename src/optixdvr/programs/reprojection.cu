@@ -0,0 +1,104 @@
+#include <optix_world.h>
+#include "reprojection.h"
+
+/* Temporal reprojection on the device, see Reprojection. Both programs
+   are launched over the frame: reprojection_splat before a frame that
+   reuses the last one, which renderPixel then reads its reused pixels
+   from, and reprojection_store after every frame that keeps its points */
+
+rtDeclareVariable(uint2, pixelID, rtLaunchIndex, );
+rtDeclareVariable(uint2, launchDim, rtLaunchDim, );
+
+rtBuffer<uchar4, 2> fb;
+rtBuffer<float, 2> surfaceDistanceBuffer;
+/* Where reprojection_store leaves this frame's points and ages, the host
+   swaps them with the last frame's afterwards */
+rtBuffer<float4, 2> reprojectionNextPoints;
+rtBuffer<unsigned char, 2> reprojectionNextAges;
+
+rtDeclareVariable(float, reprojectionMaxDepthStep, , );
+rtDeclareVariable(int, reprojectionMaxAge, , );
+rtDeclareVariable(unsigned int, reprojectionFrame, , );
+
+rtDeclareVariable(float3, camera_lower_left_corner, , );
+rtDeclareVariable(float3, camera_horizontal, , );
+rtDeclareVariable(float3, camera_vertical, , );
+rtDeclareVariable(float3, camera_origin, , );
+rtDeclareVariable(float3, camera_w, , );
+
+/* As Reprojection::reusable */
+inline __device__ bool reusable(int x, int y, float distance)
+{
+  if(distance < 0.0f || reprojectionAges[pixelID] >= reprojectionMaxAge)
+    return false;
+
+  const int dx[4] = { -1, 1, 0, 0 };
+  const int dy[4] = { 0, 0, -1, 1 };
+  for(int n = 0; n < 4; ++n)
+  {
+    const int nx = x + dx[n];
+    const int ny = y + dy[n];
+    if(nx < 0 || ny < 0 || nx >= (int)launchDim.x || ny >= (int)launchDim.y)
+      continue;
+    const float neighbour = reprojectionPoints[make_uint2(nx, ny)].w;
+    if(neighbour >= 0.0f && fabsf(neighbour - distance) > reprojectionMaxDepthStep)
+      return false;
+  }
+  return true;
+}
+
+/* Splats a point of the last frame into the new view, the nearest one
+   landing on a pixel wins, and on a tie the first, as on the host */
+RT_PROGRAM void reprojection_splat()
+{
+  if(pixelID.x == 0 && pixelID.y == 0)
+    reprojectionReused[0] = 0;
+
+  const float4 p = reprojectionPoints[pixelID];
+  if(!reusable((int)pixelID.x, (int)pixelID.y, p.w))
+    return;
+
+  const vec3f point(p.x, p.y, p.z);
+  int x, y;
+  if(!reprojection_pixel(point, camera_origin, camera_lower_left_corner, camera_horizontal,
+    camera_vertical, camera_w, (int)launchDim.x, (int)launchDim.y, x, y))
+    return;
+
+  const float distance = (point - vec3f(camera_origin)).length();
+  const unsigned int source = pixelID.y * launchDim.x + pixelID.x;
+  const unsigned long long target = ((unsigned long long)__float_as_uint(distance) << 32) | source;
+  atomicMin(&reprojectionTargets[make_uint2(x, y)], target);
+}
+
+/* Keeps the frame just rendered for the next one: the colours, the
+   points reused pixels carried along and those of the marched ones at
+   their surface distances. Clears the targets for the next splat */
+RT_PROGRAM void reprojection_store()
+{
+  const unsigned long long target = reprojectionTargets[pixelID];
+  reprojectionTargets[pixelID] = ReprojectionNoTarget;
+  reprojectionColours[pixelID] = fb[pixelID];
+
+  if(target != ReprojectionNoTarget)
+  {
+    const unsigned int source = (unsigned int)target;
+    const uint2 from = make_uint2(source % launchDim.x, source / launchDim.x);
+    float4 point = reprojectionPoints[from];
+    point.w = __uint_as_float((unsigned int)(target >> 32));
+    reprojectionNextPoints[pixelID] = point;
+    reprojectionNextAges[pixelID] = reprojectionAges[from] + 1;
+    return;
+  }
+
+  /* The ray through the pixel as renderPixel generates it without a lens */
+  const float s = float(pixelID.x) / float(launchDim.x);
+  const float t = float(pixelID.y) / float(launchDim.y);
+  const vec3f origin(camera_origin);
+  const vec3f direction = normalize(vec3f(camera_lower_left_corner) + s * vec3f(camera_horizontal)
+    + t * vec3f(camera_vertical) - origin);
+  const float distance = surfaceDistanceBuffer[pixelID];
+  const vec3f point = origin + direction * distance;
+  reprojectionNextPoints[pixelID] = make_float4(point.x, point.y, point.z, distance);
+  reprojectionNextAges[pixelID] = reprojection_first_age(
+    pixelID.y * launchDim.x + pixelID.x, reprojectionFrame, reprojectionMaxAge);
+}
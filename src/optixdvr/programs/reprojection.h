@@ -0,0 +1,58 @@
+#pragma once
+
+#include "vec.h"
+
+/* Temporal reprojection, shared by Reprojection on the host and
+   reprojection.cu, which warp the same way */
+
+#ifdef __CUDACC__
+#include <optix_world.h>
+/* The last frame's colours, its surface points with their distance from
+   its camera in w, -1 where there's none, and their ages */
+rtBuffer<uchar4, 2> reprojectionColours;
+rtBuffer<float4, 2> reprojectionPoints;
+rtBuffer<unsigned char, 2> reprojectionAges;
+/* The nearest point splatted onto each pixel of the new frame, the bits
+   of its distance high and the pixel it came from low */
+rtBuffer<unsigned long long, 2> reprojectionTargets;
+/* Pixels the last frame reused */
+rtBuffer<unsigned int, 1> reprojectionReused;
+#endif
+
+#define ReprojectionNoTarget 0xffffffffffffffffull
+
+/* Pixel of a width x height frame that a surface point lands on, for a
+   camera at origin with the focus plane corner, spans and backward axis
+   w that Camera::basis gives. A point d from the origin meets the focus
+   plane at k * d, with k = dot(plane, w) / dot(d, w), and its offset on
+   the plane from the corner gives the pixel. False for points behind
+   the camera or off the frame */
+inline __device__ bool reprojection_pixel(
+  const vec3f& point,
+  const vec3f& origin,
+  const vec3f& lowerLeft,
+  const vec3f& horizontal,
+  const vec3f& vertical,
+  const vec3f& w,
+  int width,
+  int height,
+  int& x,
+  int& y
+){
+  const vec3f d = point - origin;
+  const float depth = dot(d, w);
+  if(depth >= 0.0f)
+    return false;
+  const vec3f plane = lowerLeft - origin;
+  const vec3f q = d * (dot(plane, w) / depth) - plane;
+  x = (int)floorf(dot(q, horizontal) * (1.0f / dot(horizontal, horizontal)) * (float)width + 0.5f);
+  y = (int)floorf(dot(q, vertical) * (1.0f / dot(vertical, vertical)) * (float)height + 0.5f);
+  return x >= 0 && y >= 0 && x < width && y < height;
+}
+
+/* Age a freshly marched pixel starts at, scattered over pixels and
+   frames so that they don't all expire on the same frame */
+inline __device__ unsigned char reprojection_first_age(unsigned int pixel, unsigned int frame, int maxAge)
+{
+  return (unsigned char)((pixel * 2654435761u + frame) % (unsigned int)(maxAge > 1 ? maxAge : 1));
+}
@@ -28,6 +28,13 @@ inline __device__ vec3f random_in_unit_disk(DRand48 &local_rand_state) {
 }
 
 
+/* Seed of a pixel's sequence, every accumulated frame gets its own.
+   Frame 0 seeds with the pixel index alone */
+inline __device__ int pixel_seed(int pixel_index, int frame_index)
+{
+  return (int)((unsigned int)pixel_index + (unsigned int)frame_index * 0x9E3779B9u);
+}
+
 #define RANDVEC3F vec3f(rnd(),rnd(),rnd())
 
 inline __device__ vec3f random_in_unit_sphere(DRand48 &rnd) {
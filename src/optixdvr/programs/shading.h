@@ -0,0 +1,54 @@
+#pragma once
+
+#include "vec.h"
+
+/* Gradient shading, shared by volume_shading.cu and the CPU renderer, see
+   Shading. Gradients are in normalised value per voxel along the voxel
+   axes, voxelsPerUnit turns them into world space for the normal */
+
+/* One axis of a central difference whose taps were clamped to the brick,
+   a one-sided difference on its faces */
+inline __device__ float gradient_difference(float minus, float plus, float distance)
+{
+  return distance > 0.0f ? (plus - minus) / distance : 0.0f;
+}
+
+/* Gradient from a filtered packed normal: a direction mapped to [0, 1]
+   in xyz and the magnitude in w */
+inline __device__ vec3f unpack_gradient(const vec4f& packed)
+{
+  const vec3f direction(packed.x * 2.0f - 1.0f, packed.y * 2.0f - 1.0f, packed.z * 2.0f - 1.0f);
+  const float length = direction.length();
+  return length > 0.0f ? direction * (packed.w / length) : vec3f(0.0f);
+}
+
+/* Blinn-Phong of a sample's colour with terms (ambient, diffuse, specular,
+   shininess). Lit from either side, the normal faces the eye. Samples
+   whose gradient is too weak to have a surface are left as they were */
+inline __device__ vec3f shade_sample(
+    const vec3f& colour,
+    const vec3f& gradient,
+    const vec3f& voxelsPerUnit,
+    const vec3f& toLight,
+    const vec3f& toEye,
+    const vec4f& terms,
+    float minGradient
+){
+  if(gradient.length() <= minGradient)
+    return colour;
+
+  vec3f normal = normalize(gradient * voxelsPerUnit);
+  if(dot(normal, toEye) < 0.0f)
+    normal = -normal;
+  const float diffuse = fmaxf(dot(normal, toLight), 0.0f);
+  const vec3f halfway = normalize(toLight + toEye);
+  const float specular = diffuse > 0.0f ? powf(fmaxf(dot(normal, halfway), 0.0f), terms.w) : 0.0f;
+
+  const float lit = terms.x + terms.y * diffuse;
+  const float highlight = terms.z * specular;
+  return vec3f(
+    fminf(colour.x * lit + highlight, 1.0f),
+    fminf(colour.y * lit + highlight, 1.0f),
+    fminf(colour.z * lit + highlight, 1.0f)
+  );
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "vec.h"
+
+/* Empty-space-aware stepping inside active leaves, shared by volume.cu and
+   the CPU renderer. A ray samples on the same lattice of base steps as
+   always, but may skip ahead over the samples of a leaf whose transfer
+   function opacity is bounded low enough, see OpacityBounds */
+
+/* Base steps a ray may take at once in a leaf whose opacity is at most
+   bound. Transparent leaves get maxScale. Others as many as keep a
+   stretched step's corrected opacity, 1 - (1 - bound)^(k * correction),
+   at most tolerance */
+inline __device__ int step_scale(float bound, float opacityCorrection, float tolerance, int maxScale)
+{
+  if(bound <= 0.0f)
+    return maxScale;
+  if(bound >= 1.0f || tolerance <= 0.0f)
+    return 1;
+  float k = logf(1.0f - tolerance) / (opacityCorrection * logf(1.0f - bound));
+  return (int)fminf(fmaxf(k, 1.0f), (float)maxScale);
+}
+
+/* Base steps from p to the first sample outside the box [lo, hi) */
+inline __device__ int steps_to_leave(const vec3f& p, const vec3f& step, const vec3f& lo, const vec3f& hi)
+{
+  float t = 1e30f;
+  if(step.x > 0.0f) t = fminf(t, (hi.x - p.x) / step.x);
+  if(step.x < 0.0f) t = fminf(t, (lo.x - p.x) / step.x);
+  if(step.y > 0.0f) t = fminf(t, (hi.y - p.y) / step.y);
+  if(step.y < 0.0f) t = fminf(t, (lo.y - p.y) / step.y);
+  if(step.z > 0.0f) t = fminf(t, (hi.z - p.z) / step.z);
+  if(step.z < 0.0f) t = fminf(t, (lo.z - p.z) / step.z);
+  return (int)fmaxf(ceilf(t), 1.0f);
+}
@@ -1,17 +1,26 @@
 #include <optix_world.h>
 #include "prd.h"
 #include "brickpoolentry.h"
+#include "stepping.h"
 
 rtDeclareVariable(optix::Ray, ray, rtCurrentRay, );
 rtDeclareVariable(PerRayData, prd, rtPayload, );
 
 rtDeclareVariable(int, dontSample, , );
+rtDeclareVariable(float, ertThreshold, , );
 rtTextureSampler<float, 3> volumeTexture;
 rtTextureSampler<float4, 1> transferFunction;
 rtDeclareVariable(float3, brickSizeVolumeSpace, , );
 rtDeclareVariable(float3, volumeMin, , );
 rtDeclareVariable(float3, volumeSize, , );
 
+/* Empty-space-aware stepping, see OpacityBounds */
+rtDeclareVariable(int, adaptiveStep, , );
+rtDeclareVariable(int, maxStepScale, , );
+rtDeclareVariable(float, stepTolerance, , );
+rtDeclareVariable(float3, leafSizeVolumeSpace, , );
+rtBuffer<float, 3> opacityBounds;
+
 inline __device__ void accumulate(
     const optix::Ray &ray_in,
     float entryDistance,
@@ -37,16 +46,54 @@ inline __device__ void accumulate(
     /* Ray-stepping loop */
     vec3f p = brickEntryPoint;
     vec4f a = accumulation;
+    float surfaceDistance = prd.out.surfaceDistance;
     const vec3f step = prd.in.volumeSpaceStep;
     const float opacityCorrection = prd.in.opacityCorrection;
     vec3f pageTableIndex;
     vec3f prevPageTableIndex(-1.0f);
     vec3f poolOffset;
     vec3f brickBegin;
+    float2 brickScale = make_float2(1.0f, 0.0f);
     const vec3f brickSizeInv = vec3f(1.0f) / brickSizeVolumeSpace;
     int ptaccesses = 0;
-    for(int i = 0; i < steps && a.w < 0.99f; ++i)
+    vec3f leafMin(0.0f);
+    vec3f leafMax(-1.0f);
+    float leafBound = 1.0f;
+    int leafScale = 1;
+    int advance = 1;
+    for(int i = 0; i < steps && a.w < ertThreshold; i += advance)
     {
+        /* Skip ahead through the rest of a transparent leaf, or stretch
+           the step through a nearly transparent one */
+        if(adaptiveStep)
+        {
+            if(!(p.x >= leafMin.x && p.y >= leafMin.y && p.z >= leafMin.z
+                && p.x < leafMax.x && p.y < leafMax.y && p.z < leafMax.z))
+            {
+                const vec3f leafSize = vec3f(leafSizeVolumeSpace);
+                const vec3f leaf(floorf(p.x / leafSize.x), floorf(p.y / leafSize.y), floorf(p.z / leafSize.z));
+                const size_t3 leaves = opacityBounds.size();
+                leafBound = 1.0f;
+                if(leaf.x >= 0.0f && leaf.y >= 0.0f && leaf.z >= 0.0f
+                    && leaf.x < (float)leaves.x && leaf.y < (float)leaves.y && leaf.z < (float)leaves.z)
+                {
+                    leafMin = leaf * leafSize;
+                    leafMax = leafMin + leafSize;
+                    leafBound = opacityBounds[make_uint3((unsigned int)leaf.x, (unsigned int)leaf.y, (unsigned int)leaf.z)];
+                }
+                leafScale = step_scale(leafBound, opacityCorrection, stepTolerance, maxStepScale);
+            }
+            advance = 1;
+            if(leafScale > 1)
+            {
+                advance = min(min(leafScale, steps_to_leave(p, step, leafMin, leafMax)), steps - i);
+            }
+            if(leafBound <= 0.0f)
+            {
+                p += step * (float)advance;
+                continue;
+            }
+        }
 
         pageTableIndex.x = floorf(p.x * brickSizeInv.x);
         pageTableIndex.y = floorf(p.y * brickSizeInv.y);
@@ -58,7 +105,7 @@ inline __device__ void accumulate(
             ushort4 pageTableEntry = tex3D(pageTableTexture, pageTableIndex.x, pageTableIndex.y, pageTableIndex.z);
             if(pageTableEntry.w == PageTableEntryNotPaged)
             {
-                p += step;
+                p += step * (float)advance;
                 continue;
             }
             brickBegin = pageTableIndex * brickSizeVolumeSpace;
@@ -67,6 +114,7 @@ inline __device__ void accumulate(
             poolOffset.x = (float)pageTableEntry.x * poolDataRegionSize.x + 0.5f;
             poolOffset.y = (float)pageTableEntry.y * poolDataRegionSize.y + 0.5f;
             poolOffset.z = (float)pageTableEntry.z * poolDataRegionSize.z + 0.5f;
+            brickScale = tex3D(pageTableScaleTexture, pageTableIndex.x, pageTableIndex.y, pageTableIndex.z);
             prevPageTableIndex = pageTableIndex;
             ptaccesses++;
         }
@@ -79,12 +127,13 @@ inline __device__ void accumulate(
 
         /* Sample the volume */
         float value = tex3D(volumeTexture, voxelAddress.x, voxelAddress.y, voxelAddress.z);
+        value = value * brickScale.x + brickScale.y;
 
         /* Tranform from voxel intesity to colour */
         vec4f colour = tex1D(transferFunction, value);
 
         /* Apply opacity correction and accumulate colour */
-        colour.w = 1.0f - powf(1.0f - colour.w, opacityCorrection);
+        colour.w = 1.0f - powf(1.0f - colour.w, opacityCorrection * (float)advance);
         float opacity = 1.0f - a.w;
         colour.w *= opacity;
         a.x = colour.x * colour.w + a.x;
@@ -92,10 +141,15 @@ inline __device__ void accumulate(
         a.z = colour.z * colour.w + a.z;
         a.w = colour.w + a.w;
 
+        /* Representative depth for reprojection */
+        if(a.w >= 0.5f && surfaceDistance < 0.0f)
+            surfaceDistance = entryDistance + (float)i * prd.in.worldSpaceStepSize;
+
         /* Step along the ray */
-        p += step;
+        p += step * (float)advance;
     }
     prd.out.pageTableAccesses += ptaccesses;
+    prd.out.surfaceDistance = surfaceDistance;
 
     accumulation = a;
 }
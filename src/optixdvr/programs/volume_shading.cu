@@ -1,101 +1,226 @@
 #include <optix_world.h>
 #include "prd.h"
+#include "brickpoolentry.h"
+#include "stepping.h"
+#include "shading.h"
 
-/*! the parameters that describe each individual sphere geometry */
-// rtDeclareVariable(float3, boxMin, , );
-// rtDeclareVariable(float3, boxMax, , );
-rtDeclareVariable(float3, poolRegionOffset, , );
-rtDeclareVariable(float3, poolRegionSize, , );
-
-/*! the implicit state's ray we will intersect against */
 rtDeclareVariable(optix::Ray, ray, rtCurrentRay, );
-
-/*! the attributes we use to communicate between intersection programs and hit program */
-rtDeclareVariable(float3, hit_rec_normal, attribute hit_rec_normal, );
-rtDeclareVariable(float3, hit_rec_p, attribute hit_rec_p, );
-
-/*! the per ray data we operate on */
 rtDeclareVariable(PerRayData, prd, rtPayload, );
 
+rtDeclareVariable(int, dontSample, , );
 rtDeclareVariable(float, ertThreshold, , );
 rtTextureSampler<float, 3> volumeTexture;
 rtTextureSampler<float4, 1> transferFunction;
-rtDeclareVariable(float3, volumeDimensions, ,  );
-rtDeclareVariable(float3, lightPositionVolumeSpace, , );
-rtDeclareVariable(float3, gradientStep, , );
-
+rtDeclareVariable(float3, brickSizeVolumeSpace, , );
+rtDeclareVariable(float3, volumeMin, , );
+rtDeclareVariable(float3, volumeSize, , );
+
+/* Empty-space-aware stepping, see OpacityBounds */
+rtDeclareVariable(int, adaptiveStep, , );
+rtDeclareVariable(int, maxStepScale, , );
+rtDeclareVariable(float, stepTolerance, , );
+rtDeclareVariable(float3, leafSizeVolumeSpace, , );
+rtBuffer<float, 3> opacityBounds;
+
+/* Gradient shading, see Shading. Normals are read from the precomputed
+   gradient pool, laid out as the brick pool, or taken from 6 taps */
+rtDeclareVariable(float3, volumeDimensions, , );
+rtDeclareVariable(float3, lightPosition, , );
+rtDeclareVariable(float4, shadingTerms, , );
+rtDeclareVariable(float, minGradient, , );
+rtDeclareVariable(int, precomputedGradients, , );
+rtTextureSampler<float4, 3> gradientTexture;
+
+/* Pool voxel at an address, decoded */
+inline __device__ float tap(float x, float y, float z, float2 brickScale)
+{
+    return tex3D(volumeTexture, x, y, z) * brickScale.x + brickScale.y;
+}
 
 inline __device__ void accumulate(
     const optix::Ray &ray_in,
     float entryDistance,
     float exitDistance,
-    vec4f &accumulation)
-{
-    // const vec3f rayDirection = vec3f(ray_in.direction);
-    // const vec3f rayOrigin = vec3f(ray_in.origin);
-    // entryDistance = fmaxf(prd.in.worldSpaceStepSize, entryDistance);
-    // exitDistance = fmaxf(prd.in.worldSpaceStepSize, exitDistance);
-    // const float depth = exitDistance - entryDistance;
-
-    // vec3f worldSpaceEntry;
-    // worldSpaceEntry.x = rayDirection.x * entryDistance + rayOrigin.x;
-    // worldSpaceEntry.y = rayDirection.y * entryDistance + rayOrigin.y;
-    // worldSpaceEntry.z = rayDirection.z * entryDistance + rayOrigin.z;
-
-    // const int steps = depth / prd.in.worldSpaceStepSize;
-    // const vec3f brickEntryPoint = (worldSpaceEntry - prd.hit.boxMin) / (prd.hit.boxMax - prd.hit.boxMin);
-    // const vec3f step = prd.in.poolSpaceStep;
-
-    // /* Ray-stepping loop */
-    // vec3f p;
-    // p.x = brickEntryPoint.x * poolRegionSize.x + poolRegionOffset.x;
-    // p.y = brickEntryPoint.y * poolRegionSize.y + poolRegionOffset.y;
-    // p.z = brickEntryPoint.z * poolRegionSize.z + poolRegionOffset.z;
-
-    // vec4f a = accumulation;
-    // const float opacityCorrection = prd.in.opacityCorrection;
-    // for(int i = 0; i < steps && a.w < ertThreshold; ++i)
-    // {
-    //     float value = tex3D(volumeTexture, p.x, p.y, p.z);
-    //     vec4f colour = tex1D(transferFunction, value);
-
-    //     if(colour.w > 0.0f)
-    //     {
-    //         vec3f normal;
-    //         normal.x = tex3D(volumeTexture, p.x + gradientStep.x, p.y, p.z)
-    //                 - tex3D(volumeTexture, p.x - gradientStep.x, p.y, p.z);
-    //         normal.y = tex3D(volumeTexture, p.x, p.y + gradientStep.y, p.z)
-    //                 - tex3D(volumeTexture, p.x, p.y - gradientStep.y, p.z);
-    //         normal.z = tex3D(volumeTexture, p.x, p.y, p.z + gradientStep.z)
-    //                 - tex3D(volumeTexture, p.x, p.y, p.z - gradientStep.z);
-    //         normal = normalize(normal);
-
-    //         vec3f lightPosition(2, 0, 0);
-    //         vec3f toLight = normalize(lightPosition - p);
-    //         float diff = fmaxf(fminf(dot(toLight, normal), 1.0f), 0.0f);
-
-    //         colour.x *= diff;
-    //         colour.y *= diff;
-    //         colour.z *= diff;
-    //         float opacity = 1.0f - a.w;
-    //         a += colour * opacity;
-    //     }
-
-
-    //     p += step;
-    // }
-
-    // accumulation = a;
+    vec4f &accumulation
+){
+    const vec3f rayDirection = vec3f(ray.direction);
+    const vec3f rayOrigin = vec3f(ray.origin);
+
+    /* Round up and down to the nearest entry/exit samples */
+    int startSample = (int)ceilf(entryDistance / prd.in.worldSpaceStepSize);
+    int endSample = (int)floorf(exitDistance / prd.in.worldSpaceStepSize);
+    exitDistance = (float)endSample * prd.in.worldSpaceStepSize;
+    prd.hit.exitDistance = exitDistance + prd.in.worldSpaceStepSize;
+    const int steps = endSample - startSample;
+
+    /* Get the world space entry point */
+    const vec3f worldSpaceEntry = rayDirection * entryDistance + rayOrigin;
+
+    /* Convert this to volume space */
+    const vec3f brickEntryPoint = (worldSpaceEntry - volumeMin) / volumeSize;
+
+    /* Ray-stepping loop */
+    vec3f p = brickEntryPoint;
+    vec4f a = accumulation;
+    float surfaceDistance = prd.out.surfaceDistance;
+    const vec3f step = prd.in.volumeSpaceStep;
+    const float opacityCorrection = prd.in.opacityCorrection;
+    vec3f pageTableIndex;
+    vec3f prevPageTableIndex(-1.0f);
+    vec3f poolOffset;
+    vec3f brickBegin;
+    float2 brickScale = make_float2(1.0f, 0.0f);
+    const vec3f brickSizeInv = vec3f(1.0f) / brickSizeVolumeSpace;
+    int ptaccesses = 0;
+    vec3f leafMin(0.0f);
+    vec3f leafMax(-1.0f);
+    float leafBound = 1.0f;
+    int leafScale = 1;
+    int advance = 1;
+    const vec3f toEye = -rayDirection;
+    const vec3f voxelsPerUnit = vec3f(volumeDimensions) / vec3f(volumeSize);
+    const vec4f terms = vec4f(shadingTerms);
+    for(int i = 0; i < steps && a.w < ertThreshold; i += advance)
+    {
+        /* Skip ahead through the rest of a transparent leaf, or stretch
+           the step through a nearly transparent one */
+        if(adaptiveStep)
+        {
+            if(!(p.x >= leafMin.x && p.y >= leafMin.y && p.z >= leafMin.z
+                && p.x < leafMax.x && p.y < leafMax.y && p.z < leafMax.z))
+            {
+                const vec3f leafSize = vec3f(leafSizeVolumeSpace);
+                const vec3f leaf(floorf(p.x / leafSize.x), floorf(p.y / leafSize.y), floorf(p.z / leafSize.z));
+                const size_t3 leaves = opacityBounds.size();
+                leafBound = 1.0f;
+                if(leaf.x >= 0.0f && leaf.y >= 0.0f && leaf.z >= 0.0f
+                    && leaf.x < (float)leaves.x && leaf.y < (float)leaves.y && leaf.z < (float)leaves.z)
+                {
+                    leafMin = leaf * leafSize;
+                    leafMax = leafMin + leafSize;
+                    leafBound = opacityBounds[make_uint3((unsigned int)leaf.x, (unsigned int)leaf.y, (unsigned int)leaf.z)];
+                }
+                leafScale = step_scale(leafBound, opacityCorrection, stepTolerance, maxStepScale);
+            }
+            advance = 1;
+            if(leafScale > 1)
+            {
+                advance = min(min(leafScale, steps_to_leave(p, step, leafMin, leafMax)), steps - i);
+            }
+            if(leafBound <= 0.0f)
+            {
+                p += step * (float)advance;
+                continue;
+            }
+        }
+
+        pageTableIndex.x = floorf(p.x * brickSizeInv.x);
+        pageTableIndex.y = floorf(p.y * brickSizeInv.y);
+        pageTableIndex.z = floorf(p.z * brickSizeInv.z);
+
+        /* If we've moved to a new brick, need to fetch page table info */
+        if(pageTableIndex != prevPageTableIndex)
+        {
+            ushort4 pageTableEntry = tex3D(pageTableTexture, pageTableIndex.x, pageTableIndex.y, pageTableIndex.z);
+            if(pageTableEntry.w == PageTableEntryNotPaged)
+            {
+                p += step * (float)advance;
+                continue;
+            }
+            brickBegin = pageTableIndex * brickSizeVolumeSpace;
+
+            /* For some reason, have to push the offset half a voxel for visual fix? */
+            poolOffset.x = (float)pageTableEntry.x * poolDataRegionSize.x + 0.5f;
+            poolOffset.y = (float)pageTableEntry.y * poolDataRegionSize.y + 0.5f;
+            poolOffset.z = (float)pageTableEntry.z * poolDataRegionSize.z + 0.5f;
+            brickScale = tex3D(pageTableScaleTexture, pageTableIndex.x, pageTableIndex.y, pageTableIndex.z);
+            prevPageTableIndex = pageTableIndex;
+            ptaccesses++;
+        }
+
+        /* Convert p from normalized volume space to pool data space */
+        vec3f voxelAddress;
+        voxelAddress.x = poolOffset.x + ((p.x - brickBegin.x) * brickSizeInv.x) * poolSampleRegionSize.x;
+        voxelAddress.y = poolOffset.y + ((p.y - brickBegin.y) * brickSizeInv.y) * poolSampleRegionSize.y;
+        voxelAddress.z = poolOffset.z + ((p.z - brickBegin.z) * brickSizeInv.z) * poolSampleRegionSize.z;
+
+        /* Sample the volume */
+        float value = tex3D(volumeTexture, voxelAddress.x, voxelAddress.y, voxelAddress.z);
+        value = value * brickScale.x + brickScale.y;
+
+        /* Tranform from voxel intesity to colour */
+        vec4f colour = tex1D(transferFunction, value);
+
+        /* Light what the transfer function shows */
+        if(colour.w > 0.0f)
+        {
+            vec3f gradient;
+            if(precomputedGradients)
+            {
+                gradient = unpack_gradient(vec4f(tex3D(gradientTexture, voxelAddress.x, voxelAddress.y, voxelAddress.z)));
+            }
+            else
+            {
+                /* Taps stay in the brick's slot, one sided on its faces */
+                const vec3f lo = poolOffset;
+                const vec3f hi = poolOffset + vec3f(poolDataRegionSize) - vec3f(1.0f);
+                const float xm = fmaxf(voxelAddress.x - 1.0f, lo.x);
+                const float xp = fminf(voxelAddress.x + 1.0f, hi.x);
+                const float ym = fmaxf(voxelAddress.y - 1.0f, lo.y);
+                const float yp = fminf(voxelAddress.y + 1.0f, hi.y);
+                const float zm = fmaxf(voxelAddress.z - 1.0f, lo.z);
+                const float zp = fminf(voxelAddress.z + 1.0f, hi.z);
+                gradient.x = gradient_difference(
+                    tap(xm, voxelAddress.y, voxelAddress.z, brickScale),
+                    tap(xp, voxelAddress.y, voxelAddress.z, brickScale), xp - xm);
+                gradient.y = gradient_difference(
+                    tap(voxelAddress.x, ym, voxelAddress.z, brickScale),
+                    tap(voxelAddress.x, yp, voxelAddress.z, brickScale), yp - ym);
+                gradient.z = gradient_difference(
+                    tap(voxelAddress.x, voxelAddress.y, zm, brickScale),
+                    tap(voxelAddress.x, voxelAddress.y, zp, brickScale), zp - zm);
+            }
+            const vec3f worldSpacePoint = vec3f(volumeMin) + p * vec3f(volumeSize);
+            const vec3f lit = shade_sample(vec3f(colour.x, colour.y, colour.z), gradient, voxelsPerUnit,
+                normalize(vec3f(lightPosition) - worldSpacePoint), toEye, terms, minGradient);
+            colour.x = lit.x;
+            colour.y = lit.y;
+            colour.z = lit.z;
+        }
+
+        /* Apply opacity correction and accumulate colour */
+        colour.w = 1.0f - powf(1.0f - colour.w, opacityCorrection * (float)advance);
+        float opacity = 1.0f - a.w;
+        colour.w *= opacity;
+        a.x = colour.x * colour.w + a.x;
+        a.y = colour.y * colour.w + a.y;
+        a.z = colour.z * colour.w + a.z;
+        a.w = colour.w + a.w;
+
+        /* Representative depth for reprojection */
+        if(a.w >= 0.5f && surfaceDistance < 0.0f)
+            surfaceDistance = entryDistance + (float)i * prd.in.worldSpaceStepSize;
+
+        /* Step along the ray */
+        p += step * (float)advance;
+    }
+    prd.out.pageTableAccesses += ptaccesses;
+    prd.out.surfaceDistance = surfaceDistance;
+
+    accumulation = a;
 }
 
 
 /*! optix program for entering a volume region */
 RT_PROGRAM void closest_hit()
 {
-    accumulate(
-        ray,
-        prd.hit.entryDistance,
-        prd.hit.exitDistance,
-        prd.out.accumulation
-    );
+    if(!dontSample)
+    {
+        accumulate(
+            ray,
+            prd.hit.entryDistance,
+            prd.hit.exitDistance,
+            prd.out.accumulation
+        );
+    }
 }
\ No newline at end of file
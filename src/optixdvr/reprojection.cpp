@@ -0,0 +1,157 @@
+#include "reprojection.hpp"
+#include "programs/reprojection.h"
+#include "utils/utils.h"
+
+#include <cmath>
+#include <cstring>
+
+void Reprojection::invalidate()
+{
+    mValid = false;
+}
+
+bool Reprojection::reusable(int x, int y) const
+{
+    const size_t i = (size_t)y * mWidth + x;
+    const float distance = mDistances[i];
+    if(distance < 0.0f || mAges[i] >= mMaxAge)
+    {
+        return false;
+    }
+
+    const int dx[4] = { -1, 1, 0, 0 };
+    const int dy[4] = { 0, 0, -1, 1 };
+    for(int n = 0; n < 4; ++n)
+    {
+        const int nx = x + dx[n];
+        const int ny = y + dy[n];
+        if(nx < 0 || ny < 0 || nx >= mWidth || ny >= mHeight)
+        {
+            continue;
+        }
+        const float neighbour = mDistances[(size_t)ny * mWidth + nx];
+        if(neighbour >= 0.0f && fabsf(neighbour - distance) > mMaxDepthStep)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Reprojection::warpable(const Camera& camera, int width, int height)
+{
+    /* A lens spreads each pixel over many depths */
+    if(!mValid || width != mWidth || height != mHeight
+        || camera.mAperture > 0.0f || mCamera.mAperture > 0.0f)
+    {
+        mWidth = width;
+        mHeight = height;
+        mStats.set("reprojectionreuse", 0.0);
+        return false;
+    }
+    return true;
+}
+
+bool Reprojection::reproject(const Camera& camera, int width, int height)
+{
+    utils::Timer timer;
+    timer.start();
+
+    const size_t pixels = (size_t)width * (size_t)height;
+    mFrame.assign(pixels * 4, 0);
+    mWarpedPoints.resize(pixels);
+    mWarpedDistances.assign(pixels, -1.0f);
+    mWarpedAges.assign(pixels, 0);
+
+    if(!warpable(camera, width, height))
+    {
+        return false;
+    }
+
+    vec3f toLowerLeft, toHorizontal, toVertical, toU, toV, toW;
+    camera.basis(toLowerLeft, toHorizontal, toVertical, toU, toV, toW);
+
+    size_t reused = 0;
+    for(int y = 0; y < mHeight; ++y)
+    {
+        for(int x = 0; x < mWidth; ++x)
+        {
+            if(!reusable(x, y))
+            {
+                continue;
+            }
+
+            const size_t i = (size_t)y * mWidth + x;
+            int nx, ny;
+            if(!reprojection_pixel(mPoints[i], camera.mOrigin, toLowerLeft, toHorizontal, toVertical, toW,
+                mWidth, mHeight, nx, ny))
+            {
+                continue;
+            }
+
+            const size_t j = (size_t)ny * mWidth + nx;
+            const float distance = (mPoints[i] - camera.mOrigin).length();
+            if(mWarpedDistances[j] >= 0.0f && mWarpedDistances[j] <= distance)
+            {
+                continue;
+            }
+            reused += mWarpedDistances[j] < 0.0f ? 1 : 0;
+            mWarpedPoints[j] = mPoints[i];
+            mWarpedDistances[j] = distance;
+            mWarpedAges[j] = mAges[i] + 1;
+            memcpy(&mFrame[j * 4], &mPrevious[i * 4], 3);
+            mFrame[j * 4 + 3] = 255;
+        }
+    }
+
+    timer.stop();
+    mStats.set("reprojectionreuse", (double)reused / (double)pixels);
+    mStats.set("reprojectiontime", timer.getTime());
+    return true;
+}
+
+void Reprojection::store(const Camera& camera, const unsigned char* frame, const float* surfaceDistances)
+{
+    const size_t pixels = mFrame.size() / 4;
+    mCamera = camera;
+    mPrevious.assign(frame, frame + pixels * 4);
+    mPoints.resize(pixels);
+    mDistances.resize(pixels);
+    mAges.resize(pixels);
+    mFrameCount++;
+
+    vec3f lowerLeft, horizontal, vertical, u, v, w;
+    camera.basis(lowerLeft, horizontal, vertical, u, v, w);
+
+    for(int y = 0; y < mHeight; ++y)
+    {
+        for(int x = 0; x < mWidth; ++x)
+        {
+            const size_t i = (size_t)y * mWidth + x;
+            if(reused(i))
+            {
+                mPoints[i] = mWarpedPoints[i];
+                mDistances[i] = mWarpedDistances[i];
+                mAges[i] = mWarpedAges[i];
+                continue;
+            }
+
+            /* The ray through the pixel as raygen generates it */
+            const float s = float(x) / float(mWidth);
+            const float t = float(y) / float(mHeight);
+            const vec3f direction = normalize(lowerLeft + s * horizontal + t * vertical - camera.mOrigin);
+            mPoints[i] = camera.mOrigin + direction * surfaceDistances[i];
+            mDistances[i] = surfaceDistances[i];
+
+            mAges[i] = reprojection_first_age((unsigned int)i, mFrameCount, mMaxAge);
+        }
+    }
+    mValid = true;
+}
+
+unsigned int Reprojection::stored(const Camera& camera)
+{
+    mCamera = camera;
+    mValid = true;
+    return ++mFrameCount;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vector>
+
+#include "camera.hpp"
+#include "programs/vec.h"
+#include "utils/stats.hpp"
+
+/**
+ * Temporal reprojection for a moving camera, shared by the OptiX and CPU
+ * backends. Each pixel keeps a representative depth: the distance at
+ * which its ray turned half opaque. The point at that depth travels with
+ * the pixel, so rounding to pixel centres doesn't add up over frames.
+ * reproject() splats the points into the new view, nearest first. The
+ * backends then only march the pixels that nothing landed on and the
+ * ones that can't be trusted.
+ *
+ * Some pixels are marched again rather than reused:
+ * - pixels that never turned half opaque;
+ * - pixels on a depth edge, whose colour mixes two surfaces;
+ * - pixels reprojected mMaxAge times in a row.
+ * Ages start staggered, so the refreshes spread over frames.
+ *
+ * The OptiX backend keeps the frame and points on the device and warps
+ * them there with the same math, programs/reprojection.h, so it only
+ * uses this class for deciding when the last frame can be reused.
+ */
+class Reprojection
+{
+public:
+    Stats mStats;
+
+    /* Neighbouring depths further apart than this, in world units, make
+       an edge */
+    float mMaxDepthStep = 0.02f;
+    /* Frames a pixel is reused for before it is marched again */
+    int mMaxAge = 8;
+
+    /* The warped frame: RGBA8 with alpha 255 on the reused pixels and 0
+       on those to march, rows bottom to top like the frame buffers */
+    std::vector<unsigned char> mFrame;
+
+    /* Forgets the stored frame, after anything but the camera changed */
+    void invalidate();
+
+    /* Whether the stored frame can be warped into the camera's view at
+       this size. If not the size is taken for the next frame */
+    bool warpable(const Camera& camera, int width, int height);
+
+    /* Warps the stored frame into the camera's view. False when there's
+       nothing to reuse and every pixel is marched */
+    bool reproject(const Camera& camera, int width, int height);
+
+    bool reused(size_t pixel) const { return mFrame[pixel * 4 + 3] != 0; }
+
+    /* Keeps the frame rendered after reproject() for the next one, with
+       the surface distances of its marched pixels */
+    void store(const Camera& camera, const unsigned char* frame, const float* surfaceDistances);
+
+    /* As store() for a frame stored elsewhere, returns its number for
+       reprojection_first_age() */
+    unsigned int stored(const Camera& camera);
+
+private:
+    bool mValid = false;
+    int mWidth = 0;
+    int mHeight = 0;
+    Camera mCamera;
+    unsigned int mFrameCount = 0;
+
+    /* The last frame, its surface points and their distances from its
+       camera, -1 where there's none, and reuse counts */
+    std::vector<unsigned char> mPrevious;
+    std::vector<vec3f> mPoints;
+    std::vector<float> mDistances;
+    std::vector<unsigned char> mAges;
+
+    /* The same warped into the current view */
+    std::vector<vec3f> mWarpedPoints;
+    std::vector<float> mWarpedDistances;
+    std::vector<unsigned char> mWarpedAges;
+
+    /* Whether a pixel of the last frame can be reused */
+    bool reusable(int x, int y) const;
+};
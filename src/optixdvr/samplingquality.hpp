@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+
+/**
+ * How finely rays sample the volume, shared by the OptiX and CPU
+ * backends. Fewer samples per voxel and an earlier termination trade
+ * image quality for speed. The opacity correction rescales every
+ * sample's alpha to the step actually taken, so coarser steps keep the
+ * volume about as opaque.
+ *
+ * The defaults are the Final preset, which is what the renderer always
+ * used.
+ */
+struct SamplingQuality
+{
+    enum Preset
+    {
+        Draft,
+        Interactive,
+        Final
+    };
+
+    /* Ray march steps per voxel along the ray */
+    float mSamplesPerVoxel = 2.0f;
+    /* Accumulated opacity at which a ray stops */
+    float mERTThreshold = 0.99f;
+    /* Steps across the unit volume the transfer function's opacities are
+       given for. Changes the look, not the cost, so presets keep it */
+    float mOpacityReference = 150.0f;
+
+    void apply(Preset preset)
+    {
+        switch(preset)
+        {
+        case Draft:
+            mSamplesPerVoxel = 0.5f;
+            mERTThreshold = 0.95f;
+            break;
+        case Interactive:
+            mSamplesPerVoxel = 1.0f;
+            mERTThreshold = 0.98f;
+            break;
+        case Final:
+            mSamplesPerVoxel = 2.0f;
+            mERTThreshold = 0.99f;
+            break;
+        }
+    }
+
+    static const char* name(Preset preset)
+    {
+        switch(preset)
+        {
+        case Draft: return "draft";
+        case Interactive: return "interactive";
+        default: return "final";
+        }
+    }
+
+    /* False if the name isn't a preset */
+    static bool parse(const std::string& name, Preset& preset)
+    {
+        for(int p = Draft; p <= Final; ++p)
+        {
+            if(name == SamplingQuality::name((Preset)p))
+            {
+                preset = (Preset)p;
+                return true;
+            }
+        }
+        return false;
+    }
+};
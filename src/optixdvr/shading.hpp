@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+
+#include "programs/vec.h"
+
+/**
+ * Gradient shading of the volume, shared by the OptiX and CPU backends.
+ * Samples the transfer function shows are lit by the point light with
+ * Blinn-Phong, their normal along the value gradient, see
+ * programs/shading.h.
+ *
+ * Gradients either come from 6 taps around every visible sample, or are
+ * read from normals precomputed for the paged bricks, see GradientPool.
+ * The first costs 6 more volume reads per visible sample and shows
+ * seams on the bricks' low faces, whose neighbours aren't in the brick.
+ * The second costs 4 bytes per pool voxel and a pass over the new bricks
+ * after every upload, and is only there at full resolution for volumes
+ * held in memory. Elsewhere gradients are taken on the fly.
+ */
+struct Shading
+{
+    enum Gradients
+    {
+        GradientsOnTheFly,
+        GradientsPrecomputed
+    };
+
+    Gradients mGradients = GradientsOnTheFly;
+
+    float mAmbient = 0.3f;
+    float mDiffuse = 0.7f;
+    float mSpecular = 0.3f;
+    float mShininess = 32.0f;
+    /* Gradient magnitude, in normalised value per voxel, below which a
+       sample is left unlit. Homogeneous regions have no surface to light */
+    float mMinGradient = 0.005f;
+
+    vec4f terms() const
+    {
+        return vec4f(mAmbient, mDiffuse, mSpecular, mShininess);
+    }
+
+    static const char* name(Gradients gradients)
+    {
+        return gradients == GradientsPrecomputed ? "precomputed" : "onthefly";
+    }
+
+    /* False if the name isn't a gradient source */
+    static bool parse(const std::string& name, Gradients& gradients)
+    {
+        for(int g = GradientsOnTheFly; g <= GradientsPrecomputed; ++g)
+        {
+            if(name == Shading::name((Gradients)g))
+            {
+                gradients = (Gradients)g;
+                return true;
+            }
+        }
+        return false;
+    }
+};
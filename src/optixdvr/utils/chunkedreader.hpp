@@ -0,0 +1,184 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "utils.h"
+
+namespace utils
+{
+    /**
+     * Reads a file into memory by splitting it into fixed size chunks that
+     * are pulled concurrently with pread(). With mDirectIO set, chunks are
+     * read with O_DIRECT (bypassing the page cache) where the platform and
+     * file system allow it, through an aligned bounce buffer if the
+     * destination itself isn't aligned. Falls back to a single fread on
+     * platforms without pread.
+     */
+    class ChunkedReader
+    {
+    public:
+        size_t mChunkSize = 16UL * 1024UL * 1024UL;
+        unsigned int mThreads = 0;
+        bool mDirectIO = false;
+
+        float mLastReadTime = 0.0f;
+        double mLastBandwidth = 0.0;
+
+        /* O_DIRECT needs offsets, sizes and buffers aligned to the block size */
+        static const size_t DirectAlignment = 4096;
+
+        size_t read(const char* path, char* destination, size_t bytes)
+        {
+            Timer timer;
+            timer.start();
+            size_t total = readChunks(path, destination, bytes);
+            timer.stop();
+
+            mLastReadTime = timer.getTime();
+            mLastBandwidth = mLastReadTime > 0.0f
+                ? ((double)total / (1024.0 * 1024.0)) / (mLastReadTime / 1000.0)
+                : 0.0;
+            return total;
+        }
+
+    private:
+#if defined(_WIN32) || defined(_WIN64)
+        size_t readChunks(const char* path, char* destination, size_t bytes)
+        {
+            FILE* fp = fopen(path, "rb");
+            if(fp == NULL)
+            {
+                return 0;
+            }
+            size_t total = fread(destination, 1, bytes, fp);
+            fclose(fp);
+            return total;
+        }
+#else
+        size_t chunkSize() const
+        {
+            /* Keep chunks a multiple of the direct I/O alignment */
+            size_t size = mChunkSize < DirectAlignment ? DirectAlignment : mChunkSize;
+            return (size / DirectAlignment) * DirectAlignment;
+        }
+
+        static size_t readFully(int fd, char* destination, size_t bytes, off_t offset)
+        {
+            size_t done = 0;
+            while(done < bytes)
+            {
+                ssize_t r = pread(fd, destination + done, bytes - done, offset + done);
+                if(r <= 0)
+                {
+                    break;
+                }
+                done += (size_t)r;
+            }
+            return done;
+        }
+
+        size_t readChunks(const char* path, char* destination, size_t bytes)
+        {
+            int fd = open(path, O_RDONLY);
+            if(fd < 0)
+            {
+                return 0;
+            }
+
+            int directfd = -1;
+#ifdef O_DIRECT
+            if(mDirectIO)
+            {
+                directfd = open(path, O_RDONLY | O_DIRECT);
+            }
+#endif
+
+            const size_t chunk = chunkSize();
+            const size_t chunks = (bytes + chunk - 1) / chunk;
+            unsigned int threads = mThreads ? mThreads : std::thread::hardware_concurrency();
+            if(threads == 0)
+            {
+                threads = 1;
+            }
+            if(threads > chunks)
+            {
+                threads = chunks ? (unsigned int)chunks : 1;
+            }
+
+            std::atomic<size_t> nextChunk(0);
+            std::atomic<size_t> total(0);
+            auto worker = [&]()
+            {
+                char* bounce = nullptr;
+                size_t c;
+                while((c = nextChunk++) < chunks)
+                {
+                    size_t offset = c * chunk;
+                    size_t length = (offset + chunk > bytes) ? bytes - offset : chunk;
+                    char* dst = destination + offset;
+                    size_t got = 0;
+
+                    /* The tail is usually not block aligned, so read it buffered */
+                    if(directfd >= 0 && length % DirectAlignment == 0)
+                    {
+                        if(((uintptr_t)dst % DirectAlignment) == 0)
+                        {
+                            got = readFully(directfd, dst, length, offset);
+                        }
+                        else
+                        {
+                            if(bounce == nullptr && posix_memalign((void**)&bounce, DirectAlignment, chunk) != 0)
+                            {
+                                bounce = nullptr;
+                            }
+                            if(bounce)
+                            {
+                                got = readFully(directfd, bounce, length, offset);
+                                memcpy(dst, bounce, got);
+                            }
+                        }
+                    }
+
+                    /* Anything direct I/O didn't deliver is read through the cache */
+                    if(got < length)
+                    {
+                        got += readFully(fd, dst + got, length - got, offset + got);
+                    }
+                    total += got;
+                }
+                free(bounce);
+            };
+
+            std::vector<std::thread> pool;
+            for(unsigned int t = 1; t < threads; ++t)
+            {
+                pool.push_back(std::thread(worker));
+            }
+            worker();
+            for(size_t t = 0; t < pool.size(); ++t)
+            {
+                pool[t].join();
+            }
+
+            if(directfd >= 0)
+            {
+                close(directfd);
+            }
+            close(fd);
+            return total;
+        }
+#endif
+    };
+}
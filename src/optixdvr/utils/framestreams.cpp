@@ -0,0 +1,430 @@
+#include "framestreams.hpp"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+    "FrameRing needs lock-free atomics to share them between processes");
+
+static const char FrameRingMagic[8] = {'D', 'V', 'R', 'R', 'I', 'N', 'G', '\0'};
+static const size_t FrameRingAlignment = 4096;
+
+static size_t alignUp(size_t bytes)
+{
+    return (bytes + FrameRingAlignment - 1) / FrameRingAlignment * FrameRingAlignment;
+}
+
+/* POSIX shared memory names start with a slash */
+static std::string segmentName(const std::string& name)
+{
+    return name.empty() || name[0] == '/' ? name : "/" + name;
+}
+
+static FrameRingSlot* ringSlot(const FrameRingHeader* header, uint64_t frame)
+{
+    const size_t slot = (size_t)(frame % header->mSlots);
+    return (FrameRingSlot*)((char*)header + alignUp(sizeof(FrameRingHeader)) + slot * header->mSlotStride);
+}
+
+FrameRing::~FrameRing()
+{
+    close();
+}
+
+bool FrameRing::create(size_t slotBytes)
+{
+    close();
+#if defined(_WIN32) || defined(_WIN64)
+    std::cerr << "==FrameRing== Shared memory frames need POSIX shared memory" << std::endl;
+    return false;
+#else
+    mSegmentName = segmentName(mName);
+    const size_t slots = std::max(mSlots, (size_t)2);
+    const size_t stride = alignUp(alignUp(sizeof(FrameRingSlot)) + slotBytes);
+    const size_t bytes = alignUp(sizeof(FrameRingHeader)) + slots * stride;
+
+    /* Start over from a segment left behind by a crashed producer */
+    shm_unlink(mSegmentName.c_str());
+    int fd = shm_open(mSegmentName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(fd < 0)
+    {
+        std::cerr << "==FrameRing== Can't create shared memory " << mSegmentName << std::endl;
+        return false;
+    }
+    if(ftruncate(fd, (off_t)bytes) != 0)
+    {
+        std::cerr << "==FrameRing== Can't size shared memory " << mSegmentName << std::endl;
+        ::close(fd);
+        shm_unlink(mSegmentName.c_str());
+        return false;
+    }
+    void* mapping = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(mapping == MAP_FAILED)
+    {
+        std::cerr << "==FrameRing== Can't map shared memory " << mSegmentName << std::endl;
+        shm_unlink(mSegmentName.c_str());
+        return false;
+    }
+
+    /* The segment comes zeroed, fill in the header last */
+    mSegmentBytes = bytes;
+    mHeader = new (mapping) FrameRingHeader;
+    mHeader->mVersion = Version;
+    mHeader->mSlots = (uint32_t)slots;
+    mHeader->mSlotBytes = slotBytes;
+    mHeader->mSlotStride = stride;
+    mHeader->mPublished.store(0, std::memory_order_relaxed);
+    mHeader->mClosed.store(0, std::memory_order_relaxed);
+    for(size_t s = 0; s < slots; ++s)
+    {
+        FrameRingSlot* slot = new (ringSlot(mHeader, s)) FrameRingSlot;
+        slot->mSequence.store(0, std::memory_order_relaxed);
+        slot->mWidth.store(0, std::memory_order_relaxed);
+        slot->mHeight.store(0, std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(mHeader->mMagic, FrameRingMagic, sizeof(FrameRingMagic));
+
+    mStats.set("ringbytes", bytes);
+    return true;
+#endif
+}
+
+void FrameRing::close()
+{
+#if !defined(_WIN32) && !defined(_WIN64)
+    if(mHeader)
+    {
+        mHeader->mClosed.store(1, std::memory_order_release);
+        munmap(mHeader, mSegmentBytes);
+        shm_unlink(mSegmentName.c_str());
+    }
+#endif
+    mHeader = nullptr;
+    mSegmentBytes = 0;
+}
+
+bool FrameRing::publish(int width, int height, const unsigned char* pixels)
+{
+    if(mName.empty() || mFailed)
+    {
+        return false;
+    }
+
+    utils::Timer timer;
+    timer.start();
+
+    const size_t bytes = (size_t)width * (size_t)height * 4;
+    if(!mHeader || bytes > mHeader->mSlotBytes || segmentName(mName) != mSegmentName)
+    {
+        if(!create(bytes))
+        {
+            /* Don't try again every frame */
+            mFailed = true;
+            return false;
+        }
+    }
+
+    const uint64_t frame = mHeader->mPublished.load(std::memory_order_relaxed);
+    FrameRingSlot* slot = ringSlot(mHeader, frame);
+    slot->mSequence.store(2 * frame + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->mWidth.store((uint32_t)width, std::memory_order_relaxed);
+    slot->mHeight.store((uint32_t)height, std::memory_order_relaxed);
+    memcpy((char*)slot + alignUp(sizeof(FrameRingSlot)), pixels, bytes);
+    slot->mSequence.store(2 * frame + 2, std::memory_order_release);
+    mHeader->mPublished.store(frame + 1, std::memory_order_release);
+
+    timer.stop();
+    mStats.set("ringframes", (double)(frame + 1));
+    mStats.set("ringpublishtime", timer.getTime());
+    return true;
+}
+
+FrameRingReader::~FrameRingReader()
+{
+    detach();
+}
+
+bool FrameRingReader::attach(const std::string& name)
+{
+    detach();
+#if defined(_WIN32) || defined(_WIN64)
+    return false;
+#else
+    const std::string segment = segmentName(name);
+    int fd = shm_open(segment.c_str(), O_RDONLY, 0);
+    if(fd < 0)
+    {
+        return false;
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(FrameRingHeader))
+    {
+        ::close(fd);
+        return false;
+    }
+    void* mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(mapping == MAP_FAILED)
+    {
+        return false;
+    }
+
+    const FrameRingHeader* header = (const FrameRingHeader*)mapping;
+    if(memcmp(header->mMagic, FrameRingMagic, sizeof(FrameRingMagic)) != 0
+        || header->mVersion != FrameRing::Version)
+    {
+        /* Not a ring, or not filled in yet */
+        munmap(mapping, (size_t)info.st_size);
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    mHeader = header;
+    mSegmentBytes = (size_t)info.st_size;
+    mLastFrame = 0;
+    return true;
+#endif
+}
+
+void FrameRingReader::detach()
+{
+#if !defined(_WIN32) && !defined(_WIN64)
+    if(mHeader)
+    {
+        munmap((void*)mHeader, mSegmentBytes);
+    }
+#endif
+    mHeader = nullptr;
+    mSegmentBytes = 0;
+}
+
+bool FrameRingReader::closed() const
+{
+    return mHeader && mHeader->mClosed.load(std::memory_order_acquire);
+}
+
+bool FrameRingReader::read(std::vector<unsigned char>& pixels, int& width, int& height, uint64_t& frame)
+{
+    if(!mHeader)
+    {
+        return false;
+    }
+
+    /* Only lost if the producer laps the ring while this copies, which
+       takes a very slow reader more than once in a row */
+    for(int attempt = 0; attempt < 4; ++attempt)
+    {
+        const uint64_t published = mHeader->mPublished.load(std::memory_order_acquire);
+        if(published == 0 || published == mLastFrame)
+        {
+            return false;
+        }
+        const uint64_t newest = published - 1;
+        const FrameRingSlot* slot = ringSlot(mHeader, newest);
+        const uint64_t sequence = slot->mSequence.load(std::memory_order_acquire);
+        if(sequence != 2 * newest + 2)
+        {
+            continue;
+        }
+
+        const uint32_t w = slot->mWidth.load(std::memory_order_relaxed);
+        const uint32_t h = slot->mHeight.load(std::memory_order_relaxed);
+        const size_t bytes = std::min((size_t)w * (size_t)h * 4, (size_t)mHeader->mSlotBytes);
+        pixels.resize(bytes);
+        memcpy(pixels.data(), (const char*)slot + alignUp(sizeof(FrameRingSlot)), bytes);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(slot->mSequence.load(std::memory_order_relaxed) != sequence)
+        {
+            continue;
+        }
+        width = (int)w;
+        height = (int)h;
+        frame = newest;
+        mLastFrame = published;
+        return true;
+    }
+    return false;
+}
+
+FramePipe::~FramePipe()
+{
+    close();
+}
+
+bool FramePipe::open(int width, int height)
+{
+    std::string command = mCommand;
+    const std::string sizes[2][2] = {
+        {"{width}", std::to_string(width)},
+        {"{height}", std::to_string(height)}
+    };
+    for(int i = 0; i < 2; ++i)
+    {
+        for(size_t at = command.find(sizes[i][0]); at != std::string::npos; at = command.find(sizes[i][0], at))
+        {
+            command.replace(at, sizes[i][0].size(), sizes[i][1]);
+        }
+    }
+
+#if defined(_WIN32) || defined(_WIN64)
+    mPipe = _popen(command.c_str(), "wb");
+#else
+    mPipe = popen(command.c_str(), "w");
+#endif
+    if(!mPipe)
+    {
+        std::cerr << "==FramePipe== Can't start " << command << std::endl;
+        return false;
+    }
+
+    mWidth = width;
+    mHeight = height;
+    const size_t bytes = (size_t)width * (size_t)height * 4;
+    mPending.resize(bytes);
+    mWriting.resize(bytes);
+    mHasPending = false;
+    mStop = false;
+    mWriter = std::thread(&FramePipe::run, this);
+    return true;
+}
+
+void FramePipe::close()
+{
+    if(!mPipe)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+    mWork.notify_all();
+    mWriter.join();
+
+#if defined(_WIN32) || defined(_WIN64)
+    _pclose(mPipe);
+#else
+    /* pclose flushes what a failed write left behind, which raises
+       SIGPIPE here too once the child is gone. Block it and drop it if
+       it came, the process's handling stays as the host set it */
+    sigset_t pipeSignal, previous;
+    sigemptyset(&pipeSignal);
+    sigaddset(&pipeSignal, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeSignal, &previous);
+    pclose(mPipe);
+    sigset_t pending;
+    sigpending(&pending);
+    if(sigismember(&pending, SIGPIPE) && !sigismember(&previous, SIGPIPE))
+    {
+        const struct timespec now = {0, 0};
+        sigtimedwait(&pipeSignal, nullptr, &now);
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+#endif
+    mPipe = nullptr;
+    mStats.set("pipeframes", mSent);
+    mStats.set("pipedropped", mDropped);
+}
+
+void FramePipe::publish(int width, int height, const unsigned char* pixels)
+{
+    if(mCommand.empty() || mFailed)
+    {
+        return;
+    }
+    if(!mPipe && !open(width, height))
+    {
+        mFailed = true;
+        return;
+    }
+
+    utils::Timer timer;
+    timer.start();
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    if(width != mWidth || height != mHeight)
+    {
+        mDropped++;
+    }
+    else
+    {
+        if(mHasPending && !mDropFrames)
+        {
+            mTaken.wait(lock, [this]{ return !mHasPending || mFailed; });
+        }
+        if(mHasPending)
+        {
+            /* The child hasn't kept up, the newest frame goes instead */
+            mDropped++;
+        }
+        memcpy(mPending.data(), pixels, mPending.size());
+        mHasPending = true;
+        mWork.notify_one();
+    }
+
+    timer.stop();
+    mStats.set("pipeframes", mSent);
+    mStats.set("pipedropped", mDropped);
+    mStats.set("pipepublishtime", timer.getTime());
+}
+
+void FramePipe::run()
+{
+#if !defined(_WIN32) && !defined(_WIN64)
+    /* A child that quits should fail the writes with EPIPE, not end the
+       process. Only this thread writes to the pipe, so SIGPIPE is
+       blocked here rather than ignored process wide */
+    sigset_t pipeSignal;
+    sigemptyset(&pipeSignal);
+    sigaddset(&pipeSignal, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeSignal, nullptr);
+#endif
+
+    const size_t rowBytes = (size_t)mWidth * 4;
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(true)
+    {
+        mWork.wait(lock, [this]{ return mStop || mHasPending; });
+        if(!mHasPending)
+        {
+            return;
+        }
+        mPending.swap(mWriting);
+        mHasPending = false;
+        mTaken.notify_all();
+        lock.unlock();
+
+        /* Raw video goes top down, frames bottom up */
+        bool written = true;
+        for(int y = mHeight - 1; y >= 0 && written; --y)
+        {
+            written = fwrite(&mWriting[y * rowBytes], 1, rowBytes, mPipe) == rowBytes;
+        }
+        written = written && fflush(mPipe) == 0;
+
+        lock.lock();
+        if(!written)
+        {
+            std::cerr << "==FramePipe== " << mCommand << " stopped taking frames" << std::endl;
+            mFailed = true;
+            mTaken.notify_all();
+            return;
+        }
+        mSent++;
+    }
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#include "stats.hpp"
+
+/*
+ * Live frame output for consumers outside the renderer, without files or
+ * per-frame allocations. FrameRing shares frames with any number of
+ * readers through POSIX shared memory, FramePipe streams them to a child
+ * process's stdin. Neither lets a slow consumer hold up rendering.
+ */
+
+/* Layout of a FrameRing segment: this header, then mSlots slots of
+   mSlotStride bytes, each a FrameRingSlot followed by its pixels */
+struct FrameRingHeader
+{
+    char mMagic[8];
+    uint32_t mVersion;
+    uint32_t mSlots;
+    uint64_t mSlotBytes;
+    uint64_t mSlotStride;
+    /* Frames published, the newest is in slot (mPublished - 1) % mSlots */
+    std::atomic<uint64_t> mPublished;
+    /* Set when the producer leaves the segment, readers attach again */
+    std::atomic<uint32_t> mClosed;
+};
+
+struct FrameRingSlot
+{
+    /* Seqlock: 2n + 1 while frame n is written, 2n + 2 once it is */
+    std::atomic<uint64_t> mSequence;
+    std::atomic<uint32_t> mWidth;
+    std::atomic<uint32_t> mHeight;
+};
+
+/**
+ * Single producer, many consumer ring of frames in a POSIX shared memory
+ * segment, /dev/shm/<mName> on Linux. Frames are RGBA8, bottom row
+ * first as rendered. The producer never waits: every slot is guarded by
+ * a seqlock, and a reader whose slot got overwritten while it copied
+ * sees the sequence change and tries the newest frame again. With the
+ * default 3 slots a reader has two frame times to copy a frame.
+ *
+ * The segment is created on the first publish(), sized for that frame.
+ * A larger frame replaces it with a larger one under the same name,
+ * marking the old one closed for readers to attach again.
+ */
+class FrameRing
+{
+public:
+    static const uint32_t Version = 1;
+
+    Stats mStats;
+    /* Segment name, nothing is published while empty */
+    std::string mName;
+    size_t mSlots = 3;
+
+    ~FrameRing();
+
+    bool publish(int width, int height, const unsigned char* pixels);
+    /* Marks the segment closed and removes its name */
+    void close();
+    bool isOpen() const { return mHeader != nullptr; }
+
+private:
+    FrameRingHeader* mHeader = nullptr;
+    size_t mSegmentBytes = 0;
+    std::string mSegmentName;
+    bool mFailed = false;
+
+    bool create(size_t slotBytes);
+};
+
+/**
+ * Attaches to a FrameRing from another process, or the same one.
+ */
+class FrameRingReader
+{
+public:
+    ~FrameRingReader();
+
+    bool attach(const std::string& name);
+    void detach();
+    bool isAttached() const { return mHeader != nullptr; }
+    /* The producer left this segment, attach again for its new one */
+    bool closed() const;
+
+    /* Copies the newest frame into pixels if it is newer than the one read
+       last. False if there is none, or it kept being overwritten */
+    bool read(std::vector<unsigned char>& pixels, int& width, int& height, uint64_t& frame);
+
+private:
+    const FrameRingHeader* mHeader = nullptr;
+    size_t mSegmentBytes = 0;
+    uint64_t mLastFrame = 0;
+};
+
+/**
+ * Streams frames as raw RGBA8, top row first, to the stdin of mCommand,
+ * e.g. ffmpeg -f rawvideo -pix_fmt rgba -s {width}x{height} -i - out.mp4.
+ * The command is started on the first publish(), with {width} and
+ * {height} replaced by that frame's size, and frames of any other size
+ * are dropped since a raw stream can't change size.
+ *
+ * A thread writes to the pipe, publish() only copies the frame into one
+ * of two buffers. If the child hasn't taken the previous frame yet, that
+ * frame is dropped for the new one, or with mDropFrames off publish()
+ * waits for it, for recordings that must keep every frame.
+ */
+class FramePipe
+{
+public:
+    Stats mStats;
+    /* Command to start, nothing is streamed while empty */
+    std::string mCommand;
+    bool mDropFrames = true;
+
+    ~FramePipe();
+
+    void publish(int width, int height, const unsigned char* pixels);
+    /* Sends the last frame, closes the pipe and waits for the child */
+    void close();
+    bool isOpen() const { return mPipe != nullptr; }
+
+private:
+    FILE* mPipe = nullptr;
+    int mWidth = 0;
+    int mHeight = 0;
+    /* Set by the writer thread when the child stops reading */
+    std::atomic<bool> mFailed{false};
+
+    std::vector<unsigned char> mPending;
+    std::vector<unsigned char> mWriting;
+    bool mHasPending = false;
+    size_t mSent = 0;
+    size_t mDropped = 0;
+
+    std::thread mWriter;
+    std::mutex mMutex;
+    std::condition_variable mWork;
+    std::condition_variable mTaken;
+    bool mStop = false;
+
+    bool open(int width, int height);
+    void run();
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <string.h>
+
+/* IEEE 754 half floats on the host: the brick pool stores bricks
+   quantised to halfs, the CPU renderer reads them back */
+
+/* Rounds to nearest even, overflowing to inf */
+inline unsigned short floatToHalf(float f)
+{
+    unsigned int x;
+    memcpy(&x, &f, sizeof(float));
+    unsigned int sign = (x >> 16) & 0x8000;
+    int exponent = (int)((x >> 23) & 0xff) - 127 + 15;
+    unsigned int mantissa = x & 0x7fffff;
+
+    /* Inf / NaN */
+    if(((x >> 23) & 0xff) == 0xff)
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+
+    /* Overflow to inf */
+    if(exponent >= 31)
+        return sign | 0x7c00;
+
+    /* Subnormal or zero */
+    if(exponent <= 0)
+    {
+        if(exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        unsigned int shift = 14 - exponent;
+        unsigned int half = mantissa >> shift;
+        unsigned int remainder = mantissa & ((1u << shift) - 1);
+        unsigned int halfway = 1u << (shift - 1);
+        if(remainder > halfway || (remainder == halfway && (half & 1)))
+            half++;
+        return sign | half;
+    }
+
+    /* Round to nearest even, a carry correctly bumps the exponent */
+    unsigned int half = sign | (exponent << 10) | (mantissa >> 13);
+    unsigned int remainder = mantissa & 0x1fff;
+    if(remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+        half++;
+    return half;
+}
+
+/* Exact, every half is a float */
+inline float halfToFloat(unsigned short h)
+{
+    unsigned int sign = (unsigned int)(h & 0x8000) << 16;
+    unsigned int exponent = (h >> 10) & 0x1f;
+    unsigned int mantissa = h & 0x3ff;
+    unsigned int x;
+    if(exponent == 0)
+    {
+        if(mantissa == 0)
+        {
+            x = sign;
+        }
+        else
+        {
+            /* Normalise the subnormal */
+            exponent = 127 - 15 + 1;
+            while(!(mantissa & 0x400))
+            {
+                mantissa <<= 1;
+                exponent--;
+            }
+            mantissa &= 0x3ff;
+            x = sign | (exponent << 23) | (mantissa << 13);
+        }
+    }
+    else if(exponent == 31)
+    {
+        x = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else
+    {
+        x = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+    float f;
+    memcpy(&f, &x, sizeof(float));
+    return f;
+}
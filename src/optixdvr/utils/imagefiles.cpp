@@ -0,0 +1,280 @@
+#include "imagefiles.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <zlib.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* Rows deflated as one unit. Small enough to go round the threads on
+   small frames, large enough that the dictionary resets don't show */
+static const size_t STRIP_ROWS = 64;
+
+static bool writeFile(const std::string& path, const std::vector<unsigned char>& bytes)
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    if(!file)
+    {
+        std::cerr << "==ImageFiles== Can't open " << path << " for writing" << std::endl;
+        return false;
+    }
+    const size_t written = fwrite(bytes.data(), 1, bytes.size(), file);
+    const bool closed = fclose(file) == 0;
+    if(written != bytes.size() || !closed)
+    {
+        std::cerr << "==ImageFiles== Failed writing " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool writePPM(const std::string& path, size_t width, size_t height, const unsigned char* pixels)
+{
+    const std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+    std::vector<unsigned char> bytes(header.size() + width * height * 3);
+    std::copy(header.begin(), header.end(), bytes.begin());
+
+    unsigned char* out = &bytes[header.size()];
+    for(size_t y = height; y-- > 0;)
+    {
+        const unsigned char* row = pixels + y * width * 4;
+        for(size_t x = 0; x < width; ++x)
+        {
+            out[0] = row[4 * x + 0];
+            out[1] = row[4 * x + 1];
+            out[2] = row[4 * x + 2];
+            out += 3;
+        }
+    }
+    return writeFile(path, bytes);
+}
+
+static inline unsigned char paeth(int a, int b, int c)
+{
+    const int p = a + b - c;
+    const int pa = abs(p - a);
+    const int pb = abs(p - b);
+    const int pc = abs(p - c);
+    if(pa <= pb && pa <= pc)
+        return (unsigned char)a;
+    return (unsigned char)(pb <= pc ? b : c);
+}
+
+/* Filters a row with each of the five PNG filters and keeps the one with
+   the smallest sum of signed bytes, libpng's default heuristic. previous
+   is nullptr for the first row */
+static void filterRow(
+    const unsigned char* row,
+    const unsigned char* previous,
+    size_t bytes,
+    unsigned char* candidates,
+    unsigned char* out
+){
+    const size_t bpp = 4;
+    unsigned char* none = candidates;
+    unsigned char* sub = candidates + bytes;
+    unsigned char* up = candidates + 2 * bytes;
+    unsigned char* average = candidates + 3 * bytes;
+    unsigned char* predicted = candidates + 4 * bytes;
+
+    /* The first pixel has no left neighbour, nor up on the first row */
+    for(size_t i = 0; i < bpp; ++i)
+    {
+        const int u = previous ? previous[i] : 0;
+        none[i] = row[i];
+        sub[i] = row[i];
+        up[i] = (unsigned char)(row[i] - u);
+        average[i] = (unsigned char)(row[i] - u / 2);
+        predicted[i] = (unsigned char)(row[i] - u);
+    }
+    if(!previous)
+    {
+        for(size_t i = bpp; i < bytes; ++i)
+        {
+            const int l = row[i - bpp];
+            none[i] = row[i];
+            sub[i] = (unsigned char)(row[i] - l);
+            up[i] = row[i];
+            average[i] = (unsigned char)(row[i] - l / 2);
+            predicted[i] = (unsigned char)(row[i] - l);
+        }
+    }
+    else
+    {
+        for(size_t i = bpp; i < bytes; ++i)
+        {
+            const int l = row[i - bpp];
+            const int u = previous[i];
+            none[i] = row[i];
+            sub[i] = (unsigned char)(row[i] - l);
+            up[i] = (unsigned char)(row[i] - u);
+            average[i] = (unsigned char)(row[i] - (l + u) / 2);
+            predicted[i] = (unsigned char)(row[i] - paeth(l, u, previous[i - bpp]));
+        }
+    }
+    size_t best = 0;
+    size_t bestSum = (size_t)-1;
+    for(size_t f = 0; f < 5; ++f)
+    {
+        const unsigned char* filtered = candidates + f * bytes;
+        size_t sum = 0;
+        for(size_t i = 0; i < bytes; ++i)
+        {
+            sum += filtered[i] < 128 ? filtered[i] : 256 - filtered[i];
+        }
+        if(sum < bestSum)
+        {
+            bestSum = sum;
+            best = f;
+        }
+    }
+    out[0] = (unsigned char)best;
+    std::copy(candidates + best * bytes, candidates + (best + 1) * bytes, out + 1);
+}
+
+static void appendU32(std::vector<unsigned char>& bytes, unsigned long v)
+{
+    bytes.push_back((unsigned char)(v >> 24));
+    bytes.push_back((unsigned char)(v >> 16));
+    bytes.push_back((unsigned char)(v >> 8));
+    bytes.push_back((unsigned char)v);
+}
+
+static void appendChunk(std::vector<unsigned char>& bytes, const char* type, const unsigned char* data, size_t size)
+{
+    appendU32(bytes, size);
+    const size_t start = bytes.size();
+    bytes.insert(bytes.end(), type, type + 4);
+    bytes.insert(bytes.end(), data, data + size);
+    appendU32(bytes, crc32(0L, &bytes[start], (uInt)(size + 4)));
+}
+
+bool writePNG(
+    const std::string& path,
+    size_t width,
+    size_t height,
+    const unsigned char* pixels,
+    int compression,
+    unsigned int threads
+){
+    if(width == 0 || height == 0)
+    {
+        std::cerr << "==ImageFiles== Can't write an empty PNG to " << path << std::endl;
+        return false;
+    }
+
+    const size_t rowBytes = width * 4;
+    const int strips = (int)((height + STRIP_ROWS - 1) / STRIP_ROWS);
+    const int level = compression < 0 ? Z_DEFAULT_COMPRESSION : std::min(compression, 9);
+
+    std::vector<std::vector<unsigned char>> deflated(strips);
+    std::vector<uLong> checksums(strips);
+    std::vector<uLong> lengths(strips);
+    bool failed = false;
+
+#ifdef _OPENMP
+    const int teams = threads ? (int)threads : omp_get_max_threads();
+#endif
+    #pragma omp parallel num_threads(teams)
+    {
+        std::vector<unsigned char> filtered;
+        std::vector<unsigned char> candidates(5 * rowBytes);
+
+        #pragma omp for schedule(dynamic)
+        for(int s = 0; s < strips; ++s)
+        {
+            /* File rows go top down, the frame's bottom up */
+            const size_t first = s * STRIP_ROWS;
+            const size_t rows = std::min(STRIP_ROWS, height - first);
+            filtered.resize(rows * (rowBytes + 1));
+            for(size_t r = 0; r < rows; ++r)
+            {
+                const size_t y = height - 1 - (first + r);
+                const unsigned char* previous = y + 1 < height ? pixels + (y + 1) * rowBytes : nullptr;
+                filterRow(pixels + y * rowBytes, previous, rowBytes, &candidates[0], &filtered[r * (rowBytes + 1)]);
+            }
+            checksums[s] = adler32(adler32(0L, Z_NULL, 0), filtered.data(), (uInt)filtered.size());
+            lengths[s] = (uLong)filtered.size();
+
+            /* Raw deflate, every strip but the last ends byte aligned
+               without a final block so that they concatenate. Filtered
+               strategy as libpng, it suits filtered rows */
+            z_stream stream = z_stream();
+            if(deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_FILTERED) != Z_OK)
+            {
+                #pragma omp atomic write
+                failed = true;
+                continue;
+            }
+            std::vector<unsigned char>& out = deflated[s];
+            out.resize(deflateBound(&stream, filtered.size()) + 16);
+            stream.next_in = filtered.data();
+            stream.avail_in = (uInt)filtered.size();
+            stream.next_out = out.data();
+            stream.avail_out = (uInt)out.size();
+            const int flush = s == strips - 1 ? Z_FINISH : Z_SYNC_FLUSH;
+            const int result = deflate(&stream, flush);
+            if(result != (flush == Z_FINISH ? Z_STREAM_END : Z_OK) || stream.avail_in != 0)
+            {
+                #pragma omp atomic write
+                failed = true;
+            }
+            out.resize(out.size() - stream.avail_out);
+            deflateEnd(&stream);
+        }
+    }
+    if(failed)
+    {
+        std::cerr << "==ImageFiles== Failed deflating " << path << std::endl;
+        return false;
+    }
+
+    /* One IDAT chunk per strip, together a zlib stream around the
+       strips with their checksums combined */
+    uLong checksum = adler32(0L, Z_NULL, 0);
+    for(int s = 0; s < strips; ++s)
+    {
+        checksum = adler32_combine(checksum, checksums[s], lengths[s]);
+    }
+    deflated.front().insert(deflated.front().begin(), {0x78, 0x9c});
+    appendU32(deflated.back(), checksum);
+
+    std::vector<unsigned char> bytes;
+    const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    bytes.insert(bytes.end(), signature, signature + 8);
+    std::vector<unsigned char> header;
+    appendU32(header, width);
+    appendU32(header, height);
+    /* 8 bit RGBA, deflate, adaptive filtering, not interlaced */
+    const unsigned char format[5] = {8, 6, 0, 0, 0};
+    header.insert(header.end(), format, format + 5);
+    appendChunk(bytes, "IHDR", header.data(), header.size());
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if(!file)
+    {
+        std::cerr << "==ImageFiles== Can't open " << path << " for writing" << std::endl;
+        return false;
+    }
+    bool written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    for(int s = 0; s < strips && written; ++s)
+    {
+        bytes.clear();
+        appendChunk(bytes, "IDAT", deflated[s].data(), deflated[s].size());
+        written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    }
+    bytes.clear();
+    appendChunk(bytes, "IEND", nullptr, 0);
+    written = written && fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    if(fclose(file) != 0 || !written)
+    {
+        std::cerr << "==ImageFiles== Failed writing " << path << std::endl;
+        return false;
+    }
+    return true;
+}
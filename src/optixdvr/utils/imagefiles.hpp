@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/*
+ * Image files written from RGBA8 frames whose bottom row comes first, as
+ * the renderer leaves them, much faster than savePPM.h.
+ *
+ * writePPM converts and flips the frame in one pass into a single buffer
+ * and writes it in one go. writePNG splits the frame into strips of rows
+ * that are filtered and deflated independently on OpenMP threads, then
+ * joined into one zlib stream, much as pigz does. Back references can't
+ * cross a strip, which costs well under a percent of the file size.
+ *
+ * Both return false, after saying why, if the file can't be written.
+ */
+
+/* RGB 'P6' PPM, alpha is dropped */
+bool writePPM(const std::string& path, size_t width, size_t height, const unsigned char* pixels);
+
+/* RGBA PNG at zlib level compression, 0 to 9 or -1 for zlib's default, on
+   up to threads threads, 0 for OpenMP's default */
+bool writePNG(
+    const std::string& path,
+    size_t width,
+    size_t height,
+    const unsigned char* pixels,
+    int compression = -1,
+    unsigned int threads = 0
+);
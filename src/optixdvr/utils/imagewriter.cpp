@@ -0,0 +1,155 @@
+#include "imagewriter.hpp"
+#include "imagefiles.hpp"
+#include "savePPM.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstring>
+
+ImageWriter::~ImageWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+    mWork.notify_all();
+    for(size_t i = 0; i < mWorkers.size(); ++i)
+    {
+        mWorkers[i].join();
+    }
+}
+
+void ImageWriter::save(const std::string& path, int width, int height, const unsigned char* pixels)
+{
+    utils::Timer timer;
+    timer.start();
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    if(mWorkers.empty())
+    {
+        const unsigned int cores = std::max(std::thread::hardware_concurrency(), 1u);
+        const unsigned int threads = std::max(mThreads ? mThreads : cores, 1u);
+        mDeflateThreads = std::max(cores / threads, 1u);
+        for(unsigned int i = 0; i < threads; ++i)
+        {
+            mWorkers.push_back(std::thread(&ImageWriter::worker, this));
+        }
+    }
+    mDone.wait(lock, [this]{ return mJobs.size() < std::max(mQueueLength, (size_t)1); });
+    timer.stop();
+
+    Job job;
+    job.mPath = path;
+    job.mWidth = width;
+    job.mHeight = height;
+    job.mFormat = mFormat;
+    job.mCompression = mCompression;
+    if(!mSpare.empty())
+    {
+        job.mPixels.swap(mSpare.back());
+        mSpare.pop_back();
+    }
+    /* Copy outside the lock, the workers only need it to take jobs */
+    lock.unlock();
+    const size_t bytes = (size_t)width * (size_t)height * 4;
+    job.mPixels.resize(bytes);
+    memcpy(&job.mPixels[0], pixels, bytes);
+    lock.lock();
+
+    mJobs.push_back(std::move(job));
+    mPending++;
+    mStats.set("encodewaittime", mStats.get("encodewaittime") + timer.getTime());
+    mStats.set("encodequeue", mJobs.size());
+    mStats.set("encodedimages", mWritten);
+    mStats.set("encodetime", mWritten ? mEncodeTime / (float)mWritten : 0.0f);
+    lock.unlock();
+    mWork.notify_one();
+}
+
+void ImageWriter::flush()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDone.wait(lock, [this]{ return mPending == 0; });
+    mStats.set("encodequeue", 0);
+    mStats.set("encodedimages", mWritten);
+    mStats.set("encodetime", mWritten ? mEncodeTime / (float)mWritten : 0.0f);
+}
+
+void ImageWriter::worker()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(true)
+    {
+        mWork.wait(lock, [this]{ return mStop || !mJobs.empty(); });
+        if(mJobs.empty())
+        {
+            return;
+        }
+        Job job = std::move(mJobs.front());
+        mJobs.pop_front();
+        /* Room in the queue for save() */
+        mDone.notify_all();
+        lock.unlock();
+
+        utils::Timer timer;
+        timer.start();
+        write(job.mPath, job.mWidth, job.mHeight, &job.mPixels[0], job.mFormat, job.mCompression, mDeflateThreads);
+        timer.stop();
+
+        lock.lock();
+        mSpare.push_back(std::move(job.mPixels));
+        mEncodeTime += timer.getTime();
+        mWritten++;
+        mPending--;
+        mDone.notify_all();
+    }
+}
+
+const char* ImageWriter::extension(Format format)
+{
+    switch(format)
+    {
+    case FormatPPM:
+        return "ppm";
+    case FormatQOI:
+        return "qoi";
+    default:
+        return "png";
+    }
+}
+
+bool ImageWriter::parse(const std::string& name, Format& format)
+{
+    for(int f = FormatPNG; f <= FormatQOI; ++f)
+    {
+        if(name == extension((Format)f))
+        {
+            format = (Format)f;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ImageWriter::write(
+    const std::string& path,
+    int width,
+    int height,
+    const unsigned char* pixels,
+    Format format,
+    int compression,
+    unsigned int threads
+){
+    switch(format)
+    {
+    case FormatPPM:
+        writePPM(path, width, height, pixels);
+        break;
+    case FormatQOI:
+        saveQOI(path, width, height, pixels);
+        break;
+    default:
+        writePNG(path, width, height, pixels, compression, threads);
+        break;
+    }
+}
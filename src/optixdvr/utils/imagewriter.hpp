@@ -0,0 +1,94 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stats.hpp"
+
+/**
+ * Writes frames to image files on a pool of threads, so that rendering
+ * the next frame overlaps encoding the last. save() copies the frame into
+ * a queue of at most mQueueLength images and returns, only waiting when
+ * the queue is full. Image buffers are recycled, so a capture at a fixed
+ * size stops allocating once the queue has filled once.
+ *
+ * PNG spends most of its time in zlib, mCompression trades file size for
+ * that time. PPM and QOI skip zlib altogether, QOI still being lossless
+ * with alpha at a few times PPM's compression.
+ */
+class ImageWriter
+{
+public:
+    enum Format
+    {
+        FormatPNG,
+        FormatPPM,
+        FormatQOI
+    };
+
+    Stats mStats;
+    Format mFormat = FormatPNG;
+    /* zlib level of PNGs, 0 to 9, -1 for libpng's default */
+    int mCompression = -1;
+    /* Images waiting to be written before save() blocks */
+    size_t mQueueLength = 4;
+    /* Encoding threads, 0 for one per core. Taken on the first save() */
+    unsigned int mThreads = 2;
+
+    ~ImageWriter();
+
+    /* Queues RGBA8 pixels, bottom row first, to be written to path in
+       mFormat. Called from one thread at a time */
+    void save(const std::string& path, int width, int height, const unsigned char* pixels);
+    /* Waits until every queued image has been written */
+    void flush();
+
+    /* File extension of a format, without the dot */
+    static const char* extension(Format format);
+    /* False if the name isn't a format's extension */
+    static bool parse(const std::string& name, Format& format);
+    /* Writes pixels to path at once, on the calling thread. PNGs are
+       deflated on up to threads threads, 0 for OpenMP's default */
+    static void write(
+        const std::string& path,
+        int width,
+        int height,
+        const unsigned char* pixels,
+        Format format,
+        int compression,
+        unsigned int threads = 0
+    );
+
+private:
+    struct Job
+    {
+        std::string mPath;
+        int mWidth;
+        int mHeight;
+        Format mFormat;
+        int mCompression;
+        std::vector<unsigned char> mPixels;
+    };
+
+    std::deque<Job> mJobs;
+    std::vector<std::vector<unsigned char>> mSpare;
+    /* Queued and being written */
+    size_t mPending = 0;
+    size_t mWritten = 0;
+    float mEncodeTime = 0.0f;
+
+    std::vector<std::thread> mWorkers;
+    /* Deflate threads of each worker, the cores shared between them so
+       the workers together don't oversubscribe them */
+    unsigned int mDeflateThreads = 1;
+    std::mutex mMutex;
+    std::condition_variable mWork;
+    std::condition_variable mDone;
+    bool mStop = false;
+
+    void worker();
+};
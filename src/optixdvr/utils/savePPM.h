@@ -20,7 +20,9 @@
 // ooawe
 #include "../programs/vec.h"
 // std
+#include <algorithm>
 #include <fstream>
+#include <string>
 #include <vector>
 #include <assert.h>
 #include <png.h>
@@ -45,11 +47,14 @@ inline void savePPM(const std::string &fileName,
   assert(file.good());
 }
 
+/*! compression is the zlib level, 0 (fastest) to 9 (smallest), or -1
+  for libpng's default */
 inline void savePNG(
   const std::string &fileName,
   const size_t Nx, 
   const size_t Ny, 
-  const unsigned char *pixels
+  const unsigned char *pixels,
+  const int compression = -1
 ){
   /* create file */
   FILE *fp = fopen(fileName.c_str(), "wb");
@@ -101,6 +106,9 @@ inline void savePNG(
     PNG_FILTER_TYPE_BASE
   );
 
+  if (compression >= 0)
+    png_set_compression_level(png_ptr, std::min(compression, 9));
+
   png_write_info(png_ptr, info_ptr);
 
 
@@ -121,4 +129,104 @@ inline void savePNG(
   png_destroy_write_struct(&png_ptr, (png_infopp)NULL);
 
   fclose(fp);
-}
\ No newline at end of file
+}
+
+/*! saving to a QOI file (https://qoiformat.org), lossless RGBA at a
+  fraction of the cost of zlib. Rows are written top down, like savePNG */
+inline void saveQOI(
+  const std::string &fileName,
+  const size_t Nx,
+  const size_t Ny,
+  const unsigned char *pixels
+){
+  FILE *fp = fopen(fileName.c_str(), "wb");
+  if (!fp)
+  {
+    printf("[write_qoi_file] File %s could not be opened for writing\n", fileName.c_str());
+    return;
+  }
+
+  /* worst case is a 5 byte RGBA op per pixel */
+  std::vector<unsigned char> bytes;
+  bytes.reserve(14 + Nx * Ny * 5 + 8);
+  const unsigned char header[14] = {
+    'q', 'o', 'i', 'f',
+    (unsigned char)(Nx >> 24), (unsigned char)(Nx >> 16), (unsigned char)(Nx >> 8), (unsigned char)Nx,
+    (unsigned char)(Ny >> 24), (unsigned char)(Ny >> 16), (unsigned char)(Ny >> 8), (unsigned char)Ny,
+    4, 0
+  };
+  bytes.insert(bytes.end(), header, header + 14);
+
+  unsigned char index[64][4] = {};
+  unsigned char prev[4] = {0, 0, 0, 255};
+  int run = 0;
+  for(int y = (int)Ny - 1; y >= 0; --y)
+  {
+    const unsigned char *row = &pixels[(Nx * y) * 4];
+    for(size_t x = 0; x < Nx; ++x)
+    {
+      const unsigned char *px = &row[x * 4];
+      if(px[0] == prev[0] && px[1] == prev[1] && px[2] == prev[2] && px[3] == prev[3])
+      {
+        if(++run == 62)
+        {
+          bytes.push_back((unsigned char)(0xc0 | (run - 1)));
+          run = 0;
+        }
+        continue;
+      }
+      if(run > 0)
+      {
+        bytes.push_back((unsigned char)(0xc0 | (run - 1)));
+        run = 0;
+      }
+
+      const int slot = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+      if(index[slot][0] == px[0] && index[slot][1] == px[1]
+        && index[slot][2] == px[2] && index[slot][3] == px[3])
+      {
+        bytes.push_back((unsigned char)slot);
+      }
+      else if(px[3] == prev[3])
+      {
+        const signed char dr = (signed char)(px[0] - prev[0]);
+        const signed char dg = (signed char)(px[1] - prev[1]);
+        const signed char db = (signed char)(px[2] - prev[2]);
+        const signed char drg = (signed char)(dr - dg);
+        const signed char dbg = (signed char)(db - dg);
+        if(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+        {
+          bytes.push_back((unsigned char)(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+        }
+        else if(dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7)
+        {
+          bytes.push_back((unsigned char)(0x80 | (dg + 32)));
+          bytes.push_back((unsigned char)((drg + 8) << 4 | (dbg + 8)));
+        }
+        else
+        {
+          const unsigned char op[4] = {0xfe, px[0], px[1], px[2]};
+          bytes.insert(bytes.end(), op, op + 4);
+        }
+      }
+      else
+      {
+        const unsigned char op[5] = {0xff, px[0], px[1], px[2], px[3]};
+        bytes.insert(bytes.end(), op, op + 5);
+      }
+
+      for(int c = 0; c < 4; ++c)
+      {
+        index[slot][c] = px[c];
+        prev[c] = px[c];
+      }
+    }
+  }
+  if(run > 0)
+    bytes.push_back((unsigned char)(0xc0 | (run - 1)));
+  const unsigned char end[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+  bytes.insert(bytes.end(), end, end + 8);
+
+  fwrite(&bytes[0], 1, bytes.size(), fp);
+  fclose(fp);
+}
@@ -0,0 +1,481 @@
+#include "brickcache.hpp"
+#include "bricksource.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+static const char BrickCacheMagic[8] = { 'O', 'D', 'V', 'R', 'B', 'C', 'C', 'H' };
+
+static uint64_t alignUp(uint64_t offset, uint64_t alignment)
+{
+    return ((offset + alignment - 1) / alignment) * alignment;
+}
+
+static bool writePadding(FILE* fp, uint64_t from, uint64_t to)
+{
+    static const char zeros[BrickCache::Alignment] = { 0 };
+    while(from < to)
+    {
+        size_t n = (size_t)std::min<uint64_t>(to - from, sizeof(zeros));
+        if(fwrite(zeros, 1, n, fp) != n)
+        {
+            return false;
+        }
+        from += n;
+    }
+    return true;
+}
+
+BrickCache::~BrickCache()
+{
+    unmap();
+}
+
+bool BrickCache::sourceInfo(const VolumeFile& file, uint64_t& size, int64_t& time)
+{
+    if(file.volumes.size() == 0)
+    {
+        return false;
+    }
+
+    struct stat info;
+    if(stat(file.volumes[0].c_str(), &info) != 0)
+    {
+        return false;
+    }
+    size = (uint64_t)info.st_size;
+    time = (int64_t)info.st_mtime;
+    return true;
+}
+
+void BrickCache::histogram(Volume* volume, float lo, float hi, std::vector<uint64_t>& bins)
+{
+    bins.assign(HistogramBins, 0);
+    const float range = hi > lo ? hi - lo : 1.0f;
+    const vec3size_t dims = volume->dataDimensions;
+
+    #pragma omp parallel
+    {
+        std::vector<uint64_t> local(HistogramBins, 0);
+
+        #pragma omp for collapse(2)
+        for(int z = 0; z < (int)dims.z; ++z)
+        {
+            for(int y = 0; y < (int)dims.y; ++y)
+            {
+                for(size_t x = 0; x < dims.x; ++x)
+                {
+                    float v = volume->GetNormalisedVoxel(vec3f(x, y, z));
+                    int bin = (int)((v - lo) / range * (float)HistogramBins);
+                    bin = bin < 0 ? 0 : (bin >= (int)HistogramBins ? (int)HistogramBins - 1 : bin);
+                    local[bin]++;
+                }
+            }
+        }
+
+        #pragma omp critical
+        for(size_t b = 0; b < HistogramBins; ++b)
+        {
+            bins[b] += local[b];
+        }
+    }
+}
+
+bool BrickCache::map(const std::string& path)
+{
+    unmap();
+
+#if defined(_WIN32) || defined(_WIN64)
+    FILE* fp = fopen(path.c_str(), "rb");
+    if(fp == NULL)
+    {
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    mMappingSize = (size_t)ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    mMapping = new char[mMappingSize];
+    size_t got = fread(mMapping, 1, mMappingSize, fp);
+    fclose(fp);
+    if(got != mMappingSize)
+    {
+        unmap();
+        return false;
+    }
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        return false;
+    }
+
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+    mMappingSize = (size_t)info.st_size;
+
+    /* Private and writable, so the volume can hand out a plain char* */
+    void* mapping = mmap(NULL, mMappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+    {
+        mMappingSize = 0;
+        return false;
+    }
+    mMapping = (char*)mapping;
+    mMapped = true;
+    madvise(mMapping, mMappingSize, MADV_WILLNEED);
+#endif
+    return true;
+}
+
+void BrickCache::unmap()
+{
+    if(mMapping == nullptr)
+    {
+        return;
+    }
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    if(mMapped)
+    {
+        munmap(mMapping, mMappingSize);
+    }
+    else
+#endif
+    {
+        delete[] mMapping;
+    }
+    mMapping = nullptr;
+    mMappingSize = 0;
+    mMapped = false;
+}
+
+bool BrickCache::matches(const Header& header, uint64_t fileSize, const VolumeFile& file)
+{
+    uint64_t sourceSize = 0;
+    int64_t sourceTime = 0;
+    return fileSize >= sizeof(Header)
+        && memcmp(header.mMagic, BrickCacheMagic, sizeof(BrickCacheMagic)) == 0
+        && header.mVersion == Version
+        && header.mFileSize == fileSize
+        && sourceInfo(file, sourceSize, sourceTime)
+        && header.mSourceSize == sourceSize
+        && header.mSourceTime == sourceTime
+        && header.mDataDimensions[0] == file.dataDimensions.x
+        && header.mDataDimensions[1] == file.dataDimensions.y
+        && header.mDataDimensions[2] == file.dataDimensions.z;
+}
+
+VolumeBrick BrickCache::brick(
+    const BrickRecord& record,
+    size_t index,
+    const vec3size_t& numBricks,
+    const vec3size_t& brickSize
+){
+    VolumeBrick brick;
+    brick.mBrickIndex.x = index % numBricks.x;
+    brick.mBrickIndex.y = (index / numBricks.x) % numBricks.y;
+    brick.mBrickIndex.z = index / (numBricks.x * numBricks.y);
+    brick.mDataDimensions = brickSize;
+    brick.mActualDimensions = brick.mDataDimensions + brick.mPadMin + brick.mPadMax;
+    brick.mDataTotal = record.mDataTotal;
+    brick.minValue = record.mMinValue;
+    brick.maxValue = record.mMaxValue;
+    brick.mScale = record.mScale;
+    brick.mOffset = record.mOffset;
+    brick.mQuantisationMaxError = record.mQuantisationMaxError;
+    brick.mQuantisationMeanError = record.mQuantisationMeanError;
+    return brick;
+}
+
+Volume* BrickCache::load(
+    const std::string& path,
+    const VolumeFile& file,
+    BrickedVolume* subdivision,
+    VolumeBrickPool* pool
+){
+    utils::Timer timer;
+    timer.start();
+    mStats.set("brickcachehit", 0);
+
+    if(!map(path))
+    {
+        return nullptr;
+    }
+
+    if(mMappingSize < sizeof(Header))
+    {
+        unmap();
+        return nullptr;
+    }
+
+    const Header* header = (const Header*)mMapping;
+    const vec3size_t leafSize = subdivision->get_brick_size();
+    const vec3size_t brickSize = pool->mBrickSize;
+    const uint32_t quantisation = header->mDataType == Volume::FLOAT
+        ? (uint32_t)pool->mQuantisation
+        : (uint32_t)VolumeBrickPool::QuantiseNone;
+
+    /* Caches written out-of-core have no voxels to rebrick from */
+    bool match = matches(*header, mMappingSize, file)
+        && header->mVolumeOffset != 0
+        && header->mLeafSize[0] == leafSize.x
+        && header->mLeafSize[1] == leafSize.y
+        && header->mLeafSize[2] == leafSize.z
+        && header->mBrickSize[0] == brickSize.x
+        && header->mBrickSize[1] == brickSize.y
+        && header->mBrickSize[2] == brickSize.z
+        && header->mQuantisation == quantisation;
+    if(!match)
+    {
+        std::cout << "==BrickCache== " << path << " doesn't match the volume, rebuilding" << std::endl;
+        unmap();
+        return nullptr;
+    }
+
+    /* The voxels stay in the mapping, nothing is copied */
+    Volume* volume = VolumeFile::createVolume((Volume::DataType)header->mDataType);
+    if(volume == nullptr)
+    {
+        unmap();
+        return nullptr;
+    }
+    volume->dataType = (Volume::DataType)header->mDataType;
+    volume->dataDimensions = vec3f(
+        header->mDataDimensions[0],
+        header->mDataDimensions[1],
+        header->mDataDimensions[2]
+    );
+    volume->volumeSize = vec3f(
+        header->mVolumeSize[0],
+        header->mVolumeSize[1],
+        header->mVolumeSize[2]
+    );
+    volume->dataLimits = volume->dataDimensions - vec3f(1.0f);
+    volume->voxelsTotal = (size_t)volume->dataDimensions.x
+        * (size_t)volume->dataDimensions.y
+        * (size_t)volume->dataDimensions.z;
+    volume->dataTotal = volume->bytesPerVoxel * volume->voxelsTotal;
+    volume->data = mMapping + header->mVolumeOffset;
+    volume->dataScale = header->mDataScale;
+    volume->dataOffset = header->mDataOffset;
+
+    const LeafRecord* leafRecords = (const LeafRecord*)(mMapping + header->mLeavesOffset);
+    std::vector<AccelerationLeaf> leaves(header->mNumLeaves);
+    for(size_t i = 0; i < leaves.size(); ++i)
+    {
+        leaves[i].mMinTFValue = leafRecords[i].mMinValue;
+        leaves[i].mMaxTFValue = leafRecords[i].mMaxValue;
+    }
+
+    vec3size_t numBricks;
+    numBricks.x = ceilf(volume->dataDimensions.x / (float)brickSize.x);
+    numBricks.y = ceilf(volume->dataDimensions.y / (float)brickSize.y);
+    numBricks.z = ceilf(volume->dataDimensions.z / (float)brickSize.z);
+    const BrickRecord* brickRecords = (const BrickRecord*)(mMapping + header->mBricksOffset);
+    std::vector<VolumeBrick> bricks(header->mNumBricks);
+    for(size_t i = 0; i < bricks.size(); ++i)
+    {
+        bricks[i] = brick(brickRecords[i], i, numBricks, brickSize);
+        bricks[i].mData = mMapping + brickRecords[i].mDataOffset;
+        bricks[i].mOwnsData = false;
+    }
+
+    const uint64_t* bins = (const uint64_t*)(mMapping + header->mHistogramOffset);
+    mHistogram.assign(bins, bins + HistogramBins);
+    mMinValue = header->mMinValue;
+    mMaxValue = header->mMaxValue;
+
+    subdivision->set_leaves(volume, leafSize, leaves);
+    pool->volume(volume, bricks);
+
+    timer.stop();
+    mStats.set("brickcachehit", 1);
+    mStats.set("brickcacheloadtime", timer.getTime());
+    std::cout << "==BrickCache== Loaded " << path << " in " << timer.getTime() << "ms" << std::endl;
+    return volume;
+}
+
+bool BrickCache::write(
+    const std::string& path,
+    const VolumeFile& file,
+    Volume* volume,
+    BrickedVolume* subdivision,
+    VolumeBrickPool* pool
+){
+    utils::Timer timer;
+    timer.start();
+
+    /* Only level 0 describes the volume. Out-of-core pools read bricks
+       without data back from their source, and store no voxels */
+    if(volume == nullptr || pool->mCurrentLevel != 0)
+    {
+        return false;
+    }
+    if(volume->data == nullptr && pool->mSource == nullptr)
+    {
+        return false;
+    }
+    for(size_t i = 0; pool->mSource == nullptr && i < pool->mBricks.size(); ++i)
+    {
+        if(pool->mBricks[i].mData == nullptr)
+        {
+            return false;
+        }
+    }
+
+    Header header;
+    memset(&header, 0, sizeof(Header));
+    memcpy(header.mMagic, BrickCacheMagic, sizeof(BrickCacheMagic));
+    header.mVersion = Version;
+    if(!sourceInfo(file, header.mSourceSize, header.mSourceTime))
+    {
+        return false;
+    }
+    header.mDataType = volume->dataType;
+    header.mBytesPerVoxel = volume->bytesPerVoxel;
+    header.mDataDimensions[0] = volume->dataDimensions.x;
+    header.mDataDimensions[1] = volume->dataDimensions.y;
+    header.mDataDimensions[2] = volume->dataDimensions.z;
+    header.mVolumeSize[0] = volume->volumeSize.x;
+    header.mVolumeSize[1] = volume->volumeSize.y;
+    header.mVolumeSize[2] = volume->volumeSize.z;
+    header.mDataScale = volume->dataScale;
+    header.mDataOffset = volume->dataOffset;
+
+    const vec3size_t leafSize = subdivision->get_brick_size();
+    header.mLeafSize[0] = leafSize.x;
+    header.mLeafSize[1] = leafSize.y;
+    header.mLeafSize[2] = leafSize.z;
+    header.mBrickSize[0] = pool->mBrickSize.x;
+    header.mBrickSize[1] = pool->mBrickSize.y;
+    header.mBrickSize[2] = pool->mBrickSize.z;
+    header.mQuantisation = pool->quantises(volume)
+        ? (uint32_t)pool->mQuantisation
+        : (uint32_t)VolumeBrickPool::QuantiseNone;
+    header.mPoolBytesPerVoxel = pool->poolBytesPerVoxel();
+    header.mNumLeaves = subdivision->mLeaves.size();
+    header.mNumBricks = pool->mBricks.size();
+
+    /* Leaf ranges cover every voxel, so they give the histogram range */
+    float lo = +std::numeric_limits<float>::infinity();
+    float hi = -std::numeric_limits<float>::infinity();
+    std::vector<LeafRecord> leafRecords(header.mNumLeaves);
+    for(size_t i = 0; i < leafRecords.size(); ++i)
+    {
+        leafRecords[i].mMinValue = subdivision->mLeaves[i].mMinTFValue;
+        leafRecords[i].mMaxValue = subdivision->mLeaves[i].mMaxTFValue;
+        lo = fmin(lo, leafRecords[i].mMinValue);
+        hi = fmax(hi, leafRecords[i].mMaxValue);
+    }
+    header.mMinValue = lo;
+    header.mMaxValue = hi;
+    if(volume->data)
+    {
+        histogram(volume, lo, hi, mHistogram);
+    }
+    else
+    {
+        pool->mSource->histogram(lo, hi, HistogramBins, mHistogram);
+    }
+    mMinValue = lo;
+    mMaxValue = hi;
+
+    header.mLeavesOffset = alignUp(sizeof(Header), 64);
+    header.mBricksOffset = alignUp(header.mLeavesOffset + header.mNumLeaves * sizeof(LeafRecord), 64);
+    header.mHistogramOffset = alignUp(header.mBricksOffset + header.mNumBricks * sizeof(BrickRecord), 64);
+    header.mPayloadOffset = alignUp(header.mHistogramOffset + HistogramBins * sizeof(uint64_t), Alignment);
+
+    /* Payloads follow each other in brick index order, the order upload() pages them in */
+    std::vector<BrickRecord> brickRecords(header.mNumBricks);
+    uint64_t offset = header.mPayloadOffset;
+    for(size_t i = 0; i < brickRecords.size(); ++i)
+    {
+        const VolumeBrick& brick = pool->mBricks[i];
+        BrickRecord& record = brickRecords[i];
+        record.mMinValue = brick.minValue;
+        record.mMaxValue = brick.maxValue;
+        record.mScale = brick.mScale;
+        record.mOffset = brick.mOffset;
+        record.mQuantisationMaxError = brick.mQuantisationMaxError;
+        record.mQuantisationMeanError = brick.mQuantisationMeanError;
+        record.mDataOffset = offset;
+        record.mDataTotal = brick.mDataTotal;
+        offset = alignUp(offset + brick.mDataTotal, 64);
+    }
+    if(volume->data)
+    {
+        header.mVolumeOffset = alignUp(offset, Alignment);
+        header.mFileSize = header.mVolumeOffset + volume->dataTotal;
+    }
+    else
+    {
+        header.mVolumeOffset = 0;
+        header.mFileSize = offset;
+    }
+
+    /* Write next to the target and rename, so readers never see half a cache */
+    std::string temporary = path + ".tmp";
+    FILE* fp = fopen(temporary.c_str(), "wb");
+    if(fp == NULL)
+    {
+        std::cerr << "==BrickCache== Couldn't write " << temporary << std::endl;
+        return false;
+    }
+
+    bool ok = fwrite(&header, sizeof(Header), 1, fp) == 1;
+    ok = ok && writePadding(fp, sizeof(Header), header.mLeavesOffset);
+    ok = ok && fwrite(leafRecords.data(), sizeof(LeafRecord), leafRecords.size(), fp) == leafRecords.size();
+    ok = ok && writePadding(fp, header.mLeavesOffset + header.mNumLeaves * sizeof(LeafRecord), header.mBricksOffset);
+    ok = ok && fwrite(brickRecords.data(), sizeof(BrickRecord), brickRecords.size(), fp) == brickRecords.size();
+    ok = ok && writePadding(fp, header.mBricksOffset + header.mNumBricks * sizeof(BrickRecord), header.mHistogramOffset);
+    ok = ok && fwrite(mHistogram.data(), sizeof(uint64_t), HistogramBins, fp) == HistogramBins;
+    ok = ok && writePadding(fp, header.mHistogramOffset + HistogramBins * sizeof(uint64_t), header.mPayloadOffset);
+
+    offset = header.mPayloadOffset;
+    for(size_t i = 0; ok && i < brickRecords.size(); ++i)
+    {
+        VolumeBrick brick = pool->mBricks[i];
+        if(brick.mData == nullptr)
+        {
+            ok = pool->mSource->readBrick(pool, brick);
+        }
+        else
+        {
+            brick.mOwnsData = false;
+        }
+        ok = ok && writePadding(fp, offset, brickRecords[i].mDataOffset);
+        ok = ok && fwrite(brick.mData, 1, brick.mDataTotal, fp) == brick.mDataTotal;
+        offset = brickRecords[i].mDataOffset + brick.mDataTotal;
+        brick.free();
+    }
+    ok = ok && writePadding(fp, offset, volume->data ? header.mVolumeOffset : header.mFileSize);
+    if(volume->data)
+    {
+        ok = ok && fwrite(volume->data, 1, volume->dataTotal, fp) == volume->dataTotal;
+    }
+    ok = (fclose(fp) == 0) && ok;
+
+    if(!ok || rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        std::cerr << "==BrickCache== Couldn't write " << path << std::endl;
+        remove(temporary.c_str());
+        return false;
+    }
+
+    timer.stop();
+    mStats.set("brickcachewritetime", timer.getTime());
+    std::cout << "==BrickCache== Wrote " << path << " (" << header.mFileSize << " bytes)" << std::endl;
+    return true;
+}
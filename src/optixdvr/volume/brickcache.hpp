@@ -0,0 +1,130 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "volume.hpp"
+#include "brickedvolume.hpp"
+#include "brickpool.hpp"
+#include "../utils/stats.hpp"
+
+/**
+ * On-disk cache of a bricked volume. Holds everything loadvolume would
+ * otherwise compute from the raw file: leaf min/max grid, brick records,
+ * a value histogram, the brick payloads in pool (brick index) order and
+ * the voxels themselves. The file is mapped rather than read, and bricks
+ * and the volume point straight into the mapping, so a cache hit costs
+ * neither scanBrick nor pullBrick.
+ *
+ * A cache is only used if it was written for the same source file (size
+ * and modification time), leaf size, brick size and pool quantisation.
+ * Caches written from an out-of-core pool hold no voxels and are only
+ * read through a CachedBrickSource.
+ */
+class BrickCache
+{
+public:
+    static const uint32_t Version = 2;
+    static const size_t HistogramBins = 256;
+    static const size_t Alignment = 4096;
+
+    struct Header
+    {
+        char mMagic[8];
+        uint32_t mVersion;
+        uint32_t mDataType;
+        uint64_t mBytesPerVoxel;
+        float mDataDimensions[3];
+        float mVolumeSize[3];
+        float mDataScale;
+        float mDataOffset;
+        uint64_t mSourceSize;
+        int64_t mSourceTime;
+        uint64_t mLeafSize[3];
+        uint64_t mBrickSize[3];
+        uint32_t mQuantisation;
+        uint32_t mPoolBytesPerVoxel;
+        uint64_t mNumLeaves;
+        uint64_t mNumBricks;
+        float mMinValue;
+        float mMaxValue;
+        uint64_t mLeavesOffset;
+        uint64_t mBricksOffset;
+        uint64_t mHistogramOffset;
+        uint64_t mPayloadOffset;
+        uint64_t mVolumeOffset;
+        uint64_t mFileSize;
+    };
+
+    struct LeafRecord
+    {
+        float mMinValue;
+        float mMaxValue;
+    };
+
+    struct BrickRecord
+    {
+        float mMinValue;
+        float mMaxValue;
+        float mScale;
+        float mOffset;
+        float mQuantisationMaxError;
+        float mQuantisationMeanError;
+        uint64_t mDataOffset;
+        uint64_t mDataTotal;
+    };
+
+    Stats mStats;
+    std::vector<uint64_t> mHistogram;
+    float mMinValue = 0.0f;
+    float mMaxValue = 0.0f;
+
+    BrickCache() {}
+    ~BrickCache();
+
+    /**
+     * Maps the cache at path and, if it matches, hands the volume, leaves
+     * and bricks to subdivision and pool. The leaf size, brick size and
+     * quantisation already set on them are the ones that must match.
+     * Returns the cached volume, or nullptr on a miss.
+     */
+    Volume* load(
+        const std::string& path,
+        const VolumeFile& file,
+        BrickedVolume* subdivision,
+        VolumeBrickPool* pool
+    );
+
+    /* Writes the state loadvolume just built from the raw file */
+    bool write(
+        const std::string& path,
+        const VolumeFile& file,
+        Volume* volume,
+        BrickedVolume* subdivision,
+        VolumeBrickPool* pool
+    );
+
+    /* Magic, version, source file identity and dimensions */
+    static bool matches(const Header& header, uint64_t fileSize, const VolumeFile& file);
+
+    /* A level 0 brick as recorded, without its data */
+    static VolumeBrick brick(
+        const BrickRecord& record,
+        size_t index,
+        const vec3size_t& numBricks,
+        const vec3size_t& brickSize
+    );
+
+private:
+    char* mMapping = nullptr;
+    size_t mMappingSize = 0;
+    bool mMapped = false;
+
+    /* Identify the source so an edited file invalidates the cache */
+    static bool sourceInfo(const VolumeFile& file, uint64_t& size, int64_t& time);
+    static void histogram(Volume* volume, float lo, float hi, std::vector<uint64_t>& bins);
+
+    bool map(const std::string& path);
+    void unmap();
+};
@@ -1,4 +1,8 @@
 #include "brickedvolume.hpp"
+#include "bricksource.hpp"
+
+#include <algorithm>
+#include <cstdlib>
 
 BrickedVolume::BrickedVolume() :
     mVolume(nullptr),
@@ -37,27 +41,86 @@ void BrickedVolume::set_brick_size(const vec3size_t& bricksize)
             (size_t)mNumLeaves.x *
             (size_t)mNumLeaves.y *
             (size_t)mNumLeaves.z;
-        mLeaves.resize(m_total_subdivisions);
         mStats.set("numbricks", m_total_subdivisions);
 
         //std::cout << "==BrickedVolume== Pulling brick data... ";
-        #pragma omp parallel for collapse(3)
-        for(int z = 0; z < (int)mNumLeaves.z; ++z)
+        scan_leaves(mVolume, bricksize, mLeaves);
+
+        //mPool->set_brick_size(bricksize, mSubdivisions);
+    }
+    timer.stop();
+    mStats.set("subdivisiontime", timer.getTime());
+}
+
+void BrickedVolume::set_leaves(
+    Volume* volume,
+    const vec3size_t& leafSize,
+    std::vector<AccelerationLeaf>& leaves
+){
+    mVolume = volume;
+    mVoxelsPerBrick.x = leafSize.x;
+    mVoxelsPerBrick.y = leafSize.y;
+    mVoxelsPerBrick.z = leafSize.z;
+    mNumLeaves.x = ceilf(mVolume->dataDimensions.x / (float)leafSize.x);
+    mNumLeaves.y = ceilf(mVolume->dataDimensions.y / (float)leafSize.y);
+    mNumLeaves.z = ceilf(mVolume->dataDimensions.z / (float)leafSize.z);
+    m_total_subdivisions =
+        (size_t)mNumLeaves.x *
+        (size_t)mNumLeaves.y *
+        (size_t)mNumLeaves.z;
+
+    if(leaves.size() != m_total_subdivisions)
+    {
+        std::cerr << "==BrickedVolume== Leaf count doesn't match the volume" << std::endl;
+        set_brick_size(leafSize);
+        return;
+    }
+    std::swap(mLeaves, leaves);
+    mStats.set("numbricks", m_total_subdivisions);
+    mStats.set("subdivisiontime", 0.0);
+}
+
+void BrickedVolume::scan_leaves(
+    Volume* volume,
+    const vec3size_t& leafSize,
+    std::vector<AccelerationLeaf>& leaves
+) const {
+    if(volume->data == nullptr && mSource)
+    {
+        mSource->scanLeaves(leafSize, leaves);
+        return;
+    }
+
+    vec3size_t numLeaves;
+    numLeaves.x = ceilf(volume->dataDimensions.x / (float)leafSize.x);
+    numLeaves.y = ceilf(volume->dataDimensions.y / (float)leafSize.y);
+    numLeaves.z = ceilf(volume->dataDimensions.z / (float)leafSize.z);
+    leaves.resize(numLeaves.x * numLeaves.y * numLeaves.z);
+
+    #pragma omp parallel for collapse(3)
+    for(int z = 0; z < (int)numLeaves.z; ++z)
+    {
+        for(int y = 0; y < (int)numLeaves.y; ++y)
         {
-            for(int y = 0; y < (int)mNumLeaves.y; ++y)
+            for(int x = 0; x < (int)numLeaves.x; ++x)
             {
-                for(int x = 0; x < (int)mNumLeaves.x; ++x)
-                {
-                    AccelerationLeaf b = scanBrick(mVolume, x, y, z);
-                    leaf(x, y, z) = b;
-                }
+                size_t index = x + numLeaves.x * y + numLeaves.x * numLeaves.y * z;
+                leaves[index] = scanBrick(volume, leafSize, x, y, z);
             }
         }
+    }
+}
 
-        //mPool->set_brick_size(bricksize, mSubdivisions);
+void BrickedVolume::swap_frame(Volume* volume, std::vector<AccelerationLeaf>& leaves)
+{
+    std::swap(mLeaves, leaves);
+    mVolume = volume;
+
+    /* Leaves come in inactive, so testbricks sees every active one as a change */
+    for(size_t i = 0; i < mLeaves.size(); ++i)
+    {
+        mLeaves[i].mActive = false;
     }
-    timer.stop();
-    mStats.set("subdivisiontime", timer.getTime());
 }
 
 size_t BrickedVolume::testbricks(const TransferFunction& tf)
@@ -92,9 +155,149 @@ size_t BrickedVolume::testbricks(const TransferFunction& tf)
         mStats.set("clusteringtime", timer.getTime());
     }
 
+    /* Only leaves changing state move the distances */
+    if(mDistanceField && (changes > 0 || mDistances.size() != mLeaves.size()))
+    {
+        timer.start();
+        distanceField();
+        timer.stop();
+        mStats.set("distancefieldtime", timer.getTime());
+    }
+
     return changes;
 }
 
+namespace
+{
+    /**
+     * One pass of the separable Chebyshev transform over a line of n
+     * values g, Meijster et al.'s lower envelope scan with
+     * f(x, i) = max(|x - i|, g(i)). s and t are scratch of size n.
+     * Lines that are far from anything active stay so.
+     */
+    void chebyshevLine(int* g, int n, int far, int* s, int* t, int* out)
+    {
+        int nearest = far;
+        for(int u = 0; u < n; ++u)
+        {
+            nearest = std::min(nearest, g[u]);
+        }
+        if(nearest >= far)
+        {
+            std::copy(g, g + n, out);
+            return;
+        }
+
+        auto f = [&](int x, int i) { return std::max(std::abs(x - i), g[i]); };
+        auto sep = [&](int i, int u)
+        {
+            return g[i] <= g[u]
+                ? std::max(i + g[u], (i + u) / 2)
+                : std::min(u - g[i], (i + u) / 2);
+        };
+
+        int q = 0;
+        s[0] = 0;
+        t[0] = 0;
+        for(int u = 1; u < n; ++u)
+        {
+            while(q >= 0 && f(t[q], s[q]) > f(t[q], u))
+            {
+                q--;
+            }
+            if(q < 0)
+            {
+                q = 0;
+                s[0] = u;
+            }
+            else
+            {
+                int w = 1 + sep(s[q], u);
+                if(w < n)
+                {
+                    q++;
+                    s[q] = u;
+                    t[q] = w;
+                }
+            }
+        }
+        for(int u = n - 1; u >= 0; --u)
+        {
+            out[u] = f(u, s[q]);
+            if(u == t[q])
+            {
+                q--;
+            }
+        }
+    }
+}
+
+void BrickedVolume::distanceField()
+{
+    const int n[3] = { (int)mNumLeaves.x, (int)mNumLeaves.y, (int)mNumLeaves.z };
+    const size_t stride[3] = { 1, (size_t)n[0], (size_t)n[0] * (size_t)n[1] };
+    const int far = n[0] + n[1] + n[2];
+
+    std::vector<int> distances(mLeaves.size());
+    for(size_t i = 0; i < mLeaves.size(); ++i)
+    {
+        distances[i] = mLeaves[i].mActive ? 0 : far;
+    }
+
+    /* The max of per-axis distances separates, so transform along x, then
+       y, then z, every line of a pass independent. Lines along y and z are
+       copied out a block of neighbours in x at a time, reading whole rows */
+    const int block = 32;
+    const int maxLine = std::max(n[0], std::max(n[1], n[2]));
+    for(int axis = 0; axis < 3; ++axis)
+    {
+        const int inner = axis == 0 ? 1 : 0;
+        const int outer = axis == 2 ? 1 : 2;
+        const int width = axis == 0 ? 1 : block;
+        #pragma omp parallel
+        {
+            std::vector<int> scratch((2 * width + 2) * maxLine);
+            int* g = &scratch[0];
+            int* out = g + width * maxLine;
+            int* s = out + width * maxLine;
+            int* t = s + maxLine;
+            #pragma omp for collapse(2)
+            for(int j = 0; j < n[outer]; ++j)
+            {
+                for(int i = 0; i < n[inner]; i += width)
+                {
+                    const int lines = std::min(width, n[inner] - i);
+                    const size_t first = (size_t)i * stride[inner] + (size_t)j * stride[outer];
+                    for(int k = 0; k < n[axis]; ++k)
+                    {
+                        for(int l = 0; l < lines; ++l)
+                        {
+                            g[l * maxLine + k] = distances[first + l * stride[inner] + k * stride[axis]];
+                        }
+                    }
+                    for(int l = 0; l < lines; ++l)
+                    {
+                        chebyshevLine(g + l * maxLine, n[axis], far, s, t, out + l * maxLine);
+                    }
+                    for(int k = 0; k < n[axis]; ++k)
+                    {
+                        for(int l = 0; l < lines; ++l)
+                        {
+                            distances[first + l * stride[inner] + k * stride[axis]] = out[l * maxLine + k];
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    mDistances.resize(mLeaves.size());
+    for(size_t i = 0; i < mLeaves.size(); ++i)
+    {
+        mDistances[i] = (unsigned char)std::min(distances[i], 255);
+    }
+}
+
 void BrickedVolume::cluster()
 {
     /* Create an active bricks table which we use to keep track of */
@@ -177,15 +380,18 @@ void BrickedVolume::cluster()
     mStats.set("numclusters", mClusters.size());
 }
 
-AccelerationLeaf BrickedVolume::scanBrick(Volume* volume, int bx, int by, int bz)
-{
+AccelerationLeaf BrickedVolume::scanBrick(
+    Volume* volume,
+    const vec3size_t& leafSize,
+    int bx, int by, int bz
+){
     AccelerationLeaf brick;
     vec3size_t padMin(0);
     vec3size_t padMax(1);
-    vec3size_t actualDimensions = mVoxelsPerBrick + padMin + padMax;
+    vec3size_t actualDimensions = leafSize + padMin + padMax;
 
     int rowSize = actualDimensions.x;
-    int rowStart = bx * mVoxelsPerBrick.x;
+    int rowStart = bx * leafSize.x;
     int rowEnd = rowStart + rowSize;
     int volumeLimit = volume->dataLimits.x;
     int rowLimit = 0;
@@ -201,9 +407,9 @@ AccelerationLeaf BrickedVolume::scanBrick(Volume* volume, int bx, int by, int bz
             for(size_t x = 0; x < actualDimensions.x; ++x)
             {
                 vec3f p;
-                p.x = bx * mVoxelsPerBrick.x + x;
-                p.y = by * mVoxelsPerBrick.y + y;
-                p.z = bz * mVoxelsPerBrick.z + z;
+                p.x = bx * leafSize.x + x;
+                p.y = by * leafSize.y + y;
+                p.z = bz * leafSize.z + z;
                 p = min(p, volume->dataDimensions - vec3f(1));
 
                 float v = volume->GetNormalisedVoxel(p);
@@ -7,6 +7,8 @@
 #include "brickpool.hpp"
 #include "../utils/stats.hpp"
 
+class BrickSource;
+
 struct AccelerationLeaf
 {
 public:
@@ -26,6 +28,8 @@ public:
     vec3f mVoxelsPerBrick;
     //VolumeBrickPool* mPool;
     Volume* mVolume;
+    /* Scans volumes without data, see VolumeBrickPool::mSource */
+    BrickSource* mSource = nullptr;
 
     struct Cluster
     {
@@ -35,6 +39,12 @@ public:
     bool mCluster = false;
     std::vector<struct Cluster> mClusters;
 
+    /* Chebyshev distance in leaves from every leaf to the nearest active
+       one, 0 for active leaves and capped at 255. Kept up to date by
+       testbricks when enabled, rays can leap distance - 1 leaves */
+    bool mDistanceField = false;
+    std::vector<unsigned char> mDistances;
+
     size_t mTotalLeaves = 0;
     size_t mTotalActiveLeaves = 0;
     size_t m_total_subdivisions = 0;
@@ -47,8 +57,21 @@ public:
     virtual void set_brick_size(const vec3size_t& bricksize);
     vec3size_t get_brick_size(){ return mVoxelsPerBrick; };
 
+    /* Use leaf ranges already computed for volume, e.g. from a cache */
+    void set_leaves(Volume* volume, const vec3size_t& leafSize, std::vector<AccelerationLeaf>& leaves);
+
+    /* Computes leaf ranges of any volume without touching this subdivision */
+    void scan_leaves(Volume* volume, const vec3size_t& leafSize, std::vector<AccelerationLeaf>& leaves) const;
+
+    /**
+     * Swap in the leaves of another frame of the same volume, scanned with
+     * the current leaf size. On return leaves holds the outgoing frame's.
+     */
+    void swap_frame(Volume* volume, std::vector<AccelerationLeaf>& leaves);
+
     virtual size_t testbricks(const TransferFunction& tf);
     void cluster();
+    void distanceField();
 
     inline AccelerationLeaf& leaf(int x, int y, int z)
     {
@@ -60,6 +83,5 @@ public:
         return leaf(x, y, z).mActive;
     }
 
-private:
-    AccelerationLeaf scanBrick(Volume* volume, int bx, int by, int bz);
+    static AccelerationLeaf scanBrick(Volume* volume, const vec3size_t& leafSize, int bx, int by, int bz);
 };
\ No newline at end of file
@@ -1,6 +1,98 @@
 
 #include "brickpool.hpp"
+#include "bricksource.hpp"
 #include "brickedvolume.hpp"
+#include "../utils/half.h"
+
+#include <type_traits>
+
+template <typename T>
+static Volume* downsample(Volume* source, VolumeBrickPool::DownsampleFilter filter)
+{
+    VolumeRepresentation<T>* level = new VolumeRepresentation<T>();
+    level->dataType = source->dataType;
+    level->dataDimensions.x = ceilf(source->dataDimensions.x / 2.0f);
+    level->dataDimensions.y = ceilf(source->dataDimensions.y / 2.0f);
+    level->dataDimensions.z = ceilf(source->dataDimensions.z / 2.0f);
+    level->dataLimits = level->dataDimensions - vec3f(1.0f);
+    level->volumeSize = source->volumeSize;
+    level->voxelsTotal = (size_t)level->dataDimensions.x
+        * (size_t)level->dataDimensions.y
+        * (size_t)level->dataDimensions.z;
+    level->dataTotal = level->bytesPerVoxel * level->voxelsTotal;
+    level->data = new char[level->dataTotal];
+
+    const T* src = (const T*)source->data;
+    T* dst = (T*)level->data;
+    const vec3size_t srcDims = source->dataDimensions;
+    const vec3size_t dstDims = level->dataDimensions;
+
+    #pragma omp parallel for collapse(2)
+    for(int z = 0; z < (int)dstDims.z; ++z)
+    {
+        for(int y = 0; y < (int)dstDims.y; ++y)
+        {
+            for(size_t x = 0; x < dstDims.x; ++x)
+            {
+                double sum = 0.0;
+                T maximum = std::numeric_limits<T>::lowest();
+                for(size_t dz = 0; dz < 2; ++dz)
+                {
+                    for(size_t dy = 0; dy < 2; ++dy)
+                    {
+                        for(size_t dx = 0; dx < 2; ++dx)
+                        {
+                            /* Clamp to the edge for odd dimensions */
+                            size_t sx = std::min(2 * x + dx, srcDims.x - 1);
+                            size_t sy = std::min(2 * (size_t)y + dy, srcDims.y - 1);
+                            size_t sz = std::min(2 * (size_t)z + dz, srcDims.z - 1);
+                            T v = src[sx + srcDims.x * sy + srcDims.x * srcDims.y * sz];
+                            sum += (double)v;
+                            maximum = std::max(maximum, v);
+                        }
+                    }
+                }
+
+                T out;
+                if(filter == VolumeBrickPool::FilterMax)
+                    out = maximum;
+                else if(std::is_integral<T>::value)
+                    out = (T)llround(sum / 8.0);
+                else
+                    out = (T)(sum / 8.0);
+                dst[x + dstDims.x * (size_t)y + dstDims.x * dstDims.y * (size_t)z] = out;
+            }
+        }
+    }
+
+    return level;
+}
+
+static Volume* downsampleVolume(Volume* source, VolumeBrickPool::DownsampleFilter filter)
+{
+    switch(source->dataType)
+    {
+    case Volume::CHAR:
+        return downsample<signed char>(source, filter);
+    case Volume::UCHAR:
+        return downsample<unsigned char>(source, filter);
+    case Volume::SHORT:
+        return downsample<short>(source, filter);
+    case Volume::USHORT:
+        return downsample<unsigned short>(source, filter);
+    case Volume::INT:
+        return downsample<int>(source, filter);
+    case Volume::UINT:
+        return downsample<unsigned int>(source, filter);
+    case Volume::FLOAT:
+        return downsample<float>(source, filter);
+    case Volume::DOUBLE:
+        return downsample<double>(source, filter);
+    default:
+        std::cerr << "==BrickPool== Can't downsample this volume type" << std::endl;
+        return nullptr;
+    }
+}
 
 VolumeBrickPool::VolumeBrickPool(){
     mBrickSize = vec3size_t(32);
@@ -10,6 +102,57 @@ VolumeBrickPool::VolumeBrickPool(){
 void VolumeBrickPool::set_brick_size(
     const vec3size_t &bricksize,
     const vec3size_t &padding
+){
+    if(!layoutBricks(bricksize, padding))
+    {
+        return;
+    }
+
+    utils::Timer timer;
+    timer.start();
+    if(mSource)
+    {
+        mSource->scanBricks(this, mBrickSize, mBricks);
+    }
+    else
+    {
+        pullBricks(mVolume, mBrickSize, mBricks);
+    }
+    timer.stop();
+    mStats.set("loadtime", timer.getTime());
+
+    finishBricks();
+}
+
+void VolumeBrickPool::volume(Volume *v, std::vector<VolumeBrick>& bricks)
+{
+    mVolume = v;
+    allocate();
+    mNextUploadSlot = 0;
+    vec3size_t padding(
+        mActualDataSize.x - mBrickSize.x,
+        mActualDataSize.y - mBrickSize.y,
+        mActualDataSize.z - mBrickSize.z
+    );
+    if(!layoutBricks(mBrickSize, padding))
+    {
+        return;
+    }
+
+    if(bricks.size() != mBricks.size())
+    {
+        std::cerr << "==BrickPool== Brick count doesn't match the volume" << std::endl;
+        return;
+    }
+    std::swap(mBricks, bricks);
+    mStats.set("loadtime", 0.0);
+
+    finishBricks();
+}
+
+bool VolumeBrickPool::layoutBricks(
+    const vec3size_t &bricksize,
+    const vec3size_t &padding
 ){
     mBrickSize = bricksize;
     mActualDataSize = bricksize + padding;
@@ -26,12 +169,17 @@ void VolumeBrickPool::set_brick_size(
     mNormalizedRegionSize.z = (float)mActualDataSize.z / (float)mDataDimensions.z;
 
     mNextUploadSlot = 0;
+    mFreeSlots.clear();
+    mHostCache.clear();
 
     if(mVolume == nullptr)
     {
-        return;
+        return false;
     }
 
+    /* Coarser levels are rebuilt for the new brick size below */
+    clear_pyramid();
+
     if(mBricks.size())
     {
         #pragma omp parallel for collapse(3)
@@ -60,35 +208,368 @@ void VolumeBrickPool::set_brick_size(
     mPageTableMemoryUsage = mNumBricks.x * mNumBricks.y * mNumBricks.z * sizeof(struct PageTableEntry);
     mStats.set("pagetablememory", mPageTableMemoryUsage);
 
-    mPageTableData.resize(mNumBricks.x * mNumBricks.y * mNumBricks.z);
-    for(size_t i = 0; i < mNumBricks.x * mNumBricks.y * mNumBricks.z; ++i)
+    resetPageTable();
+    allocatePageTable();
+    return true;
+}
+
+void VolumeBrickPool::finishBricks()
+{
+    if(quantising())
     {
+        double maxError = 0.0;
+        double meanError = 0.0;
+        for(size_t i = 0; i < mBricks.size(); ++i)
+        {
+            maxError = fmax(maxError, mBricks[i].mQuantisationMaxError);
+            meanError += mBricks[i].mQuantisationMeanError;
+        }
+        mStats.set("quantisationmaxerror", maxError);
+        mStats.set("quantisationmeanerror", meanError / (double)mBricks.size());
+    }
+
+    if(mPyramidLevels > 1 && mVolume->data)
+    {
+        build_pyramid(mPyramidLevels, mPyramidFilter);
+    }
+}
+
+void VolumeBrickPool::resetPageTable()
+{
+    size_t totalNumBricks = mNumBricks.x * mNumBricks.y * mNumBricks.z;
+
+    struct PageTableEntry pagetableEntry;
+    pagetableEntry.x = 0;
+    pagetableEntry.y = 0;
+    pagetableEntry.z = 0;
+    pagetableEntry.flags = PageTableEntryNotPaged;
+    mPageTableData.assign(totalNumBricks, pagetableEntry);
+
+    struct PageTableScaleEntry scaleEntry;
+    scaleEntry.scale = 1.0f;
+    scaleEntry.offset = 0.0f;
+    mPageTableScaleData.assign(totalNumBricks, scaleEntry);
+}
+
+void VolumeBrickPool::swap_frame(
+    Volume* volume,
+    std::vector<VolumeBrick>& bricks,
+    int outgoingFrame,
+    int incomingFrame
+){
+    /* Coarser levels share pool slots with level 0, so only reuse without them */
+    bool reuse = mLevels.size() <= 1 && outgoingFrame >= 0;
+
+    /* The pyramid was built from the outgoing frame */
+    select_level(0);
+    clear_pyramid();
+
+    std::swap(mBricks, bricks);
+    mVolume = volume;
+
+    if(!reuse || bricks.size() != mBricks.size())
+    {
+        reuse = false;
+        mNextUploadSlot = 0;
+        mFreeSlots.clear();
+        resetPageTable();
+    }
+
+    size_t reused = 0;
+    size_t pulled = 0;
+    for(size_t i = 0; i < mBricks.size(); ++i)
+    {
+        VolumeBrick& incoming = mBricks[i];
+        if(incoming.mData == nullptr)
+        {
+            if(reuse && incoming.mSameAs == outgoingFrame && bricks[i].mData != nullptr)
+            {
+                /* Identical to the brick being replaced, take over its data and slot */
+                VolumeBrick& outgoing = bricks[i];
+                incoming = outgoing;
+                outgoing.mData = nullptr;
+                outgoing.mPaged = false;
+                outgoing.mSameAs = incomingFrame;
+                reused++;
+                continue;
+            }
+
+            /* Not shown in sequence, so pull the brick after all */
+            vec3size_t index = incoming.mBrickIndex;
+            incoming = pullBrick(volume, mBrickSize, index.x, index.y, index.z);
+            pulled++;
+        }
+        incoming.mActive = false;
+        incoming.mPaged = false;
+    }
+
+    /* Everything of the outgoing frame that wasn't taken over leaves the pool */
+    for(size_t i = 0; reuse && i < bricks.size(); ++i)
+    {
+        if(!bricks[i].mPaged)
+        {
+            continue;
+        }
+        mFreeSlots.push_back(bricks[i].mPoolSlot);
+        bricks[i].mPaged = false;
+
+        mPageTableData[i].x = 0;
+        mPageTableData[i].y = 0;
+        mPageTableData[i].z = 0;
+        mPageTableData[i].flags = PageTableEntryNotPaged;
+        mPageTableScaleData[i].scale = 1.0f;
+        mPageTableScaleData[i].offset = 0.0f;
+    }
+    for(size_t i = 0; !reuse && i < bricks.size(); ++i)
+    {
+        bricks[i].mPaged = false;
+    }
+    mStats.set("framereusedbricks", reused);
+    mStats.set("framepulledbricks", pulled);
+
+    uploadPageTable();
+
+    if(mPyramidLevels > 1)
+    {
+        build_pyramid(mPyramidLevels, mPyramidFilter);
+    }
+}
+
+void VolumeBrickPool::clear_pyramid()
+{
+    for(size_t l = 0; l < mLevels.size(); ++l)
+    {
+        for(size_t i = 0; i < mLevels[l].mBricks.size(); ++i)
+        {
+            mLevels[l].mBricks[i].free();
+        }
+    }
+    mLevels.clear();
+    mCurrentLevel = 0;
+}
+
+void VolumeBrickPool::build_pyramid(size_t levels, DownsampleFilter filter)
+{
+    mPyramidLevels = levels;
+    mPyramidFilter = filter;
+    if(mVolume == nullptr || mBricks.size() == 0)
+    {
+        return;
+    }
+    if(mVolume->data == nullptr)
+    {
+        std::cerr << "==BrickPool== Out-of-core volumes have no pyramid" << std::endl;
+        return;
+    }
+
+    /* Level 0 has to be the active one while we rebuild */
+    select_level(0);
+    clear_pyramid();
+
+    utils::Timer timer;
+    timer.start();
+
+    BrickLevel base;
+    base.mDataDimensions = mVolume->dataDimensions;
+    base.mNumBricks = mNumBricks;
+    mLevels.push_back(std::move(base));
+
+    Volume* source = mVolume;
+    Volume* previous = mVolume;
+    for(size_t l = 1; l < levels; ++l)
+    {
+        /* No point going coarser than a single brick */
+        if(!(vec3size_t(previous->dataDimensions) > mBrickSize))
+        {
+            break;
+        }
+
+        Volume* level = downsampleVolume(previous, filter);
+        if(level == nullptr)
+        {
+            break;
+        }
+
+        BrickLevel bl;
+        bl.mDataDimensions = level->dataDimensions;
+        bl.mNumBricks.x = ceilf(level->dataDimensions.x / (float)mBrickSize.x);
+        bl.mNumBricks.y = ceilf(level->dataDimensions.y / (float)mBrickSize.y);
+        bl.mNumBricks.z = ceilf(level->dataDimensions.z / (float)mBrickSize.z);
+        size_t levelBricks = bl.mNumBricks.x * bl.mNumBricks.y * bl.mNumBricks.z;
+        pullBricks(level, mBrickSize, bl.mBricks);
+
         struct PageTableEntry pagetableEntry;
         pagetableEntry.x = 0;
         pagetableEntry.y = 0;
         pagetableEntry.z = 0;
         pagetableEntry.flags = PageTableEntryNotPaged;
-        mPageTableData[i] = pagetableEntry;
+        bl.mPageTableData.assign(levelBricks, pagetableEntry);
+
+        struct PageTableScaleEntry scaleEntry;
+        scaleEntry.scale = 1.0f;
+        scaleEntry.offset = 0.0f;
+        bl.mPageTableScaleData.assign(levelBricks, scaleEntry);
+
+        mLevels.push_back(std::move(bl));
+
+        /* Level volumes are only needed to build the next level down */
+        if(previous != source)
+        {
+            delete[] previous->data;
+            delete previous;
+        }
+        previous = level;
+    }
+    if(previous != source)
+    {
+        delete[] previous->data;
+        delete previous;
+    }
+
+    timer.stop();
+    mStats.set("pyramidlevels", mLevels.size());
+    mStats.set("pyramidbuildtime", timer.getTime());
+}
+
+void VolumeBrickPool::select_level(size_t level)
+{
+    if(level >= mLevels.size() || level == mCurrentLevel)
+    {
+        return;
     }
 
+    /* Park the active level's bricks and page table back in the pyramid */
+    BrickLevel& current = mLevels[mCurrentLevel];
+    std::swap(current.mBricks, mBricks);
+    std::swap(current.mPageTableData, mPageTableData);
+    std::swap(current.mPageTableScaleData, mPageTableScaleData);
+    current.mNumBricks = mNumBricks;
+
+    BrickLevel& next = mLevels[level];
+    std::swap(next.mBricks, mBricks);
+    std::swap(next.mPageTableData, mPageTableData);
+    std::swap(next.mPageTableScaleData, mPageTableScaleData);
+    mNumBricks = next.mNumBricks;
+    mCurrentLevel = level;
+
+    mPageTableMemoryUsage = mNumBricks.x * mNumBricks.y * mNumBricks.z * sizeof(struct PageTableEntry);
+    mStats.set("lodlevel", level);
+
     allocatePageTable();
+    uploadPageTable();
+}
 
-    utils::Timer timer;
-    timer.start();
-    #pragma omp parallel for collapse(3)
-    for(int z = 0; z < (int)mNumBricks.z; ++z)
+vec3f VolumeBrickPool::levelDimensions() const
+{
+    if(mLevels.size() > mCurrentLevel)
+    {
+        return mLevels[mCurrentLevel].mDataDimensions;
+    }
+    return mVolume->dataDimensions;
+}
+
+void VolumeBrickPool::set_quantisation(Quantisation quantisation)
+{
+    if(quantisation == mQuantisation)
+    {
+        return;
+    }
+
+    mQuantisation = quantisation;
+    if(mVolume == nullptr)
+    {
+        return;
+    }
+
+    if(mVolume->dataType != Volume::FLOAT)
     {
-        for(int y = 0; y < (int)mNumBricks.y; ++y)
+        std::cerr << "==BrickPool== Quantisation only applies to float volumes, ignoring" << std::endl;
+        return;
+    }
+
+    /* Pool format changes, so reallocate and re-pull every brick */
+    volume(mVolume);
+}
+
+bool VolumeBrickPool::quantising() const
+{
+    return quantises(mVolume);
+}
+
+bool VolumeBrickPool::quantises(const Volume* volume) const
+{
+    return mQuantisation != QuantiseNone
+        && volume != nullptr
+        && volume->dataType == Volume::FLOAT;
+}
+
+size_t VolumeBrickPool::poolBytesPerVoxel() const
+{
+    if(!quantising())
+    {
+        return mVolume->bytesPerVoxel;
+    }
+
+    switch(mQuantisation)
+    {
+    case Quantise8Bit:
+        return 1;
+    case Quantise16Bit:
+    case QuantiseHalf:
+        return 2;
+    default:
+        return mVolume->bytesPerVoxel;
+    }
+}
+
+RTformat VolumeBrickPool::poolFormat() const
+{
+    if(quantising())
+    {
+        switch(mQuantisation)
         {
-            for(int x = 0; x < (int)mNumBricks.x; ++x)
-            {
-                VolumeBrick b = pullBrick(x, y, z);
-                brick(x, y, z) = b;
-            }
+        case Quantise8Bit:
+            return RT_FORMAT_UNSIGNED_BYTE;
+        case Quantise16Bit:
+            return RT_FORMAT_UNSIGNED_SHORT;
+        case QuantiseHalf:
+            return RT_FORMAT_HALF;
+        default:
+            break;
         }
     }
-    timer.stop();
-    mStats.set("loadtime", timer.getTime());
+
+    /* Signed texture reads normalise to [-1, 1], VolumeFile stores signed
+       voxels biased into unsigned ones instead */
+    switch(mVolume->dataType)
+    {
+    case Volume::UCHAR:
+        return RT_FORMAT_UNSIGNED_BYTE;
+    case Volume::USHORT:
+        return RT_FORMAT_UNSIGNED_SHORT;
+    case Volume::UINT:
+        return RT_FORMAT_UNSIGNED_INT;
+    case Volume::FLOAT:
+        return RT_FORMAT_FLOAT;
+    default:
+        /* VolumeFile converts these to a compact type while loading */
+        std::cerr << "==BrickPool== Unsupported pool data type, convert on load" << std::endl;
+        return RT_FORMAT_FLOAT;
+    }
+}
+
+void VolumeBrickPool::reportQuantisation(std::ostream& out) const
+{
+    out << "brick_x,brick_y,brick_z,min,max,scale,offset,max_error,mean_error" << std::endl;
+    for(size_t i = 0; i < mBricks.size(); ++i)
+    {
+        const VolumeBrick& b = mBricks[i];
+        out << b.mBrickIndex.x << "," << b.mBrickIndex.y << "," << b.mBrickIndex.z;
+        out << "," << b.minValue << "," << b.maxValue;
+        out << "," << b.mScale << "," << b.mOffset;
+        out << "," << b.mQuantisationMaxError << "," << b.mQuantisationMeanError;
+        out << std::endl;
+    }
 }
 
 void VolumeBrickPool::volume(Volume *v)
@@ -99,6 +580,67 @@ void VolumeBrickPool::volume(Volume *v)
     set_brick_size(mBrickSize);
 }
 
+size_t VolumeBrickPool::fetchBricks(const std::vector<size_t>& indices)
+{
+    utils::Timer timer;
+    timer.start();
+
+    std::vector<size_t> missing;
+    for(size_t i = 0; i < indices.size(); ++i)
+    {
+        if(mBricks[indices[i]].mData)
+        {
+            mHostCache.touch(indices[i]);
+            mHostCache.mHits++;
+        }
+        else
+        {
+            missing.push_back(indices[i]);
+        }
+    }
+
+    if(mSource)
+    {
+        #pragma omp parallel for schedule(dynamic)
+        for(int i = 0; i < (int)missing.size(); ++i)
+        {
+            if(!mSource->readBrick(this, mBricks[missing[i]]))
+            {
+                #pragma omp critical
+                std::cerr << "==BrickPool== Couldn't read brick " << missing[i] << std::endl;
+            }
+        }
+    }
+
+    /* Bricks read just now are the most recent, so older ones go first */
+    size_t read = 0;
+    std::vector<size_t> evicted;
+    for(size_t i = 0; i < missing.size(); ++i)
+    {
+        VolumeBrick& b = mBricks[missing[i]];
+        if(b.mData == nullptr)
+        {
+            continue;
+        }
+        mHostCache.insert(missing[i], b.mDataTotal, evicted);
+        mHostCache.mMisses++;
+        read++;
+    }
+    for(size_t i = 0; i < evicted.size(); ++i)
+    {
+        mBricks[evicted[i]].free();
+    }
+
+    timer.stop();
+    mStats.set("brickreadtime", timer.getTime());
+    mStats.set("brickreads", read);
+    mStats.set("hostcachebytes", mHostCache.bytes());
+    mStats.set("hostcachehits", mHostCache.mHits);
+    mStats.set("hostcachemisses", mHostCache.mMisses);
+    mStats.set("hostcacheevictions", evicted.size());
+    return read;
+}
+
 size_t VolumeBrickPool::testBricks(const TransferFunction& tf)
 {
     utils::Timer timer;
@@ -125,30 +667,212 @@ size_t VolumeBrickPool::testBricks(const TransferFunction& tf)
     return changes;
 }
 
-VolumeBrick VolumeBrickPool::pullBrick(int bx, int by, int bz)
+size_t VolumeBrickPool::uploadActiveBricks()
+{
+    /* Iterate throught the bricks and upload the unpaged ones */
+    std::vector<size_t> pending;
+    for(size_t i = 0; i < mBricks.size(); ++i)
+    {
+        if(mBricks[i].mActive && !mBricks[i].mPaged)
+        {
+            pending.push_back(i);
+        }
+    }
+
+    /* Out-of-core bricks are read in batches that fit the host cache */
+    size_t brickBytes = mBytesPerVoxel
+        * mActualDataSize.x * mActualDataSize.y * mActualDataSize.z;
+    size_t batch = mSource ? mHostCache.capacity(brickBytes) : pending.size();
+    size_t uploadedbricks = 0;
+    for(size_t start = 0; start < pending.size(); start += batch)
+    {
+        size_t end = std::min(start + batch, pending.size());
+        if(mSource)
+        {
+            std::vector<size_t> indices(pending.begin() + start, pending.begin() + end);
+            fetchBricks(indices);
+        }
+        for(size_t i = start; i < end; ++i)
+        {
+            if(mBricks[pending[i]].mData)
+            {
+                uploadBrick(mBricks[pending[i]]);
+                uploadedbricks++;
+            }
+        }
+    }
+    mStats.set("numnewuploadedbricks", uploadedbricks);
+    mStats.set("uploadedbytes", uploadedbricks * brickBytes);
+
+    return uploadedbricks;
+}
+
+bool VolumeBrickPool::pageBrick(VolumeBrick& brick, vec3size_t& slot)
 {
+    /* Slots given up by earlier frames are filled first */
+    size_t uploadslot;
+    if(mFreeSlots.size())
+    {
+        uploadslot = mFreeSlots.back();
+        mFreeSlots.pop_back();
+    }
+    else if(mNextUploadSlot < mTotalPoolBrickSlots)
+    {
+        uploadslot = mNextUploadSlot++;
+    }
+    else
+    {
+        std::cerr << "==BrickPool== Out of brick upload slots" << std::endl;
+        return false;
+    }
+
+    slot.z = uploadslot / (mPoolBrickSlots.x * mPoolBrickSlots.y);
+    slot.y = (uploadslot % (mPoolBrickSlots.x * mPoolBrickSlots.y))
+        / mPoolBrickSlots.x;
+    slot.x = uploadslot % mPoolBrickSlots.x;
+
+    brick.mPaged = true;
+    brick.mPoolSlot = uploadslot;
+
+    /* Update the page table */
+    size_t brickIndex = brick.mBrickIndex.x;
+    brickIndex += brick.mBrickIndex.y * mNumBricks.x;
+    brickIndex += brick.mBrickIndex.z * mNumBricks.x * mNumBricks.y;
+    struct PageTableEntry pageTableEntry;
+    pageTableEntry.x = slot.x;
+    pageTableEntry.y = slot.y;
+    pageTableEntry.z = slot.z;
+    pageTableEntry.flags = PageTableEntryPaged;
+    mPageTableData[brickIndex] = pageTableEntry;
+
+    struct PageTableScaleEntry scaleEntry;
+    scaleEntry.scale = brick.mScale;
+    scaleEntry.offset = brick.mOffset;
+    mPageTableScaleData[brickIndex] = scaleEntry;
+    return true;
+}
+
+void VolumeBrickPool::pullBricks(
+    Volume* volume,
+    const vec3size_t& brickSize,
+    std::vector<VolumeBrick>& bricks
+){
+    vec3size_t numBricks;
+    numBricks.x = ceilf(volume->dataDimensions.x / (float)brickSize.x);
+    numBricks.y = ceilf(volume->dataDimensions.y / (float)brickSize.y);
+    numBricks.z = ceilf(volume->dataDimensions.z / (float)brickSize.z);
+    bricks.resize(numBricks.x * numBricks.y * numBricks.z);
+
+    #pragma omp parallel for collapse(3)
+    for(int z = 0; z < (int)numBricks.z; ++z)
+    {
+        for(int y = 0; y < (int)numBricks.y; ++y)
+        {
+            for(int x = 0; x < (int)numBricks.x; ++x)
+            {
+                size_t index = x + numBricks.x * y + numBricks.x * numBricks.y * z;
+                bricks[index] = pullBrick(volume, brickSize, x, y, z);
+            }
+        }
+    }
+}
+
+size_t VolumeBrickPool::pullChangedBricks(
+    Volume* volume,
+    Volume* previous,
+    int previousFrame,
+    const vec3size_t& brickSize,
+    std::vector<VolumeBrick>& bricks
+){
+    vec3size_t numBricks;
+    numBricks.x = ceilf(volume->dataDimensions.x / (float)brickSize.x);
+    numBricks.y = ceilf(volume->dataDimensions.y / (float)brickSize.y);
+    numBricks.z = ceilf(volume->dataDimensions.z / (float)brickSize.z);
+    bricks.resize(numBricks.x * numBricks.y * numBricks.z);
+
+    size_t unchanged = 0;
+    #pragma omp parallel for collapse(3) reduction(+:unchanged)
+    for(int z = 0; z < (int)numBricks.z; ++z)
+    {
+        for(int y = 0; y < (int)numBricks.y; ++y)
+        {
+            for(int x = 0; x < (int)numBricks.x; ++x)
+            {
+                size_t index = x + numBricks.x * y + numBricks.x * numBricks.y * z;
+                if(brickUnchanged(volume, previous, brickSize, x, y, z))
+                {
+                    VolumeBrick brick;
+                    brick.mBrickIndex = vec3size_t(x, y, z);
+                    brick.mDataDimensions = brickSize;
+                    brick.mActualDimensions = brick.mDataDimensions + brick.mPadMin + brick.mPadMax;
+                    brick.mSameAs = previousFrame;
+                    bricks[index] = brick;
+                    unchanged++;
+                }
+                else
+                {
+                    bricks[index] = pullBrick(volume, brickSize, x, y, z);
+                }
+            }
+        }
+    }
+    return unchanged;
+}
+
+bool VolumeBrickPool::brickUnchanged(
+    Volume* volume,
+    Volume* previous,
+    const vec3size_t& brickSize,
+    int bx, int by, int bz
+){
+    /* Same region pullBrick copies, padding included */
+    vec3size_t actualDimensions = brickSize + vec3size_t(1);
+    size_t bpv = volume->bytesPerVoxel;
+    size_t rowStart = bx * brickSize.x;
+    size_t rowEnd = std::min(rowStart + actualDimensions.x, (size_t)volume->dataDimensions.x);
+    size_t rowBytes = bpv * (rowEnd - rowStart);
+    for(size_t z = 0; z < actualDimensions.z; ++z)
+    {
+        for(size_t y = 0; y < actualDimensions.y; ++y)
+        {
+            vec3f p;
+            p.x = rowStart;
+            p.y = by * brickSize.y + y;
+            p.z = bz * brickSize.z + z;
+            p = min(p, volume->dataDimensions - vec3f(1));
+            if(memcmp(volume->voxeladdress(p), previous->voxeladdress(p), rowBytes) != 0)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+VolumeBrick VolumeBrickPool::pullBrick(
+    Volume* volume,
+    const vec3size_t& brickSize,
+    int bx, int by, int bz
+){
     VolumeBrick brick;
     brick.mBrickIndex = vec3size_t(bx, by, bz);
-    brick.mDataDimensions = mBrickSize;
+    brick.mDataDimensions = brickSize;
     brick.mActualDimensions = brick.mDataDimensions + brick.mPadMin + brick.mPadMax;
-    size_t bpv = mVolume->bytesPerVoxel;
-    brick.mDataTotal =
-        bpv
-        * brick.mActualDimensions.x
+    size_t bpv = volume->bytesPerVoxel;
+    size_t brickVoxels =
+        brick.mActualDimensions.x
         * brick.mActualDimensions.y
         * brick.mActualDimensions.z;
-    brick.mData = new char[brick.mDataTotal];
+    brick.mDataTotal = bpv * brickVoxels;
 
-    int rowSize = brick.mActualDimensions.x;
-    int rowStart = bx * brick.mDataDimensions.x;
-    int rowEnd = rowStart + rowSize;
-    int volumeLimit = mVolume->dataLimits.x;
-    int rowLimit = 0;
-    if(volumeLimit <= rowEnd)
-    {
-        rowLimit = rowEnd - volumeLimit;
-    }
-    rowSize -= rowLimit;
+    /* Quantised bricks are pulled into a zeroed scratch copy first */
+    char* data = quantises(volume) ? new char[brick.mDataTotal]() : new char[brick.mDataTotal];
+
+    /* Voxels of the row inside the volume, the same as brickUnchanged
+       compares. At least one: a brick may start on the last voxel */
+    size_t rowStart = bx * brick.mDataDimensions.x;
+    size_t rowLimit = (size_t)volume->dataDimensions.x;
+    size_t rowSize = rowStart < rowLimit ? std::min((size_t)brick.mActualDimensions.x, rowLimit - rowStart) : 1;
     size_t brickStride = bpv * (rowSize);
     for(size_t z = 0; z < brick.mActualDimensions.z; ++z)
     {
@@ -167,18 +891,100 @@ VolumeBrick VolumeBrickPool::pullBrick(int bx, int by, int bz)
             p.x = src_x;
             p.y = src_y;
             p.z = src_z;
-            p = min(p, mVolume->dataDimensions - vec3f(1));
+            p = min(p, volume->dataDimensions - vec3f(1));
 
-            memcpy(&brick.mData[dst], mVolume->voxeladdress(p), brickStride);
+            memcpy(&data[dst], volume->voxeladdress(p), brickStride);
+
+            /* Past the volume's edge rows repeat their last voxel, as y and
+               z do and as the leaf ranges assume */
+            for(size_t x = rowSize; x < brick.mActualDimensions.x; ++x)
+            {
+                memcpy(&data[dst + bpv * x], &data[dst + bpv * (rowSize - 1)], bpv);
+            }
 
             for(size_t x = 0; x < brick.mActualDimensions.x; ++x)
             {
-                p.x = bx * brick.mDataDimensions.x + x;
-                float v = mVolume->GetNormalisedVoxel(p);
+                p.x = fminf(bx * brick.mDataDimensions.x + x, volume->dataLimits.x);
+                float v = volume->GetNormalisedVoxel(p);
                 brick.minValue = fmin(v, brick.minValue);
                 brick.maxValue = fmax(v, brick.maxValue);
             }
         }
     }
+
+    if(quantises(volume))
+    {
+        quantiseBrick(brick, (const float*)data, rowSize);
+        delete[] data;
+    }
+    else
+    {
+        brick.mData = data;
+    }
     return brick;
+}
+
+void VolumeBrickPool::quantiseBrick(VolumeBrick &brick, const float* data, size_t validRow)
+{
+    size_t brickVoxels =
+        brick.mActualDimensions.x
+        * brick.mActualDimensions.y
+        * brick.mActualDimensions.z;
+    size_t bpv = (mQuantisation == Quantise8Bit) ? 1 : 2;
+    brick.mDataTotal = bpv * brickVoxels;
+    brick.mData = new char[brick.mDataTotal];
+
+    /* Half floats keep absolute values, the integer formats are brick relative */
+    float lo = brick.minValue;
+    float hi = brick.maxValue;
+    if(mQuantisation == QuantiseHalf)
+    {
+        brick.mScale = 1.0f;
+        brick.mOffset = 0.0f;
+    }
+    else
+    {
+        brick.mScale = hi - lo;
+        brick.mOffset = lo;
+    }
+    float levels = (mQuantisation == Quantise8Bit) ? 255.0f : 65535.0f;
+    float invScale = brick.mScale > 0.0f ? 1.0f / brick.mScale : 0.0f;
+
+    double errorSum = 0.0;
+    float errorMax = 0.0f;
+    size_t errorCount = 0;
+    for(size_t i = 0; i < brickVoxels; ++i)
+    {
+        float v = data[i];
+        v = (v < lo) ? lo : ((v > hi) ? hi : v);
+
+        float decoded;
+        if(mQuantisation == QuantiseHalf)
+        {
+            unsigned short h = floatToHalf(v);
+            ((unsigned short*)brick.mData)[i] = h;
+            decoded = halfToFloat(h);
+        }
+        else
+        {
+            float n = (v - brick.mOffset) * invScale;
+            unsigned int q = (unsigned int)(n * levels + 0.5f);
+            if(mQuantisation == Quantise8Bit)
+                ((unsigned char*)brick.mData)[i] = (unsigned char)q;
+            else
+                ((unsigned short*)brick.mData)[i] = (unsigned short)q;
+            decoded = ((float)q / levels) * brick.mScale + brick.mOffset;
+        }
+
+        /* Only voxels actually copied from the volume count towards error */
+        if((i % brick.mActualDimensions.x) < validRow)
+        {
+            float error = fabsf(decoded - data[i]);
+            errorMax = fmax(errorMax, error);
+            errorSum += error;
+            errorCount++;
+        }
+    }
+    brick.mQuantisationMaxError = errorMax;
+    brick.mQuantisationMeanError = errorCount ? (float)(errorSum / (double)errorCount) : 0.0f;
 }
\ No newline at end of file
@@ -4,9 +4,12 @@
 #include <iomanip>
 #include "volume.hpp"
 #include "transferfunction.hpp"
+#include "hostbrickcache.hpp"
 #include "../programs/brickpoolentry.h"
 #include "../utils/stats.hpp"
 
+class BrickSource;
+
 class VolumeBrick
 {
 public:
@@ -15,8 +18,19 @@ public:
     size_t mDataTotal;
     float minValue;
     float maxValue;
+    float mScale = 1.0f;
+    float mOffset = 0.0f;
+    float mQuantisationMaxError = 0.0f;
+    float mQuantisationMeanError = 0.0f;
     bool mActive = false;
     bool mPaged = false;
+    /* Data mapped from a brick cache isn't freed with the brick */
+    bool mOwnsData = true;
+    /* Pool slot holding the brick while it's paged */
+    size_t mPoolSlot = 0;
+    /* Frame with identical contents this brick takes its data from, when
+       it has none of its own */
+    int mSameAs = -1;
     vec3size_t mBrickIndex;
     vec3size_t mDataDimensions;
     vec3size_t mActualDimensions;
@@ -34,15 +48,56 @@ public:
 
     void free()
     {
-        if(mData)
+        if(mData && mOwnsData)
             delete[] mData;
+        mData = nullptr;
     }
 };
 
 class VolumeBrickPool
 {
 public:
+    /**
+     * Storage format of float volumes in the pool. Quantised bricks are
+     * stored as normalised integers relative to the brick's min/max, and
+     * decoded with the scale/offset stored alongside the page table.
+     */
+    enum Quantisation
+    {
+        QuantiseNone,
+        Quantise8Bit,
+        Quantise16Bit,
+        QuantiseHalf
+    };
+
+    /* Reduction used when building coarser pyramid levels */
+    enum DownsampleFilter
+    {
+        FilterBox,
+        FilterMax
+    };
+
+    /**
+     * A single level of the brick pyramid. The level currently selected
+     * for rendering is swapped into the pool's own brick and page table
+     * members, so the entry for it in mLevels is left empty.
+     */
+    struct BrickLevel
+    {
+        vec3f mDataDimensions;
+        vec3size_t mNumBricks;
+        std::vector<VolumeBrick> mBricks;
+        std::vector<struct PageTableEntry> mPageTableData;
+        std::vector<struct PageTableScaleEntry> mPageTableScaleData;
+    };
+
     Stats mStats;
+    Quantisation mQuantisation = QuantiseNone;
+
+    std::vector<BrickLevel> mLevels;
+    size_t mCurrentLevel = 0;
+    size_t mPyramidLevels = 1;
+    DownsampleFilter mPyramidFilter = FilterMax;
 
     std::vector<VolumeBrick> mBricks;
 
@@ -55,17 +110,56 @@ public:
     size_t mBytesPerVoxel;
     size_t mTotalPoolBrickSlots;
     size_t mNextUploadSlot;
+    std::vector<size_t> mFreeSlots;
     Volume* mVolume = nullptr;
 
+    /* Set for out-of-core volumes, whose bricks are read on demand and
+       only kept in host memory while they fit the host cache */
+    BrickSource* mSource = nullptr;
+    HostBrickCache mHostCache;
+
     size_t mPageTableMemoryUsage = 0;
     std::vector<struct PageTableEntry> mPageTableData;
+    std::vector<struct PageTableScaleEntry> mPageTableScaleData;
 
     VolumeBrickPool();
 
     void volume(Volume *v);
+    /* Use bricks already built for v at the current brick size, e.g. from a cache */
+    void volume(Volume *v, std::vector<VolumeBrick>& bricks);
     void set_brick_size(const vec3size_t &bricksize, const vec3size_t &padding = vec3size_t(1));
+    void set_quantisation(Quantisation quantisation);
+    void build_pyramid(size_t levels, DownsampleFilter filter = FilterMax);
+    void clear_pyramid();
+    void select_level(size_t level);
+
+    /**
+     * Swap in the bricks of another frame of the same volume, built with
+     * pullBricks at the current brick size. On return bricks holds the
+     * outgoing frame's bricks. Incoming bricks without data that match the
+     * outgoing frame take over its brick, pool slot and page table entry,
+     * so only bricks that actually changed are uploaded again.
+     */
+    void swap_frame(
+        Volume* volume,
+        std::vector<VolumeBrick>& bricks,
+        int outgoingFrame = -1,
+        int incomingFrame = -1
+    );
+    void resetPageTable();
+    bool layoutBricks(const vec3size_t &bricksize, const vec3size_t &padding);
+    void finishBricks();
+    vec3f levelDimensions() const;
     virtual void allocate() = 0;
 
+    /* Quantisation only applies to float volumes */
+    bool quantising() const;
+    bool quantises(const Volume* volume) const;
+    size_t poolBytesPerVoxel() const;
+    /* Element format of the pool, following the volume type and quantisation */
+    RTformat poolFormat() const;
+    void reportQuantisation(std::ostream& out) const;
+
     /**
      * Upload brick data to the next available slot in the GPU
      * texture. Note that this assumes data is the same size
@@ -77,10 +171,48 @@ public:
         return mBricks[x + (int)mNumBricks.x * y + (int)mNumBricks.x * (int)mNumBricks.y * z];
     }
 
-    VolumeBrick pullBrick(int bx, int by, int bz);
+    /**
+     * Bricks are pulled from the given volume rather than mVolume, so other
+     * frames and pyramid levels can be bricked without touching the pool.
+     */
+    void pullBricks(Volume* volume, const vec3size_t& brickSize, std::vector<VolumeBrick>& bricks);
+
+    /**
+     * As pullBricks, but bricks whose voxels exactly match those in the
+     * previous frame's volume are left without data and marked as the
+     * same as that frame. Returns the number of unchanged bricks.
+     */
+    size_t pullChangedBricks(
+        Volume* volume,
+        Volume* previous,
+        int previousFrame,
+        const vec3size_t& brickSize,
+        std::vector<VolumeBrick>& bricks
+    );
+    static bool brickUnchanged(Volume* volume, Volume* previous, const vec3size_t& brickSize, int bx, int by, int bz);
+    VolumeBrick pullBrick(Volume* volume, const vec3size_t& brickSize, int bx, int by, int bz);
+    void quantiseBrick(VolumeBrick &brick, const float* data, size_t validRow);
+
+    /**
+     * Makes sure the given bricks have data, reading those that don't from
+     * the source in parallel and evicting the least recently used bricks
+     * beyond the host cache budget. Returns the number of bricks read.
+     */
+    size_t fetchBricks(const std::vector<size_t>& indices);
 
     size_t testBricks(const TransferFunction &tf);
 
+    /**
+     * Uploads the active bricks that aren't paged yet, reading out-of-core
+     * bricks in batches that fit the host cache. Returns the number of
+     * bricks uploaded; the page table itself is left to the caller.
+     */
+    size_t uploadActiveBricks();
+
+    /* Claims a free pool slot for the brick and points its page table entry at it */
+    bool pageBrick(VolumeBrick& brick, vec3size_t& slot);
+
+    virtual void uploadBrick(VolumeBrick& brick) = 0;
     virtual size_t upload() = 0;
     virtual void allocatePageTable() = 0;
     virtual void uploadPageTable() = 0;
@@ -0,0 +1,458 @@
+#include "bricksource.hpp"
+
+#include <algorithm>
+#include <string.h>
+#include <sys/stat.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* Rows of a z slice read at once when streaming the histogram */
+static const size_t HistogramRows = 64;
+
+static bool readFully(int fd, char* destination, size_t bytes, uint64_t offset)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    return false;
+#else
+    size_t done = 0;
+    while(done < bytes)
+    {
+        ssize_t got = pread(fd, destination + done, bytes - done, (off_t)(offset + done));
+        if(got <= 0)
+        {
+            return false;
+        }
+        done += (size_t)got;
+    }
+    return true;
+#endif
+}
+
+RawBrickSource::RawBrickSource(const VolumeFile& file) :
+    mFile(file)
+{
+}
+
+RawBrickSource::~RawBrickSource()
+{
+#if !defined(_WIN32) && !defined(_WIN64)
+    if(mFd >= 0)
+    {
+        close(mFd);
+    }
+#endif
+    delete mVolume;
+}
+
+bool RawBrickSource::open()
+{
+#if defined(_WIN32) || defined(_WIN64)
+    std::cerr << "==BrickSource== Out-of-core volumes need pread()" << std::endl;
+    return false;
+#else
+    if(mFile.volumes.size() == 0)
+    {
+        return false;
+    }
+
+    mVolume = mFile.createHeader();
+    if(mVolume == nullptr)
+    {
+        std::cerr << "==BrickSource== This element type can't be read out-of-core" << std::endl;
+        return false;
+    }
+
+    const char* path = mFile.volumes[0].c_str();
+    mFd = ::open(path, O_RDONLY);
+    if(mFd < 0)
+    {
+        std::cerr << "==BrickSource== Error opening file: " << path << std::endl;
+        return false;
+    }
+
+    struct stat info;
+    if(fstat(mFd, &info) != 0 || (size_t)info.st_size < mVolume->dataTotal)
+    {
+        std::cerr << "==BrickSource== " << path << " is smaller than its header says" << std::endl;
+        return false;
+    }
+
+    std::cout << "==BrickSource== Reading " << path << " out-of-core ("
+        << mVolume->dataTotal << " bytes)" << std::endl;
+    return true;
+#endif
+}
+
+Volume* RawBrickSource::readRegion(const vec3size_t& origin, const vec3size_t& size)
+{
+    const vec3size_t dims(mVolume->dataDimensions);
+    vec3size_t extent;
+    extent.x = std::min(size.x, dims.x - origin.x);
+    extent.y = std::min(size.y, dims.y - origin.y);
+    extent.z = std::min(size.z, dims.z - origin.z);
+
+    Volume* region = VolumeFile::createVolume(mVolume->dataType);
+    region->dataType = mVolume->dataType;
+    region->dataDimensions = vec3f(extent.x, extent.y, extent.z);
+    region->dataLimits = region->dataDimensions - vec3f(1.0f);
+    region->voxelsTotal = extent.x * extent.y * extent.z;
+    region->dataTotal = region->bytesPerVoxel * region->voxelsTotal;
+    region->dataScale = mVolume->dataScale;
+    region->dataOffset = mVolume->dataOffset;
+    region->data = new char[region->dataTotal];
+
+    /* Whole rows are contiguous in the file, so read a slice at a time */
+    const size_t bpv = mVolume->bytesPerVoxel;
+    const size_t rowBytes = bpv * extent.x;
+    const bool wholeRows = (origin.x == 0 && extent.x == dims.x);
+    bool ok = true;
+    for(size_t z = 0; ok && z < extent.z; ++z)
+    {
+        uint64_t slice = (uint64_t)(origin.z + z) * dims.y * dims.x;
+        if(wholeRows)
+        {
+            uint64_t offset = bpv * (slice + (uint64_t)origin.y * dims.x);
+            ok = readFully(mFd, region->data + z * extent.y * rowBytes, extent.y * rowBytes, offset);
+            continue;
+        }
+        for(size_t y = 0; ok && y < extent.y; ++y)
+        {
+            uint64_t offset = bpv * (slice + (uint64_t)(origin.y + y) * dims.x + origin.x);
+            ok = readFully(mFd, region->data + (z * extent.y + y) * rowBytes, rowBytes, offset);
+        }
+    }
+
+    if(!ok)
+    {
+        freeRegion(region);
+        return nullptr;
+    }
+    VolumeFile::removeSign(mFile.type, region->data, region->voxelsTotal);
+    return region;
+}
+
+void RawBrickSource::freeRegion(Volume* region)
+{
+    delete[] region->data;
+    delete region;
+}
+
+void RawBrickSource::scanLeaves(const vec3size_t& leafSize, std::vector<AccelerationLeaf>& leaves)
+{
+    const vec3size_t dims(mVolume->dataDimensions);
+    vec3size_t numLeaves;
+    numLeaves.x = ceilf(mVolume->dataDimensions.x / (float)leafSize.x);
+    numLeaves.y = ceilf(mVolume->dataDimensions.y / (float)leafSize.y);
+    numLeaves.z = ceilf(mVolume->dataDimensions.z / (float)leafSize.z);
+    leaves.assign(numLeaves.x * numLeaves.y * numLeaves.z, AccelerationLeaf());
+
+    /* A row of leaves with the padding scanBrick reads past its far side */
+    bool failed = false;
+    #pragma omp parallel for collapse(2) schedule(dynamic)
+    for(int z = 0; z < (int)numLeaves.z; ++z)
+    {
+        for(int y = 0; y < (int)numLeaves.y; ++y)
+        {
+            Volume* slab = readRegion(
+                vec3size_t(0, y * leafSize.y, z * leafSize.z),
+                vec3size_t(dims.x, leafSize.y + 1, leafSize.z + 1)
+            );
+            if(slab == nullptr)
+            {
+                #pragma omp atomic write
+                failed = true;
+                continue;
+            }
+            for(int x = 0; x < (int)numLeaves.x; ++x)
+            {
+                size_t index = x + numLeaves.x * y + numLeaves.x * numLeaves.y * z;
+                leaves[index] = BrickedVolume::scanBrick(slab, leafSize, x, 0, 0);
+            }
+            freeRegion(slab);
+        }
+    }
+
+    if(failed)
+    {
+        std::cerr << "==BrickSource== Couldn't read all leaves" << std::endl;
+    }
+}
+
+void RawBrickSource::scanBricks(
+    VolumeBrickPool* pool,
+    const vec3size_t& brickSize,
+    std::vector<VolumeBrick>& bricks
+){
+    const vec3size_t dims(mVolume->dataDimensions);
+    vec3size_t numBricks;
+    numBricks.x = ceilf(mVolume->dataDimensions.x / (float)brickSize.x);
+    numBricks.y = ceilf(mVolume->dataDimensions.y / (float)brickSize.y);
+    numBricks.z = ceilf(mVolume->dataDimensions.z / (float)brickSize.z);
+    bricks.assign(numBricks.x * numBricks.y * numBricks.z, VolumeBrick());
+
+    /* Pull each brick from a slab holding its row, then drop the data */
+    VolumeBrick layout;
+    vec3size_t actual = brickSize + layout.mPadMin + layout.mPadMax;
+    bool failed = false;
+    #pragma omp parallel for collapse(2) schedule(dynamic)
+    for(int z = 0; z < (int)numBricks.z; ++z)
+    {
+        for(int y = 0; y < (int)numBricks.y; ++y)
+        {
+            Volume* slab = readRegion(
+                vec3size_t(0, y * brickSize.y, z * brickSize.z),
+                vec3size_t(dims.x, actual.y, actual.z)
+            );
+            if(slab == nullptr)
+            {
+                #pragma omp atomic write
+                failed = true;
+                continue;
+            }
+            for(int x = 0; x < (int)numBricks.x; ++x)
+            {
+                size_t index = x + numBricks.x * y + numBricks.x * numBricks.y * z;
+                VolumeBrick brick = pool->pullBrick(slab, brickSize, x, 0, 0);
+                brick.free();
+                brick.mBrickIndex = vec3size_t(x, y, z);
+                bricks[index] = brick;
+            }
+            freeRegion(slab);
+        }
+    }
+
+    if(failed)
+    {
+        std::cerr << "==BrickSource== Couldn't read all bricks" << std::endl;
+    }
+}
+
+bool RawBrickSource::readBrick(VolumeBrickPool* pool, VolumeBrick& brick)
+{
+    /* One voxel more in x so pullBrick clamps the row as it does on the whole volume */
+    const vec3size_t brickSize = pool->mBrickSize;
+    vec3size_t origin(
+        brick.mBrickIndex.x * brickSize.x,
+        brick.mBrickIndex.y * brickSize.y,
+        brick.mBrickIndex.z * brickSize.z
+    );
+    vec3size_t size = brick.mActualDimensions + vec3size_t(1, 0, 0);
+    Volume* region = readRegion(origin, size);
+    if(region == nullptr)
+    {
+        return false;
+    }
+
+    VolumeBrick pulled = pool->pullBrick(region, brickSize, 0, 0, 0);
+    freeRegion(region);
+
+    brick.mData = pulled.mData;
+    brick.mDataTotal = pulled.mDataTotal;
+    brick.mOwnsData = true;
+    return true;
+}
+
+void RawBrickSource::histogram(float lo, float hi, size_t numBins, std::vector<uint64_t>& bins)
+{
+    bins.assign(numBins, 0);
+    const float range = hi > lo ? hi - lo : 1.0f;
+    const vec3size_t dims(mVolume->dataDimensions);
+    const size_t chunks = (dims.y + HistogramRows - 1) / HistogramRows;
+
+    #pragma omp parallel
+    {
+        std::vector<uint64_t> local(numBins, 0);
+
+        #pragma omp for collapse(2) schedule(dynamic)
+        for(int z = 0; z < (int)dims.z; ++z)
+        {
+            for(int c = 0; c < (int)chunks; ++c)
+            {
+                Volume* rows = readRegion(
+                    vec3size_t(0, c * HistogramRows, z),
+                    vec3size_t(dims.x, HistogramRows, 1)
+                );
+                if(rows == nullptr)
+                {
+                    continue;
+                }
+                for(size_t y = 0; y < (size_t)rows->dataDimensions.y; ++y)
+                {
+                    for(size_t x = 0; x < dims.x; ++x)
+                    {
+                        float v = rows->GetNormalisedVoxel(vec3f(x, y, 0));
+                        int bin = (int)((v - lo) / range * (float)numBins);
+                        bin = bin < 0 ? 0 : (bin >= (int)numBins ? (int)numBins - 1 : bin);
+                        local[bin]++;
+                    }
+                }
+                freeRegion(rows);
+            }
+        }
+
+        #pragma omp critical
+        for(size_t b = 0; b < numBins; ++b)
+        {
+            bins[b] += local[b];
+        }
+    }
+}
+
+CachedBrickSource::CachedBrickSource(const VolumeFile& file, const std::string& path) :
+    RawBrickSource(file),
+    mPath(path)
+{
+    memset(&mHeader, 0, sizeof(mHeader));
+}
+
+CachedBrickSource::~CachedBrickSource()
+{
+#if !defined(_WIN32) && !defined(_WIN64)
+    if(mCacheFd >= 0)
+    {
+        close(mCacheFd);
+    }
+#endif
+}
+
+bool CachedBrickSource::open()
+{
+#if defined(_WIN32) || defined(_WIN64)
+    return false;
+#else
+    mCacheFd = ::open(mPath.c_str(), O_RDONLY);
+    if(mCacheFd < 0)
+    {
+        return false;
+    }
+
+    struct stat info;
+    if(fstat(mCacheFd, &info) != 0
+        || !readFully(mCacheFd, (char*)&mHeader, sizeof(mHeader), 0)
+        || !BrickCache::matches(mHeader, (uint64_t)info.st_size, mFile))
+    {
+        std::cout << "==BrickSource== " << mPath << " doesn't match the volume, rebuilding" << std::endl;
+        return false;
+    }
+
+    mBrickRecords.resize(mHeader.mNumBricks);
+    if(!readFully(
+        mCacheFd,
+        (char*)mBrickRecords.data(),
+        mBrickRecords.size() * sizeof(BrickCache::BrickRecord),
+        mHeader.mBricksOffset
+    )){
+        return false;
+    }
+
+    if(!RawBrickSource::open())
+    {
+        return false;
+    }
+    std::cout << "==BrickSource== Reading bricks from " << mPath << std::endl;
+    return true;
+#endif
+}
+
+bool CachedBrickSource::cachedBrickSize(const vec3size_t& brickSize) const
+{
+    return mHeader.mBrickSize[0] == brickSize.x
+        && mHeader.mBrickSize[1] == brickSize.y
+        && mHeader.mBrickSize[2] == brickSize.z;
+}
+
+void CachedBrickSource::scanLeaves(const vec3size_t& leafSize, std::vector<AccelerationLeaf>& leaves)
+{
+    if(mHeader.mLeafSize[0] != leafSize.x
+        || mHeader.mLeafSize[1] != leafSize.y
+        || mHeader.mLeafSize[2] != leafSize.z)
+    {
+        RawBrickSource::scanLeaves(leafSize, leaves);
+        return;
+    }
+
+    std::vector<BrickCache::LeafRecord> records(mHeader.mNumLeaves);
+    if(!readFully(
+        mCacheFd,
+        (char*)records.data(),
+        records.size() * sizeof(BrickCache::LeafRecord),
+        mHeader.mLeavesOffset
+    )){
+        RawBrickSource::scanLeaves(leafSize, leaves);
+        return;
+    }
+
+    leaves.assign(records.size(), AccelerationLeaf());
+    for(size_t i = 0; i < leaves.size(); ++i)
+    {
+        leaves[i].mMinTFValue = records[i].mMinValue;
+        leaves[i].mMaxTFValue = records[i].mMaxValue;
+    }
+}
+
+void CachedBrickSource::scanBricks(
+    VolumeBrickPool* pool,
+    const vec3size_t& brickSize,
+    std::vector<VolumeBrick>& bricks
+){
+    const uint32_t quantisation = pool->quantises(mVolume)
+        ? (uint32_t)pool->mQuantisation
+        : (uint32_t)VolumeBrickPool::QuantiseNone;
+    mCachedBricks = cachedBrickSize(brickSize) && mHeader.mQuantisation == quantisation;
+    if(!mCachedBricks)
+    {
+        RawBrickSource::scanBricks(pool, brickSize, bricks);
+        return;
+    }
+
+    vec3size_t numBricks;
+    numBricks.x = ceilf(mVolume->dataDimensions.x / (float)brickSize.x);
+    numBricks.y = ceilf(mVolume->dataDimensions.y / (float)brickSize.y);
+    numBricks.z = ceilf(mVolume->dataDimensions.z / (float)brickSize.z);
+    bricks.resize(mBrickRecords.size());
+    for(size_t i = 0; i < bricks.size(); ++i)
+    {
+        bricks[i] = BrickCache::brick(mBrickRecords[i], i, numBricks, brickSize);
+    }
+}
+
+bool CachedBrickSource::readBrick(VolumeBrickPool* pool, VolumeBrick& brick)
+{
+    if(!mCachedBricks || !cachedBrickSize(pool->mBrickSize))
+    {
+        return RawBrickSource::readBrick(pool, brick);
+    }
+
+    size_t index = brick.mBrickIndex.x
+        + pool->mNumBricks.x * brick.mBrickIndex.y
+        + pool->mNumBricks.x * pool->mNumBricks.y * brick.mBrickIndex.z;
+    const BrickCache::BrickRecord& record = mBrickRecords[index];
+    char* data = new char[record.mDataTotal];
+    if(!readFully(mCacheFd, data, record.mDataTotal, record.mDataOffset))
+    {
+        delete[] data;
+        return false;
+    }
+    brick.mData = data;
+    brick.mDataTotal = record.mDataTotal;
+    brick.mOwnsData = true;
+    return true;
+}
+
+void CachedBrickSource::histogram(float lo, float hi, size_t numBins, std::vector<uint64_t>& bins)
+{
+    if(mHeader.mMinValue != lo || mHeader.mMaxValue != hi || numBins != BrickCache::HistogramBins)
+    {
+        RawBrickSource::histogram(lo, hi, numBins, bins);
+        return;
+    }
+
+    bins.resize(numBins);
+    if(!readFully(mCacheFd, (char*)bins.data(), numBins * sizeof(uint64_t), mHeader.mHistogramOffset))
+    {
+        RawBrickSource::histogram(lo, hi, numBins, bins);
+    }
+}
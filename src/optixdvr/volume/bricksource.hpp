@@ -0,0 +1,96 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "volume.hpp"
+#include "brickedvolume.hpp"
+#include "brickpool.hpp"
+#include "brickcache.hpp"
+
+/**
+ * Supplies leaf ranges and brick data for a volume that isn't held in
+ * host memory. The volume handed to the subdivision and pool is only a
+ * header (data is null), and bricks are read when the pool pages them in.
+ * Leaves and bricks come out exactly as scan_leaves and pullBricks would
+ * produce them from the whole volume.
+ */
+class BrickSource
+{
+public:
+    virtual ~BrickSource() {}
+
+    /* The data-less volume bricks are read for */
+    virtual Volume* volume() = 0;
+
+    virtual void scanLeaves(const vec3size_t& leafSize, std::vector<AccelerationLeaf>& leaves) = 0;
+
+    /* Bricks come back with ranges and quantisation set but without data */
+    virtual void scanBricks(VolumeBrickPool* pool, const vec3size_t& brickSize, std::vector<VolumeBrick>& bricks) = 0;
+
+    /* Reads the data of a brick scanned at the pool's current brick size */
+    virtual bool readBrick(VolumeBrickPool* pool, VolumeBrick& brick) = 0;
+
+    /* Histogram of normalised voxel values over [lo, hi] */
+    virtual void histogram(float lo, float hi, size_t numBins, std::vector<uint64_t>& bins) = 0;
+};
+
+/**
+ * Reads bricks straight from the raw voxel file with pread(). Scanning
+ * streams the file once for the leaves and once for the bricks, a slab
+ * of rows at a time, so host memory stays bounded by a few slabs.
+ */
+class RawBrickSource : public BrickSource
+{
+public:
+    RawBrickSource(const VolumeFile& file);
+    virtual ~RawBrickSource();
+
+    /* Fails for files that can't be read piecewise, e.g. types converted on load */
+    virtual bool open();
+
+    Volume* volume() { return mVolume; }
+    void scanLeaves(const vec3size_t& leafSize, std::vector<AccelerationLeaf>& leaves);
+    void scanBricks(VolumeBrickPool* pool, const vec3size_t& brickSize, std::vector<VolumeBrick>& bricks);
+    bool readBrick(VolumeBrickPool* pool, VolumeBrick& brick);
+    void histogram(float lo, float hi, size_t numBins, std::vector<uint64_t>& bins);
+
+protected:
+    VolumeFile mFile;
+    Volume* mVolume = nullptr;
+    int mFd = -1;
+
+    /* Reads the box at origin, clamped to the volume, into a new volume */
+    Volume* readRegion(const vec3size_t& origin, const vec3size_t& size);
+    static void freeRegion(Volume* region);
+};
+
+/**
+ * Reads leaves, brick records and brick payloads from a cache file
+ * written by BrickCache, one brick at a time. Sizes or a quantisation
+ * other than the cached ones fall back to the raw file.
+ */
+class CachedBrickSource : public RawBrickSource
+{
+public:
+    CachedBrickSource(const VolumeFile& file, const std::string& path);
+    ~CachedBrickSource();
+
+    bool open();
+
+    void scanLeaves(const vec3size_t& leafSize, std::vector<AccelerationLeaf>& leaves);
+    void scanBricks(VolumeBrickPool* pool, const vec3size_t& brickSize, std::vector<VolumeBrick>& bricks);
+    bool readBrick(VolumeBrickPool* pool, VolumeBrick& brick);
+    void histogram(float lo, float hi, size_t numBins, std::vector<uint64_t>& bins);
+
+private:
+    std::string mPath;
+    int mCacheFd = -1;
+    BrickCache::Header mHeader;
+    std::vector<BrickCache::BrickRecord> mBrickRecords;
+    /* Pool bricks were scanned from the cache rather than the raw file */
+    bool mCachedBricks = false;
+
+    bool cachedBrickSize(const vec3size_t& brickSize) const;
+};
@@ -0,0 +1,214 @@
+#include "gradientpool.hpp"
+#include "../programs/shading.h"
+
+#include <type_traits>
+
+template <typename T>
+static inline float normalised(T v)
+{
+    /* As GetNormalisedVoxel and the pool's normalised texture reads */
+    if(std::is_floating_point<T>::value)
+        return (float)v;
+    const float lowest = (float)std::numeric_limits<T>::lowest();
+    return ((float)v - lowest) / ((float)std::numeric_limits<T>::max() - lowest);
+}
+
+/* Central differences of every voxel of the brick's padded region, one
+   sided on the volume's faces, packed into its slot */
+template <typename T>
+static void packBrick(
+    const Volume* volume,
+    const VolumeBrick& brick,
+    const vec3size_t& slot,
+    const vec3size_t& region,
+    const vec3size_t& dimensions,
+    unsigned char* packed
+){
+    const T* src = (const T*)volume->data;
+    const size_t dx = (size_t)volume->dataDimensions.x;
+    const size_t dy = (size_t)volume->dataDimensions.y;
+    const size_t dz = (size_t)volume->dataDimensions.z;
+    const size_t sx = dx;
+    const size_t sxy = dx * dy;
+    const vec3size_t origin(
+        brick.mBrickIndex.x * brick.mDataDimensions.x,
+        brick.mBrickIndex.y * brick.mDataDimensions.y,
+        brick.mBrickIndex.z * brick.mDataDimensions.z
+    );
+
+    for(size_t z = 0; z < region.z; ++z)
+    {
+        const size_t vz = std::min(origin.z + z, dz - 1);
+        const size_t zm = vz > 0 ? vz - 1 : vz;
+        const size_t zp = std::min(vz + 1, dz - 1);
+        for(size_t y = 0; y < region.y; ++y)
+        {
+            const size_t vy = std::min(origin.y + y, dy - 1);
+            const size_t ym = vy > 0 ? vy - 1 : vy;
+            const size_t yp = std::min(vy + 1, dy - 1);
+            unsigned char* row = packed + 4 * (
+                slot.x * region.x
+                + (slot.y * region.y + y) * dimensions.x
+                + (slot.z * region.z + z) * dimensions.x * dimensions.y);
+            for(size_t x = 0; x < region.x; ++x)
+            {
+                const size_t vx = std::min(origin.x + x, dx - 1);
+                const size_t xm = vx > 0 ? vx - 1 : vx;
+                const size_t xp = std::min(vx + 1, dx - 1);
+
+                vec3f g;
+                g.x = gradient_difference(normalised(src[xm + vy * sx + vz * sxy]),
+                    normalised(src[xp + vy * sx + vz * sxy]), (float)(xp - xm));
+                g.y = gradient_difference(normalised(src[vx + ym * sx + vz * sxy]),
+                    normalised(src[vx + yp * sx + vz * sxy]), (float)(yp - ym));
+                g.z = gradient_difference(normalised(src[vx + vy * sx + zm * sxy]),
+                    normalised(src[vx + vy * sx + zp * sxy]), (float)(zp - zm));
+
+                const float magnitude = g.length();
+                const vec3f direction = magnitude > 0.0f ? g * (1.0f / magnitude) : vec3f(0.0f);
+                row[4 * x + 0] = (unsigned char)((direction.x * 0.5f + 0.5f) * 255.0f + 0.5f);
+                row[4 * x + 1] = (unsigned char)((direction.y * 0.5f + 0.5f) * 255.0f + 0.5f);
+                row[4 * x + 2] = (unsigned char)((direction.z * 0.5f + 0.5f) * 255.0f + 0.5f);
+                row[4 * x + 3] = (unsigned char)(fminf(magnitude, 1.0f) * 255.0f + 0.5f);
+            }
+        }
+    }
+}
+
+static bool packBrick(
+    const Volume* volume,
+    const VolumeBrick& brick,
+    const vec3size_t& slot,
+    const vec3size_t& region,
+    const vec3size_t& dimensions,
+    unsigned char* packed
+){
+    switch(volume->dataType)
+    {
+    case Volume::CHAR:
+        packBrick<signed char>(volume, brick, slot, region, dimensions, packed);
+        return true;
+    case Volume::UCHAR:
+        packBrick<unsigned char>(volume, brick, slot, region, dimensions, packed);
+        return true;
+    case Volume::SHORT:
+        packBrick<short>(volume, brick, slot, region, dimensions, packed);
+        return true;
+    case Volume::USHORT:
+        packBrick<unsigned short>(volume, brick, slot, region, dimensions, packed);
+        return true;
+    case Volume::INT:
+        packBrick<int>(volume, brick, slot, region, dimensions, packed);
+        return true;
+    case Volume::UINT:
+        packBrick<unsigned int>(volume, brick, slot, region, dimensions, packed);
+        return true;
+    case Volume::FLOAT:
+        packBrick<float>(volume, brick, slot, region, dimensions, packed);
+        return true;
+    case Volume::DOUBLE:
+        packBrick<double>(volume, brick, slot, region, dimensions, packed);
+        return true;
+    default:
+        return false;
+    }
+}
+
+void GradientPool::clear()
+{
+    mValid = false;
+    mVolume = nullptr;
+    mUsedSlots = 0;
+    mSlotBricks.clear();
+    std::vector<unsigned char>().swap(mData);
+    mDimensions = vec3size_t(0);
+    mStats.set("gradientmemory", 0);
+}
+
+bool GradientPool::update(VolumeBrickPool& pool)
+{
+    if(pool.mVolume == nullptr || pool.mVolume->data == nullptr
+        || pool.mCurrentLevel != 0 || pool.mTotalPoolBrickSlots == 0)
+    {
+        /* Coarser levels reuse the slots, so start over when back */
+        clear();
+        return false;
+    }
+
+    utils::Timer timer;
+    timer.start();
+
+    /* A new volume, frame or brick layout refills the slots */
+    const vec3size_t region = pool.mActualDataSize;
+    if(pool.mVolume != mVolume || region != mRegion || pool.mNextUploadSlot < mUsedSlots)
+    {
+        mSlotBricks.clear();
+        mVolume = pool.mVolume;
+        mRegion = region;
+    }
+    mUsedSlots = pool.mNextUploadSlot;
+
+    const vec3size_t& slots = pool.mPoolBrickSlots;
+    const size_t layerSlots = slots.x * slots.y;
+    const size_t layers = (mUsedSlots + layerSlots - 1) / layerSlots;
+    const size_t rows = layers > 1 ? slots.y : (mUsedSlots + slots.x - 1) / slots.x;
+    const vec3size_t dimensions(
+        slots.x * region.x,
+        std::max(rows, (size_t)1) * region.y,
+        std::max(layers, (size_t)1) * region.z
+    );
+    if(dimensions != mDimensions)
+    {
+        /* Strides change, so every slot is packed again */
+        mDimensions = dimensions;
+        mData.assign(4 * mDimensions.x * mDimensions.y * mDimensions.z, 0);
+        mSlotBricks.clear();
+    }
+    mSlotBricks.resize(pool.mTotalPoolBrickSlots, 0);
+
+    std::vector<size_t> pending;
+    for(size_t i = 0; i < pool.mBricks.size(); ++i)
+    {
+        const VolumeBrick& brick = pool.mBricks[i];
+        if(brick.mPaged && mSlotBricks[brick.mPoolSlot] != i + 1)
+        {
+            pending.push_back(i);
+        }
+    }
+
+    bool packed = true;
+    #pragma omp parallel for schedule(dynamic)
+    for(int i = 0; i < (int)pending.size(); ++i)
+    {
+        const VolumeBrick& brick = pool.mBricks[pending[i]];
+        vec3size_t slot;
+        slot.z = brick.mPoolSlot / layerSlots;
+        slot.y = (brick.mPoolSlot % layerSlots) / slots.x;
+        slot.x = brick.mPoolSlot % slots.x;
+        if(!packBrick(mVolume, brick, slot, region, mDimensions, &mData[0]))
+        {
+            #pragma omp atomic write
+            packed = false;
+        }
+    }
+    if(!packed)
+    {
+        std::cerr << "==GradientPool== Can't take gradients of this volume type" << std::endl;
+        clear();
+        return false;
+    }
+    for(size_t i = 0; i < pending.size(); ++i)
+    {
+        mSlotBricks[pool.mBricks[pending[i]].mPoolSlot] = pending[i] + 1;
+    }
+    mValid = true;
+
+    timer.stop();
+    if(pending.size())
+    {
+        mStats.set("gradienttime", timer.getTime());
+    }
+    mStats.set("gradientbricks", pending.size());
+    mStats.set("gradientmemory", mData.size());
+    return pending.size() > 0;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+
+#include "brickpool.hpp"
+#include "../utils/stats.hpp"
+
+/**
+ * Normals precomputed for the bricks paged into a VolumeBrickPool, for
+ * shading without taking 6 taps per sample, see Shading. Every pool voxel
+ * gets the central difference gradient of the volume voxel it holds, so
+ * brick faces see their neighbours and show no seams. Gradients are
+ * packed into RGBA8: the direction mapped to [0, 255] in xyz and the
+ * magnitude, clamped to 1, in w.
+ *
+ * The packed pool has the brick pool's layout over the slots in use, so
+ * the page table addresses both alike. Only bricks paged since the last
+ * update are packed, in parallel. Normals are taken from the level 0
+ * volume, so there are none for coarser levels or out-of-core volumes.
+ */
+class GradientPool
+{
+public:
+    Stats mStats;
+
+    /* Packed normals, x fastest, mDimensions voxels. Rows span all the
+       pool's slots across, layers all its rows once a layer is full */
+    std::vector<unsigned char> mData;
+    vec3size_t mDimensions = vec3size_t(0);
+
+    /* Packs the normals of the bricks paged since the last call. True if
+       mData changed */
+    bool update(VolumeBrickPool& pool);
+
+    /* Whether mData holds the normals of every brick the pool has paged */
+    bool valid() const { return mValid; }
+
+    /* Forgets everything packed, the next update starts over */
+    void clear();
+
+private:
+    bool mValid = false;
+    const Volume* mVolume = nullptr;
+    vec3size_t mRegion = vec3size_t(0);
+    size_t mUsedSlots = 0;
+    /* Brick index + 1 packed into each slot, 0 for none */
+    std::vector<size_t> mSlotBricks;
+};
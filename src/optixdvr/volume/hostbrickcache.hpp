@@ -0,0 +1,85 @@
+#pragma once
+
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Least recently used bookkeeping for brick data held in host memory by
+ * an out-of-core pool. Only tracks brick indices and sizes, the pool
+ * frees the data of whatever gets evicted.
+ */
+class HostBrickCache
+{
+public:
+    /* Budget in bytes, 0 means unbounded */
+    size_t mBudget = 1024UL * 1024UL * 1024UL;
+
+    size_t mHits = 0;
+    size_t mMisses = 0;
+
+    void clear()
+    {
+        mOrder.clear();
+        mEntries.clear();
+        mBytes = 0;
+        mHits = 0;
+        mMisses = 0;
+    }
+
+    bool contains(size_t index) const
+    {
+        return mEntries.count(index) != 0;
+    }
+
+    void touch(size_t index)
+    {
+        auto entry = mEntries.find(index);
+        if(entry != mEntries.end())
+        {
+            mOrder.splice(mOrder.begin(), mOrder, entry->second);
+        }
+    }
+
+    /* Adds a brick as the most recent one and evicts the oldest to stay in budget */
+    void insert(size_t index, size_t bytes, std::vector<size_t>& evicted)
+    {
+        if(contains(index))
+        {
+            touch(index);
+            return;
+        }
+        mOrder.push_front(std::make_pair(index, bytes));
+        mEntries[index] = mOrder.begin();
+        mBytes += bytes;
+
+        while(mBudget && mBytes > mBudget && mOrder.size() > 1)
+        {
+            std::pair<size_t, size_t> oldest = mOrder.back();
+            mOrder.pop_back();
+            mEntries.erase(oldest.first);
+            mBytes -= oldest.second;
+            evicted.push_back(oldest.first);
+        }
+    }
+
+    /* How many bricks of the given size fit, never less than one */
+    size_t capacity(size_t brickBytes) const
+    {
+        if(mBudget == 0 || brickBytes == 0)
+        {
+            return (size_t)-1;
+        }
+        size_t bricks = mBudget / brickBytes;
+        return bricks ? bricks : 1;
+    }
+
+    size_t bytes() const { return mBytes; }
+    size_t size() const { return mOrder.size(); }
+
+private:
+    std::list<std::pair<size_t, size_t>> mOrder;
+    std::unordered_map<size_t, std::list<std::pair<size_t, size_t>>::iterator> mEntries;
+    size_t mBytes = 0;
+};
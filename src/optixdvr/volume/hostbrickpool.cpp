@@ -0,0 +1,71 @@
+#include "hostbrickpool.hpp"
+
+HostVolumeBrickPool::~HostVolumeBrickPool()
+{
+    delete[] mPoolData;
+}
+
+void HostVolumeBrickPool::allocate()
+{
+    mBytesPerVoxel = poolBytesPerVoxel();
+    mFormat = poolFormat();
+
+    /* Same layer size as the GPU pool so slots are laid out identically */
+    mDataDimensions.x = 1024;
+    mDataDimensions.y = 1024;
+    size_t layer = mDataDimensions.x * mDataDimensions.y;
+    mDataDimensions.z = mPoolMemory / (layer * mBytesPerVoxel);
+
+    mPoolBrickSlots.x = 0;
+    mPoolBrickSlots.y = 0;
+    mPoolBrickSlots.z = 0;
+    mTotalPoolBrickSlots = 0;
+
+    /* Pages are only touched once bricks are uploaded to them. The tail
+       lets ray packets gather narrow voxels 32 bits at a time */
+    delete[] mPoolData;
+    mPoolData = new char[layer * mDataDimensions.z * mBytesPerVoxel + sizeof(int)];
+    mStats.set("poolmemory", layer * mDataDimensions.z * mBytesPerVoxel);
+
+    mNextUploadSlot = 0;
+    mFreeSlots.clear();
+}
+
+size_t HostVolumeBrickPool::upload()
+{
+    return uploadActiveBricks();
+}
+
+void HostVolumeBrickPool::uploadBrick(VolumeBrick &brick)
+{
+    vec3size_t slot;
+    if(!pageBrick(brick, slot))
+    {
+        return;
+    }
+
+    size_t rowBytes = mBytesPerVoxel * mActualDataSize.x;
+    for(size_t z = 0; z < mActualDataSize.z; ++z)
+    {
+        for(size_t y = 0; y < mActualDataSize.y; ++y)
+        {
+            size_t dst_x = slot.x * mActualDataSize.x;
+            size_t dst_y = (y + slot.y * mActualDataSize.y)
+                * mDataDimensions.x;
+            size_t dst_z = (z + slot.z * mActualDataSize.z)
+                * mDataDimensions.y
+                * mDataDimensions.x;
+
+            size_t src_y = y * brick.mActualDimensions.x;
+            size_t src_z = z
+                * brick.mActualDimensions.y
+                * brick.mActualDimensions.x;
+
+            memcpy(
+                &mPoolData[mBytesPerVoxel * (dst_x + dst_y + dst_z)],
+                &brick.mData[mBytesPerVoxel * (src_y + src_z)],
+                rowBytes
+            );
+        }
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "brickpool.hpp"
+
+/**
+ * Brick pool held in host memory for the CPU renderer. Slots, page table
+ * and storage formats are the same as the OptiX pool's, so a renderer
+ * reading it sees exactly what the volume texture would hold.
+ */
+class HostVolumeBrickPool : public VolumeBrickPool
+{
+public:
+    /* Upper bound on the pool's host memory, as the GPU pool is bounded by
+       the device's free memory */
+    size_t mPoolMemory = 1024UL * 1024UL * 1024UL;
+
+    RTformat mFormat;
+    char* mPoolData = nullptr;
+
+    ~HostVolumeBrickPool();
+
+    void allocate();
+    void uploadBrick(VolumeBrick &brick);
+    size_t upload();
+
+    /* The page table is read straight from mPageTableData */
+    void allocatePageTable() {}
+    void uploadPageTable() {}
+};
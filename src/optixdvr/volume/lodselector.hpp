@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+
+#include "../camera.hpp"
+
+/**
+ * Host-side level-of-detail selection for the brick pyramid. Picks the
+ * coarsest level whose voxels cover at most mPixelsPerVoxel pixels on
+ * screen, based on the camera's distance to the volume bounds, so raising
+ * it picks coarser levels. Does not touch OptiX, so it can be driven from
+ * any Camera and bounding box.
+ */
+class LODSelector
+{
+public:
+    /* Maximum on-screen size (in pixels) of a voxel at the chosen level,
+       larger budgets allow coarser levels */
+    float mPixelsPerVoxel = 1.0f;
+    /* Added to the computed level before clamping, positive is coarser */
+    float mBias = 0.0f;
+
+    /* Distance from the camera to the closest point of the bounds */
+    static float distance(const Camera& camera, const vec3f& boundsMin, const vec3f& boundsMax)
+    {
+        vec3f closest = max(boundsMin, min(camera.mOrigin, boundsMax));
+        return (closest - camera.mOrigin).length();
+    }
+
+    /* Height in pixels of a world space length seen at the given distance */
+    static float projectedSize(const Camera& camera, int imageHeight, float worldSize, float distance)
+    {
+        float theta = camera.mFOVY * ((float)M_PI) / 180.0f;
+        float viewHeight = 2.0f * distance * tanf(theta / 2.0f);
+        if(viewHeight <= 0.0f)
+        {
+            return std::numeric_limits<float>::infinity();
+        }
+        return worldSize / viewHeight * (float)imageHeight;
+    }
+
+    /* On-screen size of a level 0 voxel */
+    float voxelPixels(
+        const Camera& camera,
+        int imageHeight,
+        const vec3f& boundsMin,
+        const vec3f& boundsMax,
+        const vec3f& dataDimensions
+    ) const {
+        vec3f voxelSize = (boundsMax - boundsMin) / dataDimensions;
+        float smallestVoxel = fminf(fminf(voxelSize.x, voxelSize.y), voxelSize.z);
+        float d = distance(camera, boundsMin, boundsMax);
+        return projectedSize(camera, imageHeight, smallestVoxel, d);
+    }
+
+    size_t select(
+        const Camera& camera,
+        int imageHeight,
+        const vec3f& boundsMin,
+        const vec3f& boundsMax,
+        const vec3f& dataDimensions,
+        size_t numLevels
+    ) const {
+        if(numLevels <= 1)
+        {
+            return 0;
+        }
+
+        /* Each level doubles the voxel size */
+        float pixels = voxelPixels(camera, imageHeight, boundsMin, boundsMax, dataDimensions);
+        float level = log2f(mPixelsPerVoxel / pixels) + mBias;
+        if(!(level > 0.0f))
+        {
+            return 0;
+        }
+
+        size_t l = (size_t)floorf(level);
+        return l < numLevels ? l : numLevels - 1;
+    }
+};
@@ -213,19 +213,35 @@ private:
         }
         else if(!STRING_COMPARE(buffer, "MET_LONG"))
         {
+            /* MetaIO longs are 32-bit regardless of platform */
             model_info.type = Volume::LONG;
-            model_info.bytesPerElement = 8;
+            model_info.bytesPerElement = 4;
         }
         else if(!STRING_COMPARE(buffer, "MET_ULONG"))
         {
             model_info.type = Volume::ULONG;
-            model_info.bytesPerElement = sizeof(unsigned long);
+            model_info.bytesPerElement = 4;
+        }
+        else if(!STRING_COMPARE(buffer, "MET_LONG_LONG"))
+        {
+            model_info.type = Volume::LONG;
+            model_info.bytesPerElement = 8;
+        }
+        else if(!STRING_COMPARE(buffer, "MET_ULONG_LONG"))
+        {
+            model_info.type = Volume::ULONG;
+            model_info.bytesPerElement = 8;
         }
         else if (!STRING_COMPARE(buffer, "MET_FLOAT"))
         {
             model_info.type = Volume::FLOAT;
             model_info.bytesPerElement = sizeof(float);
         }
+        else if (!STRING_COMPARE(buffer, "MET_DOUBLE"))
+        {
+            model_info.type = Volume::DOUBLE;
+            model_info.bytesPerElement = sizeof(double);
+        }
         else
         {
             std::cerr << "Unknown data type '" << buffer << "'" << std::endl;
@@ -0,0 +1,42 @@
+#include "opacitybounds.hpp"
+
+#include <cmath>
+
+void OpacityBounds::update(const BrickedVolume& volume, const TransferFunction& tf)
+{
+    utils::Timer timer;
+    timer.start();
+
+    mNumLeaves[0] = (int)volume.mNumLeaves.x;
+    mNumLeaves[1] = (int)volume.mNumLeaves.y;
+    mNumLeaves[2] = (int)volume.mNumLeaves.z;
+    mLeafSize = volume.mVoxelsPerBrick / volume.mVolume->dataDimensions;
+
+    size_t transparent = 0;
+    mBounds.resize(volume.mLeaves.size());
+    for(size_t i = 0; i < volume.mLeaves.size(); ++i)
+    {
+        const AccelerationLeaf& leaf = volume.mLeaves[i];
+        mBounds[i] = tf.maxOpacity(leaf.mMinTFValue, leaf.mMaxTFValue);
+        transparent += mBounds[i] <= 0.0f ? 1 : 0;
+    }
+
+    timer.stop();
+    mStats.set("opacityboundstime", timer.getTime());
+    mStats.set("transparentleaves", transparent);
+}
+
+float OpacityBounds::bound(const vec3f& p, vec3f& lo, vec3f& hi) const
+{
+    const int x = (int)floorf(p.x / mLeafSize.x);
+    const int y = (int)floorf(p.y / mLeafSize.y);
+    const int z = (int)floorf(p.z / mLeafSize.z);
+    if(x < 0 || y < 0 || z < 0 || x >= mNumLeaves[0] || y >= mNumLeaves[1] || z >= mNumLeaves[2])
+    {
+        return 1.0f;
+    }
+
+    lo = vec3f((float)x, (float)y, (float)z) * mLeafSize;
+    hi = lo + mLeafSize;
+    return mBounds[(size_t)x + (size_t)mNumLeaves[0] * ((size_t)y + (size_t)mNumLeaves[1] * (size_t)z)];
+}
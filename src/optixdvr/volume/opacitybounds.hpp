@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+
+#include "brickedvolume.hpp"
+#include "transferfunction.hpp"
+#include "../utils/stats.hpp"
+
+/**
+ * Upper bounds on the opacity the transfer function can give each leaf
+ * of a BrickedVolume, from the leaf's value range. Leaves hold the voxel
+ * past their far side too, so the bound covers every sample the march
+ * interpolates inside the leaf at full resolution.
+ *
+ * Rays stretch their steps through leaves with low bounds, see
+ * step_scale() in programs/stepping.h, and take base steps near features.
+ * Leaves bounded at 0 are skipped exactly, they can't add anything.
+ */
+class OpacityBounds
+{
+public:
+    Stats mStats;
+
+    /* Longest stretched step, in base steps */
+    int mMaxStepScale = 8;
+    /* Corrected opacity a stretched step may reach in a leaf that isn't
+       transparent, 0 only stretches through transparent leaves */
+    float mTolerance = 0.0f;
+
+    /* One per leaf, x fastest as in BrickedVolume::mLeaves */
+    std::vector<float> mBounds;
+    int mNumLeaves[3] = { 0, 0, 0 };
+    /* In normalised volume space */
+    vec3f mLeafSize;
+
+    void update(const BrickedVolume& volume, const TransferFunction& tf);
+
+    /* Bound of the leaf holding p in normalised volume space, 1 outside
+       the grid. lo and hi get the leaf's corners */
+    float bound(const vec3f& p, vec3f& lo, vec3f& hi) const;
+};
@@ -5,6 +5,7 @@ OptixVolumeBrickPool::OptixVolumeBrickPool()
 {
     mContext = &OptixInstance::get()->m_context;
     mPageTableBuffer = nullptr;
+    mPageTableScaleBuffer = nullptr;
 }
 
 void OptixVolumeBrickPool::allocatePageTable()
@@ -13,6 +14,8 @@ void OptixVolumeBrickPool::allocatePageTable()
     {
         mPageTableTexture->destroy();
         mPageTableBuffer->destroy();
+        mPageTableScaleTexture->destroy();
+        mPageTableScaleBuffer->destroy();
     }
     mPageTableBuffer = (*mContext)->createBuffer(
         RT_BUFFER_INPUT,
@@ -32,6 +35,25 @@ void OptixVolumeBrickPool::allocatePageTable()
     mPageTableTexture->setIndexingMode(RT_TEXTURE_INDEX_ARRAY_INDEX);
     mPageTableTexture->setReadMode(RT_TEXTURE_READ_ELEMENT_TYPE);
     mPageTableTexture->setBuffer(0, 0, mPageTableBuffer);
+
+    mPageTableScaleBuffer = (*mContext)->createBuffer(
+        RT_BUFFER_INPUT,
+        RT_FORMAT_FLOAT2,
+        mNumBricks.x, mNumBricks.y, mNumBricks.z
+    );
+
+    mPageTableScaleTexture = (*mContext)->createTextureSampler();
+    mPageTableScaleTexture->setWrapMode(0, RT_WRAP_CLAMP_TO_EDGE);
+    mPageTableScaleTexture->setWrapMode(1, RT_WRAP_CLAMP_TO_EDGE);
+    mPageTableScaleTexture->setWrapMode(2, RT_WRAP_CLAMP_TO_EDGE);
+    mPageTableScaleTexture->setFilteringModes(
+        RT_FILTER_NEAREST,
+        RT_FILTER_NEAREST,
+        RT_FILTER_NEAREST
+    );
+    mPageTableScaleTexture->setIndexingMode(RT_TEXTURE_INDEX_ARRAY_INDEX);
+    mPageTableScaleTexture->setReadMode(RT_TEXTURE_READ_ELEMENT_TYPE);
+    mPageTableScaleTexture->setBuffer(0, 0, mPageTableScaleBuffer);
 }
 
 void OptixVolumeBrickPool::allocate()
@@ -58,7 +80,7 @@ void OptixVolumeBrickPool::allocate()
     cudaGetDeviceProperties(&deviceProperties, 0);
 
     //mVolume = volume;
-    mBytesPerVoxel = mVolume->bytesPerVoxel;
+    mBytesPerVoxel = poolBytesPerVoxel();
     size_t voxelSpace = memportion / mBytesPerVoxel;
 
     // IMPORTANT NOTE:
@@ -79,24 +101,7 @@ void OptixVolumeBrickPool::allocate()
     mPoolBrickSlots.z = 0;
     mTotalPoolBrickSlots = 0;
 
-    switch(mVolume->dataType)
-    {
-    case Volume::CHAR:
-        mOptixFormat = RT_FORMAT_BYTE;
-        break;
-    case Volume::UCHAR:
-        mOptixFormat = RT_FORMAT_UNSIGNED_BYTE;
-        break;
-    case Volume::USHORT:
-        mOptixFormat = RT_FORMAT_UNSIGNED_SHORT;
-        break;
-    case Volume::UINT:
-        mOptixFormat = RT_FORMAT_UNSIGNED_INT;
-        break;
-    case Volume::FLOAT:
-        mOptixFormat = RT_FORMAT_FLOAT;
-        break;
-    }
+    mOptixFormat = poolFormat();
 
     mOptixBuffer = (*mContext)->createBuffer(
         RT_BUFFER_INPUT,
@@ -118,24 +123,12 @@ void OptixVolumeBrickPool::allocate()
     mTextureSampler->setBuffer(0, 0, mOptixBuffer);
 
     mNextUploadSlot = 0;
+    mFreeSlots.clear();
 };
 
 size_t OptixVolumeBrickPool::upload()
 {
-    /* Iterate throught the bricks and upload the unpaged ones */
-    int uploadedbricks = 0;
-    for(int i = 0; i < mBricks.size(); ++i)
-    {
-        if(mBricks[i].mActive)
-        {
-            if(!mBricks[i].mPaged)
-            {
-                uploadBrick(mBricks[i]);
-                uploadedbricks++;
-            }
-        }
-    }
-    mStats.set("numnewuploadedbricks", uploadedbricks);
+    size_t uploadedbricks = uploadActiveBricks();
 
     /* If the page table has bee updated, we need to upload it */
     if(uploadedbricks > 0)
@@ -150,19 +143,12 @@ size_t OptixVolumeBrickPool::upload()
 
 void OptixVolumeBrickPool::uploadBrick(VolumeBrick &brick)
 {
-    if(mNextUploadSlot >= mTotalPoolBrickSlots)
+    vec3size_t uploadbrick;
+    if(!pageBrick(brick, uploadbrick))
     {
-        std::cerr << "==BrickPool== Out of brick upload slots" << std::endl;
         return;
     }
 
-    size_t uploadslot = mNextUploadSlot++;
-    vec3size_t uploadbrick;
-    uploadbrick.z = uploadslot / (mPoolBrickSlots.x * mPoolBrickSlots.y);
-    uploadbrick.y = (uploadslot % (mPoolBrickSlots.x * mPoolBrickSlots.y))
-        / mPoolBrickSlots.x;
-    uploadbrick.x = uploadslot % mPoolBrickSlots.x;
-
     char* mappedBuffer = (char*)mOptixBuffer->map(0, RT_BUFFER_MAP_WRITE);
     for(size_t z = 0; z < mActualDataSize.z; ++z)
     {
@@ -192,18 +178,6 @@ void OptixVolumeBrickPool::uploadBrick(VolumeBrick &brick)
         }
     }
     mOptixBuffer->unmap();
-    brick.mPaged = true;
-
-    /* Update the page table */
-    size_t brickIndex = brick.mBrickIndex.x;
-    brickIndex += brick.mBrickIndex.y * mNumBricks.x;
-    brickIndex += brick.mBrickIndex.z * mNumBricks.x * mNumBricks.y;
-    struct PageTableEntry pageTableEntry;
-    pageTableEntry.x = uploadbrick.x;
-    pageTableEntry.y = uploadbrick.y;
-    pageTableEntry.z = uploadbrick.z;
-    pageTableEntry.flags = PageTableEntryPaged;
-    mPageTableData[brickIndex] = pageTableEntry;
 };
 
 void OptixVolumeBrickPool::uploadPageTable()
@@ -214,8 +188,13 @@ void OptixVolumeBrickPool::uploadPageTable()
     memcpy(map, &mPageTableData[0], mPageTableMemoryUsage);
     mPageTableBuffer->unmap();
 
+    struct PageTableScaleEntry* scaleMap = (struct PageTableScaleEntry*)mPageTableScaleBuffer->map();
+    memcpy(scaleMap, &mPageTableScaleData[0], mPageTableScaleData.size() * sizeof(struct PageTableScaleEntry));
+    mPageTableScaleBuffer->unmap();
+
     /* Set Optix variables */
     (*mContext)["pageTableTexture"]->set(mPageTableTexture);
+    (*mContext)["pageTableScaleTexture"]->set(mPageTableScaleTexture);
 
     (*mContext)["poolSlots"]->setFloat(
         mPoolBrickSlots.x,
@@ -15,6 +15,8 @@ public:
     optix::TextureSampler mTextureSampler;
     optix::Buffer mPageTableBuffer;
     optix::TextureSampler mPageTableTexture;
+    optix::Buffer mPageTableScaleBuffer;
+    optix::TextureSampler mPageTableScaleTexture;
 
     OptixVolumeBrickPool();
 
@@ -0,0 +1,310 @@
+#include "timeseries.hpp"
+
+VolumeTimeSeries::VolumeTimeSeries(
+    const VolumeFile& file,
+    BrickedVolume* subdivision,
+    VolumeBrickPool* pool,
+    size_t prefetch
+) :
+    mFile(file),
+    mSubdivision(subdivision),
+    mPool(pool),
+    mPrefetch(prefetch)
+{
+    /* Room for the shown frame, the prefetched ones and one spare */
+    mFrames.resize(mPrefetch + 2);
+
+    /* The renderer has already loaded and bricked the first frame */
+    VolumeFrame& first = mFrames[0];
+    first.mFrame = 0;
+    first.mVolume = mFile.volume;
+    first.mLoaded = true;
+    first.mShown = true;
+    first.mLeafSize = mSubdivision->get_brick_size();
+    first.mBrickSize = mPool->mBrickSize;
+    mCurrent = &first;
+
+    mLeafSize = first.mLeafSize;
+    mBrickSize = first.mBrickSize;
+    for(size_t i = 1; i <= mPrefetch && i < (size_t)numFrames(); ++i)
+    {
+        mWanted.push_back((int)i);
+    }
+
+    mWorker = std::thread(&VolumeTimeSeries::run, this);
+}
+
+VolumeTimeSeries::~VolumeTimeSeries()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+    mWork.notify_all();
+    mWorker.join();
+
+    /* The shown frame's leaves and bricks belong to the subdivision and pool */
+    for(size_t i = 0; i < mFrames.size(); ++i)
+    {
+        VolumeFrame& frame = mFrames[i];
+        for(size_t b = 0; b < frame.mBricks.size(); ++b)
+        {
+            frame.mBricks[b].free();
+        }
+        if(frame.mVolume)
+        {
+            delete[] frame.mVolume->data;
+            delete frame.mVolume;
+        }
+    }
+}
+
+Volume* VolumeTimeSeries::show(int f)
+{
+    if(numFrames() == 0)
+    {
+        return nullptr;
+    }
+    f = ((f % numFrames()) + numFrames()) % numFrames();
+
+    utils::Timer timer;
+    timer.start();
+
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    /* Brick at the sizes in use now, which may have been changed since */
+    mLeafSize = mSubdivision->get_brick_size();
+    mBrickSize = mPool->mBrickSize;
+    mCurrent->mLeafSize = mLeafSize;
+    mCurrent->mBrickSize = mBrickSize;
+
+    mWanted.clear();
+    for(size_t i = 0; i <= mPrefetch && i < (size_t)numFrames(); ++i)
+    {
+        mWanted.push_back((f + (int)i) % numFrames());
+    }
+    mWork.notify_one();
+
+    if(mCurrent->mFrame == f)
+    {
+        return mCurrent->mVolume;
+    }
+
+    VolumeFrame* frame = find(f);
+    bool prefetched = frame && !frame->mBusy && ready(*frame);
+    while(!(frame && !frame->mBusy && (frame->mFailed || ready(*frame))))
+    {
+        mDone.wait(lock);
+        frame = find(f);
+    }
+
+    if(frame->mFailed)
+    {
+        /* Free the slot so the frame is retried next time */
+        frame->mFrame = -1;
+        frame->mFailed = false;
+        std::cerr << "==TimeSeries== Couldn't load frame " << f << std::endl;
+        return nullptr;
+    }
+
+    /* Keep the prefetcher off both slots while their contents move */
+    frame->mShown = true;
+    VolumeFrame* previous = mCurrent;
+    mCurrent = frame;
+    lock.unlock();
+
+    timer.stop();
+    mStats.set("framewaittime", timer.getTime());
+    mStats.set("frameprefetched", prefetched ? 1 : 0);
+    mStats.set("frameloadtime", frame->mLoadTime);
+    mStats.set("framebricktime", frame->mBrickTime);
+    mStats.set("frameunchangedbricks", frame->mUnchangedBricks);
+
+    /* Lend the new frame's data out and hand the old frame's back */
+    timer.start();
+    mSubdivision->swap_frame(frame->mVolume, frame->mLeaves);
+    std::swap(frame->mLeaves, previous->mLeaves);
+    mPool->swap_frame(frame->mVolume, frame->mBricks, previous->mFrame, f);
+    std::swap(frame->mBricks, previous->mBricks);
+    timer.stop();
+    mStats.set("frameswaptime", timer.getTime());
+    mStats.set("frame", f);
+
+    lock.lock();
+    previous->mShown = false;
+    mWork.notify_one();
+
+    return frame->mVolume;
+}
+
+void VolumeTimeSeries::run()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(!mStop)
+    {
+        /* Pick the most urgent wanted frame that still needs work */
+        VolumeFrame* slot = nullptr;
+        int f = -1;
+        bool load = false;
+        for(size_t i = 0; i < mWanted.size() && slot == nullptr; ++i)
+        {
+            VolumeFrame* existing = find(mWanted[i]);
+            if(existing && (existing->mShown || existing->mFailed || ready(*existing)))
+            {
+                continue;
+            }
+
+            slot = existing ? existing : slotFor();
+            f = mWanted[i];
+            load = (existing == nullptr);
+        }
+
+        if(slot == nullptr)
+        {
+            mWork.wait(lock);
+            continue;
+        }
+
+        slot->mFrame = f;
+        slot->mBusy = true;
+        if(load)
+        {
+            slot->mLoaded = false;
+            slot->mFailed = false;
+        }
+        vec3size_t leafSize = mLeafSize;
+        vec3size_t brickSize = mBrickSize;
+
+        /* Only the worker replaces volumes, so the previous one stays valid */
+        Volume* previous = nullptr;
+        VolumeFrame* before = find((f + numFrames() - 1) % numFrames());
+        if(before && before != slot && before->mLoaded && !before->mBusy)
+        {
+            previous = before->mVolume;
+        }
+        lock.unlock();
+
+        bool ok = prepare(*slot, f, load, leafSize, brickSize, previous);
+
+        lock.lock();
+        slot->mBusy = false;
+        if(ok)
+        {
+            slot->mLoaded = true;
+            slot->mLeafSize = leafSize;
+            slot->mBrickSize = brickSize;
+        }
+        else
+        {
+            slot->mFailed = true;
+        }
+        mDone.notify_all();
+    }
+}
+
+bool VolumeTimeSeries::ready(const VolumeFrame& frame) const
+{
+    return frame.mLoaded
+        && !(frame.mLeafSize != mLeafSize)
+        && !(frame.mBrickSize != mBrickSize);
+}
+
+bool VolumeTimeSeries::wanted(int f) const
+{
+    for(size_t i = 0; i < mWanted.size(); ++i)
+    {
+        if(mWanted[i] == f)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+VolumeFrame* VolumeTimeSeries::find(int f)
+{
+    for(size_t i = 0; i < mFrames.size(); ++i)
+    {
+        if(mFrames[i].mFrame == f)
+        {
+            return &mFrames[i];
+        }
+    }
+    return nullptr;
+}
+
+VolumeFrame* VolumeTimeSeries::slotFor()
+{
+    /* Prefer empty slots, then any holding a frame that's no longer wanted */
+    VolumeFrame* candidate = nullptr;
+    for(size_t i = 0; i < mFrames.size(); ++i)
+    {
+        VolumeFrame& frame = mFrames[i];
+        if(frame.mShown || frame.mBusy)
+        {
+            continue;
+        }
+        if(frame.mFrame < 0)
+        {
+            return &frame;
+        }
+        if(candidate == nullptr && !wanted(frame.mFrame))
+        {
+            candidate = &frame;
+        }
+    }
+    return candidate;
+}
+
+bool VolumeTimeSeries::prepare(
+    VolumeFrame& frame,
+    int f,
+    bool load,
+    vec3size_t leafSize,
+    vec3size_t brickSize,
+    Volume* previous
+){
+    utils::Timer timer;
+    if(load)
+    {
+        timer.start();
+        if(frame.mVolume == nullptr)
+        {
+            frame.mVolume = mFile.createFrame();
+        }
+        Volume* volume = frame.mVolume ? mFile.loadFrame(f, frame.mVolume) : nullptr;
+        timer.stop();
+        frame.mLoadTime = timer.getTime();
+        if(volume == nullptr)
+        {
+            return false;
+        }
+    }
+
+    timer.start();
+    for(size_t b = 0; b < frame.mBricks.size(); ++b)
+    {
+        frame.mBricks[b].free();
+    }
+    mSubdivision->scan_leaves(frame.mVolume, leafSize, frame.mLeaves);
+    if(previous)
+    {
+        int previousFrame = (f + numFrames() - 1) % numFrames();
+        frame.mUnchangedBricks = mPool->pullChangedBricks(
+            frame.mVolume,
+            previous,
+            previousFrame,
+            brickSize,
+            frame.mBricks
+        );
+    }
+    else
+    {
+        mPool->pullBricks(frame.mVolume, brickSize, frame.mBricks);
+        frame.mUnchangedBricks = 0;
+    }
+    timer.stop();
+    frame.mBrickTime = timer.getTime();
+
+    return true;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "volume.hpp"
+#include "brickedvolume.hpp"
+#include "brickpool.hpp"
+#include "../utils/stats.hpp"
+
+/**
+ * One slot of the time series ring: a frame's voxels along with the leaf
+ * ranges and pool bricks built from them at the recorded sizes.
+ */
+struct VolumeFrame
+{
+    int mFrame = -1;
+    Volume* mVolume = nullptr;
+    std::vector<AccelerationLeaf> mLeaves;
+    std::vector<VolumeBrick> mBricks;
+    vec3size_t mLeafSize = vec3size_t(0);
+    vec3size_t mBrickSize = vec3size_t(0);
+    bool mLoaded = false;
+    bool mFailed = false;
+    /* Being loaded or bricked by the prefetcher */
+    bool mBusy = false;
+    /* Leaves and bricks are lent to the subdivision and pool */
+    bool mShown = false;
+    float mLoadTime = 0.0f;
+    float mBrickTime = 0.0f;
+    /* Bricks identical to the previous frame, left for the pool to reuse */
+    size_t mUnchangedBricks = 0;
+};
+
+/**
+ * Plays back the frames listed in a VolumeFile. Frames live in a ring of
+ * slots, and a background thread loads and bricks the frames following
+ * the one being shown so that stepping forward only has to swap them into
+ * the subdivision and pool. Bricks identical to the previous frame are not
+ * pulled again, the pool carries them over from the frame it replaces. The
+ * frame already loaded by the renderer is adopted as the first shown frame.
+ */
+class VolumeTimeSeries
+{
+public:
+    Stats mStats;
+
+    VolumeTimeSeries(
+        const VolumeFile& file,
+        BrickedVolume* subdivision,
+        VolumeBrickPool* pool,
+        size_t prefetch
+    );
+    ~VolumeTimeSeries();
+
+    int numFrames() const { return mFile.numFrames(); }
+    int currentFrame() const { return mCurrent ? mCurrent->mFrame : -1; }
+    size_t prefetchFrames() const { return mPrefetch; }
+
+    /**
+     * Makes frame f the one held by the subdivision and pool, waiting for
+     * the prefetcher if it isn't ready yet, and queues the frames after it.
+     * Returns the shown volume, or nullptr if the frame failed to load.
+     */
+    Volume* show(int f);
+
+private:
+    VolumeFile mFile;
+    BrickedVolume* mSubdivision;
+    VolumeBrickPool* mPool;
+    size_t mPrefetch;
+
+    std::vector<VolumeFrame> mFrames;
+    VolumeFrame* mCurrent = nullptr;
+
+    /* Frames wanted next, most urgent first, and the sizes to brick at */
+    std::vector<int> mWanted;
+    vec3size_t mLeafSize;
+    vec3size_t mBrickSize;
+
+    std::mutex mMutex;
+    std::condition_variable mWork;
+    std::condition_variable mDone;
+    bool mStop = false;
+    std::thread mWorker;
+
+    void run();
+    bool ready(const VolumeFrame& frame) const;
+    bool wanted(int f) const;
+    VolumeFrame* find(int f);
+    VolumeFrame* slotFor();
+    bool prepare(
+        VolumeFrame& frame,
+        int f,
+        bool load,
+        vec3size_t leafSize,
+        vec3size_t brickSize,
+        Volume* previous
+    );
+};
@@ -61,6 +61,12 @@ void TransferFunction::updateLUT()
         }
     }
 
+    mOpacitySum.assign(mSize + 1, 0.0f);
+    for(int i = 0; i < mSize; ++i)
+    {
+        mOpacitySum[i + 1] = mOpacitySum[i] + fmaxf(mLUT[i].w, 0.0f);
+    }
+
     updateTexture();
 }
 
@@ -76,6 +82,37 @@ bool TransferFunction::rangeActive(const float from, const float to) const
     return !(rightactive || leftactive);
 }
 
+float TransferFunction::maxOpacity(const float from, const float to) const
+{
+    if(mLUT == nullptr)
+    {
+        return 1.0f;
+    }
+    if(!(from <= to))
+    {
+        /* A leaf without voxels */
+        return 0.0f;
+    }
+
+    /* Entries either side of the range blend into it, one more each way
+       covers values rounded by a quantised pool */
+    const float lo = fminf(fmaxf(from, 0.0f), 1.0f);
+    const float hi = fminf(fmaxf(to, 0.0f), 1.0f);
+    const int first = std::max((int)floorf(lo * (float)mSize - 0.5f) - 1, 0);
+    const int last = std::min((int)floorf(hi * (float)mSize - 0.5f) + 2, mSize - 1);
+    if(last < first || mOpacitySum[last + 1] - mOpacitySum[first] <= 0.0f)
+    {
+        return 0.0f;
+    }
+
+    float bound = 0.0f;
+    for(int i = first; i <= last; ++i)
+    {
+        bound = fmaxf(bound, mLUT[i].w);
+    }
+    return bound;
+}
+
 void TransferFunction::addControlPoint(float v, float r, float g, float b, float a)
 {
     std::vector<TransferFunctionPoint>::iterator it;
@@ -22,6 +22,8 @@ public:
     float mRangeMin = 0.0f;
     float mRangeMax = 1.0f;
     vec4f *mLUT = nullptr;
+    /* Prefix sums of the LUT's opacities, mSize + 1 of them */
+    std::vector<float> mOpacitySum;
 
     const int mSize = 256;
 
@@ -37,6 +39,10 @@ public:
 
     bool rangeActive(const float from, const float to) const;
 
+    /* Upper bound on the opacity the LUT gives normalised values in
+       [from, to], its linear filtering included */
+    float maxOpacity(const float from, const float to) const;
+
     friend std::ostream& operator<< (std::ostream& out, const TransferFunction& tf);
 };
 
@@ -2,9 +2,12 @@
 
 #include "../programs/vec.h"
 #include "../utils/savePPM.h"
+#include "../utils/chunkedreader.hpp"
 
 #include <iostream>
 #include <limits>
+#include <vector>
+#include <stdint.h>
 #include <string.h>
 //#include <optix.h>
 //#include <optixu/optixpp.h>
@@ -34,7 +37,10 @@ public:
     size_t bytesPerVoxel;
     DataType dataType;
     char* data;
+    /* Maps normalised voxels back to file units when converted on load:
+       original = normalised * dataScale + dataOffset */
     float dataScale;
+    float dataOffset = 0.0f;
 
     Volume() :
         dataDimensions(0),
@@ -44,6 +50,8 @@ public:
     {
     }
 
+    virtual ~Volume(){}
+
     inline size_t XYZToIdx(const vec3f &p)
     {
         return
@@ -67,8 +75,10 @@ public:
     char* voxeladdress(const vec3f& p){ return (char*)&((T*)data)[XYZToIdx(p)]; };
     float GetNormalisedVoxel(const vec3f& p){	return TypeToNormalisedFloat(((T*)data)[XYZToIdx(p)]); }
     void SetNormalisedVoxel(const vec3f& p, float volume){ ((T*)data)[XYZToIdx(p)] = NormalisedFloatToType(volume);	}
-    T NormalisedFloatToType(float volume){ return (T)(volume * (float)std::numeric_limits<T>::max()); }
-    float TypeToNormalisedFloat(T volume){ return (float)volume / (float)std::numeric_limits<T>::max(); }
+    /* The type's whole range maps onto [0, 1], signed types included */
+    T NormalisedFloatToType(float volume){ return (T)(volume * typeRange() + (float)std::numeric_limits<T>::lowest()); }
+    float TypeToNormalisedFloat(T volume){ return ((float)volume - (float)std::numeric_limits<T>::lowest()) / typeRange(); }
+    static float typeRange(){ return (float)std::numeric_limits<T>::max() - (float)std::numeric_limits<T>::lowest(); }
 };
 
 template<> class VolumeRepresentation<float> : public Volume
@@ -103,56 +113,371 @@ public:
     std::vector<std::string> volumes;
     Volume* volume = nullptr;
 
-    Volume* loadFrame(int f)
+    /* Type frames are stored in after any on-load conversion */
+    Volume::DataType storedType = Volume::UCHAR;
+
+    utils::ChunkedReader reader;
+
+    static Volume* createVolume(Volume::DataType t)
+    {
+        switch(t)
+        {
+        case Volume::CHAR:
+            return new VolumeRepresentation<signed char>();
+        case Volume::UCHAR:
+            return new VolumeRepresentation<unsigned char>();
+        case Volume::SHORT:
+            return new VolumeRepresentation<short>();
+        case Volume::USHORT:
+            return new VolumeRepresentation<unsigned short>();
+        case Volume::FLOAT:
+            return new VolumeRepresentation<float>();
+        default:
+            return nullptr;
+        }
+    }
+
+    /* Factor taking a normalised voxel of the given type back to its value */
+    static float normalisationScale(Volume::DataType t)
+    {
+        switch(t)
+        {
+        case Volume::CHAR:
+            return VolumeRepresentation<signed char>::typeRange();
+        case Volume::UCHAR:
+            return VolumeRepresentation<unsigned char>::typeRange();
+        case Volume::SHORT:
+            return VolumeRepresentation<short>::typeRange();
+        case Volume::USHORT:
+            return VolumeRepresentation<unsigned short>::typeRange();
+        default:
+            return 1.0f;
+        }
+    }
+
+    /**
+     * Signed 8/16-bit voxels are stored biased into the unsigned type of
+     * the same size, v + 128 or v + 32768, recorded in dataOffset. Every
+     * stored integer type then normalises over [0, 1] the same way on the
+     * host, in the pool's textures and in the CPU renderer.
+     */
+    static Volume::DataType storageType(Volume::DataType t)
+    {
+        switch(t)
+        {
+        case Volume::CHAR:
+            return Volume::UCHAR;
+        case Volume::SHORT:
+            return Volume::USHORT;
+        default:
+            return t;
+        }
+    }
+
+    static double signedBias(Volume::DataType t)
+    {
+        switch(t)
+        {
+        case Volume::CHAR:
+            return 128.0;
+        case Volume::SHORT:
+            return 32768.0;
+        default:
+            return 0.0;
+        }
+    }
+
+    /* Biases count voxels of file type t read into data in place, flipping
+       the sign bit adds the bias in two's complement */
+    static void removeSign(Volume::DataType t, char* data, size_t count)
+    {
+        if(t == Volume::CHAR)
+        {
+            uint8_t* voxels = (uint8_t*)data;
+            #pragma omp parallel for
+            for(long long i = 0; i < (long long)count; ++i)
+            {
+                voxels[i] ^= 0x80;
+            }
+        }
+        else if(t == Volume::SHORT)
+        {
+            uint16_t* voxels = (uint16_t*)data;
+            #pragma omp parallel for
+            for(long long i = 0; i < (long long)count; ++i)
+            {
+                voxels[i] ^= 0x8000;
+            }
+        }
+    }
+
+    /**
+     * The pool can only sample 8/16-bit integers and floats, so wider
+     * types are converted while loading. Integer data is normalised over
+     * its actual range, (v - min) / (max - min), whatever that range is,
+     * and quantised to UCHAR or USHORT if that keeps a step per integer
+     * so the values stay exact, otherwise kept as float. Doubles become
+     * floats as they are.
+     */
+    static bool needsConversion(Volume::DataType t)
+    {
+        return t == Volume::INT
+            || t == Volume::UINT
+            || t == Volume::LONG
+            || t == Volume::ULONG
+            || t == Volume::DOUBLE;
+    }
+
+    static Volume::DataType compactType(Volume::DataType t, double lo, double hi)
+    {
+        if(t == Volume::DOUBLE)
+            return Volume::FLOAT;
+        if(hi - lo <= 255.0)
+            return Volume::UCHAR;
+        if(hi - lo <= 65535.0)
+            return Volume::USHORT;
+        return Volume::FLOAT;
+    }
+
+    int numFrames() const
+    {
+        return (int)volumes.size();
+    }
+
+    /**
+     * Allocates another volume in the same stored format as the first
+     * loaded frame, for reading further frames of a time series into.
+     */
+    Volume* createFrame()
     {
         if(volume == nullptr)
         {
-            switch(type)
+            return nullptr;
+        }
+        Volume* frame = createVolume(storedType);
+        allocate(frame);
+        frame->dataScale = volume->dataScale;
+        frame->dataOffset = volume->dataOffset;
+        return frame;
+    }
+
+    /**
+     * Reads frame f into target, or into this file's own volume if no
+     * target is given. The first frame decides the stored format.
+     */
+    Volume* loadFrame(int f, Volume* target = nullptr)
+    {
+        const bool convert = needsConversion(type);
+        if(volume == nullptr && !convert)
+        {
+            storedType = storageType(type);
+            volume = createVolume(storedType);
+            if(volume == nullptr)
             {
-            case Volume::FLOAT:
-                volume = new VolumeRepresentation<float>();
-                break;
-            case Volume::UCHAR:
-                volume = new VolumeRepresentation<unsigned char>();
-                break;
-            case Volume::USHORT:
-                volume = new VolumeRepresentation<unsigned short>();
-                break;
-            default:
-                std::cerr << "Haven't handled this type yet..." << std::endl;
+                std::cerr << "Unsupported volume element type" << std::endl;
+                return nullptr;
             }
+            allocate(volume);
+        }
+        if(target == nullptr)
+        {
+            target = volume;
+        }
+
+        size_t voxels = (size_t)dataDimensions.x
+            * (size_t)dataDimensions.y
+            * (size_t)dataDimensions.z;
+        size_t fileBytes = (size_t)bytesPerElement * voxels;
 
-            volume->dataType = type;
-            volume->dataDimensions = dataDimensions;
-            volume->volumeSize = dataDimensions * elementSpacing;
-            volume->dataLimits = dataDimensions - vec3f(1.0f);
-            volume->voxelsTotal = (size_t)dataDimensions.x
-                * (size_t)dataDimensions.y
-                * (size_t)dataDimensions.z;
-            volume->dataTotal = volume->bytesPerVoxel * volume->voxelsTotal;
-            volume->data = new char[volume->dataTotal];
+        /* Converted frames are read into a scratch buffer first */
+        std::vector<char> raw;
+        char* destination;
+        if(convert)
+        {
+            raw.resize(fileBytes);
+            destination = raw.data();
+        }
+        else
+        {
+            destination = target->data;
         }
 
         const char* dataPath = volumes[f].c_str();
-        FILE* fp = fopen(dataPath, "rb");
-        if (fp == NULL)
+        size_t bytesRead = reader.read(dataPath, destination, fileBytes);
+        if(bytesRead == 0 && fileBytes > 0)
         {
             std::cerr << "Error opening file: " << dataPath << std::endl;
-            exit(0);
+            return nullptr;
+        }
+        else if(bytesRead < fileBytes)
+        {
+            std::cerr << "Fewer bytes were found that expected in voxel data file" << std::endl;
         }
         else
         {
-            if(fread(volume->data, 1, volume->dataTotal, fp) < volume->dataTotal)
+            std::cout << "Successfully read '" << dataPath << "' (" << fileBytes << " bytes, "
+                << reader.mLastBandwidth << " MB/s)" << std::endl;
+        }
+
+        if(convert)
+        {
+            if(!convertFrame(raw.data(), voxels, target))
             {
-                std::cerr << "Fewer bytes were found that expected in voxel data file" << std::endl;
+                return nullptr;
             }
-            else
+        }
+        else
+        {
+            removeSign(type, target->data, voxels);
+        }
+
+        return target;
+    }
+
+    /**
+     * A volume with the first frame's dimensions and format but no voxel
+     * data, for reading bricks on demand. Types that need converting are
+     * only known after reading the whole frame, so they aren't supported.
+     */
+    Volume* createHeader()
+    {
+        if(needsConversion(type))
+        {
+            return nullptr;
+        }
+        storedType = storageType(type);
+        Volume* header = createVolume(storedType);
+        if(header)
+        {
+            describe(header);
+        }
+        return header;
+    }
+
+private:
+    void allocate(Volume* v)
+    {
+        describe(v);
+        v->data = new char[v->dataTotal];
+    }
+
+    void describe(Volume* v)
+    {
+        v->dataType = storedType;
+        v->dataDimensions = dataDimensions;
+        v->volumeSize = dataDimensions * elementSpacing;
+        v->dataLimits = dataDimensions - vec3f(1.0f);
+        v->voxelsTotal = (size_t)dataDimensions.x
+            * (size_t)dataDimensions.y
+            * (size_t)dataDimensions.z;
+        v->dataTotal = v->bytesPerVoxel * v->voxelsTotal;
+        v->dataScale = normalisationScale(storedType);
+        v->dataOffset = (float)-signedBias(type);
+    }
+
+    template <typename S>
+    static void range(const char* raw, size_t count, double& lo, double& hi)
+    {
+        const S* src = (const S*)raw;
+        double l = +std::numeric_limits<double>::infinity();
+        double h = -std::numeric_limits<double>::infinity();
+        #pragma omp parallel for reduction(min:l) reduction(max:h)
+        for(long long i = 0; i < (long long)count; ++i)
+        {
+            double v = (double)src[i];
+            l = v < l ? v : l;
+            h = v > h ? v : h;
+        }
+        lo = l;
+        hi = h;
+    }
+
+    /* Stores (v - offset) / scale, quantised over the whole of an integer
+       target's range */
+    template <typename S, typename D>
+    static void convert(const char* raw, char* data, size_t count, double offset, double scale)
+    {
+        const S* src = (const S*)raw;
+        D* dst = (D*)data;
+        const double highest = (double)std::numeric_limits<D>::max();
+        const double invScale = scale != 0.0 ? 1.0 / scale : 0.0;
+        #pragma omp parallel for
+        for(long long i = 0; i < (long long)count; ++i)
+        {
+            double v = ((double)src[i] - offset) * invScale;
+            if(std::numeric_limits<D>::is_integer)
             {
-                std::cout << "Successfully read '" << dataPath << "' (" << volume->dataTotal << " bytes)" << std::endl;
+                /* Later frames may exceed the first frame's range */
+                v = v < 0.0 ? 0.0 : (v > 1.0 ? 1.0 : v);
+                v = v * highest + 0.5;
             }
-            fclose(fp);
+            dst[i] = (D)v;
         }
+    }
 
-        return volume;
+    /* A null target is the first frame, which creates the volume */
+    template <typename S>
+    bool convertFrom(const char* raw, size_t count, Volume*& target)
+    {
+        if(target == nullptr)
+        {
+            double lo, hi;
+            range<S>(raw, count, lo, hi);
+            storedType = compactType(type, lo, hi);
+            volume = createVolume(storedType);
+            allocate(volume);
+
+            /* Normalised over the data range, bar doubles */
+            if(type != Volume::DOUBLE)
+            {
+                volume->dataScale = (float)(hi > lo ? hi - lo : 1.0);
+                volume->dataOffset = (float)lo;
+            }
+            std::cout << "Converting voxel data to a compact pool format (range "
+                << lo << " to " << hi << ")" << std::endl;
+            target = volume;
+        }
+
+        const double offset = target->dataOffset;
+        const double scale = target->dataScale;
+        switch(storedType)
+        {
+        case Volume::UCHAR:
+            convert<S, unsigned char>(raw, target->data, count, offset, scale);
+            break;
+        case Volume::USHORT:
+            convert<S, unsigned short>(raw, target->data, count, offset, scale);
+            break;
+        case Volume::FLOAT:
+            convert<S, float>(raw, target->data, count, offset, scale);
+            break;
+        default:
+            return false;
+        }
+        return true;
+    }
+
+    bool convertFrame(const char* raw, size_t count, Volume*& target)
+    {
+        switch(type)
+        {
+        case Volume::INT:
+            return convertFrom<int32_t>(raw, count, target);
+        case Volume::UINT:
+            return convertFrom<uint32_t>(raw, count, target);
+        case Volume::LONG:
+            if(bytesPerElement == 8)
+                return convertFrom<int64_t>(raw, count, target);
+            return convertFrom<int32_t>(raw, count, target);
+        case Volume::ULONG:
+            if(bytesPerElement == 8)
+                return convertFrom<uint64_t>(raw, count, target);
+            return convertFrom<uint32_t>(raw, count, target);
+        case Volume::DOUBLE:
+            return convertFrom<double>(raw, count, target);
+        default:
+            std::cerr << "Unsupported volume element type" << std::endl;
+            return false;
+        }
     }
 };
\ No newline at end of file
@@ -30,13 +30,27 @@ PYBIND11_MODULE(pyoptixdvr, m)
 
     /* Bindings for Brick Pool */
     py::class_<VolumeBrickPool> pyBrickPool(m, "VolumeBrickPool");
+    py::enum_<VolumeBrickPool::Quantisation>(pyBrickPool, "Quantisation")
+        .value("none", VolumeBrickPool::QuantiseNone)
+        .value("uint8", VolumeBrickPool::Quantise8Bit)
+        .value("uint16", VolumeBrickPool::Quantise16Bit)
+        .value("half", VolumeBrickPool::QuantiseHalf);
     pyBrickPool.def("setBrickSize", &VolumeBrickPool::set_brick_size, py::arg("brickSize")=vec3size_t(32), py::arg("padding")=vec3size_t(1));
+    py::enum_<VolumeBrickPool::DownsampleFilter>(pyBrickPool, "DownsampleFilter")
+        .value("box", VolumeBrickPool::FilterBox)
+        .value("max", VolumeBrickPool::FilterMax);
+    pyBrickPool.def("setQuantisation", &VolumeBrickPool::set_quantisation);
+    pyBrickPool.def("buildPyramid", &VolumeBrickPool::build_pyramid, py::arg("levels"), py::arg("filter")=VolumeBrickPool::FilterMax);
+    pyBrickPool.def("selectLevel", &VolumeBrickPool::select_level);
+    pyBrickPool.def_readonly("currentLevel", &VolumeBrickPool::mCurrentLevel);
     pyBrickPool.def_readwrite("stats", &VolumeBrickPool::mStats);
 
     /* Bindings for Sub Division */
     py::class_<BrickedVolume> pyBrickedVolume(m, "VolumeSubdivision");
     pyBrickedVolume.def("setLeafSize", &BrickedVolume::set_brick_size);
     pyBrickedVolume.def_readwrite("cluster", &BrickedVolume::mCluster);
+    pyBrickedVolume.def_readwrite("distanceField", &BrickedVolume::mDistanceField);
+    pyBrickedVolume.def_readonly("distances", &BrickedVolume::mDistances);
     pyBrickedVolume.def_readwrite("stats", &BrickedVolume::mStats);
 
     /* Bindings for the Camear class */
@@ -45,8 +59,141 @@ PYBIND11_MODULE(pyoptixdvr, m)
     pyCamera.def("origin", &Camera::origin);
     pyCamera.def("lookdir", (void (Camera::*)(const vec3f&)) &Camera::lookdir);
 
+    /* Bindings for the parallel volume reader */
+    py::class_<utils::ChunkedReader> pyChunkedReader(m, "ChunkedReader");
+    pyChunkedReader.def_readwrite("chunkSize", &utils::ChunkedReader::mChunkSize);
+    pyChunkedReader.def_readwrite("threads", &utils::ChunkedReader::mThreads);
+    pyChunkedReader.def_readwrite("directIO", &utils::ChunkedReader::mDirectIO);
+    pyChunkedReader.def_readonly("lastBandwidth", &utils::ChunkedReader::mLastBandwidth);
+
+    /* Bindings for the LOD selector */
+    py::class_<LODSelector> pyLODSelector(m, "LODSelector");
+    pyLODSelector.def_readwrite("pixelsPerVoxel", &LODSelector::mPixelsPerVoxel);
+    pyLODSelector.def_readwrite("bias", &LODSelector::mBias);
+    pyLODSelector.def("select", &LODSelector::select);
+
+    /* Bindings for the CPU backend's tile scheduler and renderer */
+    py::class_<TileScheduler> pyTileScheduler(m, "TileScheduler");
+    pyTileScheduler.def_readwrite("tileSize", &TileScheduler::mTileSize);
+    pyTileScheduler.def_readwrite("threads", &TileScheduler::mThreads);
+    pyTileScheduler.def_readonly("tileTimes", &TileScheduler::mTileTimes);
+    pyTileScheduler.def_readonly("tileThreads", &TileScheduler::mTileThreads);
+
+    py::class_<BVH> pyBVH(m, "BVH");
+    pyBVH.def_readwrite("maxLeafSize", &BVH::mMaxLeafSize);
+    pyBVH.def_readwrite("traversalCost", &BVH::mTraversalCost);
+    pyBVH.def_readwrite("stats", &BVH::mStats);
+
+    py::class_<LeafGrid> pyLeafGrid(m, "LeafGrid");
+    pyLeafGrid.def_readwrite("stats", &LeafGrid::mStats);
+
+    py::class_<AdaptiveSampler> pyAdaptiveSampler(m, "AdaptiveSampler");
+    pyAdaptiveSampler.def_readwrite("stats", &AdaptiveSampler::mStats);
+    pyAdaptiveSampler.def_readwrite("tileSize", &AdaptiveSampler::mTileSize);
+    pyAdaptiveSampler.def_readwrite("minPasses", &AdaptiveSampler::mMinPasses);
+    pyAdaptiveSampler.def_readwrite("maxPasses", &AdaptiveSampler::mMaxPasses);
+    pyAdaptiveSampler.def_readwrite("threshold", &AdaptiveSampler::mThreshold);
+    pyAdaptiveSampler.def_readwrite("timeBudget", &AdaptiveSampler::mTimeBudget);
+
+    py::class_<SamplingQuality> pySamplingQuality(m, "SamplingQuality");
+    py::enum_<SamplingQuality::Preset>(pySamplingQuality, "Preset")
+        .value("draft", SamplingQuality::Draft)
+        .value("interactive", SamplingQuality::Interactive)
+        .value("final", SamplingQuality::Final);
+    pySamplingQuality.def_readwrite("samplesPerVoxel", &SamplingQuality::mSamplesPerVoxel);
+    pySamplingQuality.def_readwrite("ertThreshold", &SamplingQuality::mERTThreshold);
+    pySamplingQuality.def_readwrite("opacityReference", &SamplingQuality::mOpacityReference);
+    pySamplingQuality.def("apply", &SamplingQuality::apply);
+
+    py::class_<OpacityBounds> pyOpacityBounds(m, "OpacityBounds");
+    pyOpacityBounds.def_readwrite("stats", &OpacityBounds::mStats);
+    pyOpacityBounds.def_readwrite("maxStepScale", &OpacityBounds::mMaxStepScale);
+    pyOpacityBounds.def_readwrite("tolerance", &OpacityBounds::mTolerance);
+    pyOpacityBounds.def_readonly("bounds", &OpacityBounds::mBounds);
+
+    py::class_<Shading> pyShading(m, "Shading");
+    py::enum_<Shading::Gradients>(pyShading, "Gradients")
+        .value("onthefly", Shading::GradientsOnTheFly)
+        .value("precomputed", Shading::GradientsPrecomputed);
+    pyShading.def_readwrite("gradients", &Shading::mGradients);
+    pyShading.def_readwrite("ambient", &Shading::mAmbient);
+    pyShading.def_readwrite("diffuse", &Shading::mDiffuse);
+    pyShading.def_readwrite("specular", &Shading::mSpecular);
+    pyShading.def_readwrite("shininess", &Shading::mShininess);
+    pyShading.def_readwrite("minGradient", &Shading::mMinGradient);
+
+    py::class_<ImageWriter> pyImageWriter(m, "ImageWriter");
+    py::enum_<ImageWriter::Format>(pyImageWriter, "Format")
+        .value("png", ImageWriter::FormatPNG)
+        .value("ppm", ImageWriter::FormatPPM)
+        .value("qoi", ImageWriter::FormatQOI);
+    pyImageWriter.def_readwrite("stats", &ImageWriter::mStats);
+    pyImageWriter.def_readwrite("format", &ImageWriter::mFormat);
+    pyImageWriter.def_readwrite("compression", &ImageWriter::mCompression);
+    pyImageWriter.def_readwrite("queueLength", &ImageWriter::mQueueLength);
+    pyImageWriter.def_readwrite("threads", &ImageWriter::mThreads);
+    pyImageWriter.def("flush", &ImageWriter::flush);
+
+    py::class_<FrameRing> pyFrameRing(m, "FrameRing");
+    pyFrameRing.def_readwrite("stats", &FrameRing::mStats);
+    pyFrameRing.def_readwrite("name", &FrameRing::mName);
+    pyFrameRing.def_readwrite("slots", &FrameRing::mSlots);
+    pyFrameRing.def("close", &FrameRing::close);
+    pyFrameRing.def("isOpen", &FrameRing::isOpen);
+
+    py::class_<FrameRingReader> pyFrameRingReader(m, "FrameRingReader");
+    pyFrameRingReader.def(py::init<>());
+    pyFrameRingReader.def("attach", &FrameRingReader::attach);
+    pyFrameRingReader.def("detach", &FrameRingReader::detach);
+    pyFrameRingReader.def("isAttached", &FrameRingReader::isAttached);
+    pyFrameRingReader.def("closed", &FrameRingReader::closed);
+    /* (pixels, width, height, frame), or None without a new frame */
+    pyFrameRingReader.def("read", [](FrameRingReader& r) -> py::object {
+        std::vector<unsigned char> pixels;
+        int width = 0, height = 0;
+        uint64_t frame = 0;
+        if(!r.read(pixels, width, height, frame))
+            return py::none();
+        return py::make_tuple(py::bytes((const char*)pixels.data(), pixels.size()), width, height, frame);
+    });
+
+    py::class_<FramePipe> pyFramePipe(m, "FramePipe");
+    pyFramePipe.def_readwrite("stats", &FramePipe::mStats);
+    pyFramePipe.def_readwrite("command", &FramePipe::mCommand);
+    pyFramePipe.def_readwrite("dropFrames", &FramePipe::mDropFrames);
+    pyFramePipe.def("close", &FramePipe::close);
+    pyFramePipe.def("isOpen", &FramePipe::isOpen);
+
+    py::class_<GradientPool> pyGradientPool(m, "GradientPool");
+    pyGradientPool.def_readwrite("stats", &GradientPool::mStats);
+    pyGradientPool.def_readonly("dimensions", &GradientPool::mDimensions);
+    pyGradientPool.def_property_readonly("valid", &GradientPool::valid);
+
+    py::class_<Reprojection> pyReprojection(m, "Reprojection");
+    pyReprojection.def_readwrite("stats", &Reprojection::mStats);
+    pyReprojection.def_readwrite("maxDepthStep", &Reprojection::mMaxDepthStep);
+    pyReprojection.def_readwrite("maxAge", &Reprojection::mMaxAge);
+    pyReprojection.def("invalidate", &Reprojection::invalidate);
+
+    py::class_<CPURenderer> pyCPURenderer(m, "CPURenderer");
+    py::enum_<CPURenderer::EmptySpaceSkipping>(pyCPURenderer, "EmptySpaceSkipping")
+        .value("boxes", CPURenderer::ESSBoxes)
+        .value("bvh", CPURenderer::ESSBVH)
+        .value("grid", CPURenderer::ESSGrid);
+    pyCPURenderer.def_property_readonly("scheduler", [](CPURenderer& r) { return &r.mScheduler; }, py::return_value_policy::reference_internal);
+    pyCPURenderer.def_readwrite("stats", &CPURenderer::mStats);
+    pyCPURenderer.def_readwrite("usePackets", &CPURenderer::mUsePackets);
+    pyCPURenderer.def_property_readonly("packetsSupported", &CPURenderer::packetsSupported);
+    pyCPURenderer.def_readwrite("emptySpaceSkipping", &CPURenderer::mEmptySpaceSkipping);
+    pyCPURenderer.def_property_readonly("bvh", [](CPURenderer& r) { return &r.mBVH; }, py::return_value_policy::reference_internal);
+    pyCPURenderer.def_property_readonly("leafGrid", [](CPURenderer& r) { return &r.mLeafGrid; }, py::return_value_policy::reference_internal);
+    pyCPURenderer.def("updateBoxes", &CPURenderer::updateBoxes);
+
     /* Bindings for the renderer itself */
     py::class_<OptixDVR> pyOptixDVR(m, "OptixDVR");
+    py::enum_<OptixDVR::Backend>(pyOptixDVR, "Backend")
+        .value("optix", OptixDVR::BackendOptix)
+        .value("cpu", OptixDVR::BackendCPU);
     pyOptixDVR.def("loadVolume", &OptixDVR::loadvolume);
     pyOptixDVR.def("loadTransferFunction", &OptixDVR::loadtransferfunction);
     pyOptixDVR.def("render", &OptixDVR::render);
@@ -54,14 +201,50 @@ PYBIND11_MODULE(pyoptixdvr, m)
     pyOptixDVR.def("resizeFrameBuffer", &OptixDVR::resizeFrameBuffer);
     pyOptixDVR.def("updateScene", &OptixDVR::updateScene);
     pyOptixDVR.def("saveToPNG", &OptixDVR::saveToPNG);
+    pyOptixDVR.def("saveImage", &OptixDVR::saveImage);
+    pyOptixDVR.def("readFrame", [](OptixDVR& o) {
+        const unsigned char* frame = o.readFrame();
+        size_t bytes = frame ? (size_t)o.m_renderwidth * o.m_renderheight * 4 : 0;
+        return py::bytes((const char*)frame, bytes);
+    });
     pyOptixDVR.def_readwrite("subdivision", &OptixDVR::m_subdivision);
     pyOptixDVR.def_readwrite("pool", &OptixDVR::mPool);
     pyOptixDVR.def_readwrite("stats", &OptixDVR::mStats);
     pyOptixDVR.def_readwrite("camera", &OptixDVR::m_camera);
     pyOptixDVR.def_readwrite("highlightERT", &OptixDVR::m_highlightert);
     pyOptixDVR.def_readwrite("showDepthComplexity", &OptixDVR::m_showdepthcomplexity);
+    pyOptixDVR.def_readwrite("reader", &OptixDVR::m_reader);
+    pyOptixDVR.def("numFrames", &OptixDVR::numFrames);
+    pyOptixDVR.def("setFrame", &OptixDVR::setFrame);
+    pyOptixDVR.def("nextFrame", &OptixDVR::nextFrame);
+    pyOptixDVR.def_readonly("frame", &OptixDVR::m_frame);
+    pyOptixDVR.def_readwrite("prefetchFrames", &OptixDVR::m_prefetchframes);
+    pyOptixDVR.def_readwrite("brickCachePath", &OptixDVR::m_brickcachepath);
+    pyOptixDVR.def_readwrite("outOfCore", &OptixDVR::m_outofcore);
+    pyOptixDVR.def_readwrite("hostCacheMB", &OptixDVR::m_hostcachemb);
+    pyOptixDVR.def_readwrite("useLOD", &OptixDVR::m_uselod);
+    pyOptixDVR.def_readwrite("lodSelector", &OptixDVR::m_lodselector);
+    pyOptixDVR.def_readonly("backend", &OptixDVR::m_backend);
+    pyOptixDVR.def_readonly("cpuRenderer", &OptixDVR::m_cpurenderer);
+    pyOptixDVR.def_readwrite("accumulate", &OptixDVR::m_accumulate);
+    pyOptixDVR.def_readonly("accumulatedFrames", &OptixDVR::m_accumulatedframes);
+    pyOptixDVR.def("resetAccumulation", &OptixDVR::resetAccumulation);
+    pyOptixDVR.def_readwrite("adaptiveSampling", &OptixDVR::m_adaptivesampling);
+    pyOptixDVR.def_property_readonly("sampler", [](OptixDVR& r) { return &r.m_sampler; }, py::return_value_policy::reference_internal);
+    pyOptixDVR.def_readwrite("reproject", &OptixDVR::m_reproject);
+    pyOptixDVR.def_readwrite("adaptiveStep", &OptixDVR::m_adaptivestep);
+    pyOptixDVR.def_property_readonly("opacityBounds", [](OptixDVR& r) { return &r.m_opacitybounds; }, py::return_value_policy::reference_internal);
+    pyOptixDVR.def_readwrite("useShading", &OptixDVR::m_useshading);
+    pyOptixDVR.def_readwrite("lightPosition", &OptixDVR::m_lightposition);
+    pyOptixDVR.def_property_readonly("shading", [](OptixDVR& r) { return &r.m_shading; }, py::return_value_policy::reference_internal);
+    pyOptixDVR.def_property_readonly("gradients", [](OptixDVR& r) { return &r.m_gradients; }, py::return_value_policy::reference_internal);
+    pyOptixDVR.def_property_readonly("quality", [](OptixDVR& r) { return &r.m_quality; }, py::return_value_policy::reference_internal);
+    pyOptixDVR.def_property_readonly("reprojection", [](OptixDVR& r) { return &r.m_reprojection; }, py::return_value_policy::reference_internal);
+    pyOptixDVR.def_property_readonly("imageWriter", [](OptixDVR& r) { return &r.m_imagewriter; }, py::return_value_policy::reference_internal);
+    pyOptixDVR.def_property_readonly("frameRing", [](OptixDVR& r) { return &r.m_framering; }, py::return_value_policy::reference_internal);
+    pyOptixDVR.def_property_readonly("framePipe", [](OptixDVR& r) { return &r.m_framepipe; }, py::return_value_policy::reference_internal);
 
     /* Bindings for DVR instance (should be used to get a renderer) */
     py::class_<OptixInstance> pyOptixInstance(m, "instance");
-    pyOptixInstance.def_static("get", &OptixInstance::get);
+    pyOptixInstance.def_static("get", &OptixInstance::get, py::arg("backend")=OptixDVR::BackendOptix);
 }
\ No newline at end of file
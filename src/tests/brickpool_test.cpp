@@ -0,0 +1,57 @@
+#include "test.hpp"
+#include "../optixdvr/volume/hostbrickpool.hpp"
+
+#include <algorithm>
+
+/* 33 x 4 x 4 voxels whose value is their x, so that with 16 voxel bricks
+   the last one starts on the last voxel */
+static Volume* oddWidthVolume()
+{
+    const int nx = 33;
+    const int n = 4;
+    VolumeRepresentation<unsigned char>* volume = new VolumeRepresentation<unsigned char>();
+    volume->dataType = Volume::UCHAR;
+    volume->dataDimensions = vec3f((float)nx, (float)n, (float)n);
+    volume->dataLimits = volume->dataDimensions - vec3f(1.0f);
+    volume->volumeSize = vec3f(1.0f);
+    volume->voxelsTotal = (size_t)nx * n * n;
+    volume->dataTotal = volume->voxelsTotal;
+    volume->dataScale = 255.0f;
+    volume->data = new char[volume->dataTotal];
+    for(size_t i = 0; i < volume->voxelsTotal; ++i)
+    {
+        volume->data[i] = (char)(i % nx);
+    }
+    return volume;
+}
+
+TEST(pullBrickOddWidth)
+{
+    Volume* volume = oddWidthVolume();
+    HostVolumeBrickPool pool;
+    const vec3size_t brickSize(16);
+
+    for(int bx = 0; bx < 3; ++bx)
+    {
+        VolumeBrick brick = pool.pullBrick(volume, brickSize, bx, 0, 0);
+        const unsigned char* data = (const unsigned char*)brick.mData;
+        const size_t row = brick.mActualDimensions.x;
+        size_t wrong = 0;
+        int lo = 255, hi = 0;
+        for(size_t i = 0; i < brick.mDataTotal; ++i)
+        {
+            /* Past the edge rows repeat the last voxel, 32 */
+            const int expected = std::min(bx * 16 + (int)(i % row), 32);
+            wrong += data[i] != expected;
+            lo = std::min(lo, (int)data[i]);
+            hi = std::max(hi, (int)data[i]);
+        }
+        CHECK(wrong == 0);
+        CHECK_NEAR(brick.minValue, lo / 255.0f, 1e-6f);
+        CHECK_NEAR(brick.maxValue, hi / 255.0f, 1e-6f);
+        brick.free();
+    }
+
+    delete[] volume->data;
+    delete volume;
+}
@@ -0,0 +1,104 @@
+#include "test.hpp"
+#include "../optixdvr/volume/lodselector.hpp"
+
+/* A unit cube of 64^3 voxels, seen along -z from in front of its centre */
+static const vec3f BoundsMin(0.0f);
+static const vec3f BoundsMax(1.0f);
+static const vec3f Dimensions(64.0f);
+static const size_t Levels = 4;
+
+static Camera cameraAt(float distance)
+{
+    Camera camera;
+    camera.origin(vec3f(0.5f, 0.5f, 1.0f + distance));
+    return camera;
+}
+
+/* Distance at which a level 0 voxel covers the given number of pixels */
+static float distanceFor(float pixels, int imageHeight)
+{
+    Camera camera;
+    float theta = camera.mFOVY * ((float)M_PI) / 180.0f;
+    return (1.0f / 64.0f) * (float)imageHeight / (pixels * 2.0f * tanf(theta / 2.0f));
+}
+
+static size_t selectAt(const LODSelector& selector, float distance, int imageHeight, size_t levels = Levels)
+{
+    return selector.select(cameraAt(distance), imageHeight, BoundsMin, BoundsMax, Dimensions, levels);
+}
+
+TEST(lodProjectedSize)
+{
+    LODSelector selector;
+    CHECK_NEAR(selector.voxelPixels(cameraAt(distanceFor(3.0f, 512)), 512, BoundsMin, BoundsMax, Dimensions), 3.0, 1e-3);
+    /* Twice as far, half the size */
+    CHECK_NEAR(selector.voxelPixels(cameraAt(distanceFor(3.0f, 512) * 2.0f), 512, BoundsMin, BoundsMax, Dimensions), 1.5, 1e-3);
+}
+
+TEST(lodFullResolutionClose)
+{
+    LODSelector selector;
+    CHECK(selectAt(selector, 0.1f, 512) == 0);
+    CHECK(selectAt(selector, distanceFor(1.5f, 512), 512) == 0);
+    /* From inside the bounds voxels are arbitrarily large */
+    Camera inside;
+    inside.origin(vec3f(0.5f));
+    CHECK(selector.select(inside, 512, BoundsMin, BoundsMax, Dimensions, Levels) == 0);
+}
+
+TEST(lodCoarserFurtherAway)
+{
+    LODSelector selector;
+    /* Level k once a voxel covers under 2^-k pixels, 0.75 keeps clear of the boundaries */
+    for(size_t k = 0; k < Levels; ++k)
+    {
+        float pixels = 0.75f / (float)(1 << k);
+        CHECK(selectAt(selector, distanceFor(pixels, 512), 512) == k);
+    }
+
+    size_t previous = 0;
+    for(float d = 0.05f; d < 100.0f; d *= 1.25f)
+    {
+        size_t level = selectAt(selector, d, 512);
+        CHECK(level >= previous);
+        previous = level;
+    }
+}
+
+TEST(lodPixelSize)
+{
+    /* A larger image makes every voxel larger on screen */
+    LODSelector selector;
+    float d = distanceFor(0.3f, 512);
+    CHECK(selectAt(selector, d, 512) == 1);
+    CHECK(selectAt(selector, d, 1024) == 0);
+    CHECK(selectAt(selector, d, 256) == 2);
+
+    /* Asking for two pixels per voxel goes one level coarser */
+    selector.mPixelsPerVoxel = 2.0f;
+    CHECK(selectAt(selector, d, 512) == 2);
+}
+
+TEST(lodClampedToTopLevel)
+{
+    LODSelector selector;
+    CHECK(selectAt(selector, 1e4f, 512) == Levels - 1);
+    CHECK(selectAt(selector, 1e4f, 512, 2) == 1);
+    CHECK(selectAt(selector, 1e4f, 512, 1) == 0);
+    CHECK(selectAt(selector, 1e4f, 512, 0) == 0);
+}
+
+TEST(lodBias)
+{
+    LODSelector selector;
+    float d = distanceFor(0.75f, 512);
+    CHECK(selectAt(selector, d, 512) == 0);
+
+    selector.mBias = 1.0f;
+    CHECK(selectAt(selector, d, 512) == 1);
+    CHECK(selectAt(selector, 1e4f, 512) == Levels - 1);
+
+    selector.mBias = -1.0f;
+    CHECK(selectAt(selector, distanceFor(0.3f, 512), 512) == 0);
+    CHECK(selectAt(selector, distanceFor(0.2f, 512), 512) == 1);
+}
@@ -0,0 +1,23 @@
+#include "test.hpp"
+
+#include <cstring>
+
+/* Runs every case, or those whose name contains the first argument */
+int main(int argc, char** argv)
+{
+    const char* filter = argc > 1 ? argv[1] : "";
+    int run = 0;
+    for(const test::Case& c : test::cases())
+    {
+        if(strstr(c.mName, filter) == nullptr)
+        {
+            continue;
+        }
+        const int before = test::failures();
+        c.mRun();
+        std::cout << "==Tests== " << c.mName << (test::failures() == before ? " passed" : " FAILED") << std::endl;
+        run++;
+    }
+    std::cout << "==Tests== " << run << " cases, " << test::failures() << " failed checks" << std::endl;
+    return test::failures() == 0 && run > 0 ? 0 : 1;
+}
@@ -0,0 +1,253 @@
+#include "test.hpp"
+#include "../optixdvr/programs/stepping.h"
+#include "../optixdvr/cpu/cpurenderer.hpp"
+#include "../optixdvr/volume/brickedvolume.hpp"
+#include "../optixdvr/volume/hostbrickpool.hpp"
+#include "../optixdvr/volume/opacitybounds.hpp"
+#include "../optixdvr/volume/transferfunction.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+/* Transparent below 0.4, then opacity ramps up to 0.5 at 0.6 and 1 at 1 */
+static void rampTransferFunction(TransferFunction& tf)
+{
+    tf.addControlPoint(0.0f, 0.0f, 0.0f, 0.0f, 0.0f);
+    tf.addControlPoint(0.4f, 0.0f, 0.0f, 0.0f, 0.0f);
+    tf.addControlPoint(0.6f, 1.0f, 0.5f, 0.2f, 0.5f);
+    tf.addControlPoint(1.0f, 0.8f, 0.8f, 0.8f, 1.0f);
+    tf.updateLUT();
+}
+
+/* Opacity of a normalised value as the linearly filtered LUT texture gives it */
+static float filteredOpacity(const TransferFunction& tf, float v)
+{
+    float x = v * (float)tf.mSize - 0.5f;
+    int i = (int)floorf(x);
+    float t = x - (float)i;
+    int i0 = std::min(std::max(i, 0), tf.mSize - 1);
+    int i1 = std::min(std::max(i + 1, 0), tf.mSize - 1);
+    return tf.mLUT[i0].w * (1.0f - t) + tf.mLUT[i1].w * t;
+}
+
+TEST(maxOpacityTransparentRange)
+{
+    TransferFunction tf;
+    rampTransferFunction(tf);
+    CHECK(tf.maxOpacity(0.0f, 0.3f) == 0.0f);
+    CHECK(tf.maxOpacity(0.1f, 0.38f) == 0.0f);
+    /* A leaf without voxels */
+    CHECK(tf.maxOpacity(1.0f, 0.0f) == 0.0f);
+    CHECK(tf.maxOpacity(0.0f, 0.5f) > 0.0f);
+}
+
+TEST(maxOpacityBoundsFilteredRange)
+{
+    TransferFunction tf;
+    rampTransferFunction(tf);
+
+    /* Every value of the range, as the filtered LUT sees it, stays under the bound */
+    srand(1);
+    for(int r = 0; r < 200; ++r)
+    {
+        float a = (float)rand() / (float)RAND_MAX;
+        float b = (float)rand() / (float)RAND_MAX;
+        float from = std::min(a, b);
+        float to = std::max(a, b);
+        float bound = tf.maxOpacity(from, to);
+        float highest = 0.0f;
+        for(int s = 0; s <= 64; ++s)
+        {
+            highest = std::max(highest, filteredOpacity(tf, from + (to - from) * (float)s / 64.0f));
+        }
+        CHECK(highest <= bound);
+    }
+
+    /* Just below the first opaque entry, which filtering blends in */
+    float edge = 103.0f / 256.0f;
+    CHECK(filteredOpacity(tf, edge) > 0.0f);
+    CHECK(tf.maxOpacity(edge - 0.5f / 256.0f, edge - 0.5f / 256.0f) > 0.0f);
+
+    /* Not much looser than the LUT either */
+    CHECK_NEAR(tf.maxOpacity(0.6f, 0.6f), 0.5, 0.02);
+    CHECK_NEAR(tf.maxOpacity(0.0f, 1.0f), 1.0, 0.01);
+}
+
+TEST(stepScale)
+{
+    CHECK(step_scale(0.0f, 1.0f, 0.0f, 8) == 8);
+    CHECK(step_scale(0.0f, 1.0f, 0.05f, 4) == 4);
+    CHECK(step_scale(1.0f, 1.0f, 0.05f, 8) == 1);
+    CHECK(step_scale(0.5f, 1.0f, 0.0f, 8) == 1);
+    CHECK(step_scale(1e-6f, 1.0f, 0.05f, 8) == 8);
+
+    /* k stretched steps keep their corrected opacity within the tolerance */
+    const float corrections[3] = {0.5f, 1.0f, 2.0f};
+    for(int c = 0; c < 3; ++c)
+    {
+        for(float bound = 0.001f; bound < 1.0f; bound *= 1.5f)
+        {
+            int k = step_scale(bound, corrections[c], 0.05f, 8);
+            CHECK(k >= 1 && k <= 8);
+            if(k > 1)
+            {
+                CHECK(1.0f - powf(1.0f - bound, (float)k * corrections[c]) <= 0.05f + 1e-5f);
+            }
+        }
+    }
+    CHECK(step_scale(0.01f, 1.0f, 0.05f, 8) == 5);
+}
+
+/* The samples before k steps from p are inside [lo, hi), sample k is on
+   or past its faces. Stopping on the lo face a sample early is safe, the
+   ray only looks up the same leaf again */
+static bool leavesAfter(const vec3f& p, const vec3f& step, const vec3f& lo, const vec3f& hi, int k)
+{
+    vec3f inside = p + step * (float)(k - 1);
+    vec3f outside = p + step * (float)k;
+    bool in = inside.x >= lo.x && inside.y >= lo.y && inside.z >= lo.z
+        && inside.x < hi.x && inside.y < hi.y && inside.z < hi.z;
+    bool out = outside.x <= lo.x || outside.y <= lo.y || outside.z <= lo.z
+        || outside.x >= hi.x || outside.y >= hi.y || outside.z >= hi.z;
+    return in && out;
+}
+
+TEST(stepsToLeave)
+{
+    const vec3f lo(0.0f);
+    const vec3f hi(1.0f);
+    const vec3f p(0.5f, 0.3f, 0.55f);
+
+    CHECK(steps_to_leave(p, vec3f(0.1f, 0.0f, 0.0f), lo, hi) == 5);
+    CHECK(steps_to_leave(p, vec3f(-0.1f, 0.0f, 0.0f), lo, hi) == 5);
+    CHECK(steps_to_leave(p, vec3f(0.0f, 0.0f, 0.25f), lo, hi) == 2);
+    CHECK(steps_to_leave(p, vec3f(0.0f, -0.2f, 0.0f), lo, hi) == 2);
+
+    const vec3f steps[4] = {
+        vec3f(0.1f, -0.2f, 0.0f),
+        vec3f(-0.03f, 0.0f, -0.07f),
+        vec3f(0.0f, 0.09f, 0.0f),
+        vec3f(-0.11f, -0.013f, 0.17f)
+    };
+    for(int s = 0; s < 4; ++s)
+    {
+        CHECK(leavesAfter(p, steps[s], lo, hi, steps_to_leave(p, steps[s], lo, hi)));
+    }
+
+    /* At least one step, even from the face the ray leaves through */
+    CHECK(steps_to_leave(vec3f(0.0f, 0.5f, 0.5f), vec3f(-0.1f, 0.0f, 0.0f), lo, hi) == 1);
+    CHECK(steps_to_leave(vec3f(1.0f, 0.5f, 0.5f), vec3f(0.1f, 0.0f, 0.0f), lo, hi) == 1);
+}
+
+/* A 48^3 ball whose values fall from 1 at its centre to 0 past its rim,
+   so the outer leaves are transparent and the inner ones are not */
+static Volume* ballVolume()
+{
+    const int n = 48;
+    VolumeRepresentation<unsigned char>* volume = new VolumeRepresentation<unsigned char>();
+    volume->dataType = Volume::UCHAR;
+    volume->dataDimensions = vec3f((float)n);
+    volume->dataLimits = volume->dataDimensions - vec3f(1.0f);
+    volume->volumeSize = vec3f(1.0f);
+    volume->voxelsTotal = (size_t)n * n * n;
+    volume->dataTotal = volume->voxelsTotal;
+    volume->dataScale = 255.0f;
+    volume->data = new char[volume->dataTotal];
+    for(int z = 0; z < n; ++z)
+    {
+        for(int y = 0; y < n; ++y)
+        {
+            for(int x = 0; x < n; ++x)
+            {
+                vec3f d = (vec3f((float)x, (float)y, (float)z) + vec3f(0.5f)) / (float)n - vec3f(0.5f);
+                float v = std::min(std::max(1.0f - d.length() / 0.45f, 0.0f), 1.0f);
+                volume->SetNormalisedVoxel(vec3f((float)x, (float)y, (float)z), v);
+            }
+        }
+    }
+    return volume;
+}
+
+TEST(adaptiveSteppingMatchesBaseSteps)
+{
+    Volume* volume = ballVolume();
+    TransferFunction tf;
+    rampTransferFunction(tf);
+
+    BrickedVolume leaves;
+    leaves.set_brick_size(vec3size_t(8));
+    leaves.set_volume(volume);
+    leaves.testbricks(tf);
+
+    HostVolumeBrickPool pool;
+    pool.mPoolMemory = 64UL * 1024UL * 1024UL;
+    pool.volume(volume);
+    pool.testBricks(tf);
+    pool.upload();
+
+    /* The boxes and grid as OptixDVR sets them up for the CPU backend */
+    CPURenderer renderer;
+    renderer.mTransferFunction = &tf;
+    vec3f volumeMin = volume->volumeSize * -0.5f;
+    vec3f subdivisions = leaves.mNumLeaves;
+    vec3f leafSize = volume->volumeSize / subdivisions;
+    vec3f voxelSize = vec3f(1.0f) / volume->dataDimensions;
+    for(int z = 0; z < (int)subdivisions.z; ++z)
+    {
+        for(int y = 0; y < (int)subdivisions.y; ++y)
+        {
+            for(int x = 0; x < (int)subdivisions.x; ++x)
+            {
+                if(leaves.leafActive(x, y, z))
+                {
+                    vec3f boxMin = volumeMin + leafSize * vec3f((float)x, (float)y, (float)z);
+                    vec3f boxMax = boxMin + leafSize + voxelSize;
+                    renderer.mAABBMinData.push_back(vec4f(boxMin.x, boxMin.y, boxMin.z, 0.0f));
+                    renderer.mAABBMaxData.push_back(vec4f(boxMax.x, boxMax.y, boxMax.z, 0.0f));
+                }
+            }
+        }
+    }
+    renderer.mVolumeMin = volumeMin;
+    renderer.mVolumeSize = volume->volumeSize;
+    renderer.mMaxBounces = (int)(subdivisions.x + subdivisions.y + subdivisions.z);
+    renderer.mLeafGrid.build(leaves.mLeaves, leaves.mDistances, subdivisions, volumeMin, volume->volumeSize, voxelSize);
+    renderer.updateBoxes();
+    renderer.updatePool(&pool);
+
+    OpacityBounds bounds;
+    bounds.update(leaves, tf);
+    CHECK(bounds.mStats.get("transparentleaves") > 0);
+
+    Camera camera;
+    camera.origin(vec3f(0.6f, 0.8f, 1.5f));
+    camera.lookat(vec3f(0.0f));
+    camera.mAspect = 4.0f / 3.0f;
+    renderer.resize(64, 48);
+
+    for(int packets = 0; packets < 2; ++packets)
+    {
+        renderer.mUsePackets = packets == 1;
+        renderer.mOpacityBounds = nullptr;
+        renderer.render(camera);
+        std::vector<unsigned char> reference = renderer.mFrame;
+        double baseSamples = renderer.mStats.get("cpusamples");
+
+        bounds.mTolerance = 0.0f;
+        renderer.mOpacityBounds = &bounds;
+        renderer.render(camera);
+        int largest = 0;
+        size_t lit = 0;
+        for(size_t i = 0; i < reference.size(); ++i)
+        {
+            largest = std::max(largest, abs((int)reference[i] - (int)renderer.mFrame[i]));
+            lit += reference[i] != 0;
+        }
+        CHECK(lit > 0);
+        CHECK(largest <= 1);
+        CHECK(renderer.mStats.get("cpusamples") < baseSamples);
+    }
+
+    delete[] volume->data;
+    delete volume;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+/*
+ * Just enough of a test harness for the host-side tests. TEST defines a
+ * case that registers itself with main(), CHECK reports a failed
+ * expression with its location and lets the case carry on.
+ */
+namespace test
+{
+    struct Case
+    {
+        const char* mName;
+        void (*mRun)();
+    };
+
+    inline std::vector<Case>& cases()
+    {
+        static std::vector<Case> registered;
+        return registered;
+    }
+
+    inline int& failures()
+    {
+        static int count = 0;
+        return count;
+    }
+
+    struct Registration
+    {
+        Registration(const char* name, void (*run)())
+        {
+            cases().push_back({name, run});
+        }
+    };
+
+    inline bool check(bool passed, const char* expression, const char* file, int line)
+    {
+        if(!passed)
+        {
+            std::cerr << file << ":" << line << ": CHECK(" << expression << ") failed" << std::endl;
+            failures()++;
+        }
+        return passed;
+    }
+
+    inline bool checkNear(double a, double b, double tolerance, const char* expression, const char* file, int line)
+    {
+        if(!(fabs(a - b) <= tolerance))
+        {
+            std::cerr << file << ":" << line << ": CHECK_NEAR(" << expression << ") failed, "
+                << a << " vs " << b << std::endl;
+            failures()++;
+            return false;
+        }
+        return true;
+    }
+}
+
+#define TEST(name) \
+    static void name(); \
+    static test::Registration name##Registration(#name, name); \
+    static void name()
+
+#define CHECK(expression) test::check((expression), #expression, __FILE__, __LINE__)
+#define CHECK_NEAR(a, b, tolerance) test::checkNear((a), (b), (tolerance), #a ", " #b, __FILE__, __LINE__)